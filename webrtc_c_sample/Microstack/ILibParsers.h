@@ -276,7 +276,8 @@ extern char* ILibCriticalLogFilename;
 	{
 		ILibTransport_DoneState_INCOMPLETE = 0, 
 		ILibTransport_DoneState_COMPLETE = 1,
-		ILibTransport_DoneState_ERROR	= -4
+		ILibTransport_DoneState_ERROR	= -4,
+		ILibTransport_DoneState_BUFFER_FULL = -5
 	}ILibTransport_DoneState;
 
 	typedef ILibTransport_DoneState(*ILibTransport_SendPtr)(void *transport, char* buffer, int bufferLength, ILibTransport_MemoryOwnership ownership, ILibTransport_DoneState done);
@@ -16,6 +16,10 @@ limitations under the License.
 
 // This is a version of the WebRTC stack with Initiator, TURN and proper retry logic.
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		// recvmmsg/sendmmsg
+#endif
+
 #if defined(WIN32) && !defined(_WIN32_WCE) && !defined(_MINCORE)
 #define _CRTDBG_MAP_ALLOC
 #include <crtdbg.h>
@@ -32,8 +36,20 @@ limitations under the License.
 #include "ILibParsers.h"
 #include "ILibAsyncSocket.h"
 #include "ILibAsyncUDPSocket.h"
+#include "ILibAsyncServerSocket.h"
 #include "ILibWebRTC.h"
 #include "../core/utils.h"
+#ifndef WIN32
+#include <pthread.h>
+#endif
+#if defined(__linux__)
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
 
 
 #include "ILibRemoteLogging.h"
@@ -44,18 +60,30 @@ limitations under the License.
 
 
 #define ILibStunClient_TIMEOUT 2
+#define ILibStunClient_ResultCacheTTL 60		// Seconds
+#define ILibStunClient_ResultCacheRetry 5000	// Milliseconds to wait for the module to be free, before refreshing a cached result
+#define ILibStun_InterfaceCacheTTL 5000		// Milliseconds. Only used where there is no netlink socket to tell us about changes
 #define ILibRUDP_WindowSize 32000
 #define ILibRUDP_StartBufferSize 2048
 #define ILibRUDP_StartMTU 1400
 #define ILibRUDP_MaxMTU 2048
 
-#define RTO_MIN 1000
-#define RTO_MAX 6000
+#define RTO_MIN 1000						// Default lower bound of the Retransmission Timeout. Can be changed with ILibSCTP_SetRTOBounds()
+#define RTO_MAX 6000						// Default upper bound of the Retransmission Timeout
+#define RTO_INITIAL 3000					// RTO used until the first RTT measurement (RFC4960 15)
 #define RTO_ALPHA 0.125
 #define RTO_BETA 0.25
 
 #define ILibSCTP_MaxReceiverCredits 100000
 #define ILibSCTP_MaxSenderCredits 0				// When we do real-time traffic, reduce the buffering. In theory, this should never be used, leave to zero
+#define ILibSCTP_MaxSendBufferSize 8388608		// Default cap on the bytes queued (Holding + Pending ACK) per association. 0 = Unlimited
+#define ILibSCTP_DelayedAckTime 200				// Max milliseconds a SACK may be delayed (RFC4960 6.2). 0 = SACK every packet
+#define ILibSCTP_HeartbeatInterval 30000		// Milliseconds the association can be idle, before a HEARTBEAT is sent
+#define ILibSCTP_MaxHeartbeatRetransmits 10		// Number of unanswered HEARTBEATs before the association is closed
+#define ILibWebRTC_CookieSecretLifetime 60000	// Milliseconds before the secret signing DTLS and SCTP cookies is rotated. Cookies are valid for up to twice this long
+#define ILibSCTP_StateCookie_MaxExtensions 14
+#define ILibSCTP_ReceiveBufferSize 4096			// Size of the pooled buffers that decrypted SCTP packets are read into
+#define ILibSCTP_ReceiveBufferPoolMaxFree 64	// Maximum number of idle receive buffers kept by the pool
 #define ILibSCTP_Stream_SparseArraySize 16		// Must be a power of 2
 #define ILibSCTP_Stream_MaximumCount 1024		// This is what Chrome/Firefox Support
 #define ILibSTUN_MaxSlots 10					// MUST be less then 128, otherwise IceSlot and dtlsSlot will collide
@@ -74,6 +102,24 @@ limitations under the License.
 // link posted by Google: http://tools.ietf.org/html/draft-muthu-behave-consent-freshness-04
 //
 #define ILibStun_MaxConsentFreshnessTimeoutSeconds 15		// Must be 15 Seconds or less to be spec compliant
+#define ILibStun_ConsentFreshnessProbeInterval 500			// Milliseconds between probes, while waiting for a response
+#define ILibStun_ConsentFreshnessBatchWindow 50				// Probes due within this many milliseconds of each other are sent together
+
+//
+// Once a session is established, the CONTROLLING side keeps probing all the validated candidate pairs, and moves the session to a
+// backup pair that has been consistently better than the selected one. (Default interval, see ILibWebRTC_SetPathProbeInterval)
+//
+#define ILibStun_PathProbeInterval 2500				// Milliseconds between probe rounds
+#define ILibStun_PathProbe_Marker 0xA5				// Second byte of the TransactionID of a path probe
+#define ILibStun_PathSwitchHysteresis 25			// A backup pair's RTT must be this many percent lower than the selected pair's...
+#define ILibStun_PathSwitchMinGain 10				// ...and at least this many milliseconds lower
+#define ILibStun_PathSwitchMaxLoss 20				// Percent. Pairs losing more probes than this are never switched to
+#define ILibStun_PathSwitchRounds 3					// Consecutive rounds a backup pair must be better for, before we switch to it
+#define ILibStun_PathSwitchHoldDown 15000			// Milliseconds after a switch, before we consider another one
+
+#define ILibStun_ICE_Ta 20							// Milliseconds between connectivity checks (RFC 8445 Ta pacing), across all IceStates
+#define ILibStun_ICE_ChecksPerCandidate 2			// Number of checks sent to each candidate that hasn't responded yet
+#define ILibStun_ICE_MaxCandidates 255				// Candidate count is encoded in a single byte in the offer block
 
 #define RCTPDEBUG(x)
 #define RCTPRCVDEBUG(x)
@@ -334,6 +380,23 @@ typedef struct ILibSCTP_InitAckChunk
 	unsigned short NumberOfInboundStreams;
 	unsigned int InitialTSN;
 }ILibSCTP_InitAckChunk;
+// Everything needed to set up the association is kept in the INIT-ACK cookie, so nothing is committed until the COOKIE-ECHO proves the peer received it
+typedef struct ILibSCTP_StateCookie
+{
+	long long uptime;			// When the INIT-ACK was sent, so we can calculate the initial RTT
+	unsigned int tag;
+	unsigned int receiverCredits;
+	unsigned int intsn;
+	unsigned int outtsn;
+	unsigned short inport;
+	unsigned short outport;
+	unsigned short maxOutStreams;
+	unsigned short maxInStreams;
+	unsigned char unreliableStream;
+	unsigned char extensionCount;
+	unsigned char extensions[ILibSCTP_StateCookie_MaxExtensions];
+	char hmac[32];
+}ILibSCTP_StateCookie;
 typedef struct ILibSCTP_ChunkHeader
 {
 	unsigned char chunkType;
@@ -424,9 +487,126 @@ typedef union ILibSCTP_PendingTSN_Data
 #endif
 #pragma pack(pop)
 
+//
+// Receive buffers are reference counted, so that the application can keep a received message alive
+// after OnData returns (and hand it to another thread) without copying it. Buffers of ILibSCTP_ReceiveBufferSize
+// are recycled through the pool, anything else is allocated to size. The pool is freed once the Stun Module is
+// destroyed AND every outstanding buffer has been released.
+//
+typedef struct ILibSCTP_ReceiveBufferPool
+{
+	sem_t Lock;
+	struct ILibSCTP_ReceiveBuffer *FreeList;
+	int FreeCount;
+	int OutstandingCount;
+	int Destroyed;
+}ILibSCTP_ReceiveBufferPool;
+
+typedef struct ILibSCTP_ReceiveBuffer
+{
+	ILibSCTP_ReceiveBufferPool *pool;
+	struct ILibSCTP_ReceiveBuffer *next;
+	int refCount;
+	int bufferLen;
+}ILibSCTP_ReceiveBuffer;
+
+#define ILibSCTP_ReceiveBuffer_Data(receiveBuffer) ((char*)(receiveBuffer) + sizeof(ILibSCTP_ReceiveBuffer))
+#define ILibSCTP_ReceiveBuffer_FromData(data) ((ILibSCTP_ReceiveBuffer*)((char*)(data) - sizeof(ILibSCTP_ReceiveBuffer)))
+
+ILibSCTP_ReceiveBufferPool* ILibSCTP_ReceiveBufferPool_Create()
+{
+	ILibSCTP_ReceiveBufferPool *retVal = (ILibSCTP_ReceiveBufferPool*)malloc(sizeof(ILibSCTP_ReceiveBufferPool));
+	if (retVal == NULL) { ILIBCRITICALEXIT(254); }
+	memset(retVal, 0, sizeof(ILibSCTP_ReceiveBufferPool));
+	sem_init(&(retVal->Lock), 0, 1);
+	return(retVal);
+}
+void ILibSCTP_ReceiveBufferPool_Free(ILibSCTP_ReceiveBufferPool *pool)
+{
+	ILibSCTP_ReceiveBuffer *next;
+	while (pool->FreeList != NULL)
+	{
+		next = pool->FreeList->next;
+		free(pool->FreeList);
+		pool->FreeList = next;
+	}
+	sem_destroy(&(pool->Lock));
+	free(pool);
+}
+void ILibSCTP_ReceiveBufferPool_Destroy(ILibSCTP_ReceiveBufferPool *pool)
+{
+	int outstanding;
+
+	sem_wait(&(pool->Lock));
+	pool->Destroyed = 1;
+	outstanding = pool->OutstandingCount;
+	sem_post(&(pool->Lock));
+
+	// If the application is still holding buffers, the last ReleaseBuffer will free the pool
+	if (outstanding == 0) { ILibSCTP_ReceiveBufferPool_Free(pool); }
+}
+ILibSCTP_ReceiveBuffer* ILibSCTP_ReceiveBuffer_Allocate(ILibSCTP_ReceiveBufferPool *pool, int bufferLen)
+{
+	ILibSCTP_ReceiveBuffer *retVal = NULL;
+
+	sem_wait(&(pool->Lock));
+	if (bufferLen == ILibSCTP_ReceiveBufferSize && pool->FreeList != NULL)
+	{
+		retVal = pool->FreeList;
+		pool->FreeList = retVal->next;
+		--pool->FreeCount;
+	}
+	++pool->OutstandingCount;
+	sem_post(&(pool->Lock));
+
+	if (retVal == NULL && (retVal = (ILibSCTP_ReceiveBuffer*)malloc(sizeof(ILibSCTP_ReceiveBuffer) + bufferLen)) == NULL) { ILIBCRITICALEXIT(254); }
+	retVal->pool = pool;
+	retVal->next = NULL;
+	retVal->refCount = 1;
+	retVal->bufferLen = bufferLen;
+	return(retVal);
+}
+void ILibSCTP_ReceiveBuffer_Retain(ILibSCTP_ReceiveBuffer *receiveBuffer)
+{
+	sem_wait(&(receiveBuffer->pool->Lock));
+	++receiveBuffer->refCount;
+	sem_post(&(receiveBuffer->pool->Lock));
+}
+int ILibSCTP_ReceiveBuffer_IsShared(ILibSCTP_ReceiveBuffer *receiveBuffer)
+{
+	int retVal;
+	sem_wait(&(receiveBuffer->pool->Lock));
+	retVal = receiveBuffer->refCount > 1 ? 1 : 0;
+	sem_post(&(receiveBuffer->pool->Lock));
+	return(retVal);
+}
+void ILibSCTP_ReceiveBuffer_Release(ILibSCTP_ReceiveBuffer *receiveBuffer)
+{
+	ILibSCTP_ReceiveBufferPool *pool = receiveBuffer->pool;
+	int freePool = 0;
+
+	sem_wait(&(pool->Lock));
+	if (--receiveBuffer->refCount > 0) { sem_post(&(pool->Lock)); return; }
+
+	--pool->OutstandingCount;
+	if (pool->Destroyed == 0 && receiveBuffer->bufferLen == ILibSCTP_ReceiveBufferSize && pool->FreeCount < ILibSCTP_ReceiveBufferPoolMaxFree)
+	{
+		// Recycle this buffer
+		receiveBuffer->next = pool->FreeList;
+		pool->FreeList = receiveBuffer;
+		++pool->FreeCount;
+		receiveBuffer = NULL;
+	}
+	freePool = (pool->Destroyed != 0 && pool->OutstandingCount == 0) ? 1 : 0;
+	sem_post(&(pool->Lock));
+
+	if (receiveBuffer != NULL) { free(receiveBuffer); }
+	if (freePool != 0) { ILibSCTP_ReceiveBufferPool_Free(pool); }
+}
+
 typedef struct ILibSCTP_Accumulator
 {
-	char *buffer;
+	char *buffer;		// Data portion of an ILibSCTP_ReceiveBuffer
 	int bufferPtr;
 	int bufferLen;
 }ILibSCTP_Accumulator;
@@ -466,7 +646,8 @@ typedef enum ILibSCTP_SackStatus
 {
 	ILibSCTP_SackStatus_NotSent = 0,
 	ILibSCTP_SackStatus_Sent = 1,
-	ILibSCTP_SackStatus_Skip = 2
+	ILibSCTP_SackStatus_Skip = 2,
+	ILibSCTP_SackStatus_Delayed = 3
 }ILibSCTP_SackStatus;
 
 #define	ILibSCTP_StreamAttributesData_Assigned_Status_ASSIGNED 0x8000
@@ -590,6 +771,27 @@ unsigned char ILibWebRTC_LoggingServer_HTML[3368] =
 };
 #endif
 
+// Keyed HMAC-SHA1 state for STUN MESSAGE-INTEGRITY. The key schedule is done once, and copied for each packet.
+typedef struct ILibStun_IntegrityContext
+{
+	int keyed;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	EVP_MAC_CTX *ctx;
+#elif OPENSSL_VERSION_NUMBER >= 0x10100000L
+	HMAC_CTX *ctx;
+#else
+	HMAC_CTX ctx;
+#endif
+}ILibStun_IntegrityContext;
+
+typedef struct ILibStun_PathStats
+{
+	long long probeSent;	// Uptime the outstanding probe was sent, 0 if there isn't one
+	int srtt;				// Smoothed RTT in milliseconds, -1 until the first response
+	int loss;				// Smoothed probe loss, in percent
+	int betterRounds;		// Consecutive rounds this pair has been better than the selected pair
+}ILibStun_PathStats;
+
 struct ILibStun_IceState
 {
 	// These 2 fields must be the first 2 fields of this structure
@@ -609,15 +811,25 @@ struct ILibStun_IceState
 	int dtlscerthashlen;
 	struct ILibStun_IceStateCandidate* hostcandidates;
 	char* hostcandidateResponseFlag;
+	char* hostcandidateCheckCount;	// Number of connectivity checks sent to each candidate
+	char* candidateblock;			// Once candidates are trickled in, the three arrays above live here instead of in offerblock
 	int hostcandidatecount;
+	int nominated;
 	int requerycount;
 	int peerHasActiveOffer;
 	int dtlsInitiator;
 	int dtlsSession;
+	int iceLite;					// Non-zero if we are the ICE-Lite side of this offer
+	int restartSession;				// DTLS session this offer is an ICE restart for, -1 if it isn't
 	struct ILibStun_Module* parentStunModule;
 	long long creationTime;
 	int useTurn;
 	void *userObject;
+	ILibStun_IntegrityContext localIntegrity;	// Keyed with the password we handed out, used to check requests and sign responses
+	ILibStun_IntegrityContext remoteIntegrity;	// Keyed with the peer's password, used to sign our checks and verify their responses
+	ILibStun_PathStats *pathStats;				// One per candidate, once we are probing the pairs of an established session
+	int pathStatsCount;
+	unsigned char pathProbeRound;
 };
 
 struct ILibStun_dTlsSession
@@ -648,11 +860,15 @@ struct ILibStun_dTlsSession
 	long long lastResent;
 	int state; // 0 = Free, 1 = Setup, 2 = Connecting, 3 = Disconnecting, 4 = Handshake
 	sem_t Lock;
+	unsigned int generation;	// Changes every time this slot is re-used, so stale handshake jobs can be detected
+	int dtlsListen;				// Non-zero until the ClientHello carrying our cookie has been accepted
 
 	ILibSparseArray DataChannelMetaDeta;
 	ILibSparseArray DataChannelMetaDetaValues;
 	ILibSparseArray PeerFeatureSet;
 	ILibSparseArray DataAccumulator;
+	ILibSparseArray DataChannelBufferedAmount;
+	ILibSparseArray DataChannelBufferedAmountLowThreshold;
 
 	unsigned short maxInStreams;
 	unsigned short maxOutStreams;
@@ -668,7 +884,10 @@ struct ILibStun_dTlsSession
 	unsigned int lastSackTime;
 	unsigned int lastRetransmitTime;
 
-	int timervalue;
+	int timervalue;						// Number of HEARTBEATs sent without a reply
+	unsigned int lastActivityTime;		// Last time a SACK/HEARTBEAT/HEARTBEAT-ACK was received
+	unsigned int T3RTXExpiry;			// When the T3-RTX timer is armed to fire, 0 = Not armed
+	int delayedAckCount;				// Number of packets received, that have not been SACK'ed yet
 	unsigned short pendingCount;
 	unsigned int pendingByteCount;
 	char* pendingQueueHead;
@@ -685,6 +904,9 @@ struct ILibStun_dTlsSession
 	int rpacketsize;
 
 	long freshnessTimestampStart;
+	long long freshnessDue;			// Uptime when this session next needs a probe, 0 if it isn't scheduled
+	int freshnessProbing;			// Non-zero while we are waiting for a response to a probe
+	long long pathSwitchTime;		// Uptime we last moved this session to a better candidate pair
 	
 	void* User2;
 	int User3;
@@ -719,6 +941,71 @@ struct ILibStun_dTlsSession
 
 #define ILibWebRTC_DTLS_TO_TIMER_OBJECT(d) ((char*)d+16)
 #define ILibWebRTC_DTLS_FROM_TIMER_OBJECT(d) ((struct ILibStun_dTlsSession*)((char*)d-16))
+#define ILibWebRTC_DTLS_TO_T3RTX_TIMER_OBJECT(d) ((char*)d+2)
+#define ILibWebRTC_DTLS_FROM_T3RTX_TIMER_OBJECT(d) ((struct ILibStun_dTlsSession*)((char*)d-2))
+#define ILibWebRTC_DTLS_TO_SACK_TIMER_OBJECT(d) ((char*)d+3)
+#define ILibWebRTC_DTLS_FROM_SACK_TIMER_OBJECT(d) ((struct ILibStun_dTlsSession*)((char*)d-3))
+
+// Client side DTLS session, cached by the fingerprint of the certificate the peer authenticated with
+typedef struct ILibWebRTC_ResumptionEntry
+{
+	char fingerprint[32];
+	SSL_SESSION *session;
+}ILibWebRTC_ResumptionEntry;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+#define ILibWebRTC_DTLS_IsServer(ssl) SSL_is_server(ssl)
+#else
+#define ILibWebRTC_DTLS_IsServer(ssl) ((ssl)->server)
+#endif
+
+// Handshake worker threads, so DTLS public key operations don't stall established sessions on the Chain thread
+#ifdef WIN32
+#define ILibWebRTC_HandshakeWorker_Init(w) InitializeCriticalSection(&((w)->QueueLock)); InitializeConditionVariable(&((w)->QueueSignal))
+#define ILibWebRTC_HandshakeWorker_Destroy(w) DeleteCriticalSection(&((w)->QueueLock))
+#define ILibWebRTC_HandshakeWorker_Lock(w) EnterCriticalSection(&((w)->QueueLock))
+#define ILibWebRTC_HandshakeWorker_UnLock(w) LeaveCriticalSection(&((w)->QueueLock))
+#define ILibWebRTC_HandshakeWorker_Wait(w) SleepConditionVariableCS(&((w)->QueueSignal), &((w)->QueueLock), INFINITE)
+#define ILibWebRTC_HandshakeWorker_Signal(w) WakeConditionVariable(&((w)->QueueSignal))
+#else
+#define ILibWebRTC_HandshakeWorker_Init(w) pthread_mutex_init(&((w)->QueueLock), NULL); pthread_cond_init(&((w)->QueueSignal), NULL)
+#define ILibWebRTC_HandshakeWorker_Destroy(w) pthread_cond_destroy(&((w)->QueueSignal)); pthread_mutex_destroy(&((w)->QueueLock))
+#define ILibWebRTC_HandshakeWorker_Lock(w) pthread_mutex_lock(&((w)->QueueLock))
+#define ILibWebRTC_HandshakeWorker_UnLock(w) pthread_mutex_unlock(&((w)->QueueLock))
+#define ILibWebRTC_HandshakeWorker_Wait(w) pthread_cond_wait(&((w)->QueueSignal), &((w)->QueueLock))
+#define ILibWebRTC_HandshakeWorker_Signal(w) pthread_cond_signal(&((w)->QueueSignal))
+#endif
+
+typedef struct ILibWebRTC_HandshakeWorker
+{
+#ifdef WIN32
+	CRITICAL_SECTION QueueLock;
+	CONDITION_VARIABLE QueueSignal;
+#else
+	pthread_mutex_t QueueLock;
+	pthread_cond_t QueueSignal;
+#endif
+	sem_t ProcessLock;			// Held while a job is being processed
+	sem_t Done;					// Posted once the thread has exited its loop, so whoever stops it can free it
+	ILibQueue Jobs;
+	int Exit;
+}ILibWebRTC_HandshakeWorker;
+
+#define ILibWebRTC_HandshakeJob_Stale -2
+
+typedef struct ILibWebRTC_HandshakeJob
+{
+	struct ILibStun_Module *parent;
+	int sessionId;
+	unsigned int generation;
+	int fromTurn;
+	struct sockaddr_in6 remoteInterface;
+	int result;					// 0 = Failed, 1 = Success, ILibWebRTC_HandshakeJob_Stale = Session went away, Other = Handshake not done yet
+	int bufferLength;
+	char *buffer;				// Inbound record, replaced by the outbound records (each prefixed with a 16 bit length) once processed
+}ILibWebRTC_HandshakeJob;
+
+#define ILibWebRTC_HandshakeWorker_ForSession(obj, sessionId) ((obj)->HandshakeWorkers[(sessionId) % (obj)->HandshakeWorkerCount])
 
 struct ILibStun_Module
 {
@@ -748,11 +1035,25 @@ struct ILibStun_Module
 	STUN_STATUS State;
 	char Secret[32];
 	char TransactionId[12];
+	int stunMode;						// Non-zero while the current exchange is NAT Behavior Discovery
+	int stunPending;					// Non-zero while an exchange is waiting for its result
+	int resultCacheTTL;					// Seconds, 0 = STUN results are not cached
+	void *resultCache;					// Mode + Local Interface + STUN Server -> ILibStun_CachedResult
+	void *resultRoutes;					// STUN Server -> Local Interface its cached results were made on
+	struct in_addr stunRoute;			// Local Interface the current exchange goes out on
 
 	// ICE State
 	ILibSCTP_OnConnect OnConnect;
 	ILibSCTP_OnData OnData;
 	ILibSCTP_OnSendOK OnSendOK;
+	ILibSCTP_OnBufferedAmountLow OnBufferedAmountLow;
+	int maxSendBufferSize;
+	int rtoMin;
+	int rtoMax;
+	int delayedAckTime;
+	ILibSCTP_ReceiveBufferPool *ReceiveBufferPool;
+	ILibSCTP_ReceiveBuffer *ReceiveBuffer;				// Buffer holding the SCTP packet currently being processed
+	ILibSCTP_ReceiveBuffer *DeliveringBuffer;			// Buffer holding the message currently being passed to OnData
 
 	int IceStatesNextSlot;
 	struct ILibStun_IceState* IceStates[ILibSTUN_MaxSlots];
@@ -762,8 +1063,23 @@ struct ILibStun_Module
 	struct ILibStun_dTlsSession* dTlsSessions[ILibSTUN_MaxSlots];
 	char* CertThumbprint;
 	int CertThumbprintLength;
+	int resumptionMaxSessions;							// 0 = DTLS Session Resumption disabled
+	ILibWebRTC_ResumptionEntry *resumptionCache;
+	ILibWebRTC_HandshakeWorker **HandshakeWorkers;		// NULL = DTLS Handshakes are done on the Chain thread
+	char cookieSecrets[2][32];							// Signs DTLS HelloVerifyRequest and SCTP INIT-ACK cookies
+	int cookieSecretIndex;
+	long long cookieSecretTime;
+	int HandshakeWorkerCount;
+	unsigned int dTlsSessionGeneration;
 
 	ILibWebRTC_OnOfferUpdated OnOfferUpdated;
+	ILibWebRTC_OnInterfacesChanged OnInterfacesChanged;
+
+	// Local Interface Cache, used for host candidates
+	struct sockaddr_in *LocalInterfaces;
+	int LocalInterfacesLength;
+	long long LocalInterfacesTime;		// Uptime the cache was filled, 0 = Must be refreshed
+	void *InterfaceMonitor;				// NULL if the platform can't tell us about changes
 
 	// WebRTC Data Channel
 	ILibWebRTC_OnDataChannel OnWebRTCDataChannel;
@@ -781,6 +1097,12 @@ struct ILibStun_Module
 	int alwaysUseTurn;
 	int alwaysConnectTurn;
 	int consentFreshnessDisabled;
+	long long consentFreshnessTick;	// Uptime the module-wide consent timer is armed for, 0 if it isn't
+	int pathProbeInterval;			// Milliseconds between path probe rounds, 0 = Disabled
+	int pathProbeArmed;				// Non-zero while the path probe timer is armed
+	int iceCheckPacing;				// Non-zero while the Ta pacing timer is armed
+	int iceCheckNextSlot;			// IceState slot the next paced check is taken from (Round Robin)
+	int iceLite;
 
 #ifdef _WEBRTCDEBUG
 	int lossPercentage;
@@ -789,18 +1111,68 @@ struct ILibStun_Module
 #endif
 };
 
+#if defined(__ARM_FEATURE_CRC32)
+// ARMv8 has instructions for the IEEE polynomial (not just CRC-32C), so use them when the compiler targets them
+#include <arm_acle.h>
 unsigned int ILibStun_CRC32(char *buf, int len)
 {
 	unsigned int c = 0xFFFFFFFF;
-	for (; len; --len, ++buf) { c = UPDC32(*buf, c); }
+	const unsigned char *next = (const unsigned char*)buf;
+	while (len && ((uintptr_t)next & 7) != 0) { c = __crc32b(c, *next++); len--; }
+	while (len >= 8) { c = __crc32d(c, *(const unsigned long long*)next); next += 8; len -= 8; }
+	while (len) { c = __crc32b(c, *next++); len--; }
 	return ~c;
 }
+#else
+// Tables for an 8 byte at a time software crc, ILibStun_CRC32_table is slice 0.
+// Fingerprints are also computed off the Chain thread (Handshake Workers, Binding Responder), so the tables are built exactly once.
+unsigned int ILibStun_CRC32_slices[8][256];
+
+void ILibStun_CRC32_init(void)
+{
+	unsigned int n, crc, k;
+	for (n = 0; n < 256; n++) { crc = ILibStun_CRC32_table[n]; ILibStun_CRC32_slices[0][n] = crc; for (k = 1; k < 8; k++) { crc = UPDC32(0, crc); ILibStun_CRC32_slices[k][n] = crc; } }
+}
+#ifdef WIN32
+INIT_ONCE ILibStun_CRC32_once = INIT_ONCE_STATIC_INIT;
+BOOL CALLBACK ILibStun_CRC32_initOnce(PINIT_ONCE once, PVOID param, PVOID *context)
+{
+	UNREFERENCED_PARAMETER(once);
+	UNREFERENCED_PARAMETER(param);
+	UNREFERENCED_PARAMETER(context);
+	ILibStun_CRC32_init();
+	return TRUE;
+}
+#define ILibStun_CRC32_EnsureInit() InitOnceExecuteOnce(&ILibStun_CRC32_once, ILibStun_CRC32_initOnce, NULL, NULL)
+#else
+pthread_once_t ILibStun_CRC32_once = PTHREAD_ONCE_INIT;
+#define ILibStun_CRC32_EnsureInit() pthread_once(&ILibStun_CRC32_once, ILibStun_CRC32_init)
+#endif
+
+// Slicing-by-8, same structure as crc32c() below. The 8 byte step assumes little-endian, big-endian stays on the byte loop.
+unsigned int ILibStun_CRC32(char *buf, int len)
+{
+	unsigned long long c = 0xFFFFFFFF;
+	const unsigned char *next = (const unsigned char*)buf;
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	ILibStun_CRC32_EnsureInit();
+	while (len && ((uintptr_t)next & 7) != 0) { c = UPDC32(*next++, c); len--; }
+	while (len >= 8) { c ^= *(const unsigned long long*)next; c = ILibStun_CRC32_slices[7][c & 0xff] ^ ILibStun_CRC32_slices[6][(c >> 8) & 0xff] ^ ILibStun_CRC32_slices[5][(c >> 16) & 0xff] ^ ILibStun_CRC32_slices[4][(c >> 24) & 0xff] ^ ILibStun_CRC32_slices[3][(c >> 32) & 0xff] ^ ILibStun_CRC32_slices[2][(c >> 40) & 0xff] ^ ILibStun_CRC32_slices[1][(c >> 48) & 0xff] ^ ILibStun_CRC32_slices[0][c >> 56]; next += 8; len -= 8; }
+#endif
+	while (len) { c = UPDC32(*next++, c); len--; }
+	return ~(unsigned int)c;
+}
+#endif
 
 struct ILibStun_Module *g_stunModule = NULL;
 
 // Function prototypes
 ILibTransport_DoneState ILibStun_SendSctpPacket(struct ILibStun_Module *obj, int session, char* buffer, int bufferLength);
 void ILibStun_OnTimeout(void *object);
+void ILibStun_ReportResult(struct ILibStun_Module *obj, ILibStun_Results result, struct sockaddr_in *publicIP);
+void ILibStun_ResultCache_Clear(struct ILibStun_Module *obj);
+void ILibStun_ResultCache_Flush(struct ILibStun_Module *obj);
+void ILibStun_ResultCache_SetRoute(struct ILibStun_Module *obj);
 void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char* buffer, int bufferLength);
 void ILibStun_SctpDisconnect(struct ILibStun_Module *obj, int session);
 void ILibStun_SendIceRequest(struct ILibStun_IceState *IceState, int SlotNumber, int useCandidate, struct sockaddr_in6* remoteInterface);
@@ -809,6 +1181,7 @@ void ILibStun_ICE_Start(struct ILibStun_IceState *state, int SelectedSlot);
 unsigned int crc32c(unsigned int crci, const void *buf, unsigned int len);
 int ILibStun_GetDtlsSessionSlotForIceState(struct ILibStun_Module *obj, struct ILibStun_IceState* ice);
 void ILibStun_InitiateDTLS(struct ILibStun_IceState *IceState, int IceSlot, struct sockaddr_in6* remoteInterface);
+int ILibStun_ICE_CompleteRestart(struct ILibStun_IceState *state, struct sockaddr_in6 *remoteInterface);
 void ILibStun_PeriodicStunCheck(struct ILibStun_Module* obj);
 int ILibTURN_GenerateStunFormattedPacketHeader(char* rbuffer, STUN_TYPE packetType, char* transactionID);
 int ILibTURN_AddAttributeToStunFormattedPacketHeader(char* rbuffer, int rptr, STUN_ATTRIBUTES attrType, char* data, int dataLen);
@@ -816,6 +1189,16 @@ void ILibTURN_DisconnectFromServer(ILibTURN_ClientModule turnModule);
 ILibWebRTC_DataChannel_CloseStatus ILibWebRTC_CloseDataChannelEx2(void *WebRTCModule, unsigned short *streamIds, int streamIdLength);
 void ILibWebRTC_PropagateChannelCloseEx(ILibSparseArray sender, struct ILibStun_dTlsSession* obj);
 ILibSparseArray ILibWebRTC_PropagateChannelClose(struct ILibStun_dTlsSession* obj, char* packet);
+void ILibStun_SctpOnT3RTX(void *object);
+void ILibSCTP_OnPathChanged(struct ILibStun_dTlsSession *o, int rtt);
+void ILibWebRTC_Resumption_Clear(struct ILibStun_Module *obj);
+void ILibWebRTC_StopHandshakeWorkers(struct ILibStun_Module *obj);
+char* ILibWebRTC_Cookie_GetSecret(struct ILibStun_Module *obj);
+void ILibStun_FreeIceState(struct ILibStun_IceState *ice);
+void ILibStun_ICE_ResizeCandidates(struct ILibStun_IceState *state, int newCount);
+void ILibStun_ICE_Nominate(struct ILibStun_IceState *state, int iceSlot, int candidateIndex);
+int ILibStun_GenerateIceRequestPacket(struct ILibStun_IceState* module, char* Packet, char* TransactionID, int useCandidate, struct sockaddr_in6* remote);
+enum ILibAsyncSocket_SendStatus ILibStun_SendPacket(struct ILibStun_IceState *iceState, char* buffer, int offset, int length, struct sockaddr_in6* remoteInterface, enum ILibAsyncSocket_MemoryOwnership memoryOwnership);
 
 typedef enum ILibWebRTC_DTLS_ContentTypes_Def
 {
@@ -926,7 +1309,7 @@ void ILibWebRTC_DestroySparseArrayTables_Accumulator(ILibSparseArray sender, int
 
 	if(acc != NULL)
 	{
-		free(acc->buffer);
+		if (acc->buffer != NULL) { ILibSCTP_ReceiveBuffer_Release(ILibSCTP_ReceiveBuffer_FromData(acc->buffer)); }
 		free(acc);
 	}
 }
@@ -936,6 +1319,8 @@ void ILibWebRTC_DestroySparseArrayTables(struct ILibStun_dTlsSession *obj)
 	ILibSparseArray_Destroy(obj->PeerFeatureSet);
 	ILibSparseArray_Destroy(obj->DataChannelMetaDetaValues);
 	ILibSparseArray_DestroyEx(obj->DataAccumulator, &ILibWebRTC_DestroySparseArrayTables_Accumulator, NULL);
+	ILibSparseArray_Destroy(obj->DataChannelBufferedAmount);
+	ILibSparseArray_Destroy(obj->DataChannelBufferedAmountLowThreshold);
 }
 void ILibWebRTC_CreateSparseArrayTables(struct ILibStun_dTlsSession *obj)
 {
@@ -943,6 +1328,24 @@ void ILibWebRTC_CreateSparseArrayTables(struct ILibStun_dTlsSession *obj)
 	obj->PeerFeatureSet = ILibSparseArray_Create(ILibSCTP_Stream_SparseArraySize, &ILibWebRTC_DataChannelBucketizer);
 	obj->DataChannelMetaDetaValues = ILibSparseArray_Create(ILibSCTP_Stream_SparseArraySize, &ILibWebRTC_DataChannelBucketizer);
 	obj->DataAccumulator = ILibSparseArray_Create(ILibSCTP_Stream_SparseArraySize, &ILibWebRTC_DataChannelBucketizer);
+	obj->DataChannelBufferedAmount = ILibSparseArray_Create(ILibSCTP_Stream_SparseArraySize, &ILibWebRTC_DataChannelBucketizer);
+	obj->DataChannelBufferedAmountLowThreshold = ILibSparseArray_Create(ILibSCTP_Stream_SparseArraySize, &ILibWebRTC_DataChannelBucketizer);
+}
+
+// Per stream integer values (Buffered Amount, Low Threshold) are stored directly in the SparseArray value. A value of 0 is not stored.
+int ILibSCTP_StreamValue_Get(ILibSparseArray sarray, unsigned short streamId)
+{
+	union{ int i; void *p; }u;
+	u.p = ILibSparseArray_Get(sarray, (int)streamId);
+	return(u.i);
+}
+void ILibSCTP_StreamValue_Set(ILibSparseArray sarray, unsigned short streamId, int value)
+{
+	union{ int i; void *p; }u;
+	u.p = NULL;
+	u.i = value;
+	if (value == 0) { ILibSparseArray_Remove(sarray, (int)streamId); }
+	else { ILibSparseArray_Add(sarray, (int)streamId, u.p); }
 }
 
 char* SCTP_ERROR_CAUSE_TO_STRING(ILibSCTP_ErrorCause_Header *cause)
@@ -1019,6 +1422,8 @@ void ILibStun_OnDestroy(void *object)
 	int i, extraClean = 0;
 	struct ILibStun_Module *obj = (struct ILibStun_Module*)object;
 
+	ILibWebRTC_StopHandshakeWorkers(obj);
+
 	// Clean up all reliable UDP state && all ICE offers (Use the same loop since both tables are ILibSTUN_MaxSlots long)
 	for (i = 0; i < ILibSTUN_MaxSlots; i++)
 	{
@@ -1032,12 +1437,17 @@ void ILibStun_OnDestroy(void *object)
 		if (obj->IceStates[i] != NULL)
 		{
 			// Clean up ICE state
-			free(obj->IceStates[i]->offerblock);
-			free(obj->IceStates[i]);
+			ILibStun_FreeIceState(obj->IceStates[i]);
 			obj->IceStates[i] = NULL;
 		}
 	}
 
+	// Receive buffers still retained by the application will keep the pool alive until they are released
+	ILibSCTP_ReceiveBufferPool_Destroy(obj->ReceiveBufferPool);
+	ILibWebRTC_Resumption_Clear(obj);
+	ILibStun_ResultCache_Clear(obj);
+	if (obj->LocalInterfaces != NULL) { free(obj->LocalInterfaces); obj->LocalInterfaces = NULL; }
+
 	if (extraClean == 0) return;
 
 #ifdef WIN32
@@ -1117,7 +1527,7 @@ int ILibStun_GetFreeIceStateSlot(struct ILibStun_Module *stunModule, struct ILib
 	{
 		slot = (stunModule->IceStatesNextSlot + i) % ILibSTUN_MaxSlots;
 		ILibRemoteLogging_printf(ILibChainGetLogger(stunModule->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "ILibStun_GetFreeIceStateSlot: NextSlot: %d, i: %d, Slot: %d ", stunModule->IceStatesNextSlot, i, slot);
-		if (stunModule->IceStates[slot] == NULL || (stunModule->IceStates[slot] != NULL && stunModule->IceStates[slot]->dtlsSession < 0 && ((ILibGetUptime() - stunModule->IceStates[slot]->creationTime) > (ILibSTUN_MaxOfferAgeSeconds * 1000))))
+		if (stunModule->IceStates[slot] == NULL || (stunModule->IceStates[slot] != NULL && stunModule->IceStates[slot]->dtlsSession < 0 && stunModule->IceStates[slot]->restartSession < 0 && ((ILibGetUptime() - stunModule->IceStates[slot]->creationTime) > (ILibSTUN_MaxOfferAgeSeconds * 1000))))
 		{
 			// This slot is either empty, or contains an offer with no DTLS session, and is older than what is allowed
 			if (oldIceState != NULL) { *oldIceState = stunModule->IceStates[slot]; }
@@ -1143,11 +1553,7 @@ void ILibStun_ClearIceState(void *stunModule, int iceSlot)
 	ice = module->IceStates[iceSlot];
 	module->IceStates[iceSlot] = NULL;
 
-	if (ice != NULL)
-	{
-		if (ice->offerblock != NULL) { free(ice->offerblock); }
-		free(ice);
-	}
+	if (ice != NULL) { ILibStun_FreeIceState(ice); }
 }
 
 int ILibStun_GetNextPeriodicInterval(int minVal, int maxVal)
@@ -1196,6 +1602,75 @@ void ILibSCTP_SetCallbacks(void* StunModule, ILibSCTP_OnConnect onconnect, ILibS
 	}
 }
 
+void ILibSCTP_SetBufferedAmountLowCallback(void* StunModule, ILibSCTP_OnBufferedAmountLow onBufferedAmountLow)
+{
+	((struct ILibStun_Module*)StunModule)->OnBufferedAmountLow = onBufferedAmountLow;
+}
+
+void ILibSCTP_SetMaxSendBufferSize(void* StunModule, int maxBufferSize)
+{
+	((struct ILibStun_Module*)StunModule)->maxSendBufferSize = maxBufferSize < 0 ? 0 : maxBufferSize;
+}
+
+void ILibSCTP_SetRTOBounds(void* StunModule, int rtoMin, int rtoMax)
+{
+	struct ILibStun_Module *obj = (struct ILibStun_Module*)StunModule;
+	if (rtoMin < 1 || rtoMax < rtoMin) return;
+	obj->rtoMin = rtoMin;
+	obj->rtoMax = rtoMax;
+}
+
+void ILibSCTP_SetDelayedAckTime(void* StunModule, int delayedAckTime)
+{
+	((struct ILibStun_Module*)StunModule)->delayedAckTime = delayedAckTime < 0 ? 0 : MIN(delayedAckTime, 500); // RFC4960 6.2 caps this at 500ms
+}
+
+int ILibSCTP_GetBufferedAmount(void* module, unsigned short streamId)
+{
+	struct ILibStun_dTlsSession *o = (struct ILibStun_dTlsSession*)module;
+	int r;
+	if (o == NULL || o->state == 0) return 0;
+	sem_wait(&(o->Lock));
+	r = ILibSCTP_StreamValue_Get(o->DataChannelBufferedAmount, streamId);
+	sem_post(&(o->Lock));
+	return r;
+}
+
+void ILibSCTP_SetBufferedAmountLowThreshold(void* module, unsigned short streamId, int threshold)
+{
+	struct ILibStun_dTlsSession *o = (struct ILibStun_dTlsSession*)module;
+	if (o == NULL || o->state == 0) return;
+	sem_wait(&(o->Lock));
+	ILibSCTP_StreamValue_Set(o->DataChannelBufferedAmountLowThreshold, streamId, threshold < 0 ? 0 : threshold);
+	sem_post(&(o->Lock));
+}
+
+int ILibSCTP_GetBufferedAmountLowThreshold(void* module, unsigned short streamId)
+{
+	struct ILibStun_dTlsSession *o = (struct ILibStun_dTlsSession*)module;
+	int r;
+	if (o == NULL || o->state == 0) return 0;
+	sem_wait(&(o->Lock));
+	r = ILibSCTP_StreamValue_Get(o->DataChannelBufferedAmountLowThreshold, streamId);
+	sem_post(&(o->Lock));
+	return r;
+}
+
+void* ILibSCTP_RetainReceiveBuffer(void* module)
+{
+	struct ILibStun_dTlsSession *o = (struct ILibStun_dTlsSession*)module;
+	ILibSCTP_ReceiveBuffer *receiveBuffer;
+	if (o == NULL || o->state == 0 || (receiveBuffer = o->parent->DeliveringBuffer) == NULL) return NULL; // Only valid from within OnData
+
+	ILibSCTP_ReceiveBuffer_Retain(receiveBuffer);
+	return receiveBuffer;
+}
+
+void ILibSCTP_ReleaseReceiveBuffer(void* receiveBuffer)
+{
+	if (receiveBuffer != NULL) { ILibSCTP_ReceiveBuffer_Release((ILibSCTP_ReceiveBuffer*)receiveBuffer); }
+}
+
 void ILibWebRTC_SetCallbacks(void *StunModule, ILibWebRTC_OnDataChannel OnDataChannel, ILibWebRTC_OnDataChannelClosed OnDataChannelClosed, ILibWebRTC_OnDataChannelAck OnDataChannelAck, ILibWebRTC_OnOfferUpdated OnOfferUpdated)
 {
 	struct ILibStun_Module* stunModule = (struct ILibStun_Module*)StunModule;
@@ -1231,21 +1706,127 @@ void ILibStun_GenerateUserAndKey(int iceSlot, char* secret, char* result)
 	ILibStun_ComputeIntegrityKey(result + 1, secret, result + 10);
 }
 
-int ILibStun_AddMessageIntegrityAttr(char* rbuffer, int ptr, char* integritykey, int integritykeylen)
+void ILibStun_IntegrityContext_Cleanup(ILibStun_IntegrityContext *ic)
+{
+	if (ic->keyed == 0) { return; }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	EVP_MAC_CTX_free(ic->ctx);
+	ic->ctx = NULL;
+#elif OPENSSL_VERSION_NUMBER >= 0x10100000L
+	HMAC_CTX_free(ic->ctx);
+	ic->ctx = NULL;
+#else
+	HMAC_CTX_cleanup(&(ic->ctx));
+#endif
+	ic->keyed = 0;
+}
+
+// Runs the HMAC-SHA1 key schedule once, so each packet only has to copy the keyed state
+void ILibStun_IntegrityContext_Init(ILibStun_IntegrityContext *ic, char* key, int keyLen)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	EVP_MAC *mac;
+	OSSL_PARAM params[2];
+#endif
+
+	ILibStun_IntegrityContext_Cleanup(ic);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA1", 0);
+	params[1] = OSSL_PARAM_construct_end();
+	if ((mac = EVP_MAC_fetch(NULL, "HMAC", NULL)) == NULL) { return; }
+	ic->ctx = EVP_MAC_CTX_new(mac);
+	EVP_MAC_free(mac);
+	if (ic->ctx == NULL) ILIBCRITICALEXIT(254);
+	if (EVP_MAC_init(ic->ctx, (unsigned char*)key, (size_t)keyLen, params) != 1) { EVP_MAC_CTX_free(ic->ctx); ic->ctx = NULL; return; }
+#elif OPENSSL_VERSION_NUMBER >= 0x10100000L
+	if ((ic->ctx = HMAC_CTX_new()) == NULL) ILIBCRITICALEXIT(254);
+	if (HMAC_Init_ex(ic->ctx, key, keyLen, EVP_sha1(), NULL) != 1) { HMAC_CTX_free(ic->ctx); ic->ctx = NULL; return; }
+#else
+	HMAC_CTX_init(&(ic->ctx));
+	if (HMAC_Init_ex(&(ic->ctx), key, keyLen, EVP_sha1(), NULL) != 1) { HMAC_CTX_cleanup(&(ic->ctx)); return; }
+#endif
+	ic->keyed = 1;
+}
+
+// Writes the 20 byte HMAC-SHA1 of buffer into result. Returns 0 if the context was never keyed.
+int ILibStun_IntegrityContext_Compute(ILibStun_IntegrityContext *ic, char* buffer, int bufferLen, char* result)
 {
+	int retVal = 0;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	EVP_MAC_CTX *hmac;
+	size_t hmaclen = 0;
+#elif OPENSSL_VERSION_NUMBER >= 0x10100000L
+	HMAC_CTX *hmac;
+	unsigned int hmaclen = 0;
+#else
 	HMAC_CTX hmac;
-	unsigned int hmaclen = 20;
+	unsigned int hmaclen = 0;
+#endif
+
+	if (ic->keyed == 0) { return 0; }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	if ((hmac = EVP_MAC_CTX_dup(ic->ctx)) == NULL) ILIBCRITICALEXIT(254);
+	if (EVP_MAC_update(hmac, (unsigned char*)buffer, (size_t)bufferLen) == 1 && EVP_MAC_final(hmac, (unsigned char*)result, &hmaclen, 20) == 1 && hmaclen == 20) { retVal = 20; }
+	EVP_MAC_CTX_free(hmac);
+#elif OPENSSL_VERSION_NUMBER >= 0x10100000L
+	if ((hmac = HMAC_CTX_new()) == NULL) ILIBCRITICALEXIT(254);
+	if (HMAC_CTX_copy(hmac, ic->ctx) == 1 && HMAC_Update(hmac, (unsigned char*)buffer, bufferLen) == 1 && HMAC_Final(hmac, (unsigned char*)result, &hmaclen) == 1 && hmaclen == 20) { retVal = 20; }
+	HMAC_CTX_free(hmac);
+#else
+	HMAC_CTX_init(&hmac);
+	if (HMAC_CTX_copy(&hmac, &(ic->ctx)) == 1 && HMAC_Update(&hmac, (unsigned char*)buffer, bufferLen) == 1 && HMAC_Final(&hmac, (unsigned char*)result, &hmaclen) == 1 && hmaclen == 20) { retVal = 20; }
+	HMAC_CTX_cleanup(&hmac);
+#endif
+	return retVal;
+}
 
+// Keys the local context from the username we handed out, and the remote context from the peer's password (if we have it yet)
+void ILibStun_IceState_InitIntegrity(struct ILibStun_IceState *ice)
+{
+	char key[33]; // Key is 32, but need 33 to put the terminating null char.
+
+	if (ice->userAndKey[0] == 8)
+	{
+		// Same derivation ILibStun_ProcessStunPacket uses for incoming requests
+		ILibStun_ComputeIntegrityKey(ice->userAndKey + 1, ice->parentStunModule->Secret, key);
+		ILibStun_IntegrityContext_Init(&(ice->localIntegrity), key, 32);
+	}
+	if (ice->rkey != NULL && ice->rkeylen > 0)
+	{
+		ILibStun_IntegrityContext_Init(&(ice->remoteIntegrity), ice->rkey, ice->rkeylen);
+	}
+}
+
+void ILibStun_FreeIceState(struct ILibStun_IceState *ice)
+{
+	ILibStun_IntegrityContext_Cleanup(&(ice->localIntegrity));
+	ILibStun_IntegrityContext_Cleanup(&(ice->remoteIntegrity));
+	if (ice->candidateblock != NULL) { free(ice->candidateblock); }
+	if (ice->offerblock != NULL) { free(ice->offerblock); }
+	if (ice->pathStats != NULL) { free(ice->pathStats); }
+	free(ice);
+}
+
+int ILibStun_AddMessageIntegrityAttrEx(char* rbuffer, int ptr, ILibStun_IntegrityContext *integrity)
+{
 	((unsigned short*)(rbuffer))[1] = htons((unsigned short)(ptr + 24 - 20));						// Set the length
 	((unsigned short*)(rbuffer + ptr))[0] = htons((unsigned short)STUN_ATTRIB_MESSAGE_INTEGRITY);	// Attribute header
 	((unsigned short*)(rbuffer + ptr))[1] = htons(20);												// Attribute length
 
-	// Setup and perform HMAC-SHA1
-	HMAC_CTX_init(&hmac);
-	HMAC_Init_ex(&hmac, integritykey, integritykeylen, EVP_sha1(), NULL);
-	HMAC_Update(&hmac, (unsigned char*)rbuffer, ptr);
-	HMAC_Final(&hmac, (unsigned char*)(rbuffer + ptr + 4), &hmaclen); // Put the HMAC in the outgoing result location
-	HMAC_CTX_cleanup(&hmac);
+	// Put the HMAC-SHA1 in the outgoing result location
+	if (ILibStun_IntegrityContext_Compute(integrity, rbuffer, ptr, rbuffer + ptr + 4) == 0) { memset(rbuffer + ptr + 4, 0, 20); }
+	return 24;
+}
+
+int ILibStun_AddMessageIntegrityAttr(char* rbuffer, int ptr, char* integritykey, int integritykeylen)
+{
+	ILibStun_IntegrityContext integrity;
+
+	// One-off keys (TURN long-term credentials, unknown slots) don't have a cached context
+	memset(&integrity, 0, sizeof(ILibStun_IntegrityContext));
+	ILibStun_IntegrityContext_Init(&integrity, integritykey, integritykeylen);
+	ILibStun_AddMessageIntegrityAttrEx(rbuffer, ptr, &integrity);
+	ILibStun_IntegrityContext_Cleanup(&integrity);
 	return 24;
 }
 
@@ -1302,6 +1883,137 @@ void ILib_Stun_SendAttributeChangeRequest(void* module, struct sockaddr* StunSer
 	ILibAsyncUDPSocket_SendTo(StunModule->UDP, (struct sockaddr*)StunServer, rbuffer, rptr, ILibAsyncSocket_MemoryOwnership_USER);
 }
 
+
+//
+// Host candidates come from a cached copy of the local interface list. On Linux, an rtnetlink socket on the chain tells us when
+// addresses or links change. Elsewhere, the list is re-read once it is older than ILibStun_InterfaceCacheTTL.
+//
+int ILibStun_RefreshLocalInterfaces(struct ILibStun_Module *obj)
+{
+	struct sockaddr_in *list = NULL;
+	int len, changed, i, j;
+
+	len = ILibGetLocalIPv4AddressList(&list, 0);
+	changed = len != obj->LocalInterfacesLength;
+	for (i = 0; changed == 0 && i < len; ++i)
+	{
+		// Same addresses, possibly in a different order, isn't a change
+		for (j = 0; j < obj->LocalInterfacesLength && obj->LocalInterfaces[j].sin_addr.s_addr != list[i].sin_addr.s_addr; ++j);
+		if (j == obj->LocalInterfacesLength) { changed = 1; }
+	}
+	if (obj->LocalInterfacesTime == 0) { changed = 0; } // The first fill has nothing to compare against, so it isn't a change
+
+	if (obj->LocalInterfaces != NULL) { free(obj->LocalInterfaces); }
+	obj->LocalInterfaces = list;
+	obj->LocalInterfacesLength = len;
+	obj->LocalInterfacesTime = ILibGetUptime();
+
+	// Our public address most likely changed with the interfaces, so cached STUN results can't be trusted anymore
+	if (changed != 0) { ILibStun_ResultCache_Flush(obj); }
+	return(changed);
+}
+
+int ILibStun_GetLocalInterfaces(struct ILibStun_Module *obj, struct sockaddr_in **list)
+{
+	if (obj->LocalInterfacesTime == 0 || (obj->InterfaceMonitor == NULL && obj->LocalInterfacesTime + ILibStun_InterfaceCacheTTL < ILibGetUptime()))
+	{
+		ILibStun_RefreshLocalInterfaces(obj);
+	}
+	*list = obj->LocalInterfaces;
+	return(obj->LocalInterfacesLength);
+}
+
+#if defined(__linux__)
+typedef struct ILibStun_InterfaceMonitor
+{
+	ILibChain_PreSelect PreSelect;
+	ILibChain_PostSelect PostSelect;
+	ILibChain_Destroy Destroy;
+	struct ILibStun_Module *module;
+	int socket;
+}ILibStun_InterfaceMonitor;
+
+void ILibStun_InterfaceMonitor_PreSelect(void* object, fd_set *readset, fd_set *writeset, fd_set *errorset, int* blocktime)
+{
+	UNREFERENCED_PARAMETER(writeset);
+	UNREFERENCED_PARAMETER(errorset);
+	UNREFERENCED_PARAMETER(blocktime);
+	FD_SET(((ILibStun_InterfaceMonitor*)object)->socket, readset);
+}
+
+void ILibStun_InterfaceMonitor_PostSelect(void* object, int slct, fd_set *readset, fd_set *writeset, fd_set *errorset)
+{
+	ILibStun_InterfaceMonitor *monitor = (ILibStun_InterfaceMonitor*)object;
+	char buffer[8192];
+	struct nlmsghdr *msg;
+	int len, changed = 0;
+
+	UNREFERENCED_PARAMETER(slct);
+	UNREFERENCED_PARAMETER(writeset);
+	UNREFERENCED_PARAMETER(errorset);
+
+	if (!FD_ISSET(monitor->socket, readset)) { return; }
+	while ((len = (int)recv(monitor->socket, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+	{
+		for (msg = (struct nlmsghdr*)buffer; NLMSG_OK(msg, (unsigned int)len); msg = NLMSG_NEXT(msg, len))
+		{
+			switch (msg->nlmsg_type)
+			{
+				case RTM_NEWADDR:
+				case RTM_DELADDR:
+				case RTM_NEWLINK:
+				case RTM_DELLINK:
+					changed = 1;
+					break;
+				default:
+					break;
+			}
+		}
+	}
+	if (len < 0 && errno == ENOBUFS) { changed = 1; } // We missed some notifications, so assume something changed
+
+	// A burst of notifications only costs one re-read
+	if (changed != 0 && ILibStun_RefreshLocalInterfaces(monitor->module) != 0 && monitor->module->OnInterfacesChanged != NULL)
+	{
+		monitor->module->OnInterfacesChanged(monitor->module);
+	}
+}
+
+void ILibStun_InterfaceMonitor_Destroy(void *object)
+{
+	close(((ILibStun_InterfaceMonitor*)object)->socket);
+}
+
+void* ILibStun_InterfaceMonitor_Create(struct ILibStun_Module *obj)
+{
+	ILibStun_InterfaceMonitor *monitor;
+	struct sockaddr_nl local;
+	int sock;
+
+	if ((sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) < 0) { return NULL; }
+	memset(&local, 0, sizeof(struct sockaddr_nl));
+	local.nl_family = AF_NETLINK;
+	local.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+	if (bind(sock, (struct sockaddr*)&local, sizeof(struct sockaddr_nl)) != 0) { close(sock); return NULL; }
+	fcntl(sock, F_SETFL, O_NONBLOCK | fcntl(sock, F_GETFL, 0));
+
+	if ((monitor = (ILibStun_InterfaceMonitor*)malloc(sizeof(ILibStun_InterfaceMonitor))) == NULL) { ILIBCRITICALEXIT(254); }
+	memset(monitor, 0, sizeof(ILibStun_InterfaceMonitor));
+	monitor->PreSelect = &ILibStun_InterfaceMonitor_PreSelect;
+	monitor->PostSelect = &ILibStun_InterfaceMonitor_PostSelect;
+	monitor->Destroy = &ILibStun_InterfaceMonitor_Destroy;
+	monitor->module = obj;
+	monitor->socket = sock;
+	ILibAddToChain(obj->Chain, monitor);
+	return(monitor);
+}
+#endif
+
+void ILibWebRTC_SetOnInterfacesChanged(void *stunModule, ILibWebRTC_OnInterfacesChanged OnInterfacesChanged)
+{
+	((struct ILibStun_Module*)stunModule)->OnInterfacesChanged = OnInterfacesChanged;
+}
+
 int ILibStun_WebRTC_UpdateOfferResponse(struct ILibStun_IceState *iceState, char **answer)
 {
 	int rlen, i;
@@ -1313,9 +2025,10 @@ int ILibStun_WebRTC_UpdateOfferResponse(struct ILibStun_IceState *iceState, char
 
 	if (iceState->useTurn != 0) { turnRecordSize = 1 + sizeof(struct sockaddr_in6); }
 	if (iceState->dtlsInitiator == 0) { BlockFlags |= ILibWebRTC_SDP_Flags_DTLS_SERVER; }
+	if (iceState->iceLite != 0) { BlockFlags |= ILibWebRTC_SDP_Flags_ICE_LITE; }
 
 	// Generate an return answer
-	LocalInterfaceListV4Len = ILibGetLocalIPv4AddressList(&LocalInterfaceListV4, 0);
+	LocalInterfaceListV4Len = ILibStun_GetLocalInterfaces(iceState->parentStunModule, &LocalInterfaceListV4);
 	if (LocalInterfaceListV4Len > 8) LocalInterfaceListV4Len = 8; // Don't send more than 8 candidates
 
 	if (iceState->parentStunModule->alwaysUseTurn != 0) { LocalInterfaceListV4Len = 0; }
@@ -1335,7 +2048,6 @@ int ILibStun_WebRTC_UpdateOfferResponse(struct ILibStun_IceState *iceState, char
 		((int*)(*answer + 49 + 33 + (i * 6)))[0] = LocalInterfaceListV4[i].sin_addr.s_addr;
 		((short*)(*answer + 49 + 33 + (i * 6) + 4))[0] = ((struct sockaddr_in*)(&(iceState->parentStunModule->LocalIf)))->sin_port;
 	}
-	if (LocalInterfaceListV4 != NULL) free(LocalInterfaceListV4);
 	if (turnRecordSize > 0)
 	{
 		(*answer + rlen)[0] = INET_SOCKADDR_LENGTH(iceState->parentStunModule->mRelayedTransportAddress.sin6_family);
@@ -1344,57 +2056,291 @@ int ILibStun_WebRTC_UpdateOfferResponse(struct ILibStun_IceState *iceState, char
 	return (rlen + turnRecordSize);
 }
 
-void ILibStun_WebRTC_ConsentFreshness_Continue(void *object)
+//
+// Consent freshness is driven by a single module timer, instead of one timer per session. Each session keeps the uptime its next probe
+// is due, and every tick sends all the probes that are due (or nearly due) in one pass.
+//
+void ILibStun_WebRTC_ConsentFreshness_OnTick(void *object);
+
+// Randomized so sessions established together don't stay in lock step. Never longer than the spec allows.
+int ILibStun_WebRTC_ConsentFreshness_NextInterval()
 {
-	struct ILibStun_dTlsSession *session = (struct ILibStun_dTlsSession*)object - 1;
-	struct timeval tv;
-	char TransactionID[12];
-	int SessionSlot;
+	unsigned short r;
+	util_random(2, (char*)&r);
+	return ((ILibStun_MaxConsentFreshnessTimeoutSeconds * 1000 * 4) / 5) + (r % ((ILibStun_MaxConsentFreshnessTimeoutSeconds * 1000) / 5 + 1));
+}
 
-	gettimeofday(&tv, NULL);
+void ILibStun_WebRTC_ConsentFreshness_Arm(struct ILibStun_Module *obj, long long due)
+{
+	long long now = ILibGetUptime();
 
-	// If this was triggered, it means we haven't received a STUN/Response yet
-	// Based on http://tools.ietf.org/html/draft-muthu-behave-consent-freshness-04
-	if (tv.tv_sec - session->freshnessTimestampStart >= ILibStun_MaxConsentFreshnessTimeoutSeconds)
-	{
-		// We need to disconnect DTLS
-		ILibRemoteLogging_printf(ILibChainGetLogger(session->parent->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_2, "Consent Freshness Timeout, Closing Session: %d", session->sessionId);
-		ILibStun_SctpDisconnect(session->parent, session->sessionId);
-	}
-	else
+	if (obj->consentFreshnessTick != 0 && obj->consentFreshnessTick <= due) { return; } // Timer will already fire in time
+	if (obj->consentFreshnessTick != 0) { ILibLifeTime_Remove(obj->Timer, (char*)obj + 1); }
+
+	obj->consentFreshnessTick = due;
+	ILibLifeTime_AddEx(obj->Timer, (char*)obj + 1, due > now ? (int)(due - now) : 0, ILibStun_WebRTC_ConsentFreshness_OnTick, NULL);
+}
+
+// Schedules the next probe for this session, one jittered interval from now
+void ILibStun_WebRTC_ConsentFreshness_Schedule(struct ILibStun_dTlsSession *session)
+{
+	session->freshnessProbing = 0;
+	session->freshnessDue = ILibGetUptime() + ILibStun_WebRTC_ConsentFreshness_NextInterval();
+	ILibStun_WebRTC_ConsentFreshness_Arm(session->parent, session->freshnessDue);
+}
+
+void ILibStun_WebRTC_ConsentFreshness_Cancel(struct ILibStun_dTlsSession *session)
+{
+	session->freshnessDue = 0;
+	session->freshnessProbing = 0;
+}
+
+void ILibStun_WebRTC_ConsentFreshness_OnTick(void *object)
+{
+	struct ILibStun_Module *obj = (struct ILibStun_Module*)((char*)object - 1);
+	struct ILibStun_dTlsSession *session;
+	struct timeval tv;
+	char TransactionID[12];
+	char Packet[512];
+	int i, Ptr;
+	long long now, next = 0;
+
+	obj->consentFreshnessTick = 0;
+	now = ILibGetUptime();
+	gettimeofday(&tv, NULL);
+
+	for (i = 0; i < ILibSTUN_MaxSlots; ++i)
 	{
-		// Keep sending a Probe and wait 500ms for a response, using the same TransactionID
-		SessionSlot = session->sessionId;
+		session = obj->dTlsSessions[i];
+		if (session == NULL || session->state == 0 || session->freshnessDue == 0) { continue; }
+		if (session->freshnessDue > now + ILibStun_ConsentFreshnessBatchWindow)
+		{
+			if (next == 0 || session->freshnessDue < next) { next = session->freshnessDue; }
+			continue;
+		}
+		if (obj->IceStates[session->iceStateSlot] == NULL) { ILibStun_WebRTC_ConsentFreshness_Cancel(session); continue; }
+
+		if (session->freshnessProbing == 0)
+		{
+			// Start a new round of probes. The TransactionID stays the same until we get a response
+			session->freshnessProbing = 1;
+			session->freshnessTimestampStart = tv.tv_sec;
+		}
+		else if (tv.tv_sec - session->freshnessTimestampStart >= ILibStun_MaxConsentFreshnessTimeoutSeconds)
+		{
+			// If we get here, it means we haven't received a STUN/Response yet
+			// Based on http://tools.ietf.org/html/draft-muthu-behave-consent-freshness-04
+			ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_2, "Consent Freshness Timeout, Closing Session: %d", session->sessionId);
+			ILibStun_WebRTC_ConsentFreshness_Cancel(session);
+			ILibStun_SctpDisconnect(obj, session->sessionId);
+			continue;
+		}
+
 		memset(TransactionID, 0, 12);
-		TransactionID[0] = (char)(SessionSlot ^ 0x80);
+		TransactionID[0] = (char)((unsigned char)session->sessionId ^ 0x80);
 		memcpy(TransactionID + 1, &(session->freshnessTimestampStart), sizeof(long) < 11 ? sizeof(long) : 11);
 
-		ILibRemoteLogging_printf(ILibChainGetLogger(session->parent->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_2, "Probing Consent Freshness for Session: %d with %s:%u", session->sessionId, ILibRemoteLogging_ConvertAddress((struct sockaddr*)&(session->remoteInterface)), htons(session->remoteInterface.sin6_port));
+		ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_2, "Probing Consent Freshness for Session: %d with %s:%u", session->sessionId, ILibRemoteLogging_ConvertAddress((struct sockaddr*)&(session->remoteInterface)), htons(session->remoteInterface.sin6_port));
+
+		// All the probes in this pass are built in the same buffer, and signed with the IceState's cached integrity context
+		Ptr = ILibStun_GenerateIceRequestPacket(obj->IceStates[session->iceStateSlot], Packet, TransactionID, 0, &(session->remoteInterface));
+		ILibStun_SendPacket(obj->IceStates[session->iceStateSlot], Packet, 0, Ptr, &(session->remoteInterface), ILibAsyncSocket_MemoryOwnership_USER);
+
+		session->freshnessDue = now + ILibStun_ConsentFreshnessProbeInterval;	// Wait 500ms for a response
+		if (next == 0 || session->freshnessDue < next) { next = session->freshnessDue; }
+	}
+
+	if (next != 0) { ILibStun_WebRTC_ConsentFreshness_Arm(obj, next); }
+}
+
+//
+// Path probing. Like consent freshness, a single module timer drives every session. Each round accounts for the probes of the previous
+// round that were never answered, checks if a backup pair has been better for long enough, then probes every validated pair again.
+//
+void ILibStun_WebRTC_PathProbe_OnTick(void *object);
+
+void ILibStun_WebRTC_PathProbe_Arm(struct ILibStun_Module *obj)
+{
+	if (obj->pathProbeInterval <= 0 || obj->pathProbeArmed != 0) { return; }
+	obj->pathProbeArmed = 1;
+	ILibLifeTime_AddEx(obj->Timer, (char*)obj + 3, obj->pathProbeInterval, ILibStun_WebRTC_PathProbe_OnTick, NULL);
+}
+
+// Candidates can still be trickled in after the session is established, so the stats grow with them
+void ILibStun_PathProbe_ResizeStats(struct ILibStun_IceState *state)
+{
+	int i;
 
-		ILibLifeTime_AddEx(session->parent->Timer, session + 1, 500, ILibStun_WebRTC_ConsentFreshness_Continue, NULL);
-		ILibStun_SendIceRequestEx(session->parent->IceStates[session->iceStateSlot], TransactionID, 0, &(session->remoteInterface));
+	if (state->pathStatsCount >= state->hostcandidatecount) { return; }
+	if ((state->pathStats = (ILibStun_PathStats*)realloc(state->pathStats, state->hostcandidatecount * sizeof(ILibStun_PathStats))) == NULL) { ILIBCRITICALEXIT(254); }
+	for (i = state->pathStatsCount; i < state->hostcandidatecount; ++i)
+	{
+		memset(&(state->pathStats[i]), 0, sizeof(ILibStun_PathStats));
+		state->pathStats[i].srtt = -1;
 	}
+	state->pathStatsCount = state->hostcandidatecount;
 }
-void ILibStun_WebRTC_ConsentFreshness_Start(void *object)
+
+void ILibStun_PathProbe_GetCandidate(struct ILibStun_IceState *state, int index, struct sockaddr_in *candidate)
 {
-	struct ILibStun_dTlsSession *session = (struct ILibStun_dTlsSession*)object - 1;
-	struct timeval tv;
+	memset(candidate, 0, sizeof(struct sockaddr_in));
+	candidate->sin_family = AF_INET;
+	candidate->sin_port = state->hostcandidates[index].port;
+	candidate->sin_addr.s_addr = state->hostcandidates[index].addr;
+}
+
+void ILibStun_PathProbe_OnResponse(struct ILibStun_IceState *state, int index, unsigned char round, struct sockaddr_in6 *remoteInterface)
+{
+	ILibStun_PathStats *stats;
+	struct sockaddr_in candidate;
+	int rtt;
+
+	if (index >= state->pathStatsCount || round != state->pathProbeRound || state->pathStats[index].probeSent == 0) { return; } // Stale
+	ILibStun_PathProbe_GetCandidate(state, index, &candidate);
+	if (remoteInterface->sin6_family != AF_INET || memcmp(remoteInterface, &candidate, INET_SOCKADDR_LENGTH(AF_INET)) != 0) { return; }
+
+	stats = &(state->pathStats[index]);
+	rtt = (int)(ILibGetUptime() - stats->probeSent);
+	stats->srtt = stats->srtt < 0 ? rtt : (7 * stats->srtt + rtt) / 8;
+	stats->loss = (7 * stats->loss) / 8;
+	stats->probeSent = 0;
+}
+
+// Returns non-zero if the pair at 'backup' is better enough than the selected pair at 'current', to be worth switching to
+int ILibStun_PathProbe_IsBetter(ILibStun_PathStats *backup, ILibStun_PathStats *current)
+{
+	if (backup->srtt < 0 || backup->loss > ILibStun_PathSwitchMaxLoss) { return 0; }
+	if (current->loss > ILibStun_PathSwitchMaxLoss) { return 1; }
+	return (current->srtt >= 0 && backup->srtt + ILibStun_PathSwitchMinGain <= current->srtt && backup->srtt * 100 <= current->srtt * (100 - ILibStun_PathSwitchHysteresis));
+}
+
+void ILibStun_PathProbe_Switch(struct ILibStun_IceState *state, struct ILibStun_dTlsSession *session, int index)
+{
+	struct sockaddr_in candidate;
+	int i;
+
+	ILibStun_PathProbe_GetCandidate(state, index, &candidate);
+	ILibRemoteLogging_printf(ILibChainGetLogger(session->parent->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "DTLS Session: %d switching to better pair %s:%u [RTT: %d, Loss: %d%%]", session->sessionId, ILibRemoteLogging_ConvertAddress((struct sockaddr*)&candidate), ntohs(candidate.sin_port), state->pathStats[index].srtt, state->pathStats[index].loss);
+
+	// Nominate the new pair. The peer follows as soon as our DTLS traffic shows up on it
+	ILibStun_SendIceRequest(state, session->iceStateSlot, 1, (struct sockaddr_in6*)&candidate);
+	memcpy(&(session->remoteInterface), &candidate, INET_SOCKADDR_LENGTH(AF_INET));
+	session->pathSwitchTime = ILibGetUptime();
+	for (i = 0; i < state->pathStatsCount; ++i) { state->pathStats[i].betterRounds = 0; }
+
+	// The new pair just answered us, so consent starts over from here
+	if (session->freshnessDue != 0) { ILibStun_WebRTC_ConsentFreshness_Schedule(session); }
+	ILibSCTP_OnPathChanged(session, state->pathStats[index].srtt);
+}
+
+void ILibStun_PathProbe_Evaluate(struct ILibStun_IceState *state, struct ILibStun_dTlsSession *session)
+{
+	struct sockaddr_in candidate;
+	int i, current = -1, best = -1;
+
+	for (i = 0; i < state->pathStatsCount; ++i)
+	{
+		if (state->pathStats[i].probeSent != 0)
+		{
+			// Never answered
+			state->pathStats[i].loss = (7 * state->pathStats[i].loss + 100) / 8;
+			state->pathStats[i].probeSent = 0;
+		}
+		ILibStun_PathProbe_GetCandidate(state, i, &candidate);
+		if (session->remoteInterface.sin6_family == AF_INET && memcmp(&(session->remoteInterface), &candidate, INET_SOCKADDR_LENGTH(AF_INET)) == 0) { current = i; }
+	}
+	if (current < 0) { return; } // The selected pair isn't one of the candidates (ie: TURN Channel)
+
+	for (i = 0; i < state->pathStatsCount; ++i)
+	{
+		if (i == current) { continue; }
+		if (state->hostcandidateResponseFlag[i] == 1 && ILibStun_PathProbe_IsBetter(&(state->pathStats[i]), &(state->pathStats[current])) != 0)
+		{
+			++state->pathStats[i].betterRounds;
+			if (best < 0 || state->pathStats[i].srtt < state->pathStats[best].srtt) { best = i; }
+		}
+		else
+		{
+			state->pathStats[i].betterRounds = 0;
+		}
+	}
+
+	if (best >= 0 && state->pathStats[best].betterRounds >= ILibStun_PathSwitchRounds && ILibGetUptime() - session->pathSwitchTime >= ILibStun_PathSwitchHoldDown)
+	{
+		ILibStun_PathProbe_Switch(state, session, best);
+	}
+}
+
+void ILibStun_PathProbe_Send(struct ILibStun_IceState *state, int iceSlot)
+{
+	struct sockaddr_in candidate;
 	char TransactionID[12];
-	int SessionSlot = session->sessionId;
+	long long now = ILibGetUptime();
+	int i;
+
+	++state->pathProbeRound;
+	for (i = 0; i < state->pathStatsCount; ++i)
+	{
+		if (state->hostcandidateResponseFlag[i] != 1) { continue; }
 
-	if (session->parent->IceStates[session->iceStateSlot] == NULL) { return; }
+		TransactionID[0] = (char)iceSlot;
+		TransactionID[1] = (char)ILibStun_PathProbe_Marker;
+		TransactionID[2] = (char)i;		// Candidate count fits in a byte (ILibStun_ICE_MaxCandidates)
+		TransactionID[3] = (char)state->pathProbeRound;
+		util_random(8, TransactionID + 4);
 
-	memset(TransactionID, 0, 12);
-	gettimeofday(&tv, NULL);
-	session->freshnessTimestampStart = tv.tv_sec;
+		ILibStun_PathProbe_GetCandidate(state, i, &candidate);
+		state->pathStats[i].probeSent = now;
+		ILibStun_SendIceRequestEx(state, TransactionID, 0, (struct sockaddr_in6*)&candidate);
+	}
+}
+
+void ILibStun_WebRTC_PathProbe_OnTick(void *object)
+{
+	struct ILibStun_Module *obj = (struct ILibStun_Module*)((char*)object - 3);
+	struct ILibStun_dTlsSession *session;
+	struct ILibStun_IceState *state;
+	int i, active = 0;
+
+	obj->pathProbeArmed = 0;
+	for (i = 0; i < ILibSTUN_MaxSlots; ++i)
+	{
+		session = obj->dTlsSessions[i];
+		if (session == NULL || (session->state != 1 && session->state != 2) || session->iceStateSlot < 0) { continue; }
+		state = obj->IceStates[session->iceStateSlot];
+
+		// Only the CONTROLLING side gets to pick the pair. Everything through the TURN server looks like the same path
+		if (state == NULL || state->dtlsSession != session->sessionId || state->peerHasActiveOffer != 0 || state->useTurn != 0) { continue; }
+
+		active = 1;
+		if (state->hostcandidatecount < 2) { continue; }
+		ILibStun_PathProbe_ResizeStats(state);
+		ILibStun_PathProbe_Evaluate(state, session);
+		ILibStun_PathProbe_Send(state, session->iceStateSlot);
+	}
+
+	if (active != 0) { ILibStun_WebRTC_PathProbe_Arm(obj); }
+}
 
-	TransactionID[0] = ((unsigned char)SessionSlot ^ 0x80);
-	memcpy(TransactionID + 1, &(session->freshnessTimestampStart), sizeof(long) < 11 ? sizeof(long) : 11);
+void ILibWebRTC_SetPathProbeInterval(void *stunModule, int milliseconds)
+{
+	struct ILibStun_Module *obj = (struct ILibStun_Module*)stunModule;
+	int i;
 
-	ILibRemoteLogging_printf(ILibChainGetLogger(session->parent->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_2, "Probing Consent Freshness for Session: %d with %s:%u", session->sessionId, ILibRemoteLogging_ConvertAddress((struct sockaddr*)&(session->remoteInterface)), htons(session->remoteInterface.sin6_port));
+	obj->pathProbeInterval = milliseconds < 0 ? 0 : milliseconds;
+	if (obj->pathProbeArmed != 0)
+	{
+		// The next round will use the new interval
+		ILibLifeTime_Remove(obj->Timer, (char*)obj + 3);
+		obj->pathProbeArmed = 0;
+	}
+	if (obj->pathProbeInterval <= 0) { return; }
 
-	ILibLifeTime_AddEx(session->parent->Timer, session + 1, 500, ILibStun_WebRTC_ConsentFreshness_Continue, NULL);	// Wait 500ms for a response
-	ILibStun_SendIceRequestEx(session->parent->IceStates[session->iceStateSlot], TransactionID, 0, &(session->remoteInterface));
+	// Sessions that connected while probing was off never armed it, so check for them here. The tick itself skips the ones that aren't ours to probe
+	for (i = 0; i < ILibSTUN_MaxSlots; ++i)
+	{
+		if (obj->dTlsSessions[i] != NULL && (obj->dTlsSessions[i]->state == 1 || obj->dTlsSessions[i]->state == 2)) { ILibStun_WebRTC_PathProbe_Arm(obj); break; }
+	}
 }
 
 enum ILibAsyncSocket_SendStatus ILibStun_SendPacketEx(struct ILibStun_Module *stunModule, int useTurn, char* buffer, int offset, int length, struct sockaddr_in6* remoteInterface, enum ILibAsyncSocket_MemoryOwnership memoryOwnership)
@@ -1468,9 +2414,11 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 	struct sockaddr_in changedAddress;
 	char integritykey[33]; // Key is 32, but need 33 to put the terminating null char.
 	int integritykeySet = 0;
+	ILibStun_IntegrityContext *localIntegrity = NULL;
 	int processed = 0;
 	int isControlled = 0;
 	int isControlling = 0;
+	int useCandidate = 0;
 	unsigned long long tiebreakValue = 0;
 
 	// Check the length of the packet & IPv4
@@ -1600,6 +2548,7 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 
 			case STUN_ATTRIB_USE_CANDIDATE:
 			{
+				useCandidate = 1;
 				break;
 			}
 			case STUN_ATTRIB_ICE_CONTROLLED:
@@ -1654,8 +2603,9 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 			}
 			case STUN_ATTRIB_MESSAGE_INTEGRITY:
 			{
-				HMAC_CTX hmac;
-				unsigned int hmaclen = 20;
+				ILibStun_IntegrityContext oneshot;
+				ILibStun_IntegrityContext *integrity = NULL;
+				int hmaclen;
 				unsigned char hmacresult[20];
 				char* key = NULL;
 				int keylen = 0;
@@ -1664,10 +2614,20 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 
 				if (username != NULL)
 				{
-					// Compute the secret key
-					ILibStun_ComputeIntegrityKey(username, obj->Secret, integritykey);
-					key = integritykey;
-					keylen = 32;
+					// If the username is one we handed out, the IceState already has a keyed context for it
+					unsigned char slot = (unsigned char)ILibStun_CharToSlot(username[0]);
+					if (slot < ILibSTUN_MaxSlots && obj->IceStates[slot] != NULL && obj->IceStates[slot]->localIntegrity.keyed != 0 && memcmp(obj->IceStates[slot]->userAndKey + 1, username, 8) == 0)
+					{
+						integrity = &(obj->IceStates[slot]->localIntegrity);
+						localIntegrity = integrity;
+					}
+					else
+					{
+						// Compute the secret key
+						ILibStun_ComputeIntegrityKey(username, obj->Secret, integritykey);
+						key = integritykey;
+						keylen = 32;
+					}
 					integritykeySet = 1;
 				}
 				else
@@ -1678,14 +2638,12 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 					// Check to see if this is an IceSlot
 					if (slot < ILibSTUN_MaxSlots && obj->IceStates[slot] != NULL)
 					{
-						key = obj->IceStates[slot]->rkey;
-						keylen = obj->IceStates[slot]->rkeylen;
+						integrity = &(obj->IceStates[slot]->remoteIntegrity);
 					}
 					// Check to see if it's a DTLS Session Slot
 					else if ((slot ^ 0x80) < ILibSTUN_MaxSlots && obj->dTlsSessions[slot ^ 0x80] != NULL)
 					{
-						key = obj->dTlsSessions[slot ^ 0x80]->parent->IceStates[obj->dTlsSessions[slot ^ 0x80]->iceStateSlot]->rkey;
-						keylen = obj->dTlsSessions[slot ^ 0x80]->parent->IceStates[obj->dTlsSessions[slot ^ 0x80]->iceStateSlot]->rkeylen;
+						integrity = &(obj->dTlsSessions[slot ^ 0x80]->parent->IceStates[obj->dTlsSessions[slot ^ 0x80]->iceStateSlot]->remoteIntegrity);
 					}
 					else
 					{
@@ -1701,12 +2659,18 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 					((unsigned short*)buffer)[1] = htons((unsigned short)(ptr + 4));
 				}
 
-				// Setup and perform HMAC-SHA1
-				HMAC_CTX_init(&hmac);
-				HMAC_Init_ex(&hmac, key, keylen, EVP_sha1(), NULL);
-				HMAC_Update(&hmac, (unsigned char*)buffer, ptr);
-				HMAC_Final(&hmac, hmacresult, &hmaclen); // Put the HMAC in the outgoing result location
-				HMAC_CTX_cleanup(&hmac);
+				// Perform HMAC-SHA1
+				if (integrity != NULL)
+				{
+					hmaclen = ILibStun_IntegrityContext_Compute(integrity, buffer, ptr, (char*)hmacresult);
+				}
+				else
+				{
+					memset(&oneshot, 0, sizeof(ILibStun_IntegrityContext));
+					ILibStun_IntegrityContext_Init(&oneshot, key, keylen);
+					hmaclen = ILibStun_IntegrityContext_Compute(&oneshot, buffer, ptr, (char*)hmacresult);
+					ILibStun_IntegrityContext_Cleanup(&oneshot);
+				}
 
 				// Put the length back, if fingerprint was present
 				if (ntohs(((unsigned short*)(buffer + ptr + (4 + FOURBYTEBOUNDARY(attrLength))))[0]) == STUN_ATTRIB_FINGERPRINT)
@@ -1786,11 +2750,32 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 										ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "Ice Slot: %d  Candidate Match [%s:%u]", EncodedSlot, ILibRemoteLogging_ConvertAddress((struct sockaddr*)remoteInterface), htons(remoteInterface->sin6_port));
 									}
 									obj->IceStates[EncodedSlot]->hostcandidateResponseFlag[i] = 1;
+									if (useCandidate != 0 && obj->IceStates[EncodedSlot]->restartSession >= 0)
+									{
+										// The peer nominated this pair for an ICE restart
+										ILibStun_ICE_CompleteRestart(obj->IceStates[EncodedSlot], remoteInterface);
+									}
 
 									break;
 								}
 							}
 						}
+						if (i == obj->IceStates[EncodedSlot]->hostcandidatecount && obj->IceStates[EncodedSlot]->iceLite != 0 && i < ILibStun_ICE_MaxCandidates && remoteInterface->sin6_family == AF_INET)
+						{
+							// We're ICE-Lite, so we never send checks of our own. The peer may be behind a NAT, so accept the
+							// authenticated (IPv4) source as a peer reflexive candidate, otherwise DTLS from it would be refused.
+							ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "Ice Slot: %d  Peer Reflexive Candidate [%s:%u]", EncodedSlot, ILibRemoteLogging_ConvertAddress((struct sockaddr*)remoteInterface), htons(remoteInterface->sin6_port));
+							ILibStun_ICE_ResizeCandidates(obj->IceStates[EncodedSlot], i + 1);
+							obj->IceStates[EncodedSlot]->hostcandidates[i].addr = ((struct sockaddr_in*)remoteInterface)->sin_addr.s_addr;
+							obj->IceStates[EncodedSlot]->hostcandidates[i].port = remoteInterface->sin6_port;
+							obj->IceStates[EncodedSlot]->hostcandidateResponseFlag[i] = 1;
+							obj->IceStates[EncodedSlot]->hostcandidatecount++;
+							if (useCandidate != 0 && obj->IceStates[EncodedSlot]->restartSession >= 0)
+							{
+								// The peer nominated this pair for an ICE restart
+								ILibStun_ICE_CompleteRestart(obj->IceStates[EncodedSlot], remoteInterface);
+							}
+						}
 					}
 				}
 
@@ -1816,7 +2801,7 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 					((unsigned short*)(rbuffer + 20))[3] = ((struct sockaddr_in*)remoteInterface)->sin_port ^ 0x1221;					// IPv4 port
 					((unsigned int*)(rbuffer + 20))[2] = ((struct sockaddr_in*)remoteInterface)->sin_addr.s_addr ^ 0x42A41221;			// IPv4 address														
 
-					rptr += ILibStun_AddMessageIntegrityAttr(rbuffer, rptr, integritykey, 32);
+					rptr += (localIntegrity != NULL ? ILibStun_AddMessageIntegrityAttrEx(rbuffer, rptr, localIntegrity) : ILibStun_AddMessageIntegrityAttr(rbuffer, rptr, integritykey, 32));
 					rptr += ILibStun_AddFingerprint(rbuffer, rptr);												// Set the length in this function
 
 					ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_3, "...Sending Response to %s:%u", ILibRemoteLogging_ConvertAddress((struct sockaddr*)remoteInterface), ntohs(remoteInterface->sin6_port));
@@ -1833,7 +2818,7 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 					rptr = ILibTURN_GenerateStunFormattedPacketHeader(rbuffer, STUN_BINDING_ERROR_RESPONSE, buffer + 8);
 					rptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(rbuffer, rptr, STUN_ATTRIB_XOR_MAPPED_ADDRESS, address, addressLen);
 					rptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(rbuffer, rptr, STUN_ATTRIB_ERROR_CODE, errorCode, 17);
-					rptr += ILibStun_AddMessageIntegrityAttr(rbuffer, rptr, integritykey, 32);
+					rptr += (localIntegrity != NULL ? ILibStun_AddMessageIntegrityAttrEx(rbuffer, rptr, localIntegrity) : ILibStun_AddMessageIntegrityAttr(rbuffer, rptr, integritykey, 32));
 					rptr += ILibStun_AddFingerprint(rbuffer, rptr);												// Set the length in this function
 
 					ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "Responding with Role Conflict");
@@ -1856,7 +2841,7 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 				//ILibAsyncUDPSocket_SendTo(((struct ILibStun_Module*)obj)->UDP, (struct sockaddr*)remoteInterface, rbuffer, rptr, ILibAsyncSocket_MemoryOwnership_USER);
 
 				// Send an ICE request back. This is needed to unlock Chrome/Opera inbound port for TLS. Don't do more than ILibSTUN_MaxSlots of these.
-				if (obj->IceStates[EncodedSlot]->hostcandidates != NULL && obj->IceStates[EncodedSlot]->hostcandidatecount > 0)
+				if (obj->IceStates[EncodedSlot]->hostcandidates != NULL && obj->IceStates[EncodedSlot]->hostcandidatecount > 0 && obj->IceStates[EncodedSlot]->iceLite == 0)
 				{
 					if (obj->IceStates[EncodedSlot] != NULL && obj->IceStates[EncodedSlot]->requerycount < ILibSTUN_MaxSlots)
 					{
@@ -1901,10 +2886,18 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 					// We have a matching ICE Candidate and STUN Response
 					ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Candidate Match [%s:%u]", ILibRemoteLogging_ConvertAddress((struct sockaddr*)remoteInterface), htons(remoteInterface->sin6_port));
 					obj->IceStates[(int)buffer[8]]->hostcandidateResponseFlag[hx] = 1;
+
+					// Checks go out in priority order, so nominate the first pair that works instead of waiting for the rest
+					if (obj->IceStates[(int)buffer[8]]->isDoingConnectivityChecks != 0) { ILibStun_ICE_Nominate(obj->IceStates[(int)buffer[8]], (int)buffer[8], hx); }
 					break;
 				}
 			}
 		}
+		else if (obj->IceStates[(int)buffer[8]]->dtlsSession >= 0 && (unsigned char)buffer[9] == ILibStun_PathProbe_Marker)
+		{
+			// Response to one of our path probes
+			ILibStun_PathProbe_OnResponse(obj->IceStates[(int)buffer[8]], (unsigned char)buffer[10], (unsigned char)buffer[11], remoteInterface);
+		}
 
 		//// TODO: Bryan: I commented this out, because this logic will now take place during Candidate Nomination.
 		////
@@ -1951,8 +2944,7 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 
 		processed = 1;
 		// We got a response, so we can reset the timer for Freshness
-		ILibLifeTime_Remove(obj->Timer, obj->dTlsSessions[SessionSlot] + 1);
-		ILibLifeTime_Add(obj->Timer, obj->dTlsSessions[SessionSlot] + 1, ILibStun_MaxConsentFreshnessTimeoutSeconds, ILibStun_WebRTC_ConsentFreshness_Start, NULL);
+		if (obj->dTlsSessions[SessionSlot] != NULL && obj->dTlsSessions[SessionSlot]->freshnessDue != 0) { ILibStun_WebRTC_ConsentFreshness_Schedule(obj->dTlsSessions[SessionSlot]); }
 	}
 
 	if (IS_SUCCESS_RESP(messageType) && memcmp(buffer + 8, obj->TransactionId, 12) == 0) // NAT Detection Response
@@ -1987,7 +2979,7 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 			else
 			{
 				// Problem decoding the packet.
-				if (obj->OnResult != NULL) { obj->OnResult(obj, ILibStun_Results_Unknown, NULL, obj->user); }
+				ILibStun_ReportResult(obj, ILibStun_Results_Unknown, NULL);
 				ILibStun_OnCompleted(obj);
 				return 1;
 			}
@@ -1997,14 +2989,10 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 			{
 				// Check if the public IP address is one of our own.
 				struct sockaddr_in* LocalInterfaceListV4 = NULL;
-				int LocalInterfaceListV4Len = ILibGetLocalIPv4AddressList(&LocalInterfaceListV4, 0);
-				if (LocalInterfaceListV4 != NULL)
+				int LocalInterfaceListV4Len = ILibStun_GetLocalInterfaces(obj, &LocalInterfaceListV4);
+				for (i = 0; i < LocalInterfaceListV4Len; ++i)
 				{
-					for (i = 0; i < LocalInterfaceListV4Len; ++i)
-					{
-						if (((struct sockaddr_in*)&(obj->Public))->sin_addr.s_addr == ((struct sockaddr_in*)&(LocalInterfaceListV4[i]))->sin_addr.s_addr) result = 1;
-					}
-					free(LocalInterfaceListV4);
+					if (((struct sockaddr_in*)&(obj->Public))->sin_addr.s_addr == ((struct sockaddr_in*)&(LocalInterfaceListV4[i]))->sin_addr.s_addr) result = 1;
 				}
 			}
 			else
@@ -2015,14 +3003,14 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 			if (result == 1)
 			{
 				// No Nat
-				if (obj->OnResult != NULL) { obj->OnResult(obj, ILibStun_Results_No_NAT, (struct sockaddr_in*)&(obj->Public), obj->user); }
+				ILibStun_ReportResult(obj, ILibStun_Results_No_NAT, (struct sockaddr_in*)&(obj->Public));
 				ILibStun_OnCompleted(obj);
 				break;
 			}
 
 			if(NAT_MAPPING_DETECTION(obj->TransactionId)==0)
 			{
-				if (obj->OnResult != NULL) { obj->OnResult(obj, ILibStun_Results_Public_Interface, (struct sockaddr_in*)&(obj->Public), obj->user); }
+				ILibStun_ReportResult(obj, ILibStun_Results_Public_Interface, (struct sockaddr_in*)&(obj->Public));
 				ILibStun_OnCompleted(obj);
 			}
 			else if(changedAddress.sin_family == AF_INET)
@@ -2033,7 +3021,7 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 			}
 			else
 			{
-				if (obj->OnResult != NULL) { obj->OnResult(obj, ILibStun_Results_RFC5780_NOT_IMPLEMENTED, (struct sockaddr_in*)&(obj->Public), obj->user); }
+				ILibStun_ReportResult(obj, ILibStun_Results_RFC5780_NOT_IMPLEMENTED, (struct sockaddr_in*)&(obj->Public));
 				ILibStun_OnCompleted(obj);
 			}
 			break;
@@ -2042,7 +3030,7 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 			if (((struct sockaddr_in*)(&obj->Public))->sin_port == ((struct sockaddr_in*)(&obj->Public2))->sin_port)
 			{
 				// Endpoint-Independent Mapping (Full-Cone)
-				if (obj->OnResult != NULL) { obj->OnResult(obj, ILibStun_Results_Full_Cone_NAT, (struct sockaddr_in*)&(obj->Public), obj->user); }
+				ILibStun_ReportResult(obj, ILibStun_Results_Full_Cone_NAT, (struct sockaddr_in*)&(obj->Public));
 				ILibStun_OnCompleted(obj);
 			}
 			else
@@ -2059,19 +3047,19 @@ int ILibStun_ProcessStunPacket(void *j, char* buffer, int bufferLength, struct s
 			if (((struct sockaddr_in*)(&obj->Public2))->sin_port == ((struct sockaddr_in*)(&obj->Public3))->sin_port)
 			{
 				// Address Dependent Mapping
-				if (obj->OnResult != NULL) { obj->OnResult(obj, ILibStun_Results_Restricted_NAT, (struct sockaddr_in*)&(obj->Public3), obj->user); }
+				ILibStun_ReportResult(obj, ILibStun_Results_Restricted_NAT, (struct sockaddr_in*)&(obj->Public3));
 				ILibStun_OnCompleted(obj);
 			}
 			else
 			{
 				// Address and Port Dependent Mapping (Symmetric in this case)
-				if (obj->OnResult != NULL) { obj->OnResult(obj, ILibStun_Results_Symetric_NAT, (struct sockaddr_in*)&(obj->Public3), obj->user); }
+				ILibStun_ReportResult(obj, ILibStun_Results_Symetric_NAT, (struct sockaddr_in*)&(obj->Public3));
 				ILibStun_OnCompleted(obj);
 			}
 			break;
 		case STUN_STATUS_CHECKING_RESTRICTED_NAT:
 			// Restricted NAT
-			if (obj->OnResult != NULL) { obj->OnResult(obj, ILibStun_Results_Restricted_NAT, (struct sockaddr_in*)&(obj->Public), obj->user); }
+			ILibStun_ReportResult(obj, ILibStun_Results_Restricted_NAT, (struct sockaddr_in*)&(obj->Public));
 			ILibStun_OnCompleted(obj);
 			break;
 		default:
@@ -2149,7 +3137,7 @@ int ILibStun_GenerateIceRequestPacket(struct ILibStun_IceState* module, char* Pa
 
 
 	Ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(Packet, Ptr, STUN_ATTRIB_XOR_MAPPED_ADDRESS, Address, AddressLen);
-	Ptr += ILibStun_AddMessageIntegrityAttr(Packet, Ptr, module->rkey, module->rkeylen);
+	Ptr += ILibStun_AddMessageIntegrityAttrEx(Packet, Ptr, &(module->remoteIntegrity));
 	Ptr += ILibStun_AddFingerprint(Packet, Ptr);
 	free(stunUsername);
 
@@ -2220,6 +3208,84 @@ void ILibStun_DelaySendIceRequest(struct ILibStun_IceState* module, int selected
 	}
 }
 
+// Moves the DTLS session an ICE restart was for, onto the newly selected pair. DTLS, SCTP and everything queued on them carry on as before.
+// Returns 0 on success, or -1 if the session went away during the restart, in which case this offer just becomes a regular one
+int ILibStun_ICE_CompleteRestart(struct ILibStun_IceState *state, struct sockaddr_in6 *remoteInterface)
+{
+	struct ILibStun_dTlsSession *session = state->parentStunModule->dTlsSessions[state->restartSession];
+
+	if (session == NULL || (session->state != 1 && session->state != 2) || session->iceStateSlot < 0 || state->parentStunModule->IceStates[session->iceStateSlot] != state)
+	{
+		state->restartSession = -1;
+		return -1;
+	}
+
+	ILibRemoteLogging_printf(ILibChainGetLogger(state->parentStunModule->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "ICE Restart: DTLS Session %d moving to %s:%u", state->restartSession, ILibRemoteLogging_ConvertAddress((struct sockaddr*)remoteInterface), ntohs(remoteInterface->sin6_port));
+	if (memcmp(&(session->remoteInterface), remoteInterface, INET_SOCKADDR_LENGTH(remoteInterface->sin6_family)) != 0)
+	{
+		memcpy(&(session->remoteInterface), remoteInterface, INET_SOCKADDR_LENGTH(remoteInterface->sin6_family));
+		ILibSCTP_OnPathChanged(session, -1);
+	}
+	state->dtlsSession = state->restartSession;
+	state->restartSession = -1;
+	state->isDoingConnectivityChecks = 0;
+	return 0;
+}
+
+int ILibStun_GenerateIceRestartOffer(void *dtlsSession, char** offer, char* userName, char* password)
+{
+	struct ILibStun_dTlsSession *session = (struct ILibStun_dTlsSession*)dtlsSession;
+	struct ILibStun_Module *obj = session->parent;
+	struct ILibStun_IceState *ice, *old;
+	int slot = session->iceStateSlot;
+	int credentialsLength;
+
+	if ((session->state != 1 && session->state != 2) || slot < 0 || slot >= ILibSTUN_MaxSlots || (old = obj->IceStates[slot]) == NULL) { return 0; }
+
+	if ((ice = (struct ILibStun_IceState*)malloc(sizeof(struct ILibStun_IceState))) == NULL) { ILIBCRITICALEXIT(254); }
+	memset(ice, 0, sizeof(struct ILibStun_IceState));
+	util_random(8, ice->tieBreaker);
+	ice->useTurn = old->useTurn;
+	ice->parentStunModule = obj;
+	ice->creationTime = ILibGetUptime();
+	ice->dtlsSession = -1;
+	ice->restartSession = session->sessionId;
+	ice->userObject = old->userObject;
+
+	// Keep the roles of the session we are restarting
+	ice->dtlsInitiator = old->dtlsInitiator;
+	ice->peerHasActiveOffer = old->peerHasActiveOffer;
+	ice->iceLite = old->iceLite;
+
+	// Same layout as the placeholder ILibStun_GenerateIceOffer makes, followed by the peer's current credentials, so the old pair
+	// keeps passing consent checks until the peer answers
+	credentialsLength = old->rusernamelen + old->rkeylen;
+	if ((ice->offerblock = (char*)malloc(8 * sizeof(struct sockaddr_in6) + credentialsLength)) == NULL) { ILIBCRITICALEXIT(254); }
+	memset(ice->offerblock, 0, 8 * sizeof(struct sockaddr_in6));
+	if (old->rusername != NULL && old->rkey != NULL)
+	{
+		ice->rusername = ice->offerblock + 8 * sizeof(struct sockaddr_in6);
+		ice->rusernamelen = old->rusernamelen;
+		memcpy(ice->rusername, old->rusername, old->rusernamelen);
+		ice->rkey = ice->rusername + old->rusernamelen;
+		ice->rkeylen = old->rkeylen;
+		memcpy(ice->rkey, old->rkey, old->rkeylen);
+	}
+
+	// New credentials, in the same slot
+	ILibStun_GenerateUserAndKey(slot, obj->Secret, ice->userAndKey);
+	ILibStun_IceState_InitIntegrity(ice);
+	obj->IceStates[slot] = ice;
+	ILibStun_FreeIceState(old);
+
+	memcpy(userName, ice->userAndKey + 1, ice->userAndKey[0]);
+	memcpy(password, ice->userAndKey + ice->userAndKey[0] + 2, ice->userAndKey[ice->userAndKey[0] + 1]);
+	userName[(int)ice->userAndKey[0]] = 0;
+	password[(int)ice->userAndKey[(int)ice->userAndKey[0] + 1]] = 0;
+
+	return ILibStun_WebRTC_UpdateOfferResponse(ice, offer);
+}
+
 int ILibStun_GenerateIceOffer(void* StunModule, char** offer, char* userName, char* password)
 {
 	int slot;
@@ -2233,9 +3299,17 @@ int ILibStun_GenerateIceOffer(void* StunModule, char** offer, char* userName, ch
 	ice->useTurn = obj->alwaysUseTurn;
 	ice->parentStunModule = obj;
 	ice->creationTime = ILibGetUptime();
+	ice->restartSession = -1;
 	if ((ice->offerblock = (char*)malloc(8 * sizeof(struct sockaddr_in6))) == NULL){ ILIBCRITICALEXIT(254); }
 	ice->peerHasActiveOffer = 0;
 	ice->dtlsInitiator = 1;
+	if (obj->iceLite != 0)
+	{
+		// ICE-Lite is always CONTROLLED, so we'll offer to be the DTLS server, and let the peer do the checks and initiate
+		ice->peerHasActiveOffer = 1;
+		ice->dtlsInitiator = 0;
+		ice->iceLite = 1;
+	}
 	memset(ice->offerblock, 0, 8 * sizeof(struct sockaddr_in6));
 	slot = ILibStun_GetFreeIceStateSlot(obj, ice, NULL, 0);
 
@@ -2250,6 +3324,7 @@ int ILibStun_GenerateIceOffer(void* StunModule, char** offer, char* userName, ch
 	// Encoding the slot number into the user name, so we can do some processing when we receive ICE requests
 	ILibStun_GenerateUserAndKey(slot, obj->Secret, userAndKey);
 	memcpy(ice->userAndKey, userAndKey, 43);
+	ILibStun_IceState_InitIntegrity(ice);
 	memcpy(userName, userAndKey + 1, userAndKey[0]);
 	memcpy(password, userAndKey + userAndKey[0] + 2, userAndKey[userAndKey[0] + 1]);
 	userName[(int)userAndKey[0]] = 0;
@@ -2258,6 +3333,37 @@ int ILibStun_GenerateIceOffer(void* StunModule, char** offer, char* userName, ch
 	return ILibStun_WebRTC_UpdateOfferResponse(ice, offer);
 }
 
+void ILibStun_ICE_Nominate(struct ILibStun_IceState *state, int iceSlot, int candidateIndex)
+{
+	struct sockaddr_in dest;
+
+	state->isDoingConnectivityChecks = 0;
+	state->nominated = 1;
+
+	memset(&dest, 0, sizeof(struct sockaddr_in));
+	dest.sin_family = AF_INET;
+	dest.sin_port = state->hostcandidates[candidateIndex].port;
+	dest.sin_addr.s_addr = state->hostcandidates[candidateIndex].addr;
+	ILibRemoteLogging_printf(ILibChainGetLogger(state->parentStunModule->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "IceSlot: %d Nominating: %s:%u", iceSlot, ILibRemoteLogging_ConvertAddress((struct sockaddr*)&dest), ntohs(dest.sin_port));
+	ILibStun_SendIceRequest(state, iceSlot, 1, (struct sockaddr_in6*)&dest);
+
+	if (state->restartSession >= 0 && ILibStun_ICE_CompleteRestart(state, (struct sockaddr_in6*)&dest) == 0)
+	{
+		// ICE restart, the DTLS session we already have just moves to this pair
+	}
+	else if (state->dtlsInitiator != 0)
+	{
+		// Simultaneously initiate DTLS
+		ILibRemoteLogging_printf(ILibChainGetLogger(state->parentStunModule->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Initiating DTLS to: %s:%u", ILibRemoteLogging_ConvertAddress((struct sockaddr*)&dest), ntohs(dest.sin_port));
+		ILibStun_InitiateDTLS(state, iceSlot, (struct sockaddr_in6*)&dest);
+	}
+	else
+	{
+		// We are DTLS Server, not Client
+		ILibRemoteLogging_printf(ILibChainGetLogger(state->parentStunModule->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Waiting for DTLS from: %s:%u", ILibRemoteLogging_ConvertAddress((struct sockaddr*)&dest), ntohs(dest.sin_port));
+	}
+}
+
 void ILibStun_ICE_FinalizeConnectivityChecks(void *object)
 {
 	struct ILibStun_Module* obj = (struct ILibStun_Module*)object - 1;
@@ -2265,6 +3371,7 @@ void ILibStun_ICE_FinalizeConnectivityChecks(void *object)
 	int x;
 	
 	// Go through each ICE offer that is saved, and find the ones that were doing ICE Connectivity Checks, and finalize all of them
+	// Normally a pair was already nominated when its first response came back, so this only catches the stragglers
 	for (i = 0; i < ILibSTUN_MaxSlots; ++i)
 	{
 		if (obj->IceStates[i] != NULL && obj->IceStates[i]->isDoingConnectivityChecks != 0)
@@ -2279,25 +3386,7 @@ void ILibStun_ICE_FinalizeConnectivityChecks(void *object)
 					if (obj->IceStates[i]->peerHasActiveOffer == 0)
 					{
 						// Since this list is in priority order, we'll nominate the highest priority candidate that received a response
-						struct sockaddr_in dest;
-
-						memset(&dest, 0, sizeof(struct sockaddr_in));
-						dest.sin_family = AF_INET;
-						dest.sin_port = obj->IceStates[i]->hostcandidates[x].port;
-						dest.sin_addr.s_addr = obj->IceStates[i]->hostcandidates[x].addr;
-						ILibStun_SendIceRequest(obj->IceStates[i], i, 1, (struct sockaddr_in6*)&dest);
-
-						if (obj->IceStates[i]->dtlsInitiator != 0)
-						{
-							// Simultaneously initiate DTLS
-							ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Initiating DTLS to: %s:%u", ILibRemoteLogging_ConvertAddress((struct sockaddr*)&dest), ntohs(dest.sin_port));
-							ILibStun_InitiateDTLS(obj->IceStates[i], i, (struct sockaddr_in6*)&dest);
-						}
-						else
-						{
-							// We are DTLS Server, not Client
-							ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Waiting for DTLS from: %s:%u", ILibRemoteLogging_ConvertAddress((struct sockaddr*)&dest), ntohs(dest.sin_port));
-						}
+						ILibStun_ICE_Nominate(obj->IceStates[i], i, x);
 						break;
 					}
 				}
@@ -2306,6 +3395,76 @@ void ILibStun_ICE_FinalizeConnectivityChecks(void *object)
 	}
 }
 
+// Moves the candidate arrays into their own block, with room for newCount candidates. The check counts are only kept here.
+void ILibStun_ICE_ResizeCandidates(struct ILibStun_IceState *state, int newCount)
+{
+	char *block;
+	int count = state->hostcandidatecount;
+
+	if ((block = (char*)malloc(newCount * (sizeof(struct ILibStun_IceStateCandidate) + 2))) == NULL) ILIBCRITICALEXIT(254);
+	memset(block, 0, newCount * (sizeof(struct ILibStun_IceStateCandidate) + 2));
+	if (count > 0)
+	{
+		memcpy(block, state->hostcandidates, count * sizeof(struct ILibStun_IceStateCandidate));
+		memcpy(block + (newCount * sizeof(struct ILibStun_IceStateCandidate)), state->hostcandidateResponseFlag, count);
+		if (state->hostcandidateCheckCount != NULL) { memcpy(block + (newCount * (sizeof(struct ILibStun_IceStateCandidate) + 1)), state->hostcandidateCheckCount, count); }
+	}
+
+	if (state->candidateblock != NULL) { free(state->candidateblock); }
+	state->candidateblock = block;
+	state->hostcandidates = (struct ILibStun_IceStateCandidate*)block;
+	state->hostcandidateResponseFlag = block + (newCount * sizeof(struct ILibStun_IceStateCandidate));
+	state->hostcandidateCheckCount = block + (newCount * (sizeof(struct ILibStun_IceStateCandidate) + 1));
+}
+
+void ILibStun_ICE_OnPacingTick(void *object)
+{
+	struct ILibStun_Module *obj = (struct ILibStun_Module*)((char*)object - 2);
+	struct ILibStun_IceState *state;
+	struct sockaddr_in dest;
+	int i, n, c, x;
+
+	obj->iceCheckPacing = 0;
+
+	// Only one check goes out per Ta, taken Round Robin from the IceStates that are doing connectivity checks
+	for (n = 0; n < ILibSTUN_MaxSlots; ++n)
+	{
+		i = (obj->iceCheckNextSlot + n) % ILibSTUN_MaxSlots;
+		state = obj->IceStates[i];
+		if (state == NULL || state->isDoingConnectivityChecks == 0 || state->dtlsSession >= 0 || state->hostcandidateCheckCount == NULL) { continue; }
+
+		// Pick the highest priority candidate that was checked the least, skipping the ones that already responded.
+		// This way every candidate gets its first check before any gets a second, and trickled candidates jump the queue.
+		x = -1;
+		for (c = 0; c < state->hostcandidatecount; ++c)
+		{
+			if (state->hostcandidateResponseFlag[c] == 0 && state->hostcandidateCheckCount[c] < ILibStun_ICE_ChecksPerCandidate && (x < 0 || state->hostcandidateCheckCount[c] < state->hostcandidateCheckCount[x])) { x = c; }
+		}
+		if (x < 0) { continue; }
+
+		state->hostcandidateCheckCount[x]++;
+		memset(&dest, 0, sizeof(struct sockaddr_in));
+		dest.sin_family = AF_INET;
+		dest.sin_port = state->hostcandidates[x].port;
+		dest.sin_addr.s_addr = state->hostcandidates[x].addr;
+
+		ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "IceSlot: %d Sending ICE Request to: %s:%u [Controlling: %s]", i, ILibRemoteLogging_ConvertAddress((struct sockaddr*)&dest), ntohs(dest.sin_port), state->peerHasActiveOffer == 0 ? "YES" : "NO");
+		ILibStun_SendIceRequest(state, i, 0, (struct sockaddr_in6*)&dest);
+
+		obj->iceCheckNextSlot = i + 1;
+		obj->iceCheckPacing = 1;
+		ILibLifeTime_AddEx(obj->Timer, (char*)obj + 2, ILibStun_ICE_Ta, ILibStun_ICE_OnPacingTick, NULL);
+		break;
+	}
+}
+
+void ILibStun_ICE_PaceChecks(struct ILibStun_Module *obj)
+{
+	if (obj->iceCheckPacing != 0) { return; } // Already running, it will pick up the new work
+	obj->iceCheckPacing = 1;
+	ILibLifeTime_AddEx(obj->Timer, (char*)obj + 2, 0, ILibStun_ICE_OnPacingTick, NULL);
+}
+
 void ILibStun_PeriodicStunCheckEx(void *obj)
 {
 	ILibStun_PeriodicStunCheck((struct ILibStun_Module*)obj - 3);
@@ -2320,7 +3479,7 @@ void ILibStun_PeriodicStunCheck(struct ILibStun_Module* obj)
 
 	for (i = 0; i < ILibSTUN_MaxSlots; ++i)
 	{
-		if (obj->IceStates[i] != NULL && obj->IceStates[i]->hostcandidates != NULL && obj->IceStates[i]->dtlsSession < 0 && ((ILibGetUptime() - obj->IceStates[i]->creationTime) < ILibSTUN_MaxOfferAgeSeconds * 1000))
+		if (obj->IceStates[i] != NULL && obj->IceStates[i]->hostcandidates != NULL && obj->IceStates[i]->dtlsSession < 0 && obj->IceStates[i]->iceLite == 0 && ((ILibGetUptime() - obj->IceStates[i]->creationTime) < ILibSTUN_MaxOfferAgeSeconds * 1000))
 		{
 			// We will only do periodic stuns for IceOffers that don't have DTLS sessions associated, and are not expired
 			ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_4, "PeriodicStun for IceStateSlot[%d]", i);
@@ -2347,11 +3506,14 @@ void ILibStun_ICE_Start(struct ILibStun_IceState *state, int SelectedSlot)
 		ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "Starting Connectivity Checks...");
 		// Since we're not a STUN-LITE implementation, we need to perform connectivity checks
 		// We'll only do this, if we're the initiator and the peer is passive
+		if (state->hostcandidateCheckCount == NULL) { ILibStun_ICE_ResizeCandidates(state, state->hostcandidatecount); }
+		memset(state->hostcandidateCheckCount, 0, state->hostcandidatecount);
+		state->nominated = 0;
 		state->isDoingConnectivityChecks = 1;
-		ILibStun_DelaySendIceRequest(state, SelectedSlot, 0);
+		ILibStun_ICE_PaceChecks(obj);
 
-		// All of these packets are distributed within a 500ms window. 
-		// We'll set a timer for 3 seconds, to finalize the connectivity check
+		// The checks are paced Ta apart, and the first pair to respond is nominated right away.
+		// We'll still set a timer for 3 seconds, to finalize the connectivity check if that didn't happen
 		// The timer is set on the stunModule, so we don't have a race condition if the ice offer is updated/deleted during
 		// these 3 seconds.
 		ILibLifeTime_Add(obj->Timer, obj + 1, 3, ILibStun_ICE_FinalizeConnectivityChecks, NULL);
@@ -2359,8 +3521,8 @@ void ILibStun_ICE_Start(struct ILibStun_IceState *state, int SelectedSlot)
 	else
 	{
 		ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "Skipping Connectivity Checks...");
-		// We are CONTROLLED, so we just need to start the Periodic ICE Request Packets
-		ILibStun_PeriodicStunCheck(obj);
+		// We are CONTROLLED, so we just need to start the Periodic ICE Request Packets (ICE-Lite doesn't send any)
+		if (state->iceLite == 0) { ILibStun_PeriodicStunCheck(obj); }
 	}
 }
 
@@ -2370,30 +3532,14 @@ void ILibStun_SetIceOffer2_TURN_CreatePermissionResponse(ILibTURN_ClientModule t
 	struct ILibStun_Module* obj = (struct ILibStun_Module*)ILibTURN_GetTag(turnModule);
 	struct ILibStun_IceState* state = obj->IceStates[SelectedSlot];
 
-	if (success != 0)
+	if (success != 0 && state != NULL)
 	{
-		if (state->peerHasActiveOffer == 0)
-		{
-			// Since we're not a STUN-LITE implementation, we need to perform connectivity checks
-			// We'll only do this, if we're the initiator and the peer is passive
-			state->isDoingConnectivityChecks = 1;
-			ILibStun_DelaySendIceRequest(state, SelectedSlot, 0);
-
-			// All of these packets are distributed within a 500ms window. 
-			// We'll set a timer for 3 seconds, to finalize the connectivity check
-			// The timer is set on the stunModule, so we don't have a race condition if the ice offer is updated/deleted during
-			// these 3 seconds.
-			ILibLifeTime_Add(obj->Timer, obj + 1, 3, ILibStun_ICE_FinalizeConnectivityChecks, NULL);
-		}
-		else
-		{
-			// We are CONTROLLED, so we just need to start the Periodic ICE Request Packets
-			ILibStun_PeriodicStunCheck(obj);
-		}
+		ILibStun_ICE_Start(state, SelectedSlot);
 	}
 }
 
-int ILibStun_SetIceOffer2(void *StunModule, char* iceOffer, int iceOfferLen, char *username, int usernameLength, char* password, int passwordLength, char** answer)
+// restartSession is the DTLS session the offer is an ICE restart for, or -1
+int ILibStun_SetIceOfferEx(void *StunModule, char* iceOffer, int iceOfferLen, char *username, int usernameLength, char* password, int passwordLength, int restartSession, char** answer)
 {
 	int generateUserAndKey = 1;
 	struct ILibStun_Module* obj = (struct ILibStun_Module*)StunModule;
@@ -2443,7 +3589,19 @@ int ILibStun_SetIceOffer2(void *StunModule, char* iceOffer, int iceOfferLen, cha
 	state->dtlsInitiator = ((state->blockflags & ILibWebRTC_SDP_Flags_DTLS_SERVER) == ILibWebRTC_SDP_Flags_DTLS_SERVER ? 1 : 0);
 	state->parentStunModule = obj;
 	state->dtlsSession = -1;
+	state->restartSession = -1;
 	state->creationTime = ILibGetUptime();
+	if (obj->iceLite != 0)
+	{
+		// We can only be ICE-Lite if the peer is going to be CONTROLLING. If the peer insists on being the DTLS server, we do full ICE for this offer.
+		state->iceLite = state->peerHasActiveOffer != 0 ? 1 : 0;
+		if (state->iceLite == 0) { ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Peer is passive, using Full ICE instead of ICE-Lite"); }
+	}
+	if (state->iceLite == 0 && (state->blockflags & ILibWebRTC_SDP_Flags_ICE_LITE) == ILibWebRTC_SDP_Flags_ICE_LITE)
+	{
+		// An ICE-Lite peer never sends checks of its own, so we have to be CONTROLLING, whichever side is the DTLS server (RFC 8445 6.1.1)
+		state->peerHasActiveOffer = 0;
+	}
 
 	ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Remote is: [%d] %s", state->blockflags, state->peerHasActiveOffer != 0 ? "Initiator" : "Receiver");
 	ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Certificate: %s", ILibRemoteLogging_ConvertToHex(state->dtlscerthash, state->dtlscerthashlen));
@@ -2460,6 +3618,11 @@ int ILibStun_SetIceOffer2(void *StunModule, char* iceOffer, int iceOfferLen, cha
 		state->userAndKey[1 + usernameLength] = (char)passwordLength;
 		memcpy(state->userAndKey + 2 + usernameLength, password, passwordLength);
 	}
+	else if (restartSession >= 0)
+	{
+		// An ICE restart stays in the slot of the session it is for, but with new credentials
+		ILibStun_GenerateUserAndKey(obj->dTlsSessions[restartSession]->iceStateSlot, obj->Secret, state->userAndKey);
+	}
 
 	SelectedSlot = ILibStun_GetFreeIceStateSlot(obj, state, &oldState, 1);
 	if (SelectedSlot < 0)
@@ -2504,10 +3667,20 @@ int ILibStun_SetIceOffer2(void *StunModule, char* iceOffer, int iceOfferLen, cha
 				}
 			}
 			// We need to copy UserAndKey, because we will be using the same username and password
-			memcpy(state->userAndKey, oldState->userAndKey, sizeof(state->userAndKey));
+			if (restartSession < 0) { memcpy(state->userAndKey, oldState->userAndKey, sizeof(state->userAndKey)); }
 			generateUserAndKey = 0;
-			free(oldState->offerblock);
-			free(oldState);
+
+			// Carry an ICE restart through from the offer we generated, to the answer we are now setting
+			state->restartSession = restartSession >= 0 ? restartSession : oldState->restartSession;
+			if (state->restartSession >= 0)
+			{
+				// DTLS roles can't change without a new handshake, so whatever the peer put in the offer, ICE roles stay as they were
+				state->userObject = oldState->userObject;
+				state->dtlsInitiator = oldState->dtlsInitiator;
+				state->peerHasActiveOffer = oldState->peerHasActiveOffer;
+				state->iceLite = oldState->iceLite;
+			}
+			ILibStun_FreeIceState(oldState);
 			oldState = NULL;
 		}
 	}
@@ -2516,6 +3689,7 @@ int ILibStun_SetIceOffer2(void *StunModule, char* iceOffer, int iceOfferLen, cha
 	{
 		ILibStun_GenerateUserAndKey(SelectedSlot, obj->Secret, state->userAndKey); // We are going to encode the slot number in the username
 	}
+	ILibStun_IceState_InitIntegrity(state);
 
 	// Generate an return answer
 	rlen = ILibStun_WebRTC_UpdateOfferResponse(state, answer);
@@ -2546,6 +3720,32 @@ int ILibStun_SetIceOffer2(void *StunModule, char* iceOffer, int iceOfferLen, cha
 	return rlen;
 }
 
+int ILibStun_SetIceOffer2(void *StunModule, char* iceOffer, int iceOfferLen, char *username, int usernameLength, char* password, int passwordLength, char** answer)
+{
+	return ILibStun_SetIceOfferEx(StunModule, iceOffer, iceOfferLen, username, usernameLength, password, passwordLength, -1, answer);
+}
+
+int ILibStun_SetIceRestartOffer(void *dtlsSession, char* iceOffer, int iceOfferLen, char** answer)
+{
+	struct ILibStun_dTlsSession *session = (struct ILibStun_dTlsSession*)dtlsSession;
+
+	if ((session->state != 1 && session->state != 2) || session->iceStateSlot < 0 || session->iceStateSlot >= ILibSTUN_MaxSlots || session->parent->IceStates[session->iceStateSlot] == NULL) { return 0; }
+	return ILibStun_SetIceOfferEx(session->parent, iceOffer, iceOfferLen, NULL, 0, NULL, 0, session->sessionId, answer);
+}
+
+// Only new credentials from the peer mean it is restarting ICE. A repeated or updated offer with the same ufrag/pwd is not a restart
+int ILibStun_IsIceRestartOffer(void *dtlsSession, char* iceOffer, int iceOfferLen)
+{
+	struct ILibStun_dTlsSession *session = (struct ILibStun_dTlsSession*)dtlsSession;
+	struct ILibStun_IceState *state;
+	int usernameLen, passwordLen;
+
+	if (session->iceStateSlot < 0 || session->iceStateSlot >= ILibSTUN_MaxSlots || (state = session->parent->IceStates[session->iceStateSlot]) == NULL || state->rusername == NULL || state->rkey == NULL) { return 0; }
+	if (iceOfferLen < 8 || (usernameLen = iceOffer[6]) < 0 || 8 + usernameLen > iceOfferLen || (passwordLen = iceOffer[7 + usernameLen]) < 0 || 8 + usernameLen + passwordLen > iceOfferLen) { return 0; }
+
+	return (usernameLen != state->rusernamelen || passwordLen != state->rkeylen || memcmp(iceOffer + 7, state->rusername, usernameLen) != 0 || memcmp(iceOffer + 8 + usernameLen, state->rkey, passwordLen) != 0);
+}
+
 // Decode and save an ICE offer block, then return an answer block
 int ILibStun_SetIceOffer(void* StunModule, char* iceOffer, int iceOfferLen, char** answer)
 {
@@ -2554,6 +3754,15 @@ int ILibStun_SetIceOffer(void* StunModule, char* iceOffer, int iceOfferLen, char
 	return ILibStun_SetIceOffer2(StunModule, iceOffer, iceOfferLen, NULL, 0, NULL, 0, answer);
 }
 
+void ILibWebRTC_SetIceLite(void *stunModule, int enabled)
+{
+	struct ILibStun_Module *obj = (struct ILibStun_Module*)stunModule;
+
+	// Only affects offers that are generated/set after this call. The full agent does consent freshness for the both of us,
+	// and the SCTP heartbeats still detect a peer that went away.
+	obj->iceLite = enabled;
+}
+
 void ILibORTC_SetRemoteParameters(void* stunModule, char *username, int usernameLen, char *password, int passwordLen, char *certHash, int certHashLen, char *localUserName)
 {
 	// Generate a pseudo WebRTC Offer
@@ -2589,20 +3798,90 @@ void ILibORTC_SetRemoteParameters(void* stunModule, char *username, int username
 	free(answer);
 }
 
-void ILibORTC_AddCandidate(void *stunModule, char* localUsername, struct sockaddr_in6 *candidate)
+// Starts checking a candidate that was trickled in after the offer was set
+void ILibORTC_CheckNewCandidate(struct ILibStun_IceState *state, int slot, int candidateIndex)
 {
-	int slot = ILibStun_CharToSlot(localUsername[0]);
-
-	if (slot < 0 || slot > ILibSTUN_MaxSlots) { ILibRemoteLogging_printf(ILibChainGetLogger(((struct ILibStun_Module*)stunModule)->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "ILibORTC_AddCandidate called with invalid local username"); return; }
-	ILibRemoteLogging_printf(ILibChainGetLogger(((struct ILibStun_Module*)stunModule)->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "ILibORTC_AddCandidate: %s", ILibRemoteLogging_ConvertAddress((struct sockaddr*)candidate));
-	
-
-}
+	struct ILibStun_Module *obj = state->parentStunModule;
+	struct sockaddr_in dest;
 
-ILibTransport_DoneState ILibStun_SendDtls(struct ILibStun_Module *obj, int session, char* buffer, int bufferLength)
-{
-	ILibTransport_DoneState r = ILibTransport_DoneState_ERROR;
-	char exBuffer[4096];
+	if (state->dtlsSession >= 0 || state->iceLite != 0) { return; }
+	if (state->peerHasActiveOffer == 0)
+	{
+		// We are CONTROLLING. If nothing was nominated yet, the pacing timer will check this candidate next
+		if (state->nominated != 0) { return; }
+		if (state->isDoingConnectivityChecks == 0)
+		{
+			state->isDoingConnectivityChecks = 1;
+			ILibLifeTime_Remove(obj->Timer, obj + 1);
+			ILibLifeTime_Add(obj->Timer, obj + 1, 3, ILibStun_ICE_FinalizeConnectivityChecks, NULL);
+		}
+		ILibStun_ICE_PaceChecks(obj);
+	}
+	else
+	{
+		// We are CONTROLLED, so just open the path now. The Periodic ICE Requests will include it from here on
+		memset(&dest, 0, sizeof(struct sockaddr_in));
+		dest.sin_family = AF_INET;
+		dest.sin_port = state->hostcandidates[candidateIndex].port;
+		dest.sin_addr.s_addr = state->hostcandidates[candidateIndex].addr;
+		ILibStun_SendIceRequest(state, slot, 0, (struct sockaddr_in6*)&dest);
+		ILibStun_PeriodicStunCheck(obj);
+	}
+}
+
+void ILibORTC_AddCandidate_TURN_CreatePermissionResponse(ILibTURN_ClientModule turnModule, int success, void *user)
+{
+	int slot = (int)(uintptr_t)user & 0xFF;
+	int candidateIndex = (int)(uintptr_t)user >> 8;
+	struct ILibStun_Module* obj = (struct ILibStun_Module*)ILibTURN_GetTag(turnModule);
+
+	if (success != 0 && obj->IceStates[slot] != NULL && candidateIndex < obj->IceStates[slot]->hostcandidatecount)
+	{
+		ILibORTC_CheckNewCandidate(obj->IceStates[slot], slot, candidateIndex);
+	}
+}
+
+// Adds a remote candidate to an offer that was already set (Trickle ICE). Only IPv4 candidates are supported.
+void ILibORTC_AddCandidate(void *stunModule, char* localUsername, struct sockaddr_in6 *candidate)
+{
+	struct ILibStun_Module* obj = (struct ILibStun_Module*)stunModule;
+	struct ILibStun_IceState *state;
+	int slot = ILibStun_CharToSlot(localUsername[0]);
+	int i;
+
+	if (slot < 0 || slot >= ILibSTUN_MaxSlots) { ILibRemoteLogging_printf(ILibChainGetLogger(((struct ILibStun_Module*)stunModule)->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "ILibORTC_AddCandidate called with invalid local username"); return; }
+	ILibRemoteLogging_printf(ILibChainGetLogger(((struct ILibStun_Module*)stunModule)->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "ILibORTC_AddCandidate: %s", ILibRemoteLogging_ConvertAddress((struct sockaddr*)candidate));
+	
+	state = obj->IceStates[slot];
+	if (state == NULL || state->rkey == NULL || candidate->sin6_family != AF_INET) { return; } // Remote offer must be set first
+	if (state->hostcandidatecount >= ILibStun_ICE_MaxCandidates) { return; }
+
+	for (i = 0; i < state->hostcandidatecount; ++i)
+	{
+		if (state->hostcandidates[i].addr == ((struct sockaddr_in*)candidate)->sin_addr.s_addr && state->hostcandidates[i].port == candidate->sin6_port) { return; } // Already have it
+	}
+
+	// Trickled candidates are appended, so they rank below the ones that were in the offer
+	ILibStun_ICE_ResizeCandidates(state, state->hostcandidatecount + 1);
+	state->hostcandidates[state->hostcandidatecount].addr = ((struct sockaddr_in*)candidate)->sin_addr.s_addr;
+	state->hostcandidates[state->hostcandidatecount].port = candidate->sin6_port;
+	state->hostcandidatecount++;
+
+	if (state->useTurn != 0)
+	{
+		// Same as the initial offer, we can't send anything until the TURN server lets it through
+		ILibTURN_CreatePermission(obj->mTurnClientModule, candidate, 1, ILibORTC_AddCandidate_TURN_CreatePermissionResponse, (void*)(uintptr_t)(slot | ((state->hostcandidatecount - 1) << 8)));
+	}
+	else
+	{
+		ILibORTC_CheckNewCandidate(state, slot, state->hostcandidatecount - 1);
+	}
+}
+
+ILibTransport_DoneState ILibStun_SendDtls(struct ILibStun_Module *obj, int session, char* buffer, int bufferLength)
+{
+	ILibTransport_DoneState r = ILibTransport_DoneState_ERROR;
+	char exBuffer[4096];
 	int j;
 	if (obj == NULL || session < 0 || session > (ILibSTUN_MaxSlots-1) || obj->dTlsSessions[session] == NULL || SSL_state(obj->dTlsSessions[session]->ssl) != 3) return ILibTransport_DoneState_ERROR;
 
@@ -2677,6 +3956,13 @@ int ILibStun_SctpAddSackChunk(struct ILibStun_Module *obj, int session, char* pa
 	unsigned int tsn = obj->dTlsSessions[session]->intsn;
 	unsigned int bytecount = 0;
 
+	// This SACK covers everything received so far, so the Delayed ACK timer is no longer needed
+	if (obj->dTlsSessions[session]->delayedAckCount > 0)
+	{
+		obj->dTlsSessions[session]->delayedAckCount = 0;
+		ILibLifeTime_Remove(obj->Timer, ILibWebRTC_DTLS_TO_SACK_TIMER_OBJECT(obj->dTlsSessions[session]));
+	}
+
 	// Skip all packets with a low TSN. We do ths bacause we have not processed them yet, but will after adding this SACK
 	void *node = ILibLinkedList_GetNode_Head(obj->dTlsSessions[session]->receiveHoldBuffer);
 	while(node!=NULL && ntohl(((ILibSCTP_DataPayload*)ILibLinkedList_GetDataFromNode(node))->TSN) <= obj->dTlsSessions[session]->userTSN)
@@ -2725,7 +4011,84 @@ int ILibStun_SctpAddSackChunk(struct ILibStun_Module *obj, int session, char* pa
 	return (ptr + clen);
 }
 
-ILibTransport_DoneState ILibStun_SctpSendDataEx(struct ILibStun_Module *obj, int session, unsigned char flags, unsigned short streamid, unsigned short streamnum, int pid, char* data, int datalen)
+// Starts (or restarts) the T3-RTX timer, so that it expires RTO milliseconds after 'time'
+void ILibSCTP_T3RTX_Start(struct ILibStun_dTlsSession *o, unsigned int time)
+{
+	unsigned int expiry = time + (unsigned int)o->RTO;
+	int delay;
+
+	o->T3RTXTIME = time;
+	if (o->T3RTXExpiry != 0)
+	{
+		// If the timer will fire at (or before) the new expiry, leave it alone, it will re-arm itself for the remainder
+		if ((int)(expiry - o->T3RTXExpiry) >= 0) return;
+		ILibLifeTime_Remove(o->parent->Timer, ILibWebRTC_DTLS_TO_T3RTX_TIMER_OBJECT(o));
+	}
+
+	delay = (int)(expiry - (unsigned int)ILibGetUptime());
+	o->T3RTXExpiry = expiry != 0 ? expiry : 1;
+	ILibLifeTime_AddEx(o->parent->Timer, ILibWebRTC_DTLS_TO_T3RTX_TIMER_OBJECT(o), delay > 0 ? delay : 0, &ILibStun_SctpOnT3RTX, NULL);
+}
+
+// Stops the T3-RTX timer, because all outstanding data has been acknowledged
+void ILibSCTP_T3RTX_Stop(struct ILibStun_dTlsSession *o)
+{
+	o->T3RTXTIME = 0;
+	if (o->T3RTXExpiry != 0)
+	{
+		o->T3RTXExpiry = 0;
+		ILibLifeTime_Remove(o->parent->Timer, ILibWebRTC_DTLS_TO_T3RTX_TIMER_OBJECT(o));
+	}
+}
+
+// The association moved to a different candidate pair. What congestion control learned about the old path doesn't apply to the new one,
+// so start over from the initial window, and re-estimate RTT (RFC4960 7.2.1 / 6.3.1). SSTHRESH is kept, so slow start quickly gets back
+// to where the old path was, if the new one can take it. 'rtt' is the path probe RTT of the new pair, or -1 if there isn't one.
+void ILibSCTP_OnPathChanged(struct ILibStun_dTlsSession *o, int rtt)
+{
+	sem_wait(&(o->Lock));
+	o->congestionWindowSize = 4 * ILibRUDP_StartMTU;
+	o->senderCredits = MIN(o->senderCredits, o->congestionWindowSize);
+	o->PARTIAL_BYTES_ACKED = 0;
+	o->FastRetransmitExitPoint = 0;
+	if (rtt >= 0)
+	{
+		// Treat it as the first RTT measurement
+		o->SRTT = rtt;
+		o->RTTVAR = rtt / 2;
+		o->RTO = o->SRTT + 4 * o->RTTVAR;
+	}
+	else
+	{
+		o->RTO = RTO_INITIAL;
+	}
+	if (o->RTO < o->parent->rtoMin) { o->RTO = o->parent->rtoMin; }
+	if (o->RTO > o->parent->rtoMax) { o->RTO = o->parent->rtoMax; }
+#ifdef _WEBRTCDEBUG
+	if (o->onCongestionWindowSizeChanged != NULL) { o->onCongestionWindowSizeChanged(o, "OnCongestionWindowSizeChanged", o->congestionWindowSize); }
+#endif
+	sem_post(&(o->Lock));
+}
+
+// Copies 'length' bytes, starting 'offset' bytes into the I/O vector, into 'dest'
+void ILibSCTP_GatherIOVector(char* dest, const struct iovec* vec, int vecCount, int offset, int length)
+{
+	int i = 0, len;
+
+	// Skip over the buffers that are entirely before the offset
+	while (i < vecCount && offset >= (int)vec[i].iov_len) { offset -= (int)vec[i].iov_len; ++i; }
+	while (length > 0 && i < vecCount)
+	{
+		len = MIN((int)vec[i].iov_len - offset, length);
+		memcpy(dest, (char*)vec[i].iov_base + offset, len);
+		dest += len;
+		length -= len;
+		offset = 0;
+		++i;
+	}
+}
+
+ILibTransport_DoneState ILibStun_SctpSendDataEx(struct ILibStun_Module *obj, int session, unsigned char flags, unsigned short streamid, unsigned short streamnum, int pid, const struct iovec* vec, int vecCount, int offset, int datalen)
 {
 	int len;
 	int rptr = sizeof(char*) + 8 + 12;
@@ -2750,11 +4113,14 @@ ILibTransport_DoneState ILibStun_SctpSendDataEx(struct ILibStun_Module *obj, int
 	((unsigned short*)(rpacket + rptr + 8))[0] = htons(streamid);												// Stream Identifier
 	((unsigned short*)(rpacket + rptr + 10))[0] = htons(streamnum);												// Stream Sequence Number
 	((unsigned int*)(rpacket + rptr + 12))[0] = htonl(pid);														// Payload Protocol Identifier
-	memcpy(rpacket + rptr + 16, data, datalen);																	// Copy the user data
+	ILibSCTP_GatherIOVector(rpacket + rptr + 16, vec, vecCount, offset, datalen);								// Copy the user data
 	rptr += (16 + datalen);
 
 	RCTPDEBUG(printf("OUT DATA_CHUNK FLAGS: %d, TSN: %u, ID: %d, SEQ: %d, PID: %u, SIZE: %d\r\n", flags, tsn, streamid, streamnum, pid, datalen);)
 
+	// This chunk counts against the stream's Buffered Amount, until it is acknowledged by the peer. DCEP (PID 50) isn't application data, so it doesn't
+	if (pid != 50) { ILibSCTP_StreamValue_Set(obj->dTlsSessions[session]->DataChannelBufferedAmount, streamid, ILibSCTP_StreamValue_Get(obj->dTlsSessions[session]->DataChannelBufferedAmount, streamid) + datalen); }
+
 	// Check the credits
 	if ((obj->dTlsSessions[session]->receiverCredits < datalen) || datalen > obj->dTlsSessions[session]->senderCredits || (obj->dTlsSessions[session]->holdingCount != 0))
 	{
@@ -2776,7 +4142,7 @@ ILibTransport_DoneState ILibStun_SctpSendDataEx(struct ILibStun_Module *obj, int
 	if (obj->dTlsSessions[session]->T3RTXTIME == 0)
 	{
 		// Only set the T3RTX timer if it is not already running
-		obj->dTlsSessions[session]->T3RTXTIME = ((unsigned int*)(rpacket + sizeof(char*)))[1];
+		ILibSCTP_T3RTX_Start(obj->dTlsSessions[session], ((unsigned int*)(rpacket + sizeof(char*)))[1]);
 #ifdef _WEBRTCDEBUG
 		if (obj->dTlsSessions[session]->onT3RTX != NULL){ obj->dTlsSessions[session]->onT3RTX(obj, "OnT3RTX", obj->dTlsSessions[session]->RTO); }
 #endif
@@ -2818,10 +4184,10 @@ ILibTransport_DoneState ILibStun_SctpSendDataEx(struct ILibStun_Module *obj, int
 }
 
 
-ILibTransport_DoneState ILibStun_SctpSendData(struct ILibStun_Module *obj, int session, unsigned short streamid, int pid, char* data, int datalen)
+ILibTransport_DoneState ILibStun_SctpSendDataV(struct ILibStun_Module *obj, int session, unsigned short streamid, int pid, const struct iovec* vec, int vecCount)
 {
 	ILibTransport_DoneState r = ILibTransport_DoneState_ERROR;
-	int len, ptr = 0;
+	int len, ptr = 0, i, datalen = 0;
 	unsigned char flags = 0; // 2 = Start, 0 = Middle, 1 = End, 3 = Start & End
 	ILibSCTP_StreamAttributes attr;
 	ILibSCTP_StreamAttributes_Data attrData;
@@ -2830,18 +4196,34 @@ ILibTransport_DoneState ILibStun_SctpSendData(struct ILibStun_Module *obj, int s
 	attr.Raw = ILibSparseArray_Get(obj->dTlsSessions[session]->DataChannelMetaDeta, streamid);
 	attrData.Raw = ILibSparseArray_Get(obj->dTlsSessions[session]->DataChannelMetaDetaValues, streamid);
 
+	if (vec != NULL)
+	{
+		for (i = 0; i < vecCount; ++i)
+		{
+			if (vec[i].iov_base == NULL && vec[i].iov_len > 0) { return ILibTransport_DoneState_ERROR; }
+			datalen += (int)vec[i].iov_len;
+		}
+	}
+
 	if(pid != 50 && ((attr.Data.StatusFlags & ILibSCTP_StreamAttributesData_Assigned_Status_ASSIGNED) != ILibSCTP_StreamAttributesData_Assigned_Status_ASSIGNED || 
-		data == NULL || datalen == 0))
+		vec == NULL || datalen == 0))
 	{
 		return ILibTransport_DoneState_ERROR; // Error
 	}
 
+	if (pid != 50 && obj->maxSendBufferSize > 0 && (int)(obj->dTlsSessions[session]->holdingByteCount + obj->dTlsSessions[session]->pendingByteCount) + datalen > obj->maxSendBufferSize)
+	{
+		// Accepting this message would exceed the send buffer cap for this association, so reject the whole message
+		ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_2, "SCTP[%d] Send Buffer Full, rejected %d bytes on stream %u (Holding: %u / Pending: %u)", session, datalen, streamid, obj->dTlsSessions[session]->holdingByteCount, obj->dTlsSessions[session]->pendingByteCount);
+		return ILibTransport_DoneState_BUFFER_FULL;
+	}
+
 	seq = attrData.Data.NextSequenceNumber++;
 	ILibSparseArray_Add(obj->dTlsSessions[session]->DataChannelMetaDetaValues, streamid, attrData.Raw);
 
 
 	// Send the data in one block
-	if (datalen <= 1232) return ILibStun_SctpSendDataEx(obj, session, 3, streamid, seq, pid, data, datalen);
+	if (datalen <= 1232) return ILibStun_SctpSendDataEx(obj, session, 3, streamid, seq, pid, vec, vecCount, 0, datalen);
 
 	// Break the data into parts
 	while (ptr < datalen)
@@ -2856,13 +4238,21 @@ ILibTransport_DoneState ILibStun_SctpSendData(struct ILibStun_Module *obj, int s
 		if (ptr + len == datalen) flags |= 0x01;
 
 		// Send the block
-		r = ILibStun_SctpSendDataEx(obj, session, flags, streamid, seq, pid, data + ptr, len);
+		r = ILibStun_SctpSendDataEx(obj, session, flags, streamid, seq, pid, vec, vecCount, ptr, len);
 		ptr += len;
 	}
 
 	return r;
 }
 
+ILibTransport_DoneState ILibStun_SctpSendData(struct ILibStun_Module *obj, int session, unsigned short streamid, int pid, char* data, int datalen)
+{
+	struct iovec vec;
+	vec.iov_base = data;
+	vec.iov_len = datalen;
+	return ILibStun_SctpSendDataV(obj, session, streamid, pid, data == NULL ? NULL : &vec, 1);
+}
+
 // Public method used to send data on RCTP stream
 ILibTransport_DoneState ILibSCTP_Send(void* module, unsigned short streamId, char* data, int datalen)
 {
@@ -2881,7 +4271,57 @@ ILibTransport_DoneState ILibSCTP_SendEx(void* module, unsigned short streamId, c
 	return r;
 }
 
-void ILibStun_SctpProcessStreamData(struct ILibStun_Module *obj, int session, unsigned short streamId, unsigned short steamSeq, unsigned char chunkflags, int pid, char* data, int datalen)
+// Public method used to send a message gathered from several buffers on RCTP stream, without first coalescing them
+ILibTransport_DoneState ILibSCTP_SendV(void* module, unsigned short streamId, const struct iovec* vec, int vecCount, int dataType)
+{
+	ILibTransport_DoneState r;
+	struct ILibStun_dTlsSession* obj = (struct ILibStun_dTlsSession*)module;
+	if (obj->state != 2) return ILibTransport_DoneState_ERROR; // Error
+	sem_wait(&(obj->Lock));
+	r = ILibStun_SctpSendDataV(obj->parent, obj->sessionId, streamId, dataType, vec, vecCount);
+	sem_post(&(obj->Lock));
+	RCTPDEBUG(printf("ILibSCTP_SendV() count=%d, r=%d\r\n", vecCount, r);)
+	return r;
+}
+
+// Sets the reliability flags of a stream, from a DATA_CHANNEL_OPEN channel type (or an out-of-band negotiated one)
+void ILibWebRTC_DataChannel_SetReliability(struct ILibStun_Module *obj, ILibWebRTC_DataChannel_ReliabilityModes reliability, unsigned int reliabilityValue, ILibSCTP_StreamAttributes *attributes, ILibSCTP_StreamAttributes_Data *attributesData)
+{
+	switch(reliability)
+	{
+		case ILibWebRTC_DataChannel_ReliabilityMode_RELIABLE:	
+			ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Reliable");
+			break;
+		case ILibWebRTC_DataChannel_ReliabilityMode_RELIABLE_UNORDERED:
+			ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Reliable / UNORDERED");
+			attributes->Data.ReliabilityFlags |= ILibSCTP_StreamAttributesData_Assigned_Status_UNORDERED;
+			break;
+		case ILibWebRTC_DataChannel_ReliabilityMode_PARTIAL_RELIABLE_REXMIT:
+			ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Partial-Reliable / REXMIT");
+			attributes->Data.ReliabilityFlags |= ILibSCTP_StreamAttributesData_Assigned_Status_REXMIT;
+			attributesData->Data.ReliabilityValue = (unsigned short)reliabilityValue;
+			break;
+		case ILibWebRTC_DataChannel_ReliabilityMode_PARTIAL_RELIABLE_REXMIT_UNORDERED:
+			ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Partial-Reliable / UNORDERED + REXMIT");
+			attributes->Data.ReliabilityFlags |= ILibSCTP_StreamAttributesData_Assigned_Status_UNORDERED;
+			attributes->Data.ReliabilityFlags |= ILibSCTP_StreamAttributesData_Assigned_Status_REXMIT;
+			attributesData->Data.ReliabilityValue = (unsigned short)reliabilityValue;
+			break;
+		case ILibWebRTC_DataChannel_ReliabilityMode_PARTIAL_RELIABLE_TIMED:
+			ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Partial-Reliable / TIMED");
+			attributes->Data.ReliabilityFlags |= ILibSCTP_StreamAttributesData_Assigned_Status_TIMED;
+			attributesData->Data.ReliabilityValue = (unsigned short)reliabilityValue;
+			break;
+		case ILibWebRTC_DataChannel_ReliabilityMode_PARTIAL_RELIABLE_TIMED_UNORDERED:
+			ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Partial-Reliable / TIMED + UNORDERED");
+			attributes->Data.ReliabilityFlags |= ILibSCTP_StreamAttributesData_Assigned_Status_TIMED;
+			attributes->Data.ReliabilityFlags |= ILibSCTP_StreamAttributesData_Assigned_Status_UNORDERED;
+			attributesData->Data.ReliabilityValue = (unsigned short)reliabilityValue;
+			break;
+	}
+}
+
+void ILibStun_SctpProcessStreamData(struct ILibStun_Module *obj, int session, unsigned short streamId, unsigned short steamSeq, unsigned char chunkflags, int pid, ILibSCTP_ReceiveBuffer *dataBuffer, char* data, int datalen)
 {
 	struct ILibStun_dTlsSession *o = (struct ILibStun_dTlsSession*)obj->dTlsSessions[session];
 	UNREFERENCED_PARAMETER(steamSeq); // We expect all packets to be in order now.
@@ -2934,38 +4374,7 @@ void ILibStun_SctpProcessStreamData(struct ILibStun_Module *obj, int session, un
 
 					attributes.Data.StatusFlags |= ILibSCTP_StreamAttributesData_Assigned_Status_ASSIGNED;
 
-					switch((ILibWebRTC_DataChannel_ReliabilityModes)((unsigned char)data[1]))
-					{
-						case ILibWebRTC_DataChannel_ReliabilityMode_RELIABLE:	
-							ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Reliable");
-							break;
-						case ILibWebRTC_DataChannel_ReliabilityMode_RELIABLE_UNORDERED:
-							ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Reliable / UNORDERED");
-							attributes.Data.ReliabilityFlags |= ILibSCTP_StreamAttributesData_Assigned_Status_UNORDERED;
-							break;
-						case ILibWebRTC_DataChannel_ReliabilityMode_PARTIAL_RELIABLE_REXMIT:
-							ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Partial-Reliable / REXMIT");
-							attributes.Data.ReliabilityFlags |= ILibSCTP_StreamAttributesData_Assigned_Status_REXMIT;
-							attributesData.Data.ReliabilityValue = (unsigned short)(ntohl(((unsigned int*)(data+4))[0]));
-							break;
-						case ILibWebRTC_DataChannel_ReliabilityMode_PARTIAL_RELIABLE_REXMIT_UNORDERED:
-							ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Partial-Reliable / UNORDERED + REXMIT");
-							attributes.Data.ReliabilityFlags |= ILibSCTP_StreamAttributesData_Assigned_Status_UNORDERED;
-							attributes.Data.ReliabilityFlags |= ILibSCTP_StreamAttributesData_Assigned_Status_REXMIT;
-							attributesData.Data.ReliabilityValue = (unsigned short)(ntohl(((unsigned int*)(data+4))[0]));
-							break;
-						case ILibWebRTC_DataChannel_ReliabilityMode_PARTIAL_RELIABLE_TIMED:
-							ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Partial-Reliable / TIMED");
-							attributes.Data.ReliabilityFlags |= ILibSCTP_StreamAttributesData_Assigned_Status_TIMED;
-							attributesData.Data.ReliabilityValue = (unsigned short)(ntohl(((unsigned int*)(data+4))[0]));
-							break;
-						case ILibWebRTC_DataChannel_ReliabilityMode_PARTIAL_RELIABLE_TIMED_UNORDERED:
-							ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Partial-Reliable / TIMED + UNORDERED");
-							attributes.Data.ReliabilityFlags |= ILibSCTP_StreamAttributesData_Assigned_Status_TIMED;
-							attributes.Data.ReliabilityFlags |= ILibSCTP_StreamAttributesData_Assigned_Status_UNORDERED;
-							attributesData.Data.ReliabilityValue = (unsigned short)(ntohl(((unsigned int*)(data+4))[0]));
-							break;
-					}
+					ILibWebRTC_DataChannel_SetReliability(obj, (ILibWebRTC_DataChannel_ReliabilityModes)((unsigned char)data[1]), ntohl(((unsigned int*)(data+4))[0]), &attributes, &attributesData);
 					ILibSparseArray_Add(obj->dTlsSessions[session]->DataChannelMetaDeta, streamId, attributes.Raw);
 					ILibSparseArray_Add(obj->dTlsSessions[session]->DataChannelMetaDetaValues, streamId, attributesData.Raw);
 
@@ -3001,7 +4410,9 @@ void ILibStun_SctpProcessStreamData(struct ILibStun_Module *obj, int session, un
 			if (obj->OnData != NULL && obj->dTlsSessions[session]->state == 2)
 			{
 				sem_post(&(obj->dTlsSessions[session]->Lock));
+				obj->DeliveringBuffer = dataBuffer;
 				obj->OnData(obj, obj->dTlsSessions[session], streamId, pid, data, datalen, &(obj->dTlsSessions[session]->User));
+				obj->DeliveringBuffer = NULL;
 				if (obj->dTlsSessions[session] == NULL || obj->dTlsSessions[session]->state != 2) return;
 				sem_wait(&(obj->dTlsSessions[session]->Lock));
 			}
@@ -3018,9 +4429,15 @@ void ILibStun_SctpProcessStreamData(struct ILibStun_Module *obj, int session, un
 			// Accumulate data
 			if (acc->bufferPtr + datalen > acc->bufferLen)
 			{
-				// Realloc the accumulation buffer if needed
-				if ((acc->buffer = (char*)realloc(acc->buffer, acc->bufferPtr + datalen)) == NULL) ILIBCRITICALEXIT(254);
-				acc->bufferLen = acc->bufferPtr + datalen;
+				// Grow the accumulation buffer if needed
+				ILibSCTP_ReceiveBuffer *accBuffer = ILibSCTP_ReceiveBuffer_Allocate(obj->ReceiveBufferPool, MAX(acc->bufferPtr + datalen, 2 * acc->bufferLen));
+				if (acc->buffer != NULL)
+				{
+					memcpy(ILibSCTP_ReceiveBuffer_Data(accBuffer), acc->buffer, acc->bufferPtr);
+					ILibSCTP_ReceiveBuffer_Release(ILibSCTP_ReceiveBuffer_FromData(acc->buffer));
+				}
+				acc->buffer = ILibSCTP_ReceiveBuffer_Data(accBuffer);
+				acc->bufferLen = accBuffer->bufferLen;
 			}
 			memcpy(acc->buffer + acc->bufferPtr, data, datalen);
 			acc->bufferPtr += datalen;
@@ -3033,9 +4450,19 @@ void ILibStun_SctpProcessStreamData(struct ILibStun_Module *obj, int session, un
 				if (obj->OnData != NULL && obj->dTlsSessions[session]->state == 2)
 				{
 					sem_post(&(obj->dTlsSessions[session]->Lock));
+					obj->DeliveringBuffer = ILibSCTP_ReceiveBuffer_FromData(acc->buffer);
 					obj->OnData(obj, obj->dTlsSessions[session], streamId, pid, acc->buffer, acc->bufferPtr, &(obj->dTlsSessions[session]->User));
+					obj->DeliveringBuffer = NULL;
 					if (obj->dTlsSessions[session] == NULL || obj->dTlsSessions[session]->state != 2) return;
 					sem_wait(&(obj->dTlsSessions[session]->Lock));
+
+					if (ILibSCTP_ReceiveBuffer_IsShared(ILibSCTP_ReceiveBuffer_FromData(acc->buffer)) != 0)
+					{
+						// The application retained this message, so the next message must be assembled in a new buffer
+						ILibSCTP_ReceiveBuffer_Release(ILibSCTP_ReceiveBuffer_FromData(acc->buffer));
+						acc->buffer = NULL;
+						acc->bufferPtr = acc->bufferLen = 0;
+					}
 				}
 				//ILibStun_SctpSendData(obj, session, streamId, pid, obj->dTlsSessions[session]->dataAssembly, obj->dTlsSessions[session]->dataAssemblyPtr); // ECHO
 			}
@@ -3108,7 +4535,7 @@ void ILibStun_SctpDisconnect_Final(void *obj)
 	node = ILibLinkedList_GetNode_Head(o->receiveHoldBuffer);
 	while(node != NULL)
 	{
-		free(ILibLinkedList_GetDataFromNode(node));
+		ILibSCTP_ReceiveBuffer_Release(ILibSCTP_ReceiveBuffer_FromData(ILibLinkedList_GetDataFromNode(node)));
 		node = ILibLinkedList_GetNextNode(node);
 	}
 	ILibLinkedList_Destroy(o->receiveHoldBuffer);
@@ -3186,10 +4613,12 @@ void ILibStun_SctpDisconnect_Continue(void *j)
 	}
 
 	// Lets abort Consent-Freshness Checks
-	ILibLifeTime_Remove(obj->Timer, o + 1);
+	ILibStun_WebRTC_ConsentFreshness_Cancel(o);
 
-	// Remove the SCTP Heartbeat timer
+	// Remove the SCTP Heartbeat, T3-RTX and Delayed ACK timers
 	ILibLifeTime_Remove(o->parent->Timer, o);
+	ILibLifeTime_Remove(o->parent->Timer, ILibWebRTC_DTLS_TO_T3RTX_TIMER_OBJECT(o));
+	ILibLifeTime_Remove(o->parent->Timer, ILibWebRTC_DTLS_TO_SACK_TIMER_OBJECT(o));
 
 	// Start by clearing the IceState Object
 	ILibStun_ClearIceState(obj, o->iceStateSlot);
@@ -3253,7 +4682,7 @@ void ILibStun_SctpResent(struct ILibStun_dTlsSession *obj)
 
 		obj->senderCredits = ILibRUDP_StartMTU;												// Set CWND to 1 MTU
 		obj->RTO = obj->RTO * 2;															// Double the RT Timer
-		if (obj->RTO > RTO_MAX) { obj->RTO = RTO_MAX; }										// Enforce a cap on the max timeout
+		if (obj->RTO > obj->parent->rtoMax) { obj->RTO = obj->parent->rtoMax; }				// Enforce a cap on the max timeout
 		obj->SSTHRESH = MAX(obj->congestionWindowSize / 2, 4 * ILibRUDP_StartMTU);			// Update Slow Start Threshold
 		obj->congestionWindowSize = ILibRUDP_StartMTU;										// Reset the size of the Congestion Window, so that we'll initialy only have one SCTP packet in flight
 #ifdef _WEBRTCDEBUG
@@ -3275,7 +4704,7 @@ void ILibStun_SctpResent(struct ILibStun_dTlsSession *obj)
 					if (obj->T3RTXTIME == 0)
 					{
 						// Only set the T3-RTX timer if it's not already running
-						obj->T3RTXTIME = time;
+						ILibSCTP_T3RTX_Start(obj, time);
 #ifdef _WEBRTCDEBUG
 						if (obj->onT3RTX != NULL){ obj->onT3RTX(obj, "OnT3RTX", obj->RTO); }
 #endif
@@ -3296,19 +4725,62 @@ void ILibStun_SctpResent(struct ILibStun_dTlsSession *obj)
 	}
 }
 
+void ILibStun_SctpOnT3RTX(void *object)
+{
+	struct ILibStun_dTlsSession *obj = ILibWebRTC_DTLS_FROM_T3RTX_TIMER_OBJECT(object);
+	sem_wait(&(obj->Lock));
+	obj->T3RTXExpiry = 0;
+	if (obj->state == 2 && obj->T3RTXTIME != 0)
+	{
+		if ((int)((unsigned int)ILibGetUptime() - obj->T3RTXTIME) >= obj->RTO)
+		{
+			// T3-RTX Expired
+			ILibStun_SctpResent(obj);
+		}
+		else
+		{
+			// The timer was restarted since it was armed, so wait for the new expiry
+			ILibSCTP_T3RTX_Start(obj, obj->T3RTXTIME);
+		}
+	}
+	sem_post(&(obj->Lock));
+}
+
+void ILibStun_SctpOnDelayedAck(void *object)
+{
+	struct ILibStun_dTlsSession *obj = ILibWebRTC_DTLS_FROM_SACK_TIMER_OBJECT(object);
+	sem_wait(&(obj->Lock));
+	if (obj->state == 2 && obj->delayedAckCount > 0 && obj->rpacketptr == 0)
+	{
+		// Send the SACK that was held back
+		obj->delayedAckCount = 0;
+		obj->rpacketptr = ILibStun_SctpAddSackChunk(obj->parent, obj->sessionId, obj->rpacket, 12);
+		ILibStun_SendSctpPacket(obj->parent, obj->sessionId, obj->rpacket, obj->rpacketptr);
+		obj->rpacketptr = 0;
+	}
+	sem_post(&(obj->Lock));
+}
+
+// Association idle timer. Sends HEARTBEATs when the association has been idle for ILibSCTP_HeartbeatInterval, and closes it when they go unanswered
 void ILibStun_SctpOnTimeout(void *object)
 {
 	struct ILibStun_dTlsSession *obj = (struct ILibStun_dTlsSession*)object;
+	int idle;
+
 	sem_wait(&(obj->Lock));
-	// printf("Timer state=%d, value=%d\r\n", obj->state, obj->timervalue);
 	if (obj->state < 1 || obj->state > 2) { sem_post(&(obj->Lock)); return; } // Check if we are still needed, connecting or connected state only.
-	obj->timervalue++;
-	if (obj->timervalue < 80)
+
+	idle = (int)((unsigned int)ILibGetUptime() - obj->lastActivityTime);
+	if (idle < ILibSCTP_HeartbeatInterval)
 	{
-		// Resent packets
-		if (obj->state == 2) ILibStun_SctpResent(obj);
+		// We heard from the peer since this timer was armed, so just wait out the rest of the interval
+		obj->timervalue = 0;
+		ILibLifeTime_AddEx(obj->parent->Timer, obj, ILibSCTP_HeartbeatInterval - idle, &ILibStun_SctpOnTimeout, NULL);
+		sem_post(&(obj->Lock));
+		return;
 	}
-	else
+
+	if (++obj->timervalue > ILibSCTP_MaxHeartbeatRetransmits)
 	{
 		// Close the connection
 		sem_post(&(obj->Lock));
@@ -3317,7 +4789,7 @@ void ILibStun_SctpOnTimeout(void *object)
 		return;
 	}
 
-	if (obj->timervalue >= 40 && obj->state == 2)
+	if (obj->state == 2)
 	{
 		// Send Heartbeat
 		char hb[16];
@@ -3325,10 +4797,18 @@ void ILibStun_SctpOnTimeout(void *object)
 		ILibStun_SendSctpPacket(obj->parent, obj->sessionId, hb, 16);
 	}
 
-	ILibLifeTime_AddEx(obj->parent->Timer, obj, 100 + (200 * obj->timervalue), &ILibStun_SctpOnTimeout, NULL);
+	ILibLifeTime_AddEx(obj->parent->Timer, obj, obj->RTO + ILibSCTP_HeartbeatInterval, &ILibStun_SctpOnTimeout, NULL); // RFC4960 8.3
 	sem_post(&(obj->Lock));
 }
 
+// Starts the association idle timer
+void ILibStun_SctpStartTimeout(struct ILibStun_dTlsSession *obj)
+{
+	obj->timervalue = 0;
+	obj->lastActivityTime = (unsigned int)ILibGetUptime();
+	ILibLifeTime_AddEx(obj->parent->Timer, obj, ILibSCTP_HeartbeatInterval, &ILibStun_SctpOnTimeout, NULL);
+}
+
 int ILibSCTP_AddOptionalVariableParameter(char* insertionPoint, unsigned short parameterType, void *parameterData, int parameterDataLen)
 {
 	int retValue;
@@ -3381,6 +4861,7 @@ ILibSparseArray ILibWebRTC_PropagateChannelClose(struct ILibStun_dTlsSession* ob
 			if(count==0)
 			{
 				ILibSparseArray_ClearEx(obj->DataChannelMetaDetaValues, NULL, NULL);
+				ILibSparseArray_ClearEx(obj->DataChannelBufferedAmountLowThreshold, NULL, NULL);
 				retVal = ILibSparseArray_Move(obj->DataChannelMetaDeta);
 				break;
 			}
@@ -3392,6 +4873,7 @@ ILibSparseArray ILibWebRTC_PropagateChannelClose(struct ILibStun_dTlsSession* ob
 					sid = ntohs(req->Streams[count-1]);
 					ILibSparseArray_Add(retVal, sid, ILibSparseArray_Remove(obj->DataChannelMetaDeta, sid)); 
 					ILibSparseArray_Remove(obj->DataChannelMetaDetaValues, sid);
+					ILibSparseArray_Remove(obj->DataChannelBufferedAmountLowThreshold, sid);
 					--count;
 				}
 				break;
@@ -3418,10 +4900,11 @@ void* ILibSCTP_AddPacketToHoldingQueue_Chooser(void *oldValue, void *newValue, v
 	}
 	else
 	{
+		struct ILibStun_dTlsSession *o = (struct ILibStun_dTlsSession*)user;
 		unsigned short len = ntohs(((ILibSCTP_DataPayload*)newValue)->length);
-		char* retVal = (char*)malloc(len+1);
+		char* retVal = ILibSCTP_ReceiveBuffer_Data(ILibSCTP_ReceiveBuffer_Allocate(o->parent->ReceiveBufferPool, len + 1));
 		memcpy(retVal, (char*)newValue, len);
-		ReceiveHoldBuffer_Increment((ILibLinkedList)user, ((ILibSCTP_DataPayload*)newValue)->length);
+		ReceiveHoldBuffer_Increment(o->receiveHoldBuffer, ((ILibSCTP_DataPayload*)newValue)->length);
 		return(retVal);
 	}
 }
@@ -3432,10 +4915,10 @@ ILibSCTP_SackStatus ILibSCTP_AddPacketToHoldingQueue(struct ILibStun_dTlsSession
 	RCTPRCVDEBUG(printf("STORING %u, size = %d\r\n", tsn, chunksize);)
 	if (ReceiveHoldBuffer_Used(o->receiveHoldBuffer) + payload->length > ILibSCTP_MaxReceiverCredits) {return(ILibSCTP_SackStatus_Skip);}
 
-	ILibLinkedList_SortedInsertEx(o->receiveHoldBuffer, &ILibSCTP_AddPacketToHoldingQueue_Comparer, &ILibSCTP_AddPacketToHoldingQueue_Chooser, payload, o->receiveHoldBuffer);
+	ILibLinkedList_SortedInsertEx(o->receiveHoldBuffer, &ILibSCTP_AddPacketToHoldingQueue_Comparer, &ILibSCTP_AddPacketToHoldingQueue_Chooser, payload, o);
 	
 	// Send ACK now
-	if (sentsack == ILibSCTP_SackStatus_NotSent)
+	if (sentsack == ILibSCTP_SackStatus_NotSent || sentsack == ILibSCTP_SackStatus_Delayed)
 	{
 		sentsack = ILibSCTP_SackStatus_Sent;
 		o->rpacketptr = ILibStun_SctpAddSackChunk(o->parent, o->sessionId, o->rpacket, o->rpacketptr); // Send the ACK with the TSN as far forward as we can
@@ -3758,22 +5241,24 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 		}
 			break;
 		case RCTP_CHUNK_TYPE_INIT:
+		{
+			ILibSCTP_StateCookie cookie;
+
 			if (chunksize < 20 || session == -1 || o->state != 1) break;
 			o->sessionId = session;
-			o->tag = ((unsigned int*)(buffer + ptr + 4))[0];
+			o->tag = ((unsigned int*)(buffer + ptr + 4))[0]; // Needed to address the INIT-ACK, the rest of the association is only set up from the COOKIE-ECHO
 			if (o->tag == 0) { sem_post(&(o->Lock)); return; } // This tag can't be zeroes
-			o->receiverCredits = ntohl(((unsigned int*)(buffer + ptr + 8))[0]);
-#if ILibSCTP_MaxSenderCredits > 0
-			if (o->receiverCredits > ILibSCTP_MaxSenderCredits) o->receiverCredits = ILibSCTP_MaxSenderCredits; // Since we do real-time KVM, reduce the buffering.
-#endif
-			o->userTSN = o->intsn = ntohl(((unsigned int*)(buffer + ptr + 16))[0]) - 1;
-			util_random(4, (char*)&(o->outtsn));
-			o->RREQSEQ = o->outtsn;
-			o->RRESSEQ = o->intsn;
-			o->inport = ntohs(((unsigned short*)buffer)[1]);
-			o->outport = ntohs(((unsigned short*)buffer)[0]);
-			o->maxOutStreams = MIN(ntohs(((unsigned short*)(buffer + ptr + 12))[0]), ILibSCTP_Stream_MaximumCount);
-			o->maxInStreams = MIN(ntohs(((unsigned short*)(buffer + ptr + 12))[1]), ILibSCTP_Stream_MaximumCount);
+
+			memset(&cookie, 0, sizeof(ILibSCTP_StateCookie));
+			cookie.uptime = ILibGetUptime(); // So we can calculate initial RTT
+			cookie.tag = o->tag;
+			cookie.receiverCredits = ntohl(((unsigned int*)(buffer + ptr + 8))[0]);
+			cookie.intsn = ntohl(((unsigned int*)(buffer + ptr + 16))[0]) - 1;
+			util_random(4, (char*)&(cookie.outtsn));
+			cookie.inport = ntohs(((unsigned short*)buffer)[1]);
+			cookie.outport = ntohs(((unsigned short*)buffer)[0]);
+			cookie.maxOutStreams = MIN(ntohs(((unsigned short*)(buffer + ptr + 12))[0]), ILibSCTP_Stream_MaximumCount);
+			cookie.maxInStreams = MIN(ntohs(((unsigned short*)(buffer + ptr + 12))[1]), ILibSCTP_Stream_MaximumCount);
 			ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_1, "SCTP: %d received [INIT]", session);
 
 			// Optional/Variable Fields
@@ -3786,15 +5271,16 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 				{				
 					SCTP_INIT_PARAMS optionalParam = (SCTP_INIT_PARAMS)ntohs(((unsigned short*)(buffer+ptr+20 + varLen))[0]);
 					tLen = ntohs(((unsigned short*)(buffer+ptr+20+varLen))[1]);					
+					if (tLen < 4) break;
 					switch(optionalParam)
 					{
 						case SCTP_INIT_PARAM_UNRELIABLE_STREAM:
-							ILibSparseArray_Add(o->PeerFeatureSet, SCTP_INIT_PARAM_UNRELIABLE_STREAM, (void*)0x01);
+							cookie.unreliableStream = 1;
 							break;
 						case SCTP_INIT_PARAM_SUPPORTED_EXTENSIONS:
-							for(chunkIndex = 0 ; chunkIndex < tLen - 4; ++chunkIndex)
+							for(chunkIndex = 0 ; chunkIndex < tLen - 4 && cookie.extensionCount < ILibSCTP_StateCookie_MaxExtensions; ++chunkIndex)
 							{
-								ILibSparseArray_Add(o->PeerFeatureSet, (int)((unsigned char*)(buffer + ptr + 20 + varLen + 4))[chunkIndex], (void*)0x01);
+								cookie.extensions[cookie.extensionCount++] = ((unsigned char*)(buffer + ptr + 20 + varLen + 4))[chunkIndex];
 							}
 							break;
 						default:
@@ -3804,28 +5290,26 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 				}
 			}
 
-#ifdef _WEBRTCDEBUG
-			// Debug Events
-			if (o->onReceiverCredits != NULL) { o->onReceiverCredits(o, "OnReceiverCredits", o->receiverCredits); }
-#endif
-
-			RCTPDEBUG(printf("RCTP_CHUNK_TYPE_INIT, Flags=%d, outTSN=%u, inTSN=%u\r\n", chunkflags, obj->dTlsSessions[session]->outtsn, obj->dTlsSessions[session]->intsn);)
+			RCTPDEBUG(printf("RCTP_CHUNK_TYPE_INIT, Flags=%d, outTSN=%u, inTSN=%u\r\n", chunkflags, cookie.outtsn, cookie.intsn);)
 
 			// Create response
 			{
-				long long uptime = ILibGetUptime();
 				char chunks[1] = {130};
-				ILibStun_AddSctpChunkHeader(rpacket, *rptr, RCTP_CHUNK_TYPE_INITACK, 0, 37);
+				unsigned int hmacLen = 32;
+				HMAC(EVP_sha256(), ILibWebRTC_Cookie_GetSecret(obj), 32, (unsigned char*)&cookie, sizeof(ILibSCTP_StateCookie) - 32, (unsigned char*)cookie.hmac, &hmacLen);
+
+				ILibStun_AddSctpChunkHeader(rpacket, *rptr, RCTP_CHUNK_TYPE_INITACK, 0, (unsigned short)(4 + sizeof(ILibSCTP_InitAckChunk) + 4 + sizeof(ILibSCTP_StateCookie) + 5));
 				*rptr += 4;
-				((ILibSCTP_InitAckChunk*)(rpacket + *rptr))->InitiateTag = o->tag;									// Initiate Tag
+				((ILibSCTP_InitAckChunk*)(rpacket + *rptr))->InitiateTag = cookie.tag;								// Initiate Tag
 				((ILibSCTP_InitAckChunk*)(rpacket + *rptr))->A_RWND = htonl(ILibSCTP_MaxReceiverCredits);			// Advertised Receiver Window Credit (a_rwnd)	
-				((ILibSCTP_InitAckChunk*)(rpacket + *rptr))->NumberOfOutboundStreams = htons(o->maxOutStreams);		// Number of Outbound Streams
-				((ILibSCTP_InitAckChunk*)(rpacket + *rptr))->NumberOfInboundStreams = htons(o->maxInStreams);		// Number of Inbound Streams
-				((ILibSCTP_InitAckChunk*)(rpacket + *rptr))->InitialTSN = htonl(o->outtsn);							// Initial TSN
+				((ILibSCTP_InitAckChunk*)(rpacket + *rptr))->NumberOfOutboundStreams = htons(cookie.maxOutStreams);	// Number of Outbound Streams
+				((ILibSCTP_InitAckChunk*)(rpacket + *rptr))->NumberOfInboundStreams = htons(cookie.maxInStreams);	// Number of Inbound Streams
+				((ILibSCTP_InitAckChunk*)(rpacket + *rptr))->InitialTSN = htonl(cookie.outtsn);						// Initial TSN
 				*rptr += sizeof(ILibSCTP_InitAckChunk);
-				*rptr += ILibSCTP_AddOptionalVariableParameter(rpacket + *rptr, htons(7), (void*)&uptime, sizeof(uptime)); // Stick uptime as cookie, so we can calculate initial RTT
+				*rptr += ILibSCTP_AddOptionalVariableParameter(rpacket + *rptr, htons(7), (void*)&cookie, sizeof(ILibSCTP_StateCookie)); // Signed State Cookie
 				*rptr += ILibSCTP_AddOptionalVariableParameter(rpacket + *rptr, htons(SCTP_INIT_PARAM_SUPPORTED_EXTENSIONS), chunks, 1); // Supports RE-CONFIG
 			}
+		}
 			break;
 		case RCTP_CHUNK_TYPE_SACK:
 		{
@@ -3844,6 +5328,8 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 			int windowReset = 0;
 			int cumulativeTSNAdvanced = 0;
 			int pbc = o->pendingByteCount;
+			unsigned short lowStreams[ILibSCTP_Stream_MaximumCount];
+			int lowStreamsCount = 0, bufferedAmount, i;
 
 			o->zeroWindowProbeTime = 0;
 			o->lastSackTime = (unsigned int)ILibGetUptime();
@@ -3879,8 +5365,8 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 						o->RTTVAR = (int)((double)(1 - RTO_BETA) * (double)o->RTTVAR + RTO_BETA * (double)abs(o->SRTT - r));
 						o->SRTT = (int)((double)(1 - RTO_ALPHA) * (double)o->SRTT + RTO_ALPHA * (double)r);
 						o->RTO = o->SRTT + 4 * o->RTTVAR;
-						if (o->RTO < RTO_MIN) { o->RTO = RTO_MIN; }
-						if (o->RTO > RTO_MAX) { o->RTO = RTO_MAX; }
+						if (o->RTO < obj->rtoMin) { o->RTO = obj->rtoMin; }
+						if (o->RTO > obj->rtoMax) { o->RTO = obj->rtoMax; }
 						rttCalculated = 1; // We only need to calculate this once for each packet received
 
 #ifdef _WEBRTCDEBUG
@@ -3896,8 +5382,21 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 				if (o->pendingQueueHead == NULL) { o->pendingQueueTail = NULL; }
 				else { tsnx = ntohl(((unsigned int*)(o->pendingQueueHead + sizeof(char*) + 8 + 12 + 4))[0]); }
 
+				// Release these bytes from the stream's Buffered Amount, and check if we crossed the low water mark
+				if (ntohl(((unsigned int*)(packet + sizeof(char*) + 8 + 12 + 12))[0]) != 50)
+				{
+					unsigned short sid = ntohs(((unsigned short*)(packet + sizeof(char*) + 8 + 12 + 8))[0]);
+					int threshold = ILibSCTP_StreamValue_Get(o->DataChannelBufferedAmountLowThreshold, sid);
+					bufferedAmount = ILibSCTP_StreamValue_Get(o->DataChannelBufferedAmount, sid);
+					ILibSCTP_StreamValue_Set(o->DataChannelBufferedAmount, sid, MAX(0, bufferedAmount - ((((unsigned short*)(packet + sizeof(char*)))[0]) - (12 + 16))));
+					if (bufferedAmount > threshold && ILibSCTP_StreamValue_Get(o->DataChannelBufferedAmount, sid) <= threshold && lowStreamsCount < ILibSCTP_Stream_MaximumCount)
+					{
+						lowStreams[lowStreamsCount++] = sid;
+					}
+				}
+
 				free(packet);
-				o->timervalue = 0; // This is a valid SACK, reset the timeout for packet resent				
+				o->lastActivityTime = o->lastSackTime; // This is a valid SACK, the association is alive
 			}
 
 			if (cumulativeTSNAdvanced == 0)
@@ -3925,7 +5424,7 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 				o->senderCredits = o->congestionWindowSize;
 				o->PARTIAL_BYTES_ACKED = 0;
 				if(o->T3RTXTIME!=0) {ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_3, "SCTP[%d]: T3TX Timer OFF", o->sessionId);}
-				o->T3RTXTIME = 0;
+				ILibSCTP_T3RTX_Stop(o);
 #ifdef _WEBRTCDEBUG
 				if (o->onT3RTX != NULL){ o->onT3RTX(o, "OnT3RTX", 0); } // All data has been ack'ed, so we can turn off the T3RTX timer
 #endif
@@ -3935,7 +5434,7 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 				o->PARTIAL_BYTES_ACKED += cumulativeTSNAdvanced;
 				if (cumulativeTSNAdvanced > 0)
 				{
-					o->T3RTXTIME = o->lastSackTime;
+					ILibSCTP_T3RTX_Start(o, o->lastSackTime);
 					ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_3, "SCTP[%d]: T3TX Timer Restarted", o->sessionId);
 #ifdef _WEBRTCDEBUG
 					if (o->onT3RTX != NULL){ o->onT3RTX(o, "OnT3RTX", o->RTO); } // The lowest TSN has been ACK'ed, and there is still data pending, so restart the timer
@@ -4025,7 +5524,7 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 							if (packet == o->pendingQueueHead)
 							{
 								// We are re-transmitting the lowest outstanding TSN, restart the T3-RTX timer
-								o->T3RTXTIME = o->lastSackTime;
+								ILibSCTP_T3RTX_Start(o, o->lastSackTime);
 								ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_3, "SCTP[%d]: Restarting T3RTX Timer (Retransmitting lowest TSN)", o->sessionId);
 #ifdef _WEBRTCDEBUG
 								if (o->onT3RTX != NULL){ o->onT3RTX(o, "OnT3RTX", o->RTO); }
@@ -4034,7 +5533,7 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 							else if (o->T3RTXTIME == 0)
 							{
 								// Since we are not re-transmitting the lowest outstanding TSN, only start the T3-RTX timer, if it's not running
-								o->T3RTXTIME = o->lastSackTime;
+								ILibSCTP_T3RTX_Start(o, o->lastSackTime);
 								ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_3, "SCTP[%d]: Restarting T3RTX Timer (Not retransmitting lowest TSN)", o->sessionId);
 #ifdef _WEBRTCDEBUG
 								if (o->onT3RTX != NULL){ o->onT3RTX(o, "OnT3RTX", o->RTO); }
@@ -4063,7 +5562,7 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 								((unsigned int*)(packet + sizeof(char*)))[1] = o->lastSackTime;							// Update Send Time, used for retry
 								if (o->T3RTXTIME == 0)
 								{
-									o->T3RTXTIME = o->lastSackTime;
+									ILibSCTP_T3RTX_Start(o, o->lastSackTime);
 #ifdef _WEBRTCDEBUG
 									if (o->onT3RTX != NULL) { o->onT3RTX(o, "OnT3RTX", o->RTO); }
 #endif
@@ -4151,7 +5650,7 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 
 				if (o->T3RTXTIME == 0)
 				{
-					o->T3RTXTIME = o->lastSackTime;
+					ILibSCTP_T3RTX_Start(o, o->lastSackTime);
 #ifdef _WEBRTCDEBUG
 					if (o->onT3RTX != NULL){ o->onT3RTX(o, "OnT3RTX", o->RTO); } // Restart the timer, because the timer isn't currently set
 #endif
@@ -4165,6 +5664,18 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 				ILibStun_SendSctpPacket(obj, session, packet + sizeof(char*) + 8, ((unsigned short*)(packet + sizeof(char*)))[0]);	// Send the packet
 			}
 
+			// Notify the application of any streams whose Buffered Amount dropped to (or below) the low threshold
+			if (obj->OnBufferedAmountLow != NULL && lowStreamsCount > 0)
+			{
+				sem_post(&(o->Lock));
+				for (i = 0; i < lowStreamsCount; ++i)
+				{
+					obj->OnBufferedAmountLow(obj, o, lowStreams[i], o->User);
+					if (obj->dTlsSessions[session] == NULL || obj->dTlsSessions[session]->state != 2) return;
+				}
+				sem_wait(&(o->Lock));
+			}
+
 			// If we can now send more packets, notify the application
 			if (obj->OnSendOK != NULL && o->holdingCount == 0 && oldHoldCount > 0)
 			{
@@ -4179,7 +5690,7 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 		case RCTP_CHUNK_TYPE_HEARTBEAT:
 			// Echo back the heartbeat
 			RCTPDEBUG(printf("RCTP_CHUNK_TYPE_HEARTBEAT, Size=%d\r\n", chunksize);)
-			o->timervalue = 0;
+			o->lastActivityTime = (unsigned int)ILibGetUptime();
 			ILibStun_AddSctpChunkHeader(rpacket, *rptr, RCTP_CHUNK_TYPE_HEARTBEATACK, 0, chunksize);
 			memcpy(rpacket + *rptr + 4, buffer + ptr + 4, chunksize - 4);
 			*rptr += chunksize;
@@ -4187,7 +5698,7 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 			break;
 		case RCTP_CHUNK_TYPE_HEARTBEATACK:
 			RCTPDEBUG(printf("RCTP_CHUNK_TYPE_HEARTBEATACK, Size=%d\r\n", chunksize);)
-			o->timervalue = 0;
+			o->lastActivityTime = (unsigned int)ILibGetUptime();
 			break;
 		case RCTP_CHUNK_TYPE_ABORT:
 			{
@@ -4217,11 +5728,55 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 			ILibStun_SctpDisconnect(obj, session);
 			return;
 		case RCTP_CHUNK_TYPE_COOKIEECHO:
-			o->SRTT = (int)(ILibGetUptime() - *((long long*)(buffer + ptr + 4)));
+		{
+			ILibSCTP_StateCookie cookie;
+			char expected[32];
+			unsigned int hmacLen = 32;
+			int i;
+
+			if (chunksize < 4 + (int)sizeof(ILibSCTP_StateCookie)) break;
+			memcpy(&cookie, buffer + ptr + 4, sizeof(ILibSCTP_StateCookie));
+			for (i = 0; i < 2; ++i)
+			{
+				HMAC(EVP_sha256(), obj->cookieSecrets[i], 32, (unsigned char*)&cookie, sizeof(ILibSCTP_StateCookie) - 32, (unsigned char*)expected, &hmacLen);
+				if (CRYPTO_memcmp(expected, cookie.hmac, 32) == 0) break;
+			}
+			if (i == 2 || cookie.tag != o->tag || ILibGetUptime() - cookie.uptime > 2 * ILibWebRTC_CookieSecretLifetime)
+			{
+				ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_1, "SCTP: %d received [COOKIE-ECHO] with an invalid or stale cookie", session);
+				break;
+			}
+
+			if (o->state == 1)
+			{
+				// Set up the association from the cookie
+				o->receiverCredits = cookie.receiverCredits;
+#if ILibSCTP_MaxSenderCredits > 0
+				if (o->receiverCredits > ILibSCTP_MaxSenderCredits) o->receiverCredits = ILibSCTP_MaxSenderCredits; // Since we do real-time KVM, reduce the buffering.
+#endif
+				o->userTSN = o->intsn = cookie.intsn;
+				o->outtsn = cookie.outtsn;
+				o->RREQSEQ = o->outtsn;
+				o->RRESSEQ = o->intsn;
+				o->inport = cookie.inport;
+				o->outport = cookie.outport;
+				o->maxOutStreams = cookie.maxOutStreams;
+				o->maxInStreams = cookie.maxInStreams;
+				if (cookie.unreliableStream != 0) { ILibSparseArray_Add(o->PeerFeatureSet, SCTP_INIT_PARAM_UNRELIABLE_STREAM, (void*)0x01); }
+				for (i = 0; i < cookie.extensionCount && i < ILibSCTP_StateCookie_MaxExtensions; ++i) { ILibSparseArray_Add(o->PeerFeatureSet, (int)cookie.extensions[i], (void*)0x01); }
+
+#ifdef _WEBRTCDEBUG
+				// Debug Events
+				if (o->onReceiverCredits != NULL) { o->onReceiverCredits(o, "OnReceiverCredits", o->receiverCredits); }
+#endif
+			}
+
+			o->SRTT = (int)(ILibGetUptime() - cookie.uptime);
 			o->RTTVAR = o->SRTT / 2;
 			o->RTO = o->SRTT + 4 * o->RTTVAR;
 			o->SSTHRESH = 4 * ILibRUDP_StartMTU;
-			if (o->RTO < RTO_MIN) { o->RTO = RTO_MIN; }
+			if (o->RTO < obj->rtoMin) { o->RTO = obj->rtoMin; }
+			if (o->RTO > obj->rtoMax) { o->RTO = obj->rtoMax; }
 			ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_1, "SCTP: %d received [COOKIE-ECHO]", session);
 
 			*rptr = ILibStun_AddSctpChunkHeader(rpacket, *rptr, RCTP_CHUNK_TYPE_COOKIEACK, 0, 4);
@@ -4233,6 +5788,7 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 				if (obj->dTlsSessions[session] == NULL || obj->dTlsSessions[session]->state == 0) return;
 				sem_wait(&(o->Lock));
 			}
+		}
 			break;
 		case RCTP_CHUNK_TYPE_DATA:
 		{
@@ -4281,15 +5837,24 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 					o->userTSN = o->intsn;
 				}
 
-				// TODO: Optimize this, send SACK only after a little bit of time (or every 3 packets or so). Or only in some cases.
 				if (sentsack == ILibSCTP_SackStatus_NotSent)
 				{
-					sentsack = ILibSCTP_SackStatus_Sent;
-					*rptr = ILibStun_SctpAddSackChunk(obj, session, rpacket, *rptr); // Send the ACK with the TSN as far forward as we can
+					if (obj->delayedAckTime > 0 && o->delayedAckCount == 0 && ILibLinkedList_GetCount(o->receiveHoldBuffer) == 0)
+					{
+						// Delay the SACK, until the next packet arrives or the Delayed ACK timer expires (RFC4960 6.2)
+						sentsack = ILibSCTP_SackStatus_Delayed;
+						o->delayedAckCount = 1;
+						ILibLifeTime_AddEx(obj->Timer, ILibWebRTC_DTLS_TO_SACK_TIMER_OBJECT(o), obj->delayedAckTime, &ILibStun_SctpOnDelayedAck, NULL);
+					}
+					else
+					{
+						sentsack = ILibSCTP_SackStatus_Sent;
+						*rptr = ILibStun_SctpAddSackChunk(obj, session, rpacket, *rptr); // Send the ACK with the TSN as far forward as we can
+					}
 				}
 
 				sem_post(&(o->Lock));
-				ILibStun_SctpProcessStreamData(obj, session, streamId, streamSeq, chunkflags, pid, data->UserData, chunksize - 16);
+				ILibStun_SctpProcessStreamData(obj, session, streamId, streamSeq, chunkflags, pid, obj->ReceiveBuffer, data->UserData, chunksize - 16);
 				if (obj->dTlsSessions[session] == NULL || obj->dTlsSessions[session]->state == 0) return;
 				sem_wait(&(o->Lock));
 
@@ -4314,11 +5879,11 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 					o->userTSN = o->intsn = tsnx;
 
 					sem_post(&(o->Lock));
-					ILibStun_SctpProcessStreamData(obj, session, streamId, streamSeq, chunkflagsx, pid, payload->UserData, chunksizex - 16);
+					ILibStun_SctpProcessStreamData(obj, session, streamId, streamSeq, chunkflagsx, pid, ILibSCTP_ReceiveBuffer_FromData(payload), payload->UserData, chunksizex - 16);
 					if (obj->dTlsSessions[session] == NULL || obj->dTlsSessions[session]->state == 0) return;
 					sem_wait(&(o->Lock));
 
-					free(payload);
+					ILibSCTP_ReceiveBuffer_Release(ILibSCTP_ReceiveBuffer_FromData(payload));
 					ILibLinkedList_Remove(ILibLinkedList_GetNode_Head(o->receiveHoldBuffer));
 
 					if((o->flags & DTLS_PAUSE_FLAG)==DTLS_PAUSE_FLAG) {break;}
@@ -4337,9 +5902,9 @@ void ILibStun_ProcessSctpPacket(struct ILibStun_Module *obj, int session, char*
 				RCTPRCVDEBUG(printf("TOSSING %u, size = %d\r\n", tsn, chunksize);)
 
 				// Send ACK now
-				if (sentsack == 0)
+				if (sentsack == ILibSCTP_SackStatus_NotSent || sentsack == ILibSCTP_SackStatus_Delayed)
 				{
-					sentsack = 1;
+					sentsack = ILibSCTP_SackStatus_Sent;
 					*rptr = ILibStun_SctpAddSackChunk(obj, session, rpacket, *rptr); // Send the ACK with the TSN as far forward as we can
 				}
 				ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_3, "SCTP: %d Packet: %u dropped, duplicate", o->sessionId, ntohl(data->TSN));
@@ -4395,10 +5960,10 @@ void ILibSCTP_Resume(void* module)
 			obj->userTSN = ntohl(payload->TSN);
 			pulled += payload->length;
 			sem_post(&(obj->Lock));
-			ILibStun_SctpProcessStreamData(obj->parent, obj->sessionId, ntohs(payload->StreamID), ntohs(payload->StreamSequenceNumber), payload->flags, ntohl(payload->ProtocolID), payload->UserData, ntohs(payload->length) - 16);
+			ILibStun_SctpProcessStreamData(obj->parent, obj->sessionId, ntohs(payload->StreamID), ntohs(payload->StreamSequenceNumber), payload->flags, ntohl(payload->ProtocolID), ILibSCTP_ReceiveBuffer_FromData(payload), payload->UserData, ntohs(payload->length) - 16);
 			if (sobj->dTlsSessions[sessionID] == NULL || sobj->dTlsSessions[sessionID]->state == 0) return; // Referencing Dtls object this way, in case it was closed/freed by the user in the last call
 			sem_wait(&(obj->Lock));
-			free(payload);
+			ILibSCTP_ReceiveBuffer_Release(ILibSCTP_ReceiveBuffer_FromData(payload));
 			ILibLinkedList_Remove(node);
 		}
 		else
@@ -4448,6 +6013,9 @@ void ILibStun_InitiateSCTP(struct ILibStun_Module *obj, int session, unsigned sh
 	ILibStun_SendSctpPacket(obj, session, buffer, ptr);
 
 	obj->dTlsSessions[session]->tag = initiateTag;
+
+	// Start the timer, for SCTP Heartbeats
+	ILibStun_SctpStartTimeout(obj->dTlsSessions[session]);
 }
 
 void ILibWebRTC_OpenDataChannel(void *WebRTCModule, unsigned short streamId, char* channelName, int channelNameLength)
@@ -4477,6 +6045,38 @@ void ILibWebRTC_OpenDataChannel(void *WebRTCModule, unsigned short streamId, cha
 	free(buffer);
 }
 
+// Out-of-band negotiated Data Channel: Both sides declare the stream, so there is no DATA_CHANNEL_OPEN/ACK exchange, and the stream can be used immediately.
+// It can be declared as soon as the DTLS session exists, so nothing the peer sends on it right after SCTP connects is missed
+int ILibWebRTC_OpenNegotiatedDataChannel(void *WebRTCModule, unsigned short streamId, ILibWebRTC_DataChannel_ReliabilityModes reliability, unsigned short reliabilityValue)
+{
+	struct ILibStun_dTlsSession* obj = (struct ILibStun_dTlsSession*)WebRTCModule;
+	ILibSCTP_StreamAttributes attributes;
+	ILibSCTP_StreamAttributes_Data attributesData;
+
+	if (obj == NULL || obj->state == 0 || obj->state == 3 || streamId >= ILibSCTP_Stream_MaximumCount) return 1; // Error
+
+	sem_wait(&(obj->Lock));
+	attributes.Raw = ILibSparseArray_Get(obj->DataChannelMetaDeta, streamId);
+	if ((attributes.Data.StatusFlags & (ILibSCTP_StreamAttributesData_Assigned_Status_ASSIGNED | ILibSCTP_StreamAttributesData_Assigned_Status_WAITING_FOR_ACK)) != 0)
+	{
+		// This stream ID is already in use
+		sem_post(&(obj->Lock));
+		return 1;
+	}
+
+	ILibRemoteLogging_printf(ILibChainGetLogger(obj->parent->Chain), ILibRemoteLogging_Modules_WebRTC_SCTP, ILibRemoteLogging_Flags_VerbosityLevel_1, "Negotiated Data Channel on session: %u for StreamId: %u", obj->sessionId, streamId);
+
+	attributes.Raw = 0x00;
+	attributesData.Raw = 0x00;
+	attributes.Data.StatusFlags |= ILibSCTP_StreamAttributesData_Assigned_Status_ASSIGNED;
+	ILibWebRTC_DataChannel_SetReliability(obj->parent, reliability, reliabilityValue, &attributes, &attributesData);
+
+	ILibSparseArray_Add(obj->DataChannelMetaDeta, streamId, attributes.Raw);
+	ILibSparseArray_Add(obj->DataChannelMetaDetaValues, streamId, attributesData.Raw);
+	sem_post(&(obj->Lock));
+	return 0;
+}
+
 void ILibWebRTC_CloseDataChannel_ALL_Ex(ILibSparseArray sender, int index, void *data, void* user)
 {
 	UNREFERENCED_PARAMETER(sender);
@@ -4602,44 +6202,250 @@ ILibTransport_DoneState ILibWebRTC_TransportSend(void *transport, char* buffer,
 	return(retVal);
 }
 
-void ILibStun_CreateDtlsSession(struct ILibStun_Module *obj, int sessionId, int iceSlot, struct sockaddr_in6* remoteInterface)
+// Returns the current cookie secret, rotating it when it expires. Cookies signed with the previous secret are still accepted.
+char* ILibWebRTC_Cookie_GetSecret(struct ILibStun_Module *obj)
 {
-	if (obj->dTlsSessions[sessionId] == NULL) 
-	{ 
-		if ((obj->dTlsSessions[sessionId] = (struct ILibStun_dTlsSession*)malloc(sizeof(struct ILibStun_dTlsSession))) == NULL) ILIBCRITICALEXIT(254); 
-	}
-	else
+	long long uptime = ILibGetUptime();
+	if (uptime - obj->cookieSecretTime > ILibWebRTC_CookieSecretLifetime)
 	{
-		sem_destroy(&(obj->dTlsSessions[sessionId]->Lock));
-		ILibWebRTC_DestroySparseArrayTables(obj->dTlsSessions[sessionId]);
+		// Overwrite the oldest secret, so one being verified on a handshake worker is never the current one
+		util_random(32, obj->cookieSecrets[1 - obj->cookieSecretIndex]);
+		obj->cookieSecretIndex = 1 - obj->cookieSecretIndex;
+		obj->cookieSecretTime = uptime;
 	}
+	return(obj->cookieSecrets[obj->cookieSecretIndex]);
+}
 
-	memset(obj->dTlsSessions[sessionId], 0, sizeof(struct ILibStun_dTlsSession));
-	obj->dTlsSessions[sessionId]->IdentifierFlags = (unsigned short)ILibTransports_Raw_WebRTC;
-	obj->dTlsSessions[sessionId]->Chain = obj->Chain;
-	obj->dTlsSessions[sessionId]->sendPtr = &ILibWebRTC_TransportSend;
-	obj->dTlsSessions[sessionId]->closePtr = &ILibSCTP_Close;
-	//obj->dTlsSessions[sessionId]->closePtr = &ILibWebRTC_CloseDataChannel_ALL;
-	obj->dTlsSessions[sessionId]->pendingPtr = (ILibTransport_PendingBytesToSendPtr)&ILibSCTP_GetPendingBytesToSend;
+// DTLS cookies are the HMAC of the remote address, so they can be verified without keeping any state
+void ILibWebRTC_DTLS_MakeCookie(char* secret, struct sockaddr_in6 *remoteInterface, char* cookie)
+{
+	char data[2 + 2 + 16];
+	unsigned int cookieLen = 32;
 
-	obj->dTlsSessions[sessionId]->iceStateSlot = iceSlot;
-	obj->dTlsSessions[sessionId]->state = 4; //Bryan: Changed this to 4 from 1, becuase we need to call SSL_do_handshake to determine when DTLS was successful
-	obj->dTlsSessions[sessionId]->sessionId = sessionId;
-	sem_init(&(obj->dTlsSessions[sessionId]->Lock), 0, 1);
-	obj->dTlsSessions[sessionId]->parent = obj;
-	memcpy(&(obj->dTlsSessions[sessionId]->remoteInterface), remoteInterface, INET_SOCKADDR_LENGTH(remoteInterface->sin6_family));
-	obj->dTlsSessions[sessionId]->senderCredits = 4 * ILibRUDP_StartMTU;
-	obj->dTlsSessions[sessionId]->congestionWindowSize = 4 * ILibRUDP_StartMTU;
-	obj->dTlsSessions[sessionId]->ssl = SSL_new(obj->SecurityContext);
-	if ((obj->dTlsSessions[sessionId]->rpacket = (char*)malloc(4096)) == NULL) ILIBCRITICALEXIT(254);
-	obj->dTlsSessions[sessionId]->rpacketsize = 4096;
+	memset(data, 0, sizeof(data));
+	((unsigned short*)data)[0] = remoteInterface->sin6_family;
+	((unsigned short*)data)[1] = remoteInterface->sin6_port;
+	if (remoteInterface->sin6_family == AF_INET6) { memcpy(data + 4, &(remoteInterface->sin6_addr), 16); } else { memcpy(data + 4, &(((struct sockaddr_in*)remoteInterface)->sin_addr), 4); }
+	HMAC(EVP_sha256(), secret, 32, (unsigned char*)data, sizeof(data), (unsigned char*)cookie, &cookieLen);
+}
+int ILibWebRTC_DTLS_VerifyCookie(struct ILibStun_Module *obj, struct sockaddr_in6 *remoteInterface, const unsigned char* cookie, unsigned int cookieLen)
+{
+	char expected[32];
+	int i;
+
+	if (cookieLen != 32) { return(0); }
+	for (i = 0; i < 2; ++i)
+	{
+		ILibWebRTC_DTLS_MakeCookie(obj->cookieSecrets[i], remoteInterface, expected);
+		if (CRYPTO_memcmp(expected, cookie, 32) == 0) { return(1); }
+	}
+	return(0);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+#define ILibWebRTC_DTLS_COOKIE_CONST const
+#else
+#define ILibWebRTC_DTLS_COOKIE_CONST
+#endif
+int ILibWebRTC_DTLS_OnGenerateCookie(SSL *ssl, unsigned char *cookie, unsigned int *cookieLen)
+{
+	struct ILibStun_dTlsSession *o = (struct ILibStun_dTlsSession*)SSL_get_app_data(ssl);
+	if (o == NULL) { return(0); }
+	ILibWebRTC_DTLS_MakeCookie(o->parent->cookieSecrets[o->parent->cookieSecretIndex], &(o->remoteInterface), (char*)cookie);
+	*cookieLen = 32;
+	return(1);
+}
+int ILibWebRTC_DTLS_OnVerifyCookie(SSL *ssl, ILibWebRTC_DTLS_COOKIE_CONST unsigned char *cookie, unsigned int cookieLen)
+{
+	struct ILibStun_dTlsSession *o = (struct ILibStun_dTlsSession*)SSL_get_app_data(ssl);
+	return(o == NULL ? 0 : ILibWebRTC_DTLS_VerifyCookie(o->parent, &(o->remoteInterface), cookie, cookieLen));
+}
+
+void ILibWebRTC_DTLS_Send(struct ILibStun_Module *obj, int fromTurn, struct sockaddr_in6 *remoteInterface, char* buffer, int bufferLength)
+{
+	if (fromTurn != 0)
+	{
+		// Response was from TURN
+		if (remoteInterface->sin6_family == 0)
+		{
+			ILibTURN_SendChannelData(obj->mTurnClientModule, remoteInterface->sin6_port, buffer, 0, bufferLength);
+		}
+		else
+		{
+			ILibTURN_SendIndication(obj->mTurnClientModule, remoteInterface, buffer, 0, bufferLength);
+		}
+	}
+	else
+	{
+		// Response was from a local socket
+		ILibAsyncUDPSocket_SendTo(obj->UDP, (struct sockaddr*)remoteInterface, buffer, bufferLength, ILibAsyncSocket_MemoryOwnership_USER);
+	}
+}
+
+//
+// Checks that a packet for a new session is a ClientHello carrying a valid cookie. If it's a ClientHello without one, a HelloVerifyRequest
+// is sent without allocating anything, so spoofed ClientHellos can't use up session slots. Returns 0 if a session should be created.
+//
+int ILibWebRTC_DTLS_CheckClientHello(struct ILibStun_Module *obj, int fromTurn, char* buffer, int bufferLength, struct sockaddr_in6 *remoteInterface)
+{
+	char hvr[13 + 12 + 3 + 32];
+	unsigned char *hello = (unsigned char*)buffer + 13;
+	int helloLength, ptr;
+
+	// DTLS Record Header: Type(1) Version(2) Epoch(2) Sequence(6) Length(2), followed by an unfragmented ClientHello in epoch 0
+	if (bufferLength < 13 + 12 + 2 + 32 + 2 || buffer[0] != ILibAsyncSocket_TLSPlainText_ContentType_Handshake || buffer[3] != 0 || buffer[4] != 0) { return(1); }
+	if (hello[0] != ILibWebRTC_DTLSHandshakeType_clienthello) { return(1); }
+	helloLength = (hello[1] << 16) | (hello[2] << 8) | hello[3];
+	if (hello[6] != 0 || hello[7] != 0 || hello[8] != 0 || memcmp(hello + 1, hello + 9, 3) != 0 || 13 + 12 + helloLength > bufferLength) { return(1); }
+
+	// ClientVersion(2) Random(32) SessionID(1+n) Cookie(1+n)
+	ptr = 12 + 2 + 32;
+	ptr += 1 + hello[ptr];
+	if (ptr + 1 > 12 + helloLength) { return(1); }
+	if (ptr + 1 + hello[ptr] <= 12 + helloLength && ILibWebRTC_DTLS_VerifyCookie(obj, remoteInterface, hello + ptr + 1, hello[ptr]) != 0) { return(0); }
+
+	// HelloVerifyRequest, echoing the record and message sequence numbers of the ClientHello (RFC 6347 4.2.1)
+	memcpy(hvr, buffer, 11);
+	hvr[1] = (char)0xFE; hvr[2] = (char)0xFF;											// DTLS 1.0 is used for HelloVerifyRequest, regardless of version
+	((unsigned short*)(hvr + 11))[0] = htons(12 + 3 + 32);
+	hvr[13] = 3;																		// hello_verify_request
+	hvr[14] = 0; hvr[15] = 0; hvr[16] = 3 + 32;											// Length
+	memcpy(hvr + 17, hello + 4, 2);														// Message Sequence
+	hvr[19] = 0; hvr[20] = 0; hvr[21] = 0;												// Fragment Offset
+	hvr[22] = 0; hvr[23] = 0; hvr[24] = 3 + 32;											// Fragment Length
+	hvr[25] = (char)0xFE; hvr[26] = (char)0xFF;											// Server Version
+	hvr[27] = 32;
+	ILibWebRTC_DTLS_MakeCookie(ILibWebRTC_Cookie_GetSecret(obj), remoteInterface, hvr + 28);
+	ILibWebRTC_DTLS_Send(obj, fromTurn, remoteInterface, hvr, sizeof(hvr));
+	return(1);
+}
+
+// Runs the next handshake step. A session created for a verified ClientHello must go through DTLSv1_listen, so OpenSSL accepts the cookie exchange as done.
+int ILibWebRTC_DTLS_DoHandshake(struct ILibStun_dTlsSession *o)
+{
+	int r;
+	if (o->dtlsListen != 0)
+	{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+		BIO_ADDR *peer = BIO_ADDR_new();
+		r = DTLSv1_listen(o->ssl, peer);
+		BIO_ADDR_free(peer);
+#else
+		struct sockaddr_in6 peer;
+		r = (int)DTLSv1_listen(o->ssl, &peer);
+#endif
+		if (r <= 0) { return(-1); }
+		o->dtlsListen = 0;
+	}
+	return(SSL_do_handshake(o->ssl));
+}
+
+void ILibStun_CreateDtlsSession(struct ILibStun_Module *obj, int sessionId, int iceSlot, struct sockaddr_in6* remoteInterface)
+{
+	ILibWebRTC_HandshakeWorker *worker = NULL;
+
+	if (obj->dTlsSessions[sessionId] == NULL) 
+	{ 
+		if ((obj->dTlsSessions[sessionId] = (struct ILibStun_dTlsSession*)malloc(sizeof(struct ILibStun_dTlsSession))) == NULL) ILIBCRITICALEXIT(254); 
+	}
+	else
+	{
+		// Make sure a handshake worker isn't using this slot while we re-initialize it
+		if (obj->HandshakeWorkers != NULL) { worker = ILibWebRTC_HandshakeWorker_ForSession(obj, sessionId); sem_wait(&(worker->ProcessLock)); }
+		sem_destroy(&(obj->dTlsSessions[sessionId]->Lock));
+		ILibWebRTC_DestroySparseArrayTables(obj->dTlsSessions[sessionId]);
+	}
+
+	memset(obj->dTlsSessions[sessionId], 0, sizeof(struct ILibStun_dTlsSession));
+	obj->dTlsSessions[sessionId]->IdentifierFlags = (unsigned short)ILibTransports_Raw_WebRTC;
+	obj->dTlsSessions[sessionId]->Chain = obj->Chain;
+	obj->dTlsSessions[sessionId]->sendPtr = &ILibWebRTC_TransportSend;
+	obj->dTlsSessions[sessionId]->closePtr = &ILibSCTP_Close;
+	//obj->dTlsSessions[sessionId]->closePtr = &ILibWebRTC_CloseDataChannel_ALL;
+	obj->dTlsSessions[sessionId]->pendingPtr = (ILibTransport_PendingBytesToSendPtr)&ILibSCTP_GetPendingBytesToSend;
+
+	obj->dTlsSessions[sessionId]->iceStateSlot = iceSlot;
+	obj->dTlsSessions[sessionId]->state = 4; //Bryan: Changed this to 4 from 1, becuase we need to call SSL_do_handshake to determine when DTLS was successful
+	obj->dTlsSessions[sessionId]->sessionId = sessionId;
+	obj->dTlsSessions[sessionId]->generation = ++obj->dTlsSessionGeneration;
+	sem_init(&(obj->dTlsSessions[sessionId]->Lock), 0, 1);
+	obj->dTlsSessions[sessionId]->parent = obj;
+	memcpy(&(obj->dTlsSessions[sessionId]->remoteInterface), remoteInterface, INET_SOCKADDR_LENGTH(remoteInterface->sin6_family));
+	obj->dTlsSessions[sessionId]->senderCredits = 4 * ILibRUDP_StartMTU;
+	obj->dTlsSessions[sessionId]->congestionWindowSize = 4 * ILibRUDP_StartMTU;
+	obj->dTlsSessions[sessionId]->RTO = MAX(obj->rtoMin, MIN(RTO_INITIAL, obj->rtoMax));
+	obj->dTlsSessions[sessionId]->ssl = SSL_new(obj->SecurityContext);
+	SSL_set_app_data(obj->dTlsSessions[sessionId]->ssl, obj->dTlsSessions[sessionId]);
+	if ((obj->dTlsSessions[sessionId]->rpacket = (char*)malloc(4096)) == NULL) ILIBCRITICALEXIT(254);
+	obj->dTlsSessions[sessionId]->rpacketsize = 4096;
 
 	ILibWebRTC_CreateSparseArrayTables(obj->dTlsSessions[sessionId]);
 	obj->dTlsSessions[sessionId]->receiveHoldBuffer = ILibLinkedList_Create();
+	if (worker != NULL) { sem_post(&(worker->ProcessLock)); }
 
 	ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "New DTLS Session: %d linked to IceStateSlot: %d using %s:%u", sessionId, iceSlot, ILibRemoteLogging_ConvertAddress((struct sockaddr*)remoteInterface), htons(remoteInterface->sin6_port));
 }
 
+void ILibWebRTC_Resumption_Clear(struct ILibStun_Module *obj)
+{
+	int i;
+	for (i = 0; i < obj->resumptionMaxSessions; ++i)
+	{
+		if (obj->resumptionCache[i].session != NULL) { SSL_SESSION_free(obj->resumptionCache[i].session); }
+	}
+	if (obj->resumptionCache != NULL) { free(obj->resumptionCache); obj->resumptionCache = NULL; }
+	obj->resumptionMaxSessions = 0;
+}
+
+SSL_SESSION* ILibWebRTC_Resumption_Find(struct ILibStun_Module *obj, char* fingerprint)
+{
+	int i;
+	for (i = 0; i < obj->resumptionMaxSessions; ++i)
+	{
+		if (obj->resumptionCache[i].session != NULL && memcmp(obj->resumptionCache[i].fingerprint, fingerprint, 32) == 0)
+		{
+			if ((long)time(NULL) - SSL_SESSION_get_time(obj->resumptionCache[i].session) < SSL_SESSION_get_timeout(obj->resumptionCache[i].session)) { return(obj->resumptionCache[i].session); }
+
+			// Expired
+			SSL_SESSION_free(obj->resumptionCache[i].session);
+			obj->resumptionCache[i].session = NULL;
+			break;
+		}
+	}
+	return(NULL);
+}
+
+// Checks the certificate of a resumed session against the peer's offer, and caches new client side sessions. Returns non-zero if the peer must be rejected
+int ILibWebRTC_Resumption_OnHandshake(struct ILibStun_Module *obj, int session)
+{
+	struct ILibStun_IceState *ice = obj->IceStates[obj->dTlsSessions[session]->iceStateSlot];
+	SSL *ssl = obj->dTlsSessions[session]->ssl;
+	X509 *peer;
+	char thumbprint[32];
+	int i, l = 32, slot = -1;
+
+	if (ice == NULL || ice->dtlscerthashlen != 32) { return(1); }
+	if (SSL_session_reused(ssl) != 0)
+	{
+		if ((peer = SSL_get_peer_certificate(ssl)) == NULL) { return(1); }
+		X509_digest(peer, EVP_get_digestbyname("sha256"), (unsigned char*)thumbprint, (unsigned int*)&l);
+		X509_free(peer);
+		return((l == 32 && memcmp(thumbprint, ice->dtlscerthash, 32) == 0) ? 0 : 1);
+	}
+	if (ILibWebRTC_DTLS_IsServer(ssl) != 0) { return(0); } // The server side is cached by OpenSSL
+
+	// Replace the entry for this peer, otherwise an empty one, otherwise the oldest one
+	for (i = 0; i < obj->resumptionMaxSessions; ++i)
+	{
+		if (obj->resumptionCache[i].session != NULL && memcmp(obj->resumptionCache[i].fingerprint, ice->dtlscerthash, 32) == 0) { slot = i; break; }
+		if (slot < 0 || (obj->resumptionCache[slot].session != NULL && (obj->resumptionCache[i].session == NULL || SSL_SESSION_get_time(obj->resumptionCache[i].session) < SSL_SESSION_get_time(obj->resumptionCache[slot].session)))) { slot = i; }
+	}
+	if (obj->resumptionCache[slot].session != NULL) { SSL_SESSION_free(obj->resumptionCache[slot].session); }
+	memcpy(obj->resumptionCache[slot].fingerprint, ice->dtlscerthash, 32);
+	obj->resumptionCache[slot].session = SSL_get1_session(ssl);
+	return(0);
+}
+
 void ILibStun_InitiateDTLS(struct ILibStun_IceState *IceState, int IceSlot, struct sockaddr_in6* remoteInterface)
 {
 	long l;
@@ -4667,6 +6473,12 @@ void ILibStun_InitiateDTLS(struct ILibStun_IceState *IceState, int IceSlot, stru
 	// Bind everything
 	SSL_set_bio(obj->dTlsSessions[j]->ssl, read, write);
 	SSL_set_connect_state(obj->dTlsSessions[j]->ssl);
+	if (obj->resumptionMaxSessions > 0 && IceState->dtlscerthashlen == 32)
+	{
+		// Try to resume the last session we had with this peer, to skip the public key operations
+		SSL_SESSION *resumeSession = ILibWebRTC_Resumption_Find(obj, IceState->dtlscerthash);
+		if (resumeSession != NULL) { SSL_set_session(obj->dTlsSessions[j]->ssl, resumeSession); }
+	}
 	l = SSL_do_handshake(obj->dTlsSessions[j]->ssl);
 	if (l <= 0) { l = SSL_get_error(obj->dTlsSessions[j]->ssl, l); }
 
@@ -4733,7 +6545,7 @@ void ILibStun_DTLS_Success_OnCreateTURNChannelBinding(ILibTURN_ClientModule turn
 		else
 		{
 			// Start the timer, for SCTP Heartbeats
-			ILibLifeTime_AddEx(obj->Timer, obj->dTlsSessions[(int)channelNumber], 100, &ILibStun_SctpOnTimeout, NULL);
+			ILibStun_SctpStartTimeout(obj->dTlsSessions[(int)channelNumber]);
 		}
 	}
 }
@@ -4747,6 +6559,13 @@ void ILibStun_DTLS_Success(struct ILibStun_Module *obj, int session, struct sock
 	obj->dTlsSessions[session]->SSTHRESH = 4 * ILibRUDP_StartMTU;
 
 	IceSlot = obj->dTlsSessions[session]->iceStateSlot;
+	if (obj->resumptionMaxSessions > 0 && IceSlot >= 0 && ILibWebRTC_Resumption_OnHandshake(obj, session) != 0)
+	{
+		// The verify callback is skipped on a resumed session, and the peer's certificate did not match its offer. We may be holding the session lock, so defer the disconnect
+		ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Resumed Session FAILED Fingerprint Verification");
+		ILibLifeTime_Add(obj->Timer, obj->dTlsSessions[session] + 5, 0, &ILibStun_SctpDisconnect_Continue, NULL);
+		return;
+	}
 	if (IceSlot >= 0)
 	{
 		if (obj->IceStates[IceSlot]->useTurn != 0)
@@ -4762,19 +6581,209 @@ void ILibStun_DTLS_Success(struct ILibStun_Module *obj, int session, struct sock
 		else
 		{
 			// Start the timer, for SCTP Heartbeats
-			ILibLifeTime_AddEx(obj->Timer, obj->dTlsSessions[session], 100, &ILibStun_SctpOnTimeout, NULL);
+			ILibStun_SctpStartTimeout(obj->dTlsSessions[session]);
 		}
 
 		// Since DTLS is established, we can stop sending periodic STUNS on the ICE Offer Candidates
 		// TODO: Bryan: Fix this, Periodic stuns don't work like this anymore
 		ILibLifeTime_Remove(obj->Timer, obj->IceStates[IceSlot]);
 
-		if (obj->consentFreshnessDisabled == 0) // TODO: Bryan: We should really put this after SCTP has been established...
+		if (obj->consentFreshnessDisabled == 0 && obj->IceStates[IceSlot]->iceLite == 0) // TODO: Bryan: We should really put this after SCTP has been established...
 		{
 			// Start Consent Freshness Algorithm. Wait for the Timeout, then send first packet
-			ILibLifeTime_Add(obj->Timer, obj->dTlsSessions[session] + 1, ILibStun_MaxConsentFreshnessTimeoutSeconds, ILibStun_WebRTC_ConsentFreshness_Start, NULL);
+			ILibStun_WebRTC_ConsentFreshness_Schedule(obj->dTlsSessions[session]);
+		}
+		if (obj->IceStates[IceSlot]->peerHasActiveOffer == 0) { ILibStun_WebRTC_PathProbe_Arm(obj); }
+	}
+}
+
+void ILibWebRTC_HandshakeJob_Free(void *object)
+{
+	ILibWebRTC_HandshakeJob *job = (ILibWebRTC_HandshakeJob*)object;
+	if (job->buffer != NULL) { free(job->buffer); }
+	free(job);
+}
+
+// Called on the Chain thread, once a worker has run a handshake step
+void ILibWebRTC_HandshakeJob_OnComplete(void *object)
+{
+	ILibWebRTC_HandshakeJob *job = (ILibWebRTC_HandshakeJob*)object;
+	struct ILibStun_Module *obj = job->parent;
+	struct ILibStun_dTlsSession *o = obj->dTlsSessions[job->sessionId];
+	int i, len;
+
+	sem_wait(&(o->Lock));
+	if (o->generation != job->generation || o->state != 4) { sem_post(&(o->Lock)); ILibWebRTC_HandshakeJob_Free(job); return; } // Stale
+	if (job->result == 1) { o->state = 1; }
+	sem_post(&(o->Lock));
+
+	for (i = 0; i + 2 <= job->bufferLength; i += (2 + len))
+	{
+		len = (int)((unsigned short*)(job->buffer + i))[0];
+		ILibWebRTC_DTLS_HandshakeDetect(obj, "S ", job->buffer + i + 2, 0, len);
+		ILibWebRTC_DTLS_Send(obj, job->fromTurn, &(job->remoteInterface), job->buffer + i + 2, len);
+	}
+
+	if (job->result == 0)
+	{
+		ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "...Handshake FAILED");
+	}
+	else if (job->result == 1)
+	{
+		ILibStun_DTLS_Success(obj, job->sessionId, &(job->remoteInterface)); // Successful DTLS Handshake
+	}
+	ILibWebRTC_HandshakeJob_Free(job);
+}
+
+void ILibWebRTC_HandshakeJob_Process(ILibWebRTC_HandshakeJob *job)
+{
+	struct ILibStun_dTlsSession *o = job->parent->dTlsSessions[job->sessionId];
+	BIO *wbio;
+	char *response = NULL;
+	int responseLength = 0, len;
+	u_long err;
+	char reason[256];
+
+	sem_wait(&(o->Lock));
+	if (o->generation != job->generation || o->state != 4) { sem_post(&(o->Lock)); job->result = ILibWebRTC_HandshakeJob_Stale; job->bufferLength = 0; return; }
+
+	BIO_write(SSL_get_rbio(o->ssl), job->buffer, job->bufferLength);
+	job->result = ILibWebRTC_DTLS_DoHandshake(o);
+	if (job->result == 0)
+	{
+		while ((err = ERR_get_error()) != 0)
+		{
+			ERR_error_string_n(err, reason, sizeof(reason));	// ERR_error_string(err, NULL) uses a static buffer, and other workers may be here too
+			ILibRemoteLogging_printf(ILibChainGetLogger(job->parent->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "......Reason: %s", reason);
+		}
+	}
+
+	// Collect the outbound records, so they can be sent from the Chain thread
+	wbio = SSL_get_wbio(o->ssl);
+	while ((len = (int)BIO_ctrl_pending(wbio)) > 0)
+	{
+		if ((response = (char*)realloc(response, responseLength + 2 + len)) == NULL) ILIBCRITICALEXIT(254);
+		len = BIO_read(wbio, response + responseLength + 2, len);
+		if (len <= 0) { break; }
+		((unsigned short*)(response + responseLength))[0] = (unsigned short)len;
+		responseLength += (2 + len);
+	}
+	sem_post(&(o->Lock));
+
+	free(job->buffer);
+	job->buffer = response;
+	job->bufferLength = responseLength;
+}
+
+void ILibWebRTC_HandshakeWorker_Run(void *object)
+{
+	ILibWebRTC_HandshakeWorker *worker = (ILibWebRTC_HandshakeWorker*)object;
+	ILibWebRTC_HandshakeJob *job;
+
+	ILibWebRTC_HandshakeWorker_Lock(worker);
+	while (1)
+	{
+		while (worker->Exit == 0 && ILibQueue_IsEmpty(worker->Jobs) != 0) { ILibWebRTC_HandshakeWorker_Wait(worker); }
+		if (worker->Exit != 0) { break; }
+
+		// The job is marked in flight (ProcessLock) in the same critical section it is dequeued in, so nobody waiting on ProcessLock can miss it
+		job = (ILibWebRTC_HandshakeJob*)ILibQueue_DeQueue(worker->Jobs);
+		sem_wait(&(worker->ProcessLock));
+		ILibWebRTC_HandshakeWorker_UnLock(worker);
+
+		ILibWebRTC_HandshakeJob_Process(job);
+		sem_post(&(worker->ProcessLock));
+
+		ILibWebRTC_HandshakeWorker_Lock(worker);
+		if (worker->Exit == 0 && job->result != ILibWebRTC_HandshakeJob_Stale && (job->result >= 0 || job->bufferLength > 0))
+		{
+			// Context switch back to the Chain thread. Intermediate flights (WANT_READ) still have records to send.
+			// AddEx only wakes the Chain if no other timer was pending, so wake it ourselves
+			ILibLifeTime_AddEx(job->parent->Timer, job, 0, &ILibWebRTC_HandshakeJob_OnComplete, &ILibWebRTC_HandshakeJob_Free);
+			ILibForceUnBlockChain(job->parent->Chain);
+		}
+		else
+		{
+			ILibWebRTC_HandshakeJob_Free(job);
 		}
 	}
+
+	// The module is being destroyed. Whoever stopped us frees the worker once we are out
+	while ((job = (ILibWebRTC_HandshakeJob*)ILibQueue_DeQueue(worker->Jobs)) != NULL) { ILibWebRTC_HandshakeJob_Free(job); }
+	ILibWebRTC_HandshakeWorker_UnLock(worker);
+	sem_post(&(worker->Done));
+}
+
+void ILibWebRTC_HandshakeWorker_Submit(struct ILibStun_Module *obj, int session, char* buffer, int bufferLength, int fromTurn, struct sockaddr_in6 *remoteInterface)
+{
+	ILibWebRTC_HandshakeWorker *worker = ILibWebRTC_HandshakeWorker_ForSession(obj, session);
+	ILibWebRTC_HandshakeJob *job;
+
+	if ((job = (ILibWebRTC_HandshakeJob*)malloc(sizeof(ILibWebRTC_HandshakeJob))) == NULL) ILIBCRITICALEXIT(254);
+	memset(job, 0, sizeof(ILibWebRTC_HandshakeJob));
+	if ((job->buffer = (char*)malloc(bufferLength)) == NULL) ILIBCRITICALEXIT(254);
+	memcpy(job->buffer, buffer, bufferLength);
+	job->bufferLength = bufferLength;
+	job->parent = obj;
+	job->sessionId = session;
+	job->generation = obj->dTlsSessions[session]->generation;
+	job->fromTurn = fromTurn;
+	memcpy(&(job->remoteInterface), remoteInterface, sizeof(struct sockaddr_in6));
+
+	ILibWebRTC_DTLS_HandshakeDetect(obj, "R ", buffer, 0, bufferLength);
+
+	// Jobs for a session always go to the same worker, so its records are processed in order
+	ILibWebRTC_HandshakeWorker_Lock(worker);
+	ILibQueue_EnQueue(worker->Jobs, job);
+	ILibWebRTC_HandshakeWorker_Signal(worker);
+	ILibWebRTC_HandshakeWorker_UnLock(worker);
+}
+
+void ILibWebRTC_StopHandshakeWorkers(struct ILibStun_Module *obj)
+{
+	int i;
+	ILibWebRTC_HandshakeWorker *worker;
+
+	for (i = 0; i < obj->HandshakeWorkerCount; ++i)
+	{
+		// Wait for the worker to finish its current job and leave its loop, before anything it could touch is freed
+		worker = obj->HandshakeWorkers[i];
+		ILibWebRTC_HandshakeWorker_Lock(worker);
+		worker->Exit = 1;
+		ILibWebRTC_HandshakeWorker_Signal(worker);
+		ILibWebRTC_HandshakeWorker_UnLock(worker);
+		sem_wait(&(worker->Done));
+
+		ILibQueue_Destroy(worker->Jobs);
+		sem_destroy(&(worker->ProcessLock));
+		sem_destroy(&(worker->Done));
+		ILibWebRTC_HandshakeWorker_Destroy(worker);
+		free(worker);
+	}
+	if (obj->HandshakeWorkers != NULL) { free(obj->HandshakeWorkers); obj->HandshakeWorkers = NULL; }
+	obj->HandshakeWorkerCount = 0;
+}
+
+void ILibWebRTC_SetHandshakeWorkers(void *stunModule, int workerCount)
+{
+	struct ILibStun_Module *obj = (struct ILibStun_Module*)stunModule;
+	int i;
+
+	if (obj->HandshakeWorkers != NULL || workerCount <= 0) { return; }
+
+	util_openssl_threadsafe();
+	if ((obj->HandshakeWorkers = (ILibWebRTC_HandshakeWorker**)malloc(workerCount * sizeof(ILibWebRTC_HandshakeWorker*))) == NULL) ILIBCRITICALEXIT(254);
+	for (i = 0; i < workerCount; ++i)
+	{
+		if ((obj->HandshakeWorkers[i] = (ILibWebRTC_HandshakeWorker*)malloc(sizeof(ILibWebRTC_HandshakeWorker))) == NULL) ILIBCRITICALEXIT(254);
+		memset(obj->HandshakeWorkers[i], 0, sizeof(ILibWebRTC_HandshakeWorker));
+		ILibWebRTC_HandshakeWorker_Init(obj->HandshakeWorkers[i]);
+		sem_init(&(obj->HandshakeWorkers[i]->ProcessLock), 0, 1);
+		sem_init(&(obj->HandshakeWorkers[i]->Done), 0, 0);
+		obj->HandshakeWorkers[i]->Jobs = ILibQueue_Create();
+		ILibSpawnNormalThread((voidfp)&ILibWebRTC_HandshakeWorker_Run, obj->HandshakeWorkers[i]);
+	}
+	obj->HandshakeWorkerCount = workerCount;
 }
 
 void ILibStun_OnUDP(ILibAsyncUDPSocket_SocketModule socketModule, char* buffer, int bufferLength, struct sockaddr_in6 *remoteInterface, void *user, void *user2, int *PAUSE)
@@ -4821,6 +6830,15 @@ void ILibStun_OnUDP(ILibAsyncUDPSocket_SocketModule socketModule, char* buffer,
 					}
 				}
 			}
+			else if (obj->IceStates[i] != NULL && obj->IceStates[i]->restartSession >= 0 && obj->dTlsSessions[obj->IceStates[i]->restartSession] != NULL)
+			{
+				// While ICE is restarting, the old pair keeps working
+				if (memcmp(&(obj->dTlsSessions[obj->IceStates[i]->restartSession]->remoteInterface), remoteInterface, INET_SOCKADDR_LENGTH(remoteInterface->sin6_family)) == 0)
+				{
+					existingSession = obj->IceStates[i]->restartSession;
+					break;
+				}
+			}
 		}
 
 		if (existingSession < 0)
@@ -4846,6 +6864,7 @@ void ILibStun_OnUDP(ILibAsyncUDPSocket_SocketModule socketModule, char* buffer,
 									// This Candidate was Allowed, let's switch to this candidate
 									memcpy(&(obj->dTlsSessions[obj->IceStates[i]->dtlsSession]->remoteInterface), remoteInterface, INET_SOCKADDR_LENGTH(remoteInterface->sin6_family));
 									existingSession = obj->IceStates[i]->dtlsSession;
+									ILibSCTP_OnPathChanged(obj->dTlsSessions[existingSession], -1);
 									break;
 								}
 							}
@@ -4855,11 +6874,35 @@ void ILibStun_OnUDP(ILibAsyncUDPSocket_SocketModule socketModule, char* buffer,
 				}
 			}
 		}
+
+		if (existingSession < 0)
+		{
+			//
+			// DTLS on a pair selected by an ICE restart, before we saw the nomination
+			//
+			for (i = 0; i < ILibSTUN_MaxSlots && existingSession < 0; ++i)
+			{
+				if (obj->IceStates[i] != NULL && obj->IceStates[i]->restartSession >= 0)
+				{
+					for (cx = 0; cx < obj->IceStates[i]->hostcandidatecount; ++cx)
+					{
+						if (obj->IceStates[i]->hostcandidates[cx].port == remoteInterface->sin6_port && obj->IceStates[i]->hostcandidates[cx].addr == ((struct sockaddr_in*)remoteInterface)->sin_addr.s_addr && obj->IceStates[i]->hostcandidateResponseFlag[cx] == 1)
+						{
+							if (ILibStun_ICE_CompleteRestart(obj->IceStates[i], remoteInterface) == 0) { existingSession = obj->IceStates[i]->dtlsSession; }
+							break;
+						}
+					}
+				}
+			}
+		}
 	}
 	// Check if this is for a new dTLS session
 	// Modified to remove the dTLS Hello detection, because if this isn't a STUN packet, it has to be dTLS. OpenSSL will just fail the handshake if it isn't, which is fine.
 	if (existingSession == -1) 
 	{
+		// Only peers that echo our cookie get a session
+		if (obj->SecurityContext != NULL && ILibWebRTC_DTLS_CheckClientHello(obj, socketModule == NULL ? 1 : 0, buffer, bufferLength, remoteInterface) != 0) { return; }
+
 		// We don't have a session established yet, so just check to see if the candidate is allowed
 		for (i = 0; i < ILibSTUN_MaxSlots; ++i)
 		{
@@ -4919,11 +6962,12 @@ void ILibStun_OnUDP(ILibAsyncUDPSocket_SocketModule socketModule, char* buffer,
 		// Bind everything
 		SSL_set_bio(obj->dTlsSessions[j]->ssl, read, write);
 		SSL_set_accept_state(obj->dTlsSessions[j]->ssl);
+		obj->dTlsSessions[j]->dtlsListen = 1;
 
 		// Start the timer
 		//ILibLifeTime_AddEx(obj->Timer, obj->dTlsSessions[j], 100, &ILibStun_SctpOnTimeout, NULL); //Moved this to after DTLS is setup, becuase SCTP might not be setup yet
 
-		switch (SSL_do_handshake(obj->dTlsSessions[j]->ssl))
+		switch (ILibWebRTC_DTLS_DoHandshake(obj->dTlsSessions[j]))
 		{
 		case 0:
 			//
@@ -4973,6 +7017,13 @@ void ILibStun_OnUDP(ILibAsyncUDPSocket_SocketModule socketModule, char* buffer,
 		existingSession = j;
 	}
 
+	if (existingSession != -1 && obj->HandshakeWorkers != NULL && obj->dTlsSessions[existingSession]->state == 4)
+	{
+		// The handshake is run on a worker thread, which hands the session back to us once it's established
+		ILibWebRTC_HandshakeWorker_Submit(obj, existingSession, buffer, bufferLength, socketModule == NULL ? 1 : 0, remoteInterface);
+		return;
+	}
+
 	// If we have an existing dTLS session, process the data. This can also happen right after we create the session above.
 	if (existingSession != -1 && (obj->dTlsSessions[existingSession]->state == 1 || obj->dTlsSessions[existingSession]->state == 2 || obj->dTlsSessions[existingSession]->state == 4))
 	{
@@ -4983,7 +7034,7 @@ void ILibStun_OnUDP(ILibAsyncUDPSocket_SocketModule socketModule, char* buffer,
 			ILibWebRTC_DTLS_HandshakeDetect(obj, "R ", buffer, 0, bufferLength);
 
 			// Connecting... Handshake isn't done yet
-			switch (SSL_do_handshake(obj->dTlsSessions[existingSession]->ssl))
+			switch (ILibWebRTC_DTLS_DoHandshake(obj->dTlsSessions[existingSession]))
 			{
 			case 0:
 				// Handshake Failed!
@@ -5007,17 +7058,22 @@ void ILibStun_OnUDP(ILibAsyncUDPSocket_SocketModule socketModule, char* buffer,
 		}
 		else
 		{
-			i = SSL_read(obj->dTlsSessions[existingSession]->ssl, tbuffer, 4096);
+			// Decrypt into a pooled buffer, so the application can retain the payloads without copying them
+			ILibSCTP_ReceiveBuffer *receiveBuffer = ILibSCTP_ReceiveBuffer_Allocate(obj->ReceiveBufferPool, ILibSCTP_ReceiveBufferSize);
+			i = SSL_read(obj->dTlsSessions[existingSession]->ssl, ILibSCTP_ReceiveBuffer_Data(receiveBuffer), ILibSCTP_ReceiveBufferSize);
 			sem_post(&(obj->dTlsSessions[existingSession]->Lock));
 			if (i > 0)
 			{
 				// We got new dTLS data
-				ILibStun_ProcessSctpPacket(obj, existingSession, tbuffer, i);
+				obj->ReceiveBuffer = receiveBuffer;
+				ILibStun_ProcessSctpPacket(obj, existingSession, ILibSCTP_ReceiveBuffer_Data(receiveBuffer), i);
+				obj->ReceiveBuffer = NULL;
 			}
 			else if (i == 0)
 			{
 				// Session closed, perform cleanup
 				ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_DTLS, ILibRemoteLogging_Flags_VerbosityLevel_1, "DTLS Session: %d was closed", existingSession);
+				ILibSCTP_ReceiveBuffer_Release(receiveBuffer);
 				ILibStun_SctpDisconnect(obj, existingSession);
 				return;
 			}
@@ -5025,6 +7081,7 @@ void ILibStun_OnUDP(ILibAsyncUDPSocket_SocketModule socketModule, char* buffer,
 			{
 				i = SSL_get_error(obj->dTlsSessions[existingSession]->ssl, i);
 			}
+			ILibSCTP_ReceiveBuffer_Release(receiveBuffer);
 		}
 
 		if (obj->dTlsSessions[existingSession] != NULL && obj->dTlsSessions[existingSession]->state != 0)
@@ -5184,12 +7241,42 @@ void ILibWebRTC_SetTurnServer(void* stunModule, struct sockaddr_in6* turnServer,
 	}
 }
 
+void ILibWebRTC_SetTurnServerTransport(void *stunModule, ILibTURN_ServerTransports transport)
+{
+	ILibTURN_SetServerTransport(((struct ILibStun_Module*)stunModule)->mTurnClientModule, transport);
+}
+
 void ILibWebRTC_DisableConsentFreshness(void *stunModule)
 {
 	struct ILibStun_Module *obj = (struct ILibStun_Module*)stunModule;
 	obj->consentFreshnessDisabled = 1;
 }
 
+void ILibWebRTC_SetSessionResumption(void *stunModule, int maxSessions, int timeoutSeconds)
+{
+	struct ILibStun_Module *obj = (struct ILibStun_Module*)stunModule;
+
+	ILibWebRTC_Resumption_Clear(obj);
+	if (obj->SecurityContext == NULL) { return; }
+
+	if (maxSessions <= 0 || timeoutSeconds <= 0)
+	{
+		SSL_CTX_set_session_cache_mode(obj->SecurityContext, SSL_SESS_CACHE_OFF);
+		return;
+	}
+
+	if ((obj->resumptionCache = (ILibWebRTC_ResumptionEntry*)malloc(maxSessions * sizeof(ILibWebRTC_ResumptionEntry))) == NULL) { ILIBCRITICALEXIT(254); }
+	memset(obj->resumptionCache, 0, maxSessions * sizeof(ILibWebRTC_ResumptionEntry));
+	obj->resumptionMaxSessions = maxSessions;
+
+	// Session IDs only, so the server side state stays bounded by the cache size and no ticket keys need rotating
+	SSL_CTX_set_options(obj->SecurityContext, SSL_OP_NO_TICKET);
+	SSL_CTX_set_session_id_context(obj->SecurityContext, (unsigned char*)obj->CertThumbprint, obj->CertThumbprintLength);
+	SSL_CTX_set_session_cache_mode(obj->SecurityContext, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_sess_set_cache_size(obj->SecurityContext, maxSessions);
+	SSL_CTX_set_timeout(obj->SecurityContext, timeoutSeconds);
+}
+
 void ILibStunClient_SetOptions(void* StunModule, SSL_CTX* securityContext, char* certThumbprintSha256)
 {
 	struct ILibStun_Module *obj = (struct ILibStun_Module*)StunModule;
@@ -5203,6 +7290,8 @@ void ILibStunClient_SetOptions(void* StunModule, SSL_CTX* securityContext, char*
 		SSL_CTX_set_session_cache_mode(obj->SecurityContext, SSL_SESS_CACHE_OFF);
 		SSL_CTX_set_read_ahead(obj->SecurityContext, 1);
 		SSL_CTX_set_verify(obj->SecurityContext, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, ILibStunClient_dTLS_verify_callback);
+		SSL_CTX_set_cookie_generate_cb(obj->SecurityContext, &ILibWebRTC_DTLS_OnGenerateCookie);
+		SSL_CTX_set_cookie_verify_cb(obj->SecurityContext, &ILibWebRTC_DTLS_OnVerifyCookie);
 	}
 }
 
@@ -5238,7 +7327,22 @@ void* ILibStunClient_Start(void *Chain, unsigned short LocalPort, ILibStunClient
 
 	obj->Timer = ILibGetBaseTimer(Chain);
 	obj->State = STUN_STATUS_CHECKING_UDP_CONNECTIVITY;
+	obj->maxSendBufferSize = ILibSCTP_MaxSendBufferSize;
+	util_random(32, obj->cookieSecrets[0]);
+	util_random(32, obj->cookieSecrets[1]);
+	obj->cookieSecretTime = ILibGetUptime();
+	obj->rtoMin = RTO_MIN;
+	obj->rtoMax = RTO_MAX;
+	obj->delayedAckTime = ILibSCTP_DelayedAckTime;
+	obj->ReceiveBufferPool = ILibSCTP_ReceiveBufferPool_Create();
 	util_random(32, obj->Secret); // Random used to generate integrity keys
+	obj->resultCache = ILibInitHashTree();
+	obj->resultRoutes = ILibInitHashTree();
+	obj->resultCacheTTL = ILibStunClient_ResultCacheTTL;
+	obj->pathProbeInterval = ILibStun_PathProbeInterval;
+#if defined(__linux__)
+	obj->InterfaceMonitor = ILibStun_InterfaceMonitor_Create(obj);
+#endif
 
 	// Init TURN Client
 	obj->mTurnClientModule = ILibTURN_CreateTurnClient(Chain, ILibWebRTC_OnTurnConnect, ILibWebRTC_OnTurnAllocate, ILibWebRTC_OnTurnDataIndication, ILibWebRTC_OnTurnChannelData);
@@ -5258,24 +7362,24 @@ void ILibStun_OnTimeout(void *object)
 		break;
 	case STUN_STATUS_CHECKING_UDP_CONNECTIVITY:
 		// No UDP connectivity
-		if (obj->OnResult != NULL) { obj->OnResult(obj, ILibStun_Results_Unknown, NULL, obj->user); }
+		ILibStun_ReportResult(obj, ILibStun_Results_Unknown, NULL);
 		ILibStun_OnCompleted(obj);
 		break;
 	case STUN_STATUS_CHECKING_FULL_CONE_NAT:
 	{
 		// We're not supposed to trigger this case. If we did, it means the StunSever we are using does not implement RFC5389/5780
-		if (obj->OnResult != NULL) { obj->OnResult(obj, ILibStun_Results_RFC5780_NOT_IMPLEMENTED, (struct sockaddr_in*)&(obj->Public), obj->user); }
+		ILibStun_ReportResult(obj, ILibStun_Results_RFC5780_NOT_IMPLEMENTED, (struct sockaddr_in*)&(obj->Public));
 		ILibStun_OnCompleted(obj);
 	}
 		break;
 	case STUN_STATUS_CHECKING_RESTRICTED_NAT:
 		// Port Restricted NAT
-		if (obj->OnResult != NULL) { obj->OnResult(obj, ILibStun_Results_Port_Restricted_NAT, (struct sockaddr_in*)&(obj->Public), obj->user); }
+		ILibStun_ReportResult(obj, ILibStun_Results_Port_Restricted_NAT, (struct sockaddr_in*)&(obj->Public));
 		ILibStun_OnCompleted(obj);
 		break;
 	case STUN_STATUS_CHECKING_SYMETRIC_NAT:
 		// Symetric NAT
-		if (obj->OnResult != NULL) { obj->OnResult(obj, ILibStun_Results_Symetric_NAT, (struct sockaddr_in*)&(obj->Public), obj->user); }		// NOTE: Changed "ILibStun_Results_Unknown" that was here, is that ok??
+		ILibStun_ReportResult(obj, ILibStun_Results_Symetric_NAT, (struct sockaddr_in*)&(obj->Public));		// NOTE: Changed "ILibStun_Results_Unknown" that was here, is that ok??
 		ILibStun_OnCompleted(obj);
 		break;
 	}
@@ -5288,6 +7392,9 @@ void ILibStunClient_PerformNATBehaviorDiscovery(void* StunModule, struct sockadd
 	memcpy(&(obj->StunServer), StunServer, INET_SOCKADDR_LENGTH(StunServer->sin_family));
 	obj->user = user;
 	obj->State = STUN_STATUS_CHECKING_UDP_CONNECTIVITY;
+	obj->stunMode = 1;
+	obj->stunPending = 1;
+	ILibStun_ResultCache_SetRoute(obj);
 	ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "Performing NAT Behavior Discovery with: %s:%u", ILibRemoteLogging_ConvertAddress((struct sockaddr*)StunServer), ntohs(StunServer->sin_port));
 	ILib_Stun_SendAttributeChangeRequest(obj, (struct sockaddr*)&(obj->StunServer), 0x8000);
 	ILibLifeTime_Add(obj->Timer, obj, ILibStunClient_TIMEOUT, &ILibStun_OnTimeout, NULL);
@@ -5299,46 +7406,346 @@ void ILibStunClient_PerformStun(void* StunModule, struct sockaddr_in* StunServer
 	memcpy(&(obj->StunServer), StunServer, INET_SOCKADDR_LENGTH(StunServer->sin_family));
 	obj->user = user;
 	obj->State = STUN_STATUS_CHECKING_UDP_CONNECTIVITY;
+	obj->stunMode = 0;
+	obj->stunPending = 1;
+	ILibStun_ResultCache_SetRoute(obj);
 	ILibRemoteLogging_printf(ILibChainGetLogger(obj->Chain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "Performing STUN with: %s:%u", ILibRemoteLogging_ConvertAddress((struct sockaddr*)StunServer), ntohs(StunServer->sin_port));
 	ILib_Stun_SendAttributeChangeRequest(obj, (struct sockaddr*)&(obj->StunServer), 0x00);
 	ILibLifeTime_Add(obj->Timer, obj, ILibStunClient_TIMEOUT, &ILibStun_OnTimeout, NULL);
 }
 
-void ILibStunClient_SendData(void* StunModule, struct sockaddr* target, char* data, int datalen, enum ILibAsyncSocket_MemoryOwnership UserFree)
+//
+// STUN results are cached per Local Interface and STUN Server, so the next offer doesn't have to wait for a round trip.
+// The interface is the one the exchange goes out on. The socket is bound to any address, so it is found with a route lookup
+// when the exchange starts, and remembered per STUN Server for the lookups. Entries that are in use are refreshed in the
+// background before they expire, which also picks up route changes.
+//
+typedef struct ILibStun_CachedResult
 {
-	if (target->sa_family == AF_INET) ILibAsyncUDPSocket_SendTo(((struct ILibStun_Module*)StunModule)->UDP, (struct sockaddr*)target, data, datalen, UserFree);
-	else if (target->sa_family == AF_INET6) ILibAsyncUDPSocket_SendTo(((struct ILibStun_Module*)StunModule)->UDP6, (struct sockaddr*)target, data, datalen, UserFree);
-}
+	struct ILibStun_Module *module;
+	char key[13];
+	int mode;
+	struct sockaddr_in server;
+	ILibStun_Results result;
+	struct sockaddr_in publicAddress;
+	long long expires;
+	long long lastUsed;
+}ILibStun_CachedResult;
 
-struct ILibTURN_TurnClientObject
-{
-	ILibChain_PreSelect PreSelect;
-	ILibChain_PostSelect PostSelect;
-	ILibChain_Destroy Destroy;
-	ILibTURN_OnConnectTurnHandler OnConnectTurnCallback;
-	ILibTURN_OnAllocateHandler OnAllocateCallback;
-	ILibTURN_OnDataIndicationHandler OnDataIndicationCallback;
-	ILibTURN_OnChannelDataHandler OnChannelDataCallback;
+char ILibStun_ResultCache_RefreshUser;	// Marks exchanges started by the cache, whose results aren't passed to OnResult
 
-	void* TAG;
-	void* tcpClient;
-	char* username;
-	int usernameLen;
-	char* password;
-	int passwordLen;
-	void* transactionData;
-	void* sendOkStack;
+// The module's socket is bound to any address, so look up which interface the routing table sends to 'server' from.
+// Connecting a UDP socket only does the route lookup, nothing goes out on the wire
+void ILibStun_ResultCache_GetRoute(struct sockaddr_in *server, struct in_addr *local)
+{
+	struct sockaddr_in localAddress;
+#if defined(WINSOCK2)
+	int localAddressLength = sizeof(struct sockaddr_in);
+#else
+	socklen_t localAddressLength = sizeof(struct sockaddr_in);
+#endif
+	SOCKET sock;
 
-	char* currentNonce;
-	int currentNonceLen;
-	char* currentRealm;
-	int currentRealmLen;
-};
+	memset(&localAddress, 0, sizeof(struct sockaddr_in));
+	if ((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) != (SOCKET)-1)
+	{
+		if (connect(sock, (struct sockaddr*)server, sizeof(struct sockaddr_in)) != 0 || getsockname(sock, (struct sockaddr*)&localAddress, &localAddressLength) != 0)
+		{
+			memset(&localAddress, 0, sizeof(struct sockaddr_in));
+		}
+#if defined(WIN32)
+		closesocket(sock);
+#else
+		close(sock);
+#endif
+	}
+	memcpy(local, &(localAddress.sin_addr), 4);
+}
 
-void ILibTURN_OnDestroy(void* object)
+// Called once when an exchange starts, so looking up a cached result never has to make system calls
+void ILibStun_ResultCache_SetRoute(struct ILibStun_Module *obj)
 {
-	struct ILibTURN_TurnClientObject* turn = (struct ILibTURN_TurnClientObject*)object;
-	ILibDestroyHashTree(turn->transactionData);
+	memset(&(obj->stunRoute), 0, sizeof(struct in_addr));	// Stays empty if caching is off or there is no route, so the result isn't cached
+	if (obj->LocalIf.sin_addr.s_addr != INADDR_ANY)
+	{
+		obj->stunRoute = obj->LocalIf.sin_addr;
+	}
+	else if (obj->resultCache != NULL && obj->resultCacheTTL > 0)
+	{
+		ILibStun_ResultCache_GetRoute((struct sockaddr_in*)&(obj->StunServer), &(obj->stunRoute));
+	}
+}
+
+int ILibStun_ResultCache_RouteKey(struct sockaddr_in *server, char *key)
+{
+	memcpy(key, &(server->sin_addr), 4);
+	memcpy(key + 4, &(server->sin_port), 2);
+	return 6;
+}
+
+int ILibStun_ResultCache_Key(struct ILibStun_Module *obj, int mode, struct in_addr *local, struct sockaddr_in *server, char *key)
+{
+	key[0] = (char)mode;
+	memcpy(key + 1, local, 4);
+	memcpy(key + 5, &(obj->LocalIf.sin_port), 2);
+	memcpy(key + 7, &(server->sin_addr), 4);
+	memcpy(key + 11, &(server->sin_port), 2);
+	return 13;
+}
+
+void ILibStun_ResultCache_Remove(ILibStun_CachedResult *entry)
+{
+	ILibLifeTime_Remove(entry->module->Timer, entry);
+	ILibDeleteEntry(entry->module->resultCache, entry->key, sizeof(entry->key));
+	free(entry);
+}
+
+void ILibStun_ResultCache_OnRefresh(void *object)
+{
+	ILibStun_CachedResult *entry = (ILibStun_CachedResult*)object;
+	struct ILibStun_Module *obj = entry->module;
+	struct sockaddr_in server;
+
+	if (entry->lastUsed + (long long)obj->resultCacheTTL * 1000 < ILibGetUptime())
+	{
+		// Nobody asked for this result for a whole TTL, so let it go instead of keeping the exchange going
+		ILibStun_ResultCache_Remove(entry);
+		return;
+	}
+	if (obj->stunPending != 0)
+	{
+		// The module runs one exchange at a time
+		ILibLifeTime_AddEx(obj->Timer, entry, ILibStunClient_ResultCacheRetry, &ILibStun_ResultCache_OnRefresh, NULL);
+		return;
+	}
+
+	memcpy(&server, &(entry->server), sizeof(struct sockaddr_in));
+	if (entry->mode != 0)
+	{
+		ILibStunClient_PerformNATBehaviorDiscovery(obj, &server, &ILibStun_ResultCache_RefreshUser);
+	}
+	else
+	{
+		ILibStunClient_PerformStun(obj, &server, &ILibStun_ResultCache_RefreshUser);
+	}
+}
+
+void ILibStun_ResultCache_Clear(struct ILibStun_Module *obj)
+{
+	void *en, *entry;
+	char *key;
+	int keyLength;
+
+	if (obj->resultCache == NULL) { return; }
+	en = ILibHashTree_GetEnumerator(obj->resultCache);
+	while (ILibHashTree_MoveNext(en) == 0)
+	{
+		ILibHashTree_GetValue(en, &key, &keyLength, &entry);
+		ILibLifeTime_Remove(obj->Timer, entry);
+		free(entry);
+	}
+	ILibHashTree_DestroyEnumerator(en);
+	ILibDestroyHashTree(obj->resultCache);
+	ILibDestroyHashTree(obj->resultRoutes);
+	obj->resultCache = NULL;
+	obj->resultRoutes = NULL;
+}
+
+void ILibStun_ReportResult(struct ILibStun_Module *obj, ILibStun_Results result, struct sockaddr_in *publicIP)
+{
+	ILibStun_CachedResult *entry;
+	char key[13];
+	char routeKey[6];
+
+	obj->stunPending = 0;
+	if (obj->resultCache != NULL && obj->resultCacheTTL > 0 && obj->stunRoute.s_addr != INADDR_ANY)
+	{
+		ILibStun_ResultCache_Key(obj, obj->stunMode, &(obj->stunRoute), (struct sockaddr_in*)&(obj->StunServer), key);
+		entry = (ILibStun_CachedResult*)ILibGetEntry(obj->resultCache, key, sizeof(key));
+		if (result == ILibStun_Results_Unknown || publicIP == NULL)
+		{
+			// The server didn't answer, so whatever we had for it can't be trusted anymore
+			if (entry != NULL) { ILibStun_ResultCache_Remove(entry); }
+		}
+		else
+		{
+			if (entry == NULL)
+			{
+				if ((entry = (ILibStun_CachedResult*)malloc(sizeof(ILibStun_CachedResult))) == NULL) { ILIBCRITICALEXIT(254); }
+				memset(entry, 0, sizeof(ILibStun_CachedResult));
+				entry->module = obj;
+				memcpy(entry->key, key, sizeof(key));
+				entry->mode = obj->stunMode;
+				memcpy(&(entry->server), &(obj->StunServer), sizeof(struct sockaddr_in));
+				entry->lastUsed = ILibGetUptime();
+				ILibAddEntry(obj->resultCache, entry->key, sizeof(entry->key), entry);
+			}
+			else
+			{
+				ILibLifeTime_Remove(obj->Timer, entry);
+			}
+			entry->result = result;
+			memcpy(&(entry->publicAddress), publicIP, sizeof(struct sockaddr_in));
+			ILibAddEntryEx(obj->resultRoutes, routeKey, ILibStun_ResultCache_RouteKey((struct sockaddr_in*)&(obj->StunServer), routeKey), NULL, (int)obj->stunRoute.s_addr);
+			entry->expires = ILibGetUptime() + (long long)obj->resultCacheTTL * 1000;
+			ILibLifeTime_AddEx(obj->Timer, entry, obj->resultCacheTTL * 750, &ILibStun_ResultCache_OnRefresh, NULL);
+		}
+	}
+
+	if (obj->user != &ILibStun_ResultCache_RefreshUser && obj->OnResult != NULL) { obj->OnResult(obj, result, publicIP, obj->user); }
+}
+
+int ILibStunClient_GetCachedResult(void* StunModule, struct sockaddr_in* StunServer, int natBehaviorDiscovery, ILibStun_Results *result, struct sockaddr_in *publicIP)
+{
+	struct ILibStun_Module *obj = (struct ILibStun_Module*)StunModule;
+	ILibStun_CachedResult *entry;
+	struct in_addr local;
+	char key[13];
+	void *unused;
+	int route = 0;
+
+	if (obj->resultCache == NULL || StunServer->sin_family != AF_INET) { return 0; }
+	if (obj->LocalIf.sin_addr.s_addr != INADDR_ANY)
+	{
+		local = obj->LocalIf.sin_addr;
+	}
+	else
+	{
+		// No route means no exchange with this server made it into the cache
+		ILibGetEntryEx(obj->resultRoutes, key, ILibStun_ResultCache_RouteKey(StunServer, key), &unused, &route);
+		if (route == 0) { return 0; }
+		local.s_addr = (unsigned int)route;
+	}
+	ILibStun_ResultCache_Key(obj, natBehaviorDiscovery != 0 ? 1 : 0, &local, StunServer, key);
+	entry = (ILibStun_CachedResult*)ILibGetEntry(obj->resultCache, key, sizeof(key));
+	if (entry == NULL || entry->expires < ILibGetUptime()) { return 0; }
+
+	entry->lastUsed = ILibGetUptime();
+	if (result != NULL) { *result = entry->result; }
+	if (publicIP != NULL) { memcpy(publicIP, &(entry->publicAddress), sizeof(struct sockaddr_in)); }
+	return 1;
+}
+
+// Drops every cached result, but keeps the cache
+void ILibStun_ResultCache_Flush(struct ILibStun_Module *obj)
+{
+	ILibStun_CachedResult *entry;
+	void *en, *entries, *node;
+	char *key;
+	int keyLength;
+
+	if (obj->resultCache == NULL) { return; }
+	entries = ILibLinkedList_Create();
+	en = ILibHashTree_GetEnumerator(obj->resultCache);
+	while (ILibHashTree_MoveNext(en) == 0) { ILibHashTree_GetValue(en, &key, &keyLength, (void**)&entry); ILibLinkedList_AddTail(entries, entry); }
+	ILibHashTree_DestroyEnumerator(en);
+	node = ILibLinkedList_GetNode_Head(entries);
+	while (node != NULL)
+	{
+		ILibStun_ResultCache_Remove((ILibStun_CachedResult*)ILibLinkedList_GetDataFromNode(node));
+		node = ILibLinkedList_Remove(node);
+	}
+	ILibLinkedList_Destroy(entries);
+
+	// The routes go with them, the next exchange looks them up again
+	ILibDestroyHashTree(obj->resultRoutes);
+	obj->resultRoutes = ILibInitHashTree();
+}
+
+void ILibStunClient_SetResultCacheTTL(void* StunModule, int seconds)
+{
+	struct ILibStun_Module *obj = (struct ILibStun_Module*)StunModule;
+
+	// Caching was turned off, so drop what we have
+	obj->resultCacheTTL = seconds;
+	if (seconds <= 0) { ILibStun_ResultCache_Flush(obj); }
+}
+
+void ILibStunClient_SendData(void* StunModule, struct sockaddr* target, char* data, int datalen, enum ILibAsyncSocket_MemoryOwnership UserFree)
+{
+	if (target->sa_family == AF_INET) ILibAsyncUDPSocket_SendTo(((struct ILibStun_Module*)StunModule)->UDP, (struct sockaddr*)target, data, datalen, UserFree);
+	else if (target->sa_family == AF_INET6) ILibAsyncUDPSocket_SendTo(((struct ILibStun_Module*)StunModule)->UDP6, (struct sockaddr*)target, data, datalen, UserFree);
+}
+
+// Over UDP, TURN requests are retransmitted as per RFC 5389 (Section 7.2.1)
+#define ILibTURN_UDP_RTO 500
+#define ILibTURN_UDP_MaxTransmissions 7
+
+// Largest framing TURN adds around relayed data: STUN header, XOR-PEER-ADDRESS, DATA header and padding, FINGERPRINT
+#define ILibTURN_FrameHeadroom 64
+#define ILibTURN_MaxFrameSize (ILibRUDP_MaxMTU + ILibTURN_FrameHeadroom)
+#define ILibTURN_MaxRequestSize 512
+
+// Allocations, permissions and channel bindings are all refreshed from one timer per client (RFC 8656, Sections 7, 9 and 12)
+#define ILibTURN_RefreshInterval 60000				// How often the refresh cycle runs
+#define ILibTURN_AllocationLifetime 600				// Lifetime (seconds) we ask for when refreshing the allocation
+#define ILibTURN_PermissionRefresh 240000			// Permissions last 5 minutes
+#define ILibTURN_ChannelRefresh 540000				// Channel bindings last 10 minutes
+#define ILibTURN_PermissionsPerRequest 8			// Peers batched into a single CreatePermission refresh
+
+struct ILibTURN_TurnClientObject
+{
+	ILibChain_PreSelect PreSelect;
+	ILibChain_PostSelect PostSelect;
+	ILibChain_Destroy Destroy;
+	ILibTURN_OnConnectTurnHandler OnConnectTurnCallback;
+	ILibTURN_OnAllocateHandler OnAllocateCallback;
+	ILibTURN_OnDataIndicationHandler OnDataIndicationCallback;
+	ILibTURN_OnChannelDataHandler OnChannelDataCallback;
+
+	void* TAG;
+	void* Chain;
+	void* tcpClient;
+	void* udpClient;
+	void* udpClient6;
+	ILibTURN_ServerTransports transport;
+	int udpConnected;
+	struct sockaddr_in6 serverAddress;
+	void* retransmitData;
+	unsigned int tcpReads;
+	unsigned int tcpFrames;
+
+	ILibStun_IntegrityContext integrity;		// Keyed with MD5(username:realm:password), so it only changes with the realm or the credentials
+	void* permissions;							// Peer address -> ILibTURN_RefreshPeer
+	void* channels;								// Channel number -> ILibTURN_RefreshPeer
+	long long allocationExpires;
+	char* username;
+	int usernameLen;
+	char* password;
+	int passwordLen;
+	void* transactionData;
+	void* sendOkStack;
+
+	char* currentNonce;
+	int currentNonceLen;
+	char* currentRealm;
+	int currentRealmLen;
+};
+
+void ILibTURN_OnDestroy(void* object)
+{
+	struct ILibTURN_TurnClientObject* turn = (struct ILibTURN_TurnClientObject*)object;
+	void *en;
+	char *key;
+	int keyLength;
+	void *data;
+
+	en = ILibHashTree_GetEnumerator(turn->transactionData);
+	while (ILibHashTree_MoveNext(en) == 0) { ILibHashTree_GetValue(en, &key, &keyLength, &data); free(data); }
+	ILibHashTree_DestroyEnumerator(en);
+	ILibDestroyHashTree(turn->transactionData);
+	ILibDestroyHashTree(turn->retransmitData);
+	ILibStun_IntegrityContext_Cleanup(&(turn->integrity));
+
+	en = ILibHashTree_GetEnumerator(turn->permissions);
+	while (ILibHashTree_MoveNext(en) == 0) { ILibHashTree_GetValue(en, &key, &keyLength, &data); free(data); }
+	ILibHashTree_DestroyEnumerator(en);
+	ILibDestroyHashTree(turn->permissions);
+
+	en = ILibHashTree_GetEnumerator(turn->channels);
+	while (ILibHashTree_MoveNext(en) == 0) { ILibHashTree_GetValue(en, &key, &keyLength, &data); free(data); }
+	ILibHashTree_DestroyEnumerator(en);
+	ILibDestroyHashTree(turn->channels);
 }
 
 void ILibTURN_SetTag(ILibTURN_ClientModule clientModule, void *tag)
@@ -5354,12 +7761,46 @@ void* ILibTURN_GetTag(ILibTURN_ClientModule clientModule)
 
 int ILibTURN_IsConnectedToServer(ILibTURN_ClientModule clientModule)
 {
-	return (ILibAsyncSocket_IsConnected(((struct ILibTURN_TurnClientObject*)clientModule)->tcpClient));
+	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)clientModule;
+	if (turn->transport == ILibTURN_ServerTransport_UDP) { return(turn->udpConnected); }
+	return (ILibAsyncSocket_IsConnected(turn->tcpClient));
 }
 
 void ILibTURN_DisconnectFromServer(ILibTURN_ClientModule clientModule)
 {
-	ILibAsyncSocket_Disconnect(((struct ILibTURN_TurnClientObject*)clientModule)->tcpClient);
+	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)clientModule;
+	if (turn->transport == ILibTURN_ServerTransport_UDP)
+	{
+		// There is no connection to tear down, but pending retransmissions will give up once they see this
+		turn->udpConnected = 0;
+		return;
+	}
+	ILibAsyncSocket_Disconnect(turn->tcpClient);
+}
+
+void ILibTURN_SetServerTransport(ILibTURN_ClientModule turnModule, ILibTURN_ServerTransports transport)
+{
+	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)turnModule;
+	if (turn->transport == transport) { return; }
+
+	if (ILibTURN_IsConnectedToServer(turn) != 0) { ILibTURN_DisconnectFromServer(turn); }
+	turn->transport = transport;
+}
+
+// Sends a frame to the TURN server, on whichever transport this client is using
+enum ILibAsyncSocket_SendStatus ILibTURN_SendToServer(struct ILibTURN_TurnClientObject *turn, char* buffer, int length, enum ILibAsyncSocket_MemoryOwnership UserFree)
+{
+	void *udp;
+
+	if (turn->transport != ILibTURN_ServerTransport_UDP) { return(ILibAsyncSocket_Send(turn->tcpClient, buffer, length, UserFree)); }
+
+	udp = turn->serverAddress.sin6_family == AF_INET6 ? turn->udpClient6 : turn->udpClient;
+	if (turn->udpConnected == 0 || udp == NULL)
+	{
+		if (UserFree == ILibAsyncSocket_MemoryOwnership_CHAIN) { free(buffer); }
+		return(ILibAsyncSocket_SEND_ON_CLOSED_SOCKET_ERROR);
+	}
+	return(ILibAsyncUDPSocket_SendTo(udp, (struct sockaddr*)&(turn->serverAddress), buffer, length, UserFree));
 }
 
 void ILibTURN_ProcessChannelData(struct ILibTURN_TurnClientObject *turn, unsigned short ChannelNumber, char* buffer, int offset, int length)
@@ -5442,24 +7883,21 @@ void ILibTURN_GenerateIntegrityKey(char* username, char* realm, char* password,
 	util_md5(key, keyLen, integrityKey);
 }
 
-// integrity must be at least 20 in size
-void ILibTURN_CalculateMessageIntegrity(char* buffer, int offset, int length, char* key, int keyLen, char* integrity)
+// Derives the long-term credential key, and keys the cached HMAC with it. Only needed when the realm or the credentials change
+void ILibTURN_UpdateIntegrity(struct ILibTURN_TurnClientObject *turn)
 {
-	HMAC_CTX hmac;
-	unsigned int hmaclen = 20;
+	char integrityKey[16];
 
-	// Setup and perform HMAC-SHA1
-	HMAC_CTX_init(&hmac);
-	HMAC_Init_ex(&hmac, key, keyLen, EVP_sha1(), NULL);
-	HMAC_Update(&hmac, (unsigned char*)buffer + offset, length);
-	HMAC_Final(&hmac, (unsigned char*)integrity, &hmaclen); // Put the HMAC in the outgoing result location
-	HMAC_CTX_cleanup(&hmac);
+	if (turn->currentRealm == NULL || turn->username == NULL || turn->password == NULL) { ILibStun_IntegrityContext_Cleanup(&(turn->integrity)); return; }
+	ILibTURN_GenerateIntegrityKey(turn->username, turn->currentRealm, turn->password, integrityKey);
+	ILibStun_IntegrityContext_Init(&(turn->integrity), integrityKey, 16);
 }
 
-int ILibTURN_IsPacketAuthenticated(struct ILibTURN_TurnClientObject *turn, char* buffer, int offset, int length)
+// Checks FINGERPRINT (if present) and MESSAGE-INTEGRITY against the keyed context. Used by both the TURN client and server
+int ILibTURN_CheckMessageIntegrity(ILibStun_IntegrityContext *integrityContext, char* buffer, int offset, int length)
 {
-	char integrityKey[16];
 	char integrity[20];
+	int integrityLen;
 	char* fingerprint;
 	int fingerprintLen;
 	int fingerprintIndex;
@@ -5481,7 +7919,7 @@ int ILibTURN_IsPacketAuthenticated(struct ILibTURN_TurnClientObject *turn, char*
 	{
 		fingerprintIndex = ILibTURN_GetAttributeValue(buffer, offset, length, STUN_ATTRIB_FINGERPRINT, 0, NULL);
 		actual = 0x5354554e ^ ntohl(((unsigned int*)fingerprint)[0]);
-		calculated = ILibStun_CRC32(buffer + offset, fingerprintIndex);
+		calculated = ILibStun_CRC32(buffer + offset, fingerprintIndex - offset);
 		if (calculated != actual) { return 0; }
 	}
 
@@ -5492,19 +7930,160 @@ int ILibTURN_IsPacketAuthenticated(struct ILibTURN_TurnClientObject *turn, char*
 		((unsigned short*)(buffer + offset))[1] = htons(tempVal - 8);
 	}
 
-	ILibTURN_GenerateIntegrityKey(turn->username, turn->currentRealm, turn->password, integrityKey);
-	ILibTURN_CalculateMessageIntegrity(buffer, offset, MessageIntegrityPtr, integrityKey, 16, integrity);
+	integrityLen = ILibStun_IntegrityContext_Compute(integrityContext, buffer + offset, MessageIntegrityPtr - offset, integrity);
 
 	// Put Length Back if we had to adjust the value due to fingerprint
 	if (fingerprintLen > 0) { ((unsigned short*)(buffer + offset))[1] = htons(tempVal); }
 
-	if (MessageIntegrityValueLen == 20 && memcmp(MessageIntegrityValue, integrity, 20) == 0) { return 1; }
+	if (integrityLen == 20 && MessageIntegrityValueLen == 20 && memcmp(MessageIntegrityValue, integrity, 20) == 0) { return 1; }
 
 	return 0;
 }
 
+int ILibTURN_IsPacketAuthenticated(struct ILibTURN_TurnClientObject *turn, char* buffer, int offset, int length)
+{
+	return (ILibTURN_CheckMessageIntegrity(&(turn->integrity), buffer, offset, length));
+}
+
+void ILibTURN_ProcessStunFormattedPacket(struct ILibTURN_TurnClientObject *turn, char* buffer, int offset, int length);
+void ILibTURN_OnRefreshTick(void *object);
+
+struct ILibTURN_UDP_Retransmit
+{
+	struct ILibTURN_TurnClientObject *turn;
+	int rto;
+	int transmissions;
+	int packetLength;
+	char packet[];
+};
+
+void ILibTURN_UDP_OnRetransmit(void *object)
+{
+	struct ILibTURN_UDP_Retransmit *r = (struct ILibTURN_UDP_Retransmit*)object;
+	struct ILibTURN_TurnClientObject *turn = r->turn;
+	char *TransactionID = r->packet + 8;
+	char response[20];
+	STUN_TYPE method;
+
+	if (turn->udpConnected != 0 && r->transmissions < ILibTURN_UDP_MaxTransmissions)
+	{
+		++r->transmissions;
+		r->rto *= 2;
+		ILibTURN_SendToServer(turn, r->packet, r->packetLength, ILibAsyncSocket_MemoryOwnership_USER);
+		ILibLifeTime_AddEx(ILibGetBaseTimer(turn->Chain), r, r->rto, &ILibTURN_UDP_OnRetransmit, &free);
+		return;
+	}
+
+	// The server never answered. Fail the transaction the same way an error response would
+	ILibDeleteEntry(turn->retransmitData, TransactionID, 12);
+	method = ILibTURN_GetMethodType(r->packet, 0, r->packetLength);
+	if (method == TURN_ALLOCATE)
+	{
+		ILibDeleteEntry(turn->transactionData, TransactionID, 12);
+		if (turn->udpConnected != 0 && turn->OnAllocateCallback != NULL) { turn->OnAllocateCallback(turn, 0, NULL); }
+	}
+	else if (ILibHasEntry(turn->transactionData, TransactionID, 12) != 0)
+	{
+		ILibTURN_GenerateStunFormattedPacketHeader(response, (STUN_TYPE)(method | 0x0110), TransactionID);
+		((unsigned short*)response)[1] = 0;
+		ILibTURN_ProcessStunFormattedPacket(turn, response, 0, 20);
+	}
+	free(r);
+}
+
+// Sends a TURN request. Over UDP, the request is also retransmitted until the server responds
+void ILibTURN_SendRequest(struct ILibTURN_TurnClientObject *turn, char* packet, int packetLength)
+{
+	struct ILibTURN_UDP_Retransmit *r;
+
+	if (turn->transport == ILibTURN_ServerTransport_UDP)
+	{
+		if ((r = (struct ILibTURN_UDP_Retransmit*)malloc(sizeof(struct ILibTURN_UDP_Retransmit) + packetLength)) == NULL) { ILIBCRITICALEXIT(254); }
+		r->turn = turn;
+		r->rto = ILibTURN_UDP_RTO;
+		r->transmissions = 1;
+		r->packetLength = packetLength;
+		memcpy(r->packet, packet, packetLength);
+
+		ILibAddEntry(turn->retransmitData, packet + 8, 12, r);
+		ILibLifeTime_AddEx(ILibGetBaseTimer(turn->Chain), r, r->rto, &ILibTURN_UDP_OnRetransmit, &free);
+	}
+	ILibTURN_SendToServer(turn, packet, packetLength, ILibAsyncSocket_MemoryOwnership_USER);
+}
+
+// Refresh, CreatePermission and ChannelBind requests are remembered until they are answered, so they can be sent
+// again if the server tells us our NONCE went stale (RFC 8489, Section 9.2.4)
+struct ILibTURN_AuthRequest
+{
+	STUN_TYPE method;
+	void *result;
+	void *user;
+	int retried;
+	unsigned int lifetime;						// TURN_REFRESH
+	unsigned short channelNumber;				// TURN_CHANNEL_BIND
+	int peersLength;
+	struct sockaddr_in6 peers[];				// TURN_CREATE_PERMISSION and TURN_CHANNEL_BIND
+};
+void ILibTURN_SendAuthRequest(struct ILibTURN_TurnClientObject *turn, struct ILibTURN_AuthRequest *request);
+
+// Returns the ERROR-CODE of an error response, or 0 if it doesn't have one
+int ILibTURN_GetErrorCode(char* buffer, int offset, int length)
+{
+	char *val;
+	if (ILibTURN_GetAttributeValue(buffer, offset, length, STUN_ATTRIB_ERROR_CODE, 0, &val) < 4) { return 0; }
+	return ((val[2] & 0x07) * 100 + (unsigned char)val[3]);
+}
+
+// Saves the NONCE (and REALM, if it changed) the server sent in an error response
+void ILibTURN_SaveNonce(struct ILibTURN_TurnClientObject *turn, char* buffer, int offset, int length)
+{
+	char *nonce, *realm;
+	int nonceLen, realmLen;
+
+	if ((nonceLen = ILibTURN_GetAttributeValue(buffer, offset, length, STUN_ATTRIB_NONCE, 0, &nonce)) > 0)
+	{
+		if (turn->currentNonce != NULL) { free(turn->currentNonce); }
+		if ((turn->currentNonce = (char*)malloc(nonceLen + 1)) == NULL){ ILIBCRITICALEXIT(254); }
+		memcpy(turn->currentNonce, nonce, nonceLen);
+		turn->currentNonce[nonceLen] = 0;
+		turn->currentNonceLen = nonceLen;
+	}
+	if ((realmLen = ILibTURN_GetAttributeValue(buffer, offset, length, STUN_ATTRIB_REALM, 0, &realm)) > 0 &&
+		(turn->currentRealm == NULL || realmLen != turn->currentRealmLen || memcmp(turn->currentRealm, realm, realmLen) != 0))
+	{
+		if (turn->currentRealm != NULL) { free(turn->currentRealm); }
+		if ((turn->currentRealm = (char*)malloc(realmLen + 1)) == NULL){ ILIBCRITICALEXIT(254); }
+		memcpy(turn->currentRealm, realm, realmLen);
+		turn->currentRealm[realmLen] = 0;
+		turn->currentRealmLen = realmLen;
+		ILibTURN_UpdateIntegrity(turn);
+	}
+}
+
+// Takes the request a response belongs to. Returns NULL if there isn't one, or if it was sent again with a fresh NONCE
+struct ILibTURN_AuthRequest* ILibTURN_TakeAuthRequest(struct ILibTURN_TurnClientObject *turn, char* buffer, int offset, int length)
+{
+	struct ILibTURN_AuthRequest *request;
+	char *TransactionID = ILibTURN_GetTransactionID(buffer, offset, length);
+
+	if ((request = (struct ILibTURN_AuthRequest*)ILibGetEntry(turn->transactionData, TransactionID, 12)) == NULL) { return NULL; }
+	ILibDeleteEntry(turn->transactionData, TransactionID, 12);
+
+	if (IS_ERR_RESP(ILibTURN_GetMethodType(buffer, offset, length)) && request->retried == 0 && ILibTURN_GetErrorCode(buffer, offset, length) == 438 &&
+		ILibTURN_GetAttributeCount(buffer, offset, length, STUN_ATTRIB_NONCE) == 1)
+	{
+		// Stale Nonce. Only retry once, so a misbehaving server can't keep us going around in circles
+		ILibTURN_SaveNonce(turn, buffer, offset, length);
+		request->retried = 1;
+		ILibTURN_SendAuthRequest(turn, request);
+		return NULL;
+	}
+	return request;
+}
+
 void ILibTURN_ProcessStunFormattedPacket(struct ILibTURN_TurnClientObject *turn, char* buffer, int offset, int length)
 {
+	struct ILibTURN_AuthRequest *request;
 	void* tmp;
 	STUN_TYPE method = ILibTURN_GetMethodType(buffer, offset, length);
 	char* TransactionID = ILibTURN_GetTransactionID(buffer, offset, length);
@@ -5518,25 +8097,11 @@ void ILibTURN_ProcessStunFormattedPacket(struct ILibTURN_TurnClientObject *turn,
 	switch (method)
 	{
 		case TURN_CHANNEL_BIND_ERROR:
-		{
-			void **ptr;
-			int val;
-
-			ILibGetEntryEx(turn->transactionData, TransactionID, 12, (void**)&ptr, &val);
-			if (ptr[0] != NULL) { ((ILibTURN_OnCreateChannelBindingHandler)ptr[0])(turn, (unsigned short)val, 0, ptr[1]); }
-			free(ptr);
-			ILibDeleteEntry(turn->transactionData, TransactionID, 12);
-			break;
-		}
 		case TURN_CHANNEL_BIND_RESPONSE:
 		{
-			void **ptr;
-			int val;
-
-			ILibGetEntryEx(turn->transactionData, TransactionID, 12, (void**)&ptr, &val);
-			if (ptr[0] != NULL) { ((ILibTURN_OnCreateChannelBindingHandler)ptr[0])(turn, (unsigned short)val, 1, ptr[1]); }
-			free(ptr);
-			ILibDeleteEntry(turn->transactionData, TransactionID, 12);
+			if ((request = ILibTURN_TakeAuthRequest(turn, buffer, offset, length)) == NULL) { break; }
+			if (request->result != NULL) { ((ILibTURN_OnCreateChannelBindingHandler)request->result)(turn, request->channelNumber, method == TURN_CHANNEL_BIND_RESPONSE ? 1 : 0, request->user); }
+			free(request);
 			break;
 		}
 		case TURN_DATA: // Data-Indication
@@ -5559,40 +8124,11 @@ void ILibTURN_ProcessStunFormattedPacket(struct ILibTURN_TurnClientObject *turn,
 			break;
 		}
 		case TURN_CREATE_PERMISSION_ERROR:
-		{
-			void *ptr;
-			int val;
-			ILibGetEntryEx(turn->transactionData, TransactionID, 12, &ptr, &val);
-
-			if (val == 0)
-			{
-				if (ptr != NULL) { ((ILibTURN_OnCreatePermissionHandler)ptr)(turn, 0, NULL); }
-			}
-			else
-			{
-				((ILibTURN_OnCreatePermissionHandler)((void**)ptr)[0])(turn, 0, ((ILibTURN_OnCreatePermissionHandler)((void**)ptr)[1]));
-				free(ptr);
-			}
-
-			ILibDeleteEntry(turn->transactionData, TransactionID, 12);
-			break;
-		}
 		case TURN_CREATE_PERMISSION_RESPONSE:
 		{
-			void *ptr;
-			int val;
-			ILibGetEntryEx(turn->transactionData, TransactionID, 12, &ptr, &val);
-
-			if (val == 0)
-			{
-				if (ptr != NULL) { ((ILibTURN_OnCreatePermissionHandler)ptr)(turn, 1, NULL); }
-			}
-			else
-			{
-				((ILibTURN_OnCreatePermissionHandler)((void**)ptr)[0])(turn, 1, ((ILibTURN_OnCreatePermissionHandler)((void**)ptr)[1]));
-				free(ptr);
-			}
-			ILibDeleteEntry(turn->transactionData, TransactionID, 12);
+			if ((request = ILibTURN_TakeAuthRequest(turn, buffer, offset, length)) == NULL) { break; }
+			if (request->result != NULL) { ((ILibTURN_OnCreatePermissionHandler)request->result)(turn, method == TURN_CREATE_PERMISSION_RESPONSE ? 1 : 0, request->user); }
+			free(request);
 			break;
 		}
 		case TURN_ALLOCATE_ERROR:
@@ -5604,10 +8140,8 @@ void ILibTURN_ProcessStunFormattedPacket(struct ILibTURN_TurnClientObject *turn,
 				//
 				char* nonce;
 				char* realm;
-				int nonceLen, realmLen, inputKeyLen, packetPtr;
-				char inputKey[128];
-				char outputKey[16];
-				char packet[256];
+				int nonceLen, realmLen, packetPtr;
+				char packet[ILibTURN_MaxRequestSize];
 				char NewTransactionID[12];
 				char Transport[4];
 				ILibTURN_TransportTypes transport;
@@ -5617,21 +8151,7 @@ void ILibTURN_ProcessStunFormattedPacket(struct ILibTURN_TurnClientObject *turn,
 					nonceLen = ILibTURN_GetAttributeValue(buffer, offset, length, STUN_ATTRIB_NONCE, 0, &nonce);
 					realmLen = ILibTURN_GetAttributeValue(buffer, offset, length, STUN_ATTRIB_REALM, 0, &realm);
 
-					if (turn->currentNonce != NULL) { free(turn->currentNonce); }
-					if ((turn->currentNonce = (char*)malloc(nonceLen + 1)) == NULL){ ILIBCRITICALEXIT(254); }
-					memcpy(turn->currentNonce, nonce, nonceLen);
-					turn->currentNonce[nonceLen] = 0;
-					turn->currentNonceLen = nonceLen;
-
-					if (turn->currentRealm != NULL) { free(turn->currentRealm); }
-					if ((turn->currentRealm = (char*)malloc(realmLen + 1)) == NULL){ ILIBCRITICALEXIT(254); }
-					memcpy(turn->currentRealm, realm, realmLen);
-					turn->currentRealm[realmLen] = 0;
-					turn->currentRealmLen = realmLen;
-
-					inputKeyLen = snprintf(inputKey, 128, "%s:%s:%s", turn->username, turn->currentRealm, turn->password);
-
-					util_md5(inputKey, inputKeyLen, outputKey);
+					ILibTURN_SaveNonce(turn, buffer, offset, length);
 					util_random(12, NewTransactionID);
 					ILibGetEntryEx(turn->transactionData, TransactionID, 12, &tmp, (int*)(&transport));
 					ILibDeleteEntry(turn->transactionData, TransactionID, 12); // We're going to delete our TransactionID, without adding the new one, so if we fail again, we'll abort
@@ -5644,10 +8164,10 @@ void ILibTURN_ProcessStunFormattedPacket(struct ILibTURN_TurnClientObject *turn,
 					packetPtr += ILibTURN_AddAttributeToStunFormattedPacketHeader(packet, packetPtr, STUN_ATTRIB_REALM, realm, realmLen);
 					packetPtr += ILibTURN_AddAttributeToStunFormattedPacketHeader(packet, packetPtr, STUN_ATTRIB_USERNAME, turn->username, turn->usernameLen);
 
-					packetPtr += ILibStun_AddMessageIntegrityAttr(packet, packetPtr, outputKey, 16);
+					packetPtr += ILibStun_AddMessageIntegrityAttrEx(packet, packetPtr, &(turn->integrity));
 					packetPtr += ILibStun_AddFingerprint(packet, packetPtr);
 
-					ILibAsyncSocket_Send(turn->tcpClient, packet, packetPtr, ILibAsyncSocket_MemoryOwnership_USER);
+					ILibTURN_SendRequest(turn, packet, packetPtr);
 				}
 				else
 				{
@@ -5659,6 +8179,18 @@ void ILibTURN_ProcessStunFormattedPacket(struct ILibTURN_TurnClientObject *turn,
 			}
 			break;
 		}
+		case TURN_REFRESH_ERROR:
+		{
+			if ((request = ILibTURN_TakeAuthRequest(turn, buffer, offset, length)) != NULL) { free(request); }
+			break;
+		}
+		case TURN_REFRESH_RESPONSE:
+		{
+			char *val;
+			if ((request = ILibTURN_TakeAuthRequest(turn, buffer, offset, length)) != NULL) { free(request); }
+			if (ILibTURN_GetAttributeValue(buffer, offset, length, TURN_LIFETIME, 0, &val) == 4) { turn->allocationExpires = ILibGetUptime() + (long long)ntohl(((unsigned int*)val)[0]) * 1000; }
+			break;
+		}
 		case TURN_ALLOCATE_RESPONSE:
 		{
 			char *val, *transportAddress;
@@ -5674,6 +8206,9 @@ void ILibTURN_ProcessStunFormattedPacket(struct ILibTURN_TurnClientObject *turn,
 			if (valLen > 0 && transportAddressLen > 0)
 			{
 				int lifetime = ntohl(((unsigned int*)val)[0]);
+				turn->allocationExpires = ILibGetUptime() + (long long)lifetime * 1000;
+				ILibLifeTime_Remove(ILibGetBaseTimer(turn->Chain), turn);
+				ILibLifeTime_AddEx(ILibGetBaseTimer(turn->Chain), turn, ILibTURN_RefreshInterval, &ILibTURN_OnRefreshTick, NULL);
 				if (turn->OnAllocateCallback != NULL) { turn->OnAllocateCallback(turn, lifetime, &address); }
 			}
 			break;
@@ -5685,53 +8220,98 @@ void ILibTURN_ProcessStunFormattedPacket(struct ILibTURN_TurnClientObject *turn,
 	}
 }
 
+// Returns the total length of the STUN formatted message at offset, or 0 if it is not a STUN formatted message
 int ILibTURN_GetStunPacketLength(char* buffer, int offset, int length)
 {
-	unsigned short messageLength = 20 + ntohs(((unsigned short*)(buffer + offset))[1]);
-	int magic = ntohl(((unsigned int*)(buffer + offset))[1]);
-	if (messageLength > length || magic != 0x2112A442) // Check the length and magic string
-	{
-		if (magic != 0x2112A442) return ((int)messageLength);
-	}
-	return 0;
+	if (length < 8 || ntohl(((unsigned int*)(buffer + offset))[1]) != 0x2112A442) { return 0; } // Check the magic string
+	return (20 + ntohs(((unsigned short*)(buffer + offset))[1]));
 }
 
 void ILibTURN_TCP_OnData(ILibAsyncSocket_SocketModule socketModule, char* buffer, int *p_beginPointer, int endPointer, ILibAsyncSocket_OnInterrupt* OnInterrupt, void **user, int *PAUSE)
 {
 	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)*user;
+	char *frame;
+	int frameLength, available, frames = 0;
 
-	UNREFERENCED_PARAMETER(socketModule);
 	UNREFERENCED_PARAMETER(OnInterrupt);
-	UNREFERENCED_PARAMETER(PAUSE);
 
-	if (endPointer >= 4)
+	// Deliver every complete frame in the buffer, instead of one per call
+	while (*PAUSE <= 0 && (available = endPointer - *p_beginPointer) >= 4 && ILibAsyncSocket_IsConnected(socketModule) != 0)
 	{
-		if (ntohs(((unsigned short*)(buffer + *p_beginPointer))[0]) >> 14 == 1)
+		frame = buffer + *p_beginPointer;
+		if (ntohs(((unsigned short*)frame)[0]) >> 14 == 1)
 		{
 			// This is Channel Data
-			unsigned short ChannelNumber = (unsigned short)((int)ntohs(((unsigned short*)(buffer + *p_beginPointer))[0]) ^ (int)0x4000);
-			unsigned short ChannelDataLength = ntohs(((unsigned short*)(buffer + *p_beginPointer))[1]);
-			if (endPointer >= (4 + FOURBYTEBOUNDARY(ChannelDataLength)))
-			{
-				ILibTURN_ProcessChannelData(turn, ChannelNumber, buffer, *p_beginPointer + 4, ChannelDataLength);
-				*p_beginPointer += (4 + FOURBYTEBOUNDARY(ChannelDataLength));
-				return;
-			}
+			frameLength = 4 + FOURBYTEBOUNDARY(ntohs(((unsigned short*)frame)[1]));
+			if (available < frameLength) { break; }
+			ILibTURN_ProcessChannelData(turn, (unsigned short)((int)ntohs(((unsigned short*)frame)[0]) ^ (int)0x4000), frame, 4, ntohs(((unsigned short*)frame)[1]));
 		}
 		else
 		{
-			if (endPointer >= 8)
+			// STUN Formatted Packet
+			if (available < 20) { break; }
+			if ((frameLength = ILibTURN_GetStunPacketLength(frame, 0, available)) == 0)
 			{
-				// STUN Formatted Packet
-				int stunLength = ILibTURN_GetStunPacketLength(buffer, *p_beginPointer, 8);
-				if (endPointer >= stunLength)
-				{
-					ILibTURN_ProcessStunFormattedPacket(turn, buffer, *p_beginPointer, stunLength);
-					*p_beginPointer += stunLength;
-				}
+				// Neither ChannelData nor STUN, so we lost framing on the stream. There is no way to recover from that
+				ILibAsyncSocket_Disconnect(socketModule);
+				return;
 			}
+			if (available < frameLength) { break; }
+			ILibTURN_ProcessStunFormattedPacket(turn, frame, 0, frameLength);
 		}
+		*p_beginPointer += frameLength;
+		++frames;
+	}
+
+	// The socket calls us again with any partial frame left over, so only count the reads that delivered something
+	if (frames > 0)
+	{
+		++turn->tcpReads;
+		turn->tcpFrames += frames;
+	}
+}
+
+void ILibTURN_GetTcpReadStats(ILibTURN_ClientModule turnModule, unsigned int *reads, unsigned int *frames)
+{
+	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)turnModule;
+	if (reads != NULL) { *reads = turn->tcpReads; }
+	if (frames != NULL) { *frames = turn->tcpFrames; }
+}
+
+void ILibTURN_UDP_OnData(ILibAsyncUDPSocket_SocketModule socketModule, char* buffer, int bufferLength, struct sockaddr_in6 *remoteInterface, void *user, void *user2, int *PAUSE)
+{
+	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)user;
+	struct ILibTURN_UDP_Retransmit *r;
+	unsigned short frameLength;
+	STUN_TYPE method;
+
+	UNREFERENCED_PARAMETER(socketModule);
+	UNREFERENCED_PARAMETER(user2);
+	UNREFERENCED_PARAMETER(PAUSE);
+
+	// Only accept datagrams from the TURN server we are using
+	if (turn->udpConnected == 0 || bufferLength < 4 || remoteInterface->sin6_family != turn->serverAddress.sin6_family || remoteInterface->sin6_port != turn->serverAddress.sin6_port) { return; }
+	if (remoteInterface->sin6_family == AF_INET && ((struct sockaddr_in*)remoteInterface)->sin_addr.s_addr != ((struct sockaddr_in*)&(turn->serverAddress))->sin_addr.s_addr) { return; }
+	if (remoteInterface->sin6_family == AF_INET6 && memcmp(&(remoteInterface->sin6_addr), &(turn->serverAddress.sin6_addr), sizeof(struct in6_addr)) != 0) { return; }
+
+	// Each datagram carries exactly one ChannelData or STUN formatted message
+	frameLength = ntohs(((unsigned short*)buffer)[1]);
+	if (ntohs(((unsigned short*)buffer)[0]) >> 14 == 1)
+	{
+		if (4 + frameLength <= bufferLength) { ILibTURN_ProcessChannelData(turn, (unsigned short)((int)ntohs(((unsigned short*)buffer)[0]) ^ (int)0x4000), buffer, 4, frameLength); }
+		return;
+	}
+	if (bufferLength < 20 || 20 + frameLength > bufferLength || ntohl(((unsigned int*)buffer)[1]) != 0x2112A442) { return; }
+
+	method = ILibTURN_GetMethodType(buffer, 0, bufferLength);
+	if (!IS_INDICATION(method))
+	{
+		// Responses end the retransmissions of their request. Duplicates of a response we already processed are dropped
+		if ((r = (struct ILibTURN_UDP_Retransmit*)ILibGetEntry(turn->retransmitData, buffer + 8, 12)) == NULL) { return; }
+		ILibDeleteEntry(turn->retransmitData, buffer + 8, 12);
+		ILibLifeTime_Remove(ILibGetBaseTimer(turn->Chain), r);
 	}
+	ILibTURN_ProcessStunFormattedPacket(turn, buffer, 0, 20 + frameLength);
 }
 
 void ILibTURN_TCP_OnConnect(ILibAsyncSocket_SocketModule socketModule, int Connected, void *user)
@@ -5757,12 +8337,16 @@ ILibTURN_ClientModule ILibTURN_CreateTurnClient(void* chain, ILibTURN_OnConnectT
 	if (retVal == NULL){ ILIBCRITICALEXIT(254); }
 	memset(retVal, 0, sizeof(struct ILibTURN_TurnClientObject));
 	retVal->Destroy = &ILibTURN_OnDestroy;
+	retVal->Chain = chain;
 	retVal->tcpClient = ILibCreateAsyncSocketModule(chain, 4096, &ILibTURN_TCP_OnData, &ILibTURN_TCP_OnConnect, &ILibTURN_TCP_OnDisconnect, NULL);
 	retVal->OnConnectTurnCallback = OnConnectTurn;
 	retVal->OnAllocateCallback = OnAllocate;
 	retVal->OnDataIndicationCallback = OnData;
 	retVal->OnChannelDataCallback = OnChannelData;
 	retVal->transactionData = ILibInitHashTree();
+	retVal->retransmitData = ILibInitHashTree();
+	retVal->permissions = ILibInitHashTree();
+	retVal->channels = ILibInitHashTree();
 
 	ILibAddToChain(chain, retVal);
 
@@ -5775,6 +8359,8 @@ void ILibTURN_ConnectTurnServer(ILibTURN_ClientModule turnModule, struct sockadd
 
 	UNREFERENCED_PARAMETER(proxyServer);
 
+	if (turn->username != NULL) { free(turn->username); }
+	if (turn->password != NULL) { free(turn->password); }
 	if ((turn->username = (char*)malloc(usernameLen + 1)) == NULL){ ILIBCRITICALEXIT(254); }
 	if ((turn->password = (char*)malloc(passwordLen + 1)) == NULL){ ILIBCRITICALEXIT(254); }
 	memcpy(turn->username, username, usernameLen);
@@ -5783,11 +8369,30 @@ void ILibTURN_ConnectTurnServer(ILibTURN_ClientModule turnModule, struct sockadd
 	turn->password[passwordLen] = 0;
 	turn->usernameLen = usernameLen;
 	turn->passwordLen = passwordLen;
+	ILibTURN_UpdateIntegrity(turn);
 
-	ILibAsyncSocket_ConnectTo(turn->tcpClient, NULL, (struct sockaddr*)turnServer, NULL, turn);
-}
+	if (turn->transport == ILibTURN_ServerTransport_UDP)
+	{
+		struct sockaddr_in6 localInterface;
+		void **udp = turnServer->sin_family == AF_INET6 ? &(turn->udpClient6) : &(turn->udpClient);
 
-int ILibTURN_GenerateStunFormattedPacketHeader(char* rbuffer, STUN_TYPE packetType, char* transactionID)
+		// UDP is connectionless, so we are 'connected' as soon as we have a socket of the right family to reach the server with
+		memcpy(&(turn->serverAddress), turnServer, INET_SOCKADDR_LENGTH(turnServer->sin_family));
+		if (*udp == NULL)
+		{
+			memset(&localInterface, 0, sizeof(struct sockaddr_in6));
+			localInterface.sin6_family = turnServer->sin_family;
+			*udp = ILibAsyncUDPSocket_CreateEx(turn->Chain, 4096, (struct sockaddr*)&localInterface, ILibAsyncUDPSocket_Reuse_EXCLUSIVE, &ILibTURN_UDP_OnData, NULL, turn);
+		}
+		turn->udpConnected = *udp != NULL ? 1 : 0;
+		if (turn->OnConnectTurnCallback != NULL) { turn->OnConnectTurnCallback(turn, turn->udpConnected); }
+		return;
+	}
+
+	ILibAsyncSocket_ConnectTo(turn->tcpClient, NULL, (struct sockaddr*)turnServer, NULL, turn);
+}
+
+int ILibTURN_GenerateStunFormattedPacketHeader(char* rbuffer, STUN_TYPE packetType, char* transactionID)
 {
 	((unsigned short*)rbuffer)[0] = htons(packetType);								// Allocate, skip setting length for now
 	((unsigned int*)rbuffer)[1] = htonl(0x2112A442);								// Set the magic string																								
@@ -5887,6 +8492,42 @@ int ILibTURN_CreateXORMappedAddress(struct sockaddr_in6 *endpoint, char* buffer,
 	return retVal;
 }
 
+struct ILibTURN_RefreshPeer
+{
+	struct sockaddr_in6 peer;
+	unsigned short channelNumber;
+	int used;					// Set when we send to this peer, cleared by each refresh. Idle peers are left to expire on the server
+	long long refreshed;
+	char key[16];
+	int keyLength;
+};
+
+// Remembers a permission or channel binding, so the refresh cycle can keep it alive while it is in use
+void ILibTURN_TrackPeer(void *table, char *key, int keyLength, struct sockaddr_in6 *peer, unsigned short channelNumber)
+{
+	struct ILibTURN_RefreshPeer *rp = (struct ILibTURN_RefreshPeer*)ILibGetEntry(table, key, keyLength);
+
+	if (rp == NULL)
+	{
+		if ((rp = (struct ILibTURN_RefreshPeer*)malloc(sizeof(struct ILibTURN_RefreshPeer))) == NULL) { ILIBCRITICALEXIT(254); }
+		memcpy(rp->key, key, keyLength);
+		rp->keyLength = keyLength;
+		ILibAddEntry(table, rp->key, keyLength, rp);
+	}
+	memcpy(&(rp->peer), peer, INET_SOCKADDR_LENGTH(peer->sin6_family));
+	rp->channelNumber = channelNumber;
+	rp->used = 1;
+	rp->refreshed = ILibGetUptime();
+}
+
+// Permissions are per IP address, the port is ignored (RFC 8656, Section 9)
+int ILibTURN_GetPermissionKey(struct sockaddr_in6 *peer, char **key)
+{
+	if (peer->sin6_family == AF_INET6) { *key = (char*)&(peer->sin6_addr); return 16; }
+	*key = (char*)&(((struct sockaddr_in*)peer)->sin_addr);
+	return 4;
+}
+
 void ILibTURN_Allocate(ILibTURN_ClientModule turnModule, ILibTURN_TransportTypes transportType)
 {
 	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)turnModule;
@@ -5905,53 +8546,68 @@ void ILibTURN_Allocate(ILibTURN_ClientModule turnModule, ILibTURN_TransportTypes
 
 	ILibAddEntryEx(turn->transactionData, TransactionID, 12, NULL, (int)transportType);
 
-	ILibAsyncSocket_Send(turn->tcpClient, rbuffer, rptr, ILibAsyncSocket_MemoryOwnership_USER);
+	ILibTURN_SendRequest(turn, rbuffer, rptr);
 }
 
-void ILibTURN_CreatePermission(ILibTURN_ClientModule turnModule, struct sockaddr_in6* permissions, int permissionsLength, ILibTURN_OnCreatePermissionHandler result, void *user)
+// Builds and sends a Refresh, CreatePermission or ChannelBind request, and remembers it until the server answers
+void ILibTURN_SendAuthRequest(struct ILibTURN_TurnClientObject *turn, struct ILibTURN_AuthRequest *request)
 {
-	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)turnModule;
 	char peer[20];
-	char rbuffer[256];
+	char rbuffer[ILibTURN_MaxRequestSize];
 	char TransactionID[12];
+	char channel[4];
+	unsigned int lifetime;
 	int rptr, peerLen;
 	int i;
-	char integrityKey[16];
 
 	util_random(12, TransactionID);																	// Random used for transaction id	
-	ILibTURN_GenerateIntegrityKey(turn->username, turn->currentRealm, turn->password, integrityKey);
 
-	rptr = ILibTURN_GenerateStunFormattedPacketHeader(rbuffer, TURN_CREATE_PERMISSION, TransactionID);
-	for (i = 0; i < permissionsLength; ++i)
+	rptr = ILibTURN_GenerateStunFormattedPacketHeader(rbuffer, request->method, TransactionID);
+	for (i = 0; i < request->peersLength; ++i)
 	{
-		peerLen = ILibTURN_CreateXORMappedAddress(&(permissions[i]), peer, TransactionID);
+		peerLen = ILibTURN_CreateXORMappedAddress(&(request->peers[i]), peer, TransactionID);
 		rptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(rbuffer, rptr, STUN_ATTRIB_XOR_PEER_ADDRESS, peer, peerLen);
 	}
+	if (request->method == TURN_CHANNEL_BIND)
+	{
+		((unsigned short*)channel)[0] = htons(request->channelNumber ^ 0x4000);
+		((unsigned short*)channel)[1] = 0;
+		rptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(rbuffer, rptr, TURN_CHANNEL_NUMBER, channel, 4);
+	}
+	if (request->method == TURN_REFRESH)
+	{
+		lifetime = htonl(request->lifetime);
+		rptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(rbuffer, rptr, TURN_LIFETIME, (char*)&lifetime, 4);
+	}
 
 	rptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(rbuffer, rptr, STUN_ATTRIB_USERNAME, turn->username, turn->usernameLen);
 	rptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(rbuffer, rptr, STUN_ATTRIB_REALM, turn->currentRealm, turn->currentRealmLen);
 	rptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(rbuffer, rptr, STUN_ATTRIB_NONCE, turn->currentNonce, turn->currentNonceLen);
 
-	rptr += ILibStun_AddMessageIntegrityAttr(rbuffer, rptr, integrityKey, 16);
+	rptr += ILibStun_AddMessageIntegrityAttrEx(rbuffer, rptr, &(turn->integrity));
 	rptr += ILibStun_AddFingerprint(rbuffer, rptr);
 
-	if (result != NULL)
-	{
-		if (user != NULL)
-		{
-			void **val = (void**)malloc(2 * sizeof(void*));
-			if (val == NULL){ ILIBCRITICALEXIT(254); }
-			val[0] = result;
-			val[1] = user;
-			ILibAddEntryEx(turn->transactionData, TransactionID, 12, val, 2);
-		}
-		else
-		{
-			ILibAddEntryEx(turn->transactionData, TransactionID, 12, result, 0);
-		}
-	}
+	ILibAddEntry(turn->transactionData, TransactionID, 12, request);
+	ILibTURN_SendRequest(turn, rbuffer, rptr);
+}
+
+struct ILibTURN_AuthRequest* ILibTURN_CreateAuthRequest(STUN_TYPE method, struct sockaddr_in6* peers, int peersLength, void *result, void *user)
+{
+	struct ILibTURN_AuthRequest *request;
+
+	if ((request = (struct ILibTURN_AuthRequest*)malloc(sizeof(struct ILibTURN_AuthRequest) + peersLength * sizeof(struct sockaddr_in6))) == NULL) { ILIBCRITICALEXIT(254); }
+	memset(request, 0, sizeof(struct ILibTURN_AuthRequest));
+	request->method = method;
+	request->result = result;
+	request->user = user;
+	request->peersLength = peersLength;
+	if (peersLength > 0) { memcpy(request->peers, peers, peersLength * sizeof(struct sockaddr_in6)); }
+	return request;
+}
 
-	ILibAsyncSocket_Send(turn->tcpClient, rbuffer, rptr, ILibAsyncSocket_MemoryOwnership_USER);
+void ILibTURN_SendCreatePermission(struct ILibTURN_TurnClientObject *turn, struct sockaddr_in6* permissions, int permissionsLength, ILibTURN_OnCreatePermissionHandler result, void *user)
+{
+	ILibTURN_SendAuthRequest(turn, ILibTURN_CreateAuthRequest(TURN_CREATE_PERMISSION, permissions, permissionsLength, (void*)result, user));
 }
 
 enum ILibAsyncSocket_SendStatus ILibTURN_SendIndication(ILibTURN_ClientModule turnModule, struct sockaddr_in6* remotePeer, char* buffer, int offset, int length)
@@ -5959,10 +8615,18 @@ enum ILibAsyncSocket_SendStatus ILibTURN_SendIndication(ILibTURN_ClientModule tu
 	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)turnModule;
 	char Address[20];
 	char TransactionID[12];
-	char *packet = (char*)malloc(50 + length);
-	int ptr, AddressLen;
-
-	if (packet == NULL){ ILIBCRITICALEXIT(254); }
+	char frame[ILibTURN_MaxFrameSize];
+	char *packet = frame;
+	char *key;
+	int ptr, AddressLen, keyLength;
+	struct ILibTURN_RefreshPeer *rp;
+
+	// Sending keeps the permission for this peer alive in the next refresh cycle
+	keyLength = ILibTURN_GetPermissionKey(remotePeer, &key);
+	if ((rp = (struct ILibTURN_RefreshPeer*)ILibGetEntry(turn->permissions, key, keyLength)) != NULL) { rp->used = 1; }
+
+	// Relayed packets fit on the stack, so the indication goes out in a single write without touching the heap
+	if (length + ILibTURN_FrameHeadroom > (int)sizeof(frame) && (packet = (char*)malloc(length + ILibTURN_FrameHeadroom)) == NULL){ ILIBCRITICALEXIT(254); }
 	util_random(12, TransactionID);
 	ptr = ILibTURN_GenerateStunFormattedPacketHeader(packet, TURN_SEND, TransactionID);
 	AddressLen = ILibTURN_CreateXORMappedAddress(remotePeer, Address, TransactionID);
@@ -5971,68 +8635,1238 @@ enum ILibAsyncSocket_SendStatus ILibTURN_SendIndication(ILibTURN_ClientModule tu
 	ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(packet, ptr, STUN_ATTRIB_DATA, buffer + offset, length);
 	ptr += ILibStun_AddFingerprint(packet, ptr);
 
-	return ILibAsyncSocket_Send(turn->tcpClient, packet, ptr, ILibAsyncSocket_MemoryOwnership_CHAIN);
+	return ILibTURN_SendToServer(turn, packet, ptr, packet == frame ? ILibAsyncSocket_MemoryOwnership_USER : ILibAsyncSocket_MemoryOwnership_CHAIN);
 }
 
-void ILibTURN_CreateChannelBinding(ILibTURN_ClientModule turnModule, unsigned short channelNumber, struct sockaddr_in6* remotePeer, ILibTURN_OnCreateChannelBindingHandler result, void* user)
+void ILibTURN_SendChannelBind(struct ILibTURN_TurnClientObject *turn, unsigned short channelNumber, struct sockaddr_in6* remotePeer, ILibTURN_OnCreateChannelBindingHandler result, void* user)
 {
-	char TransactionID[12];
-	char Peer[20];
-	char IntegrityKey[16];
-	char Packet[256];
-	char Channel[4];
-	int Ptr, PeerLen;
+	struct ILibTURN_AuthRequest *request = ILibTURN_CreateAuthRequest(TURN_CHANNEL_BIND, remotePeer, 1, (void*)result, user);
+
+	request->channelNumber = channelNumber;
+	ILibTURN_SendAuthRequest(turn, request);
+}
 
+void ILibTURN_CreatePermission(ILibTURN_ClientModule turnModule, struct sockaddr_in6* permissions, int permissionsLength, ILibTURN_OnCreatePermissionHandler result, void *user)
+{
 	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)turnModule;
+	char *key;
+	int i, keyLength;
 
-	util_random(12, TransactionID);
-	PeerLen = ILibTURN_CreateXORMappedAddress(remotePeer, Peer, TransactionID);
-	ILibTURN_GenerateIntegrityKey(turn->username, turn->currentRealm, turn->password, IntegrityKey);
-	((unsigned short*)Channel)[0] = htons(channelNumber ^ 0x4000);
-	((unsigned short*)Channel)[1] = 0;
-
-	Ptr = ILibTURN_GenerateStunFormattedPacketHeader(Packet, TURN_CHANNEL_BIND, TransactionID);
-	Ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(Packet, Ptr, STUN_ATTRIB_XOR_PEER_ADDRESS, Peer, PeerLen);
-	Ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(Packet, Ptr, TURN_CHANNEL_NUMBER, Channel, 4);
-	Ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(Packet, Ptr, STUN_ATTRIB_USERNAME, turn->username, turn->usernameLen);
-	Ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(Packet, Ptr, STUN_ATTRIB_REALM, turn->currentRealm, turn->currentRealmLen);
-	Ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(Packet, Ptr, STUN_ATTRIB_NONCE, turn->currentNonce, turn->currentNonceLen);
-
-	Ptr += ILibStun_AddMessageIntegrityAttr(Packet, Ptr, IntegrityKey, 16);
-	Ptr += ILibStun_AddFingerprint(Packet, Ptr);
+	for (i = 0; i < permissionsLength; ++i)
+	{
+		keyLength = ILibTURN_GetPermissionKey(&(permissions[i]), &key);
+		ILibTURN_TrackPeer(turn->permissions, key, keyLength, &(permissions[i]), 0);
+	}
+	ILibTURN_SendCreatePermission(turn, permissions, permissionsLength, result, user);
+}
+
+void ILibTURN_CreateChannelBinding(ILibTURN_ClientModule turnModule, unsigned short channelNumber, struct sockaddr_in6* remotePeer, ILibTURN_OnCreateChannelBindingHandler result, void* user)
+{
+	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)turnModule;
+	char *key;
+	int keyLength;
+
+	// The binding installs a permission too, but that only lasts 5 minutes, so it has to be refreshed on its own
+	keyLength = ILibTURN_GetPermissionKey(remotePeer, &key);
+	ILibTURN_TrackPeer(turn->permissions, key, keyLength, remotePeer, 0);
+	ILibTURN_TrackPeer(turn->channels, (char*)&channelNumber, sizeof(unsigned short), remotePeer, channelNumber);
+	ILibTURN_SendChannelBind(turn, channelNumber, remotePeer, result, user);
+}
+
+void ILibTURN_RefreshAllocation(struct ILibTURN_TurnClientObject *turn, unsigned int lifetime)
+{
+	struct ILibTURN_AuthRequest *request = ILibTURN_CreateAuthRequest(TURN_REFRESH, NULL, 0, NULL, NULL);
+
+	request->lifetime = lifetime;
+	ILibTURN_SendAuthRequest(turn, request);
+}
+
+// Refreshes everything that is due in one pass, instead of keeping a timer per peer. Permissions are batched into as few requests as possible
+void ILibTURN_OnRefreshTick(void *object)
+{
+	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)object;
+	struct sockaddr_in6 batch[ILibTURN_PermissionsPerRequest];
+	struct ILibTURN_RefreshPeer *rp;
+	long long now = ILibGetUptime();
+	void *en, *idle, *node;
+	char *key;
+	int keyLength, batchLength = 0;
+
+	if (ILibTURN_IsConnectedToServer(turn) == 0 || turn->allocationExpires == 0) { return; }
+	if (turn->allocationExpires - now < 2 * ILibTURN_RefreshInterval) { ILibTURN_RefreshAllocation(turn, ILibTURN_AllocationLifetime); }
 
-	if (result != NULL)
+	idle = ILibLinkedList_Create();
+	en = ILibHashTree_GetEnumerator(turn->permissions);
+	while (ILibHashTree_MoveNext(en) == 0)
 	{
-		// Only malloc memory if the user actually cares to get called back
-		void **u = (void**)malloc(2 * sizeof(void*));
-		if (u == NULL){ ILIBCRITICALEXIT(254); }
-		u[0] = result;
-		u[1] = (void*)user;
-		ILibAddEntryEx(turn->transactionData, TransactionID, 12, u, (int)channelNumber);
+		ILibHashTree_GetValue(en, &key, &keyLength, (void**)&rp);
+		if (now - rp->refreshed < ILibTURN_PermissionRefresh) { continue; }
+		if (rp->used == 0) { ILibLinkedList_AddTail(idle, rp); continue; }
+
+		rp->used = 0;
+		rp->refreshed = now;
+		memcpy(&(batch[batchLength++]), &(rp->peer), sizeof(struct sockaddr_in6));
+		if (batchLength == ILibTURN_PermissionsPerRequest) { ILibTURN_SendCreatePermission(turn, batch, batchLength, NULL, NULL); batchLength = 0; }
 	}
+	ILibHashTree_DestroyEnumerator(en);
+	if (batchLength > 0) { ILibTURN_SendCreatePermission(turn, batch, batchLength, NULL, NULL); }
+	node = ILibLinkedList_GetNode_Head(idle);
+	while (node != NULL)
+	{
+		rp = (struct ILibTURN_RefreshPeer*)ILibLinkedList_GetDataFromNode(node);
+		ILibDeleteEntry(turn->permissions, rp->key, rp->keyLength);
+		free(rp);
+		node = ILibLinkedList_Remove(node);
+	}
+
+	// Each channel binding needs its own ChannelBind request
+	en = ILibHashTree_GetEnumerator(turn->channels);
+	while (ILibHashTree_MoveNext(en) == 0)
+	{
+		ILibHashTree_GetValue(en, &key, &keyLength, (void**)&rp);
+		if (now - rp->refreshed < ILibTURN_ChannelRefresh) { continue; }
+		if (rp->used == 0) { ILibLinkedList_AddTail(idle, rp); continue; }
+
+		rp->used = 0;
+		rp->refreshed = now;
+		ILibTURN_SendChannelBind(turn, rp->channelNumber, &(rp->peer), NULL, NULL);
+	}
+	ILibHashTree_DestroyEnumerator(en);
+	node = ILibLinkedList_GetNode_Head(idle);
+	while (node != NULL)
+	{
+		rp = (struct ILibTURN_RefreshPeer*)ILibLinkedList_GetDataFromNode(node);
+		ILibDeleteEntry(turn->channels, rp->key, rp->keyLength);
+		free(rp);
+		node = ILibLinkedList_Remove(node);
+	}
+	ILibLinkedList_Destroy(idle);
 
-	ILibAsyncSocket_Send(turn->tcpClient, Packet, Ptr, ILibAsyncSocket_MemoryOwnership_USER);
+	ILibLifeTime_AddEx(ILibGetBaseTimer(turn->Chain), turn, ILibTURN_RefreshInterval, &ILibTURN_OnRefreshTick, NULL);
 }
 
 unsigned int ILibTURN_GetPendingBytesToSend(ILibTURN_ClientModule turnModule)
 {
 	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)turnModule;
+	void *udp;
+
+	if (turn->transport == ILibTURN_ServerTransport_UDP)
+	{
+		udp = turn->serverAddress.sin6_family == AF_INET6 ? turn->udpClient6 : turn->udpClient;
+		return (udp == NULL ? 0 : ILibAsyncSocket_GetPendingBytesToSend(udp));
+	}
 	return ILibAsyncSocket_GetPendingBytesToSend(turn->tcpClient);
 }
 
 enum ILibAsyncSocket_SendStatus ILibTURN_SendChannelData(ILibTURN_ClientModule turnModule, unsigned short channelNumber, char* buffer, int offset, int length)
 {
 	struct ILibTURN_TurnClientObject *turn = (struct ILibTURN_TurnClientObject*)turnModule;
-	char header[4];
-	enum ILibAsyncSocket_SendStatus retVal;
+	char frame[ILibTURN_MaxFrameSize];
+	char *packet = frame;
+	int packetLength = 4 + length;
+	struct ILibTURN_RefreshPeer *rp;
+	char *key;
+	int keyLength;
+
+	// Sending keeps both the channel binding and the permission for its peer alive in the next refresh cycle
+	if ((rp = (struct ILibTURN_RefreshPeer*)ILibGetEntry(turn->channels, (char*)&channelNumber, sizeof(unsigned short))) != NULL)
+	{
+		rp->used = 1;
+		keyLength = ILibTURN_GetPermissionKey(&(rp->peer), &key);
+		if ((rp = (struct ILibTURN_RefreshPeer*)ILibGetEntry(turn->permissions, key, keyLength)) != NULL) { rp->used = 1; }
+	}
 
-	((unsigned short*)header)[0] = htons(channelNumber ^ 0x4000);
-	((unsigned short*)header)[1] = htons((unsigned short)length);
+	// Over TCP the message is padded to a four byte boundary. Over UDP padding is not needed (RFC 8656, Section 12.5)
+	if (turn->transport != ILibTURN_ServerTransport_UDP) { packetLength = 4 + FOURBYTEBOUNDARY(length); }
+	if (packetLength > (int)sizeof(frame) && (packet = (char*)malloc(packetLength)) == NULL){ ILIBCRITICALEXIT(254); }
 
-	ILibAsyncSocket_Send(turn->tcpClient, header, 4, ILibAsyncSocket_MemoryOwnership_USER);
-	retVal = ILibAsyncSocket_Send(turn->tcpClient, buffer + offset, length, ILibAsyncSocket_MemoryOwnership_USER);
-	if (length % 4 > 0) { retVal = ILibAsyncSocket_Send(turn->tcpClient, header, 4 - (length % 4), ILibAsyncSocket_MemoryOwnership_USER); }
-	return retVal;
+	// Header, payload and padding are framed together, so they go out in a single write
+	((unsigned short*)packet)[0] = htons(channelNumber ^ 0x4000);
+	((unsigned short*)packet)[1] = htons((unsigned short)length);
+	memcpy(packet + 4, buffer + offset, length);
+	if (packetLength > 4 + length) { memset(packet + 4 + length, 0, packetLength - 4 - length); }
+
+	return ILibTURN_SendToServer(turn, packet, packetLength, packet == frame ? ILibAsyncSocket_MemoryOwnership_USER : ILibAsyncSocket_MemoryOwnership_CHAIN);
+}
+
+//
+// Embedded TURN Server (RFC 8656). Clients reach it over UDP or TCP, and peers are relayed over UDP
+//
+#define ILibTURN_Server_DefaultLifetime 600
+#define ILibTURN_Server_MaxLifetime 3600
+#define ILibTURN_Server_PermissionLifetime 300
+#define ILibTURN_Server_ChannelLifetime 600
+#define ILibTURN_Server_SweepInterval 5000
+#define ILibTURN_Server_RelayBatchSize 32
+#define ILibTURN_Server_RelayMaxBatches 16		// Per relay socket, per select, so one busy peer can't starve the rest of the chain
+#define ILibTURN_Server_ToPeer 0				// Quota directions
+#define ILibTURN_Server_ToClient 1
+
+struct ILibTURN_ServerObject
+{
+	ILibChain_PreSelect PreSelect;
+	ILibChain_PostSelect PostSelect;
+	ILibChain_Destroy Destroy;
+	void *Chain;
+
+	void *udpListener;
+	void *tcpListener;
+	struct sockaddr_in6 relayInterface;		// Relay sockets are bound to this address, and it is what we hand out as the relayed address
+	char *realm;
+	int realmLen;
+	char nonce[17];
+	int maxAllocations;
+	int allocationCount;
+	unsigned int bandwidthQuota;			// Bytes per second, per allocation, in each direction. 0 = Unlimited
+
+	void *users;							// Username -> ILibTURN_ServerUser
+	void *allocations;						// 5-Tuple -> ILibTURN_Allocation
+	void *relays;							// Relay Socket -> ILibTURN_Allocation
+
+	void *localStunModule;					// Peers at localEndpoint are handed straight to this module, instead of going out a socket
+	struct sockaddr_in6 localEndpoint;
+
+	struct sockaddr_in6 relayPeer[ILibTURN_Server_RelayBatchSize];
+	char relayData[ILibTURN_Server_RelayBatchSize][ILibTURN_MaxFrameSize];		// Datagrams read from a relay socket
+	char relayFrame[ILibTURN_Server_RelayBatchSize][ILibTURN_MaxFrameSize];	// The same datagrams, framed for the client
+#if defined(__linux__)
+	struct iovec relayDataVector[ILibTURN_Server_RelayBatchSize];
+	struct iovec relayFrameVector[ILibTURN_Server_RelayBatchSize];
+	struct mmsghdr relayDataHeader[ILibTURN_Server_RelayBatchSize];
+	struct mmsghdr relayFrameHeader[ILibTURN_Server_RelayBatchSize];
+#endif
+};
+
+struct ILibTURN_ServerUser
+{
+	ILibStun_IntegrityContext integrity;	// Keyed with MD5(username:realm:password)
+};
+
+struct ILibTURN_ServerChannel
+{
+	unsigned short channelNumber;
+	struct sockaddr_in6 peer;
+	char peerKey[18];
+	int peerKeyLength;
+	long long expires;
+};
+
+struct ILibTURN_Allocation
+{
+	struct ILibTURN_ServerObject *server;
+	struct ILibTURN_ServerUser *user;
+	char key[24];
+	int keyLength;
+	void *connection;						// TCP connection to the client, NULL if the client is on UDP
+	struct sockaddr_in6 client;
+	SOCKET relay;
+	struct sockaddr_in6 relayedAddress;
+	char allocateTransactionID[12];			// A retransmitted Allocate gets the same answer
+	long long expires;
+	void *permissions;						// Peer IP -> Expiration (Seconds of uptime)
+	void *channels;							// Channel Number -> ILibTURN_ServerChannel
+	void *peerChannels;						// Peer IP:Port -> ILibTURN_ServerChannel
+	long long quotaTick[2];					// One token bucket per direction, so one side can't use up the other's quota
+	long long quotaTokens[2];
+};
+
+// Permissions are keyed by IP only, channels by IP and port
+int ILibTURN_Server_PeerKey(struct sockaddr_in6 *peer, char *key, int withPort)
+{
+	int len = 0;
+	if (withPort != 0) { memcpy(key, &(peer->sin6_port), 2); len = 2; } // sin_port and sin6_port are at the same offset
+	if (peer->sin6_family == AF_INET6) { memcpy(key + len, &(peer->sin6_addr), 16); return(len + 16); }
+	memcpy(key + len, &(((struct sockaddr_in*)peer)->sin_addr), 4);
+	return(len + 4);
+}
+
+int ILibTURN_Server_AllocationKey(void *connection, struct sockaddr_in6 *client, char *key)
+{
+	if (connection != NULL) { key[0] = 'T'; memcpy(key + 1, &connection, sizeof(void*)); return(1 + (int)sizeof(void*)); }
+	key[0] = 'U';
+	return(1 + ILibTURN_Server_PeerKey(client, key + 1, 1));
+}
+
+void ILibTURN_Server_SendToClient(struct ILibTURN_ServerObject *server, void *connection, struct sockaddr_in6 *client, char *buffer, int length)
+{
+	if (connection != NULL)
+	{
+		ILibAsyncSocket_Send(connection, buffer, length, ILibAsyncSocket_MemoryOwnership_USER);
+	}
+	else
+	{
+		ILibAsyncUDPSocket_SendTo(server->udpListener, (struct sockaddr*)client, buffer, length, ILibAsyncSocket_MemoryOwnership_USER);
+	}
+}
+
+// Token bucket, holding at most one second worth of the quota
+int ILibTURN_Server_TakeQuota(struct ILibTURN_Allocation *allocation, int direction, int length)
+{
+	unsigned int quota = allocation->server->bandwidthQuota;
+	long long now;
+
+	if (quota == 0) { return 1; }
+	now = ILibGetUptime();
+	allocation->quotaTokens[direction] += (now - allocation->quotaTick[direction]) * quota / 1000;
+	if (allocation->quotaTokens[direction] > quota) { allocation->quotaTokens[direction] = quota; }
+	allocation->quotaTick[direction] = now;
+
+	if (allocation->quotaTokens[direction] < length) { return 0; }
+	allocation->quotaTokens[direction] -= length;
+	return 1;
+}
+
+void ILibTURN_Server_InstallPermission(struct ILibTURN_Allocation *allocation, struct sockaddr_in6 *peer)
+{
+	char key[16];
+	int keyLength = ILibTURN_Server_PeerKey(peer, key, 0);
+	ILibAddEntryEx(allocation->permissions, key, keyLength, NULL, (int)(ILibGetUptime() / 1000) + ILibTURN_Server_PermissionLifetime);
+}
+
+int ILibTURN_Server_HasPermission(struct ILibTURN_Allocation *allocation, struct sockaddr_in6 *peer)
+{
+	char key[16];
+	void *unused;
+	int expires, keyLength = ILibTURN_Server_PeerKey(peer, key, 0);
+
+	ILibGetEntryEx(allocation->permissions, key, keyLength, &unused, &expires);
+	if (expires == 0) { return 0; }
+	if (expires < (int)(ILibGetUptime() / 1000)) { ILibDeleteEntry(allocation->permissions, key, keyLength); return 0; }
+	return 1;
+}
+
+// Peer -> Client. Frames the data with the peer's channel if it has one, otherwise as a Data indication. Returns the frame length, or 0 if it doesn't fit
+int ILibTURN_Server_FrameData(struct ILibTURN_Allocation *allocation, struct sockaddr_in6 *peer, char *buffer, int length, char *frame)
+{
+	char address[20];
+	char TransactionID[12];
+	char key[18];
+	int ptr, addressLen;
+	struct ILibTURN_ServerChannel *channel;
+
+	if (length + ILibTURN_FrameHeadroom > ILibTURN_MaxFrameSize) { return 0; }
+
+	channel = (struct ILibTURN_ServerChannel*)ILibGetEntry(allocation->peerChannels, key, ILibTURN_Server_PeerKey(peer, key, 1));
+	if (channel != NULL && channel->expires > ILibGetUptime())
+	{
+		((unsigned short*)frame)[0] = htons(channel->channelNumber);
+		((unsigned short*)frame)[1] = htons((unsigned short)length);
+		memcpy(frame + 4, buffer, length);
+		ptr = 4 + length;
+		if (allocation->connection != NULL && ptr % 4 != 0) { memset(frame + ptr, 0, 4 - (ptr % 4)); ptr = FOURBYTEBOUNDARY(ptr); } // Only TCP needs the padding
+	}
+	else
+	{
+		util_random(12, TransactionID);
+		ptr = ILibTURN_GenerateStunFormattedPacketHeader(frame, TURN_DATA, TransactionID);
+		addressLen = ILibTURN_CreateXORMappedAddress(peer, address, TransactionID);
+		ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(frame, ptr, STUN_ATTRIB_XOR_PEER_ADDRESS, address, addressLen);
+		ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(frame, ptr, STUN_ATTRIB_DATA, buffer, length);
+		ptr += ILibStun_AddFingerprint(frame, ptr);
+	}
+	return(ptr);
+}
+
+// Peer -> Client, drains one relay socket in batches
+void ILibTURN_Server_ReadRelay(struct ILibTURN_ServerObject *server, struct ILibTURN_Allocation *allocation)
+{
+	int batch, received, length;
+#if defined(__linux__)
+	int frames, i;
+#endif
+
+	for (batch = 0; batch < ILibTURN_Server_RelayMaxBatches; ++batch)
+	{
+#if defined(__linux__)
+		frames = 0;
+		// One system call to read a batch from the peers, and for UDP clients, one to send the whole batch on to the client
+		for (i = 0; i < ILibTURN_Server_RelayBatchSize; ++i) { server->relayDataHeader[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6); }
+		if ((received = recvmmsg(allocation->relay, server->relayDataHeader, ILibTURN_Server_RelayBatchSize, MSG_DONTWAIT, NULL)) <= 0) { break; }
+		for (i = 0; i < received; ++i)
+		{
+			// Only peers the client gave permission to can reach it
+			if (ILibTURN_Server_HasPermission(allocation, &(server->relayPeer[i])) == 0 || ILibTURN_Server_TakeQuota(allocation, ILibTURN_Server_ToClient, (int)server->relayDataHeader[i].msg_len) == 0) { continue; }
+			if ((length = ILibTURN_Server_FrameData(allocation, &(server->relayPeer[i]), server->relayData[i], (int)server->relayDataHeader[i].msg_len, server->relayFrame[frames])) == 0) { continue; }
+			if (allocation->connection != NULL) { ILibTURN_Server_SendToClient(server, allocation->connection, &(allocation->client), server->relayFrame[frames], length); continue; }
+			server->relayFrameVector[frames].iov_len = length;
+			server->relayFrameHeader[frames].msg_hdr.msg_name = &(allocation->client);
+			server->relayFrameHeader[frames].msg_hdr.msg_namelen = INET_SOCKADDR_LENGTH(allocation->client.sin6_family);
+			++frames;
+		}
+		if (frames > 0) { sendmmsg(ILibAsyncUDPSocket_GetSocket(server->udpListener), server->relayFrameHeader, frames, MSG_DONTWAIT); } // Anything the socket can't take is dropped, like any other UDP loss
+#else
+		for (received = 0; received < ILibTURN_Server_RelayBatchSize; ++received)
+		{
+#if defined(WINSOCK2)
+			int remoteLength = sizeof(struct sockaddr_in6);
+#else
+			socklen_t remoteLength = sizeof(struct sockaddr_in6);
+#endif
+			if ((length = (int)recvfrom(allocation->relay, server->relayData[0], ILibTURN_MaxFrameSize, 0, (struct sockaddr*)&(server->relayPeer[0]), &remoteLength)) <= 0) { break; }
+			if (ILibTURN_Server_HasPermission(allocation, &(server->relayPeer[0])) == 0 || ILibTURN_Server_TakeQuota(allocation, ILibTURN_Server_ToClient, length) == 0) { continue; }
+			if ((length = ILibTURN_Server_FrameData(allocation, &(server->relayPeer[0]), server->relayData[0], length, server->relayFrame[0])) == 0) { continue; }
+			ILibTURN_Server_SendToClient(server, allocation->connection, &(allocation->client), server->relayFrame[0], length);
+		}
+		if (received == 0) { break; }
+#endif
+		if (received < ILibTURN_Server_RelayBatchSize) { break; }
+	}
+}
+
+void ILibTURN_Server_PreSelect(void* object, fd_set *readset, fd_set *writeset, fd_set *errorset, int* blocktime)
+{
+	struct ILibTURN_ServerObject *server = (struct ILibTURN_ServerObject*)object;
+	struct ILibTURN_Allocation *allocation;
+	void *en;
+	char *key;
+	int keyLength;
+
+	UNREFERENCED_PARAMETER(writeset);
+	UNREFERENCED_PARAMETER(errorset);
+	UNREFERENCED_PARAMETER(blocktime);
+
+	en = ILibHashTree_GetEnumerator(server->relays);
+	while (ILibHashTree_MoveNext(en) == 0)
+	{
+		ILibHashTree_GetValue(en, &key, &keyLength, (void**)&allocation);
+#if defined(WIN32)
+	#pragma warning( push, 3 ) // warning C4127: conditional expression is constant
+#endif
+		FD_SET(allocation->relay, readset);
+#if defined(WIN32)
+	#pragma warning( pop )
+#endif
+	}
+	ILibHashTree_DestroyEnumerator(en);
+}
+
+void ILibTURN_Server_PostSelect(void* object, int slct, fd_set *readset, fd_set *writeset, fd_set *errorset)
+{
+	struct ILibTURN_ServerObject *server = (struct ILibTURN_ServerObject*)object;
+	struct ILibTURN_Allocation *allocation;
+	void *en;
+	char *key;
+	int keyLength;
+
+	UNREFERENCED_PARAMETER(slct);
+	UNREFERENCED_PARAMETER(writeset);
+	UNREFERENCED_PARAMETER(errorset);
+
+	// Relaying to the client never frees an allocation, so the enumeration stays valid
+	en = ILibHashTree_GetEnumerator(server->relays);
+	while (ILibHashTree_MoveNext(en) == 0)
+	{
+		ILibHashTree_GetValue(en, &key, &keyLength, (void**)&allocation);
+		if (FD_ISSET(allocation->relay, readset)) { ILibTURN_Server_ReadRelay(server, allocation); }
+	}
+	ILibHashTree_DestroyEnumerator(en);
+}
+
+// Client -> Peer
+void ILibTURN_Server_Relay(struct ILibTURN_Allocation *allocation, struct sockaddr_in6 *peer, char *buffer, int length)
+{
+	struct ILibTURN_ServerObject *server = allocation->server;
+	struct ILibStun_Module *stun;
+	struct sockaddr_in6 relayedAddress;
+
+	if (ILibTURN_Server_HasPermission(allocation, peer) == 0 || ILibTURN_Server_TakeQuota(allocation, ILibTURN_Server_ToPeer, length) == 0) { return; }
+
+	if (server->localStunModule != NULL && peer->sin6_family == server->localEndpoint.sin6_family && peer->sin6_port == server->localEndpoint.sin6_port &&
+		memcmp(peer, &(server->localEndpoint), INET_SOCKADDR_LENGTH(peer->sin6_family)) == 0)
+	{
+		// The peer lives in this process, so skip the socket, and hand the packet to it as if it had come in on its own socket from the relayed
+		// address. A NULL socket would mean it came through our TURN client. Its replies go out that socket to the relayed address, so they
+		// come back in through this allocation, like any other peer's
+		stun = (struct ILibStun_Module*)server->localStunModule;
+		memcpy(&relayedAddress, &(allocation->relayedAddress), sizeof(struct sockaddr_in6));
+		ILibStun_OnUDP(relayedAddress.sin6_family == AF_INET6 ? stun->UDP6 : stun->UDP, buffer, length, &relayedAddress, stun, NULL, NULL);
+		return;
+	}
+	sendto(allocation->relay, buffer, length, 0, (struct sockaddr*)peer, INET_SOCKADDR_LENGTH(peer->sin6_family));	// Client datagrams arrive one at a time, so there is nothing to batch on this side
+}
+
+struct ILibTURN_Allocation* ILibTURN_Server_CreateAllocation(struct ILibTURN_ServerObject *server, struct ILibTURN_ServerUser *user, void *connection, struct sockaddr_in6 *client, char *key, int keyLength)
+{
+	struct ILibTURN_Allocation *allocation;
+	struct sockaddr_in6 localInterface;
+	SOCKET relay;
+	int flags;
+#if defined(WINSOCK2)
+	int localInterfaceLength = sizeof(struct sockaddr_in6);
+#else
+	socklen_t localInterfaceLength = sizeof(struct sockaddr_in6);
+#endif
+
+	memcpy(&localInterface, &(server->relayInterface), sizeof(struct sockaddr_in6));
+	localInterface.sin6_port = 0;
+	if ((relay = ILibGetSocket((struct sockaddr*)&localInterface, SOCK_DGRAM, IPPROTO_UDP)) == 0) { return NULL; }
+	getsockname(relay, (struct sockaddr*)&localInterface, &localInterfaceLength);
+
+	// Non-blocking, so a batch stops as soon as the socket is drained
+#if defined(WIN32)
+	flags = 1;
+	ioctlsocket(relay, FIONBIO, (u_long *)(&flags));
+#else
+	flags = fcntl(relay, F_GETFL, 0);
+	fcntl(relay, F_SETFL, O_NONBLOCK | flags);
+#endif
+
+	if ((allocation = (struct ILibTURN_Allocation*)malloc(sizeof(struct ILibTURN_Allocation))) == NULL) { ILIBCRITICALEXIT(254); }
+	memset(allocation, 0, sizeof(struct ILibTURN_Allocation));
+	allocation->server = server;
+	allocation->user = user;
+	memcpy(allocation->key, key, keyLength);
+	allocation->keyLength = keyLength;
+	allocation->connection = connection;
+	memcpy(&(allocation->client), client, INET_SOCKADDR_LENGTH(client->sin6_family));
+	allocation->relay = relay;
+	memcpy(&(allocation->relayedAddress), &(server->relayInterface), sizeof(struct sockaddr_in6));
+	allocation->relayedAddress.sin6_port = localInterface.sin6_port;	// sin_port and sin6_port are at the same offset
+	allocation->permissions = ILibInitHashTree();
+	allocation->channels = ILibInitHashTree();
+	allocation->peerChannels = ILibInitHashTree();
+	allocation->quotaTick[ILibTURN_Server_ToPeer] = allocation->quotaTick[ILibTURN_Server_ToClient] = ILibGetUptime();
+	allocation->quotaTokens[ILibTURN_Server_ToPeer] = allocation->quotaTokens[ILibTURN_Server_ToClient] = server->bandwidthQuota;
+
+	ILibAddEntry(server->allocations, allocation->key, keyLength, allocation);
+	ILibAddEntry(server->relays, (char*)&(allocation->relay), sizeof(SOCKET), allocation);
+	++server->allocationCount;
+	return allocation;
+}
+
+void ILibTURN_Server_FreeAllocation(struct ILibTURN_Allocation *allocation)
+{
+	struct ILibTURN_ServerObject *server = allocation->server;
+	void *en;
+	char *key;
+	int keyLength;
+	void *data;
+
+	ILibDeleteEntry(server->allocations, allocation->key, allocation->keyLength);
+	ILibDeleteEntry(server->relays, (char*)&(allocation->relay), sizeof(SOCKET));
+#if defined(WIN32)
+	closesocket(allocation->relay);
+#else
+	close(allocation->relay);
+#endif
+	--server->allocationCount;
+
+	en = ILibHashTree_GetEnumerator(allocation->channels);
+	while (ILibHashTree_MoveNext(en) == 0) { ILibHashTree_GetValue(en, &key, &keyLength, &data); free(data); }
+	ILibHashTree_DestroyEnumerator(en);
+	ILibDestroyHashTree(allocation->channels);
+	ILibDestroyHashTree(allocation->peerChannels);
+	ILibDestroyHashTree(allocation->permissions);
+	free(allocation);
+}
+
+void ILibTURN_Server_FreeChannel(struct ILibTURN_Allocation *allocation, struct ILibTURN_ServerChannel *channel)
+{
+	unsigned short channelNumber = channel->channelNumber;
+	ILibDeleteEntry(allocation->channels, (char*)&channelNumber, sizeof(unsigned short));
+	ILibDeleteEntry(allocation->peerChannels, channel->peerKey, channel->peerKeyLength);
+	free(channel);
+}
+
+// Lifetimes below the default are raised to it, and are capped at the maximum. 0 is only meaningful for Refresh
+unsigned int ILibTURN_Server_GetLifetime(char *buffer, int length)
+{
+	char *val;
+	unsigned int lifetime = ILibTURN_Server_DefaultLifetime;
+
+	if (ILibTURN_GetAttributeValue(buffer, 0, length, TURN_LIFETIME, 0, &val) == 4)
+	{
+		lifetime = ntohl(((unsigned int*)val)[0]);
+		if (lifetime != 0 && lifetime < ILibTURN_Server_DefaultLifetime) { lifetime = ILibTURN_Server_DefaultLifetime; }
+		if (lifetime > ILibTURN_Server_MaxLifetime) { lifetime = ILibTURN_Server_MaxLifetime; }
+	}
+	return(lifetime);
+}
+
+int ILibTURN_Server_ErrorResponse(struct ILibTURN_ServerObject *server, char *packet, STUN_TYPE method, char *TransactionID, int code, char *reason, ILibStun_IntegrityContext *integrity)
+{
+	char errorCode[64];
+	int reasonLen = (int)strlen(reason);
+	int ptr;
+
+	if (reasonLen > (int)sizeof(errorCode) - 4) { reasonLen = (int)sizeof(errorCode) - 4; }
+
+	errorCode[0] = 0;
+	errorCode[1] = 0;
+	errorCode[2] = (char)(code / 100);
+	errorCode[3] = (char)(code % 100);
+	memcpy(errorCode + 4, reason, reasonLen);
+
+	ptr = ILibTURN_GenerateStunFormattedPacketHeader(packet, (STUN_TYPE)(method | 0x0110), TransactionID);
+	ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(packet, ptr, STUN_ATTRIB_ERROR_CODE, errorCode, 4 + reasonLen);
+	if (code == 401 || code == 438)
+	{
+		// Challenge the client to (re)authenticate
+		ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(packet, ptr, STUN_ATTRIB_REALM, server->realm, server->realmLen);
+		ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(packet, ptr, STUN_ATTRIB_NONCE, server->nonce, 16);
+	}
+	if (integrity != NULL) { ptr += ILibStun_AddMessageIntegrityAttrEx(packet, ptr, integrity); }
+	ptr += ILibStun_AddFingerprint(packet, ptr);
+	return(ptr);
+}
+
+int ILibTURN_Server_Allocate(struct ILibTURN_ServerObject *server, struct ILibTURN_Allocation *allocation, struct ILibTURN_ServerUser *user, void *connection, struct sockaddr_in6 *client, char *key, int keyLength, char *buffer, int length, char *packet)
+{
+	char *TransactionID = buffer + 8;
+	char address[20];
+	char *val;
+	unsigned int lifetime;
+	int ptr, addressLen;
+
+	if (allocation != NULL)
+	{
+		if (memcmp(allocation->allocateTransactionID, TransactionID, 12) != 0) { return(ILibTURN_Server_ErrorResponse(server, packet, TURN_ALLOCATE, TransactionID, 437, "Allocation Mismatch", &(user->integrity))); }
+	}
+	else
+	{
+		if (ILibTURN_GetAttributeValue(buffer, 0, length, STUN_ATTRIB_REQUESTED_TRANSPORT, 0, &val) != 4) { return(ILibTURN_Server_ErrorResponse(server, packet, TURN_ALLOCATE, TransactionID, 400, "Bad Request", &(user->integrity))); }
+		if (val[0] != (char)ILibTURN_TransportTypes_UDP) { return(ILibTURN_Server_ErrorResponse(server, packet, TURN_ALLOCATE, TransactionID, 442, "Unsupported Transport Protocol", &(user->integrity))); }
+		if (server->allocationCount >= server->maxAllocations) { return(ILibTURN_Server_ErrorResponse(server, packet, TURN_ALLOCATE, TransactionID, 486, "Allocation Quota Reached", &(user->integrity))); }
+		if ((allocation = ILibTURN_Server_CreateAllocation(server, user, connection, client, key, keyLength)) == NULL) { return(ILibTURN_Server_ErrorResponse(server, packet, TURN_ALLOCATE, TransactionID, 508, "Insufficient Capacity", &(user->integrity))); }
+		memcpy(allocation->allocateTransactionID, TransactionID, 12);
+	}
+
+	if ((lifetime = ILibTURN_Server_GetLifetime(buffer, length)) == 0) { lifetime = ILibTURN_Server_DefaultLifetime; }
+	allocation->expires = ILibGetUptime() + (long long)lifetime * 1000;
+	lifetime = htonl(lifetime);
+
+	ptr = ILibTURN_GenerateStunFormattedPacketHeader(packet, TURN_ALLOCATE_RESPONSE, TransactionID);
+	addressLen = ILibTURN_CreateXORMappedAddress(&(allocation->relayedAddress), address, TransactionID);
+	ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(packet, ptr, STUN_ATTRIB_XOR_RELAY_ADDRESS, address, addressLen);
+	ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(packet, ptr, TURN_LIFETIME, (char*)&lifetime, 4);
+	addressLen = ILibTURN_CreateXORMappedAddress(client, address, TransactionID);
+	ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(packet, ptr, STUN_ATTRIB_XOR_MAPPED_ADDRESS, address, addressLen);
+	ptr += ILibStun_AddMessageIntegrityAttrEx(packet, ptr, &(user->integrity));
+	ptr += ILibStun_AddFingerprint(packet, ptr);
+	return(ptr);
+}
+
+int ILibTURN_Server_ChannelBind(struct ILibTURN_Allocation *allocation, char *buffer, int length, char *packet)
+{
+	char *TransactionID = buffer + 8;
+	char *val, *peerAttr;
+	char peerKey[18];
+	int peerLen, peerKeyLength, ptr;
+	unsigned short channelNumber;
+	long long now = ILibGetUptime();
+	struct sockaddr_in6 peer;
+	struct ILibTURN_ServerChannel *channel, *peerChannel;
+
+	peerLen = ILibTURN_GetAttributeValue(buffer, 0, length, STUN_ATTRIB_XOR_PEER_ADDRESS, 0, &peerAttr);
+	if (ILibTURN_GetAttributeValue(buffer, 0, length, TURN_CHANNEL_NUMBER, 0, &val) != 4 || peerLen == 0) { return(ILibTURN_Server_ErrorResponse(allocation->server, packet, TURN_CHANNEL_BIND, TransactionID, 400, "Bad Request", &(allocation->user->integrity))); }
+	channelNumber = ntohs(((unsigned short*)val)[0]);
+	memset(&peer, 0, sizeof(struct sockaddr_in6));
+	ILibTURN_GetXORMappedAddress(peerAttr, peerLen, TransactionID, &peer);
+	peerKeyLength = ILibTURN_Server_PeerKey(&peer, peerKey, 1);
+
+	channel = (struct ILibTURN_ServerChannel*)ILibGetEntry(allocation->channels, (char*)&channelNumber, sizeof(unsigned short));
+	if (channel != NULL && channel->expires < now) { ILibTURN_Server_FreeChannel(allocation, channel); channel = NULL; }
+	peerChannel = (struct ILibTURN_ServerChannel*)ILibGetEntry(allocation->peerChannels, peerKey, peerKeyLength);
+	if (peerChannel != NULL && peerChannel->expires < now) { ILibTURN_Server_FreeChannel(allocation, peerChannel); peerChannel = NULL; }
+
+	// A channel is bound to exactly one peer, and a peer to exactly one channel (RFC 8656, Section 11.2)
+	if (channelNumber < 0x4000 || channelNumber > 0x4FFF || channel != peerChannel) { return(ILibTURN_Server_ErrorResponse(allocation->server, packet, TURN_CHANNEL_BIND, TransactionID, 400, "Bad Request", &(allocation->user->integrity))); }
+	if (channel == NULL)
+	{
+		if ((channel = (struct ILibTURN_ServerChannel*)malloc(sizeof(struct ILibTURN_ServerChannel))) == NULL) { ILIBCRITICALEXIT(254); }
+		channel->channelNumber = channelNumber;
+		memcpy(&(channel->peer), &peer, sizeof(struct sockaddr_in6));
+		memcpy(channel->peerKey, peerKey, peerKeyLength);
+		channel->peerKeyLength = peerKeyLength;
+		ILibAddEntry(allocation->channels, (char*)&channelNumber, sizeof(unsigned short), channel);
+		ILibAddEntry(allocation->peerChannels, channel->peerKey, peerKeyLength, channel);
+	}
+	channel->expires = now + ILibTURN_Server_ChannelLifetime * 1000;
+	ILibTURN_Server_InstallPermission(allocation, &peer);
+
+	ptr = ILibTURN_GenerateStunFormattedPacketHeader(packet, TURN_CHANNEL_BIND_RESPONSE, TransactionID);
+	ptr += ILibStun_AddMessageIntegrityAttrEx(packet, ptr, &(allocation->user->integrity));
+	ptr += ILibStun_AddFingerprint(packet, ptr);
+	return(ptr);
+}
+
+void ILibTURN_Server_ProcessStun(struct ILibTURN_ServerObject *server, void *connection, struct sockaddr_in6 *client, char *buffer, int length)
+{
+	char packet[ILibTURN_MaxRequestSize];
+	char key[24];
+	char address[20];
+	char *TransactionID = buffer + 8;
+	char *username, *nonce, *val, *data;
+	int usernameLen, nonceLen, valLen, dataLen, keyLength, ptr, i;
+	unsigned int lifetime;
+	STUN_TYPE type = ILibTURN_GetMethodType(buffer, 0, length);
+	STUN_TYPE method = (STUN_TYPE)(type & 0x3EEF);
+	struct ILibTURN_ServerUser *user;
+	struct ILibTURN_Allocation *allocation;
+	struct sockaddr_in6 peer;
+
+	keyLength = ILibTURN_Server_AllocationKey(connection, client, key);
+	allocation = (struct ILibTURN_Allocation*)ILibGetEntry(server->allocations, key, keyLength);
+
+	if (IS_INDICATION(type))
+	{
+		// Send indications aren't authenticated, they are only accepted on an existing allocation
+		if (method != TURN_SEND || allocation == NULL) { return; }
+		valLen = ILibTURN_GetAttributeValue(buffer, 0, length, STUN_ATTRIB_XOR_PEER_ADDRESS, 0, &val);
+		dataLen = ILibTURN_GetAttributeValue(buffer, 0, length, STUN_ATTRIB_DATA, 0, &data);
+		if (valLen == 0 || dataLen == 0) { return; }
+		memset(&peer, 0, sizeof(struct sockaddr_in6));
+		ILibTURN_GetXORMappedAddress(val, valLen, TransactionID, &peer);
+		ILibTURN_Server_Relay(allocation, &peer, data, dataLen);
+		return;
+	}
+	if (!IS_REQUEST(type)) { return; }
+
+	switch (method)
+	{
+		case STUN_BINDING_REQUEST:
+		{
+			// Plain STUN, so clients can learn their server reflexive address from us too
+			ptr = ILibTURN_GenerateStunFormattedPacketHeader(packet, STUN_BINDING_RESPONSE, TransactionID);
+			valLen = ILibTURN_CreateXORMappedAddress(client, address, TransactionID);
+			ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(packet, ptr, STUN_ATTRIB_XOR_MAPPED_ADDRESS, address, valLen);
+			ptr += ILibStun_AddFingerprint(packet, ptr);
+			ILibTURN_Server_SendToClient(server, connection, client, packet, ptr);
+			return;
+		}
+		case TURN_ALLOCATE:
+		case TURN_REFRESH:
+		case TURN_CREATE_PERMISSION:
+		case TURN_CHANNEL_BIND:
+			break;
+		default:
+		{
+			ptr = ILibTURN_Server_ErrorResponse(server, packet, method, TransactionID, 400, "Bad Request", NULL);
+			ILibTURN_Server_SendToClient(server, connection, client, packet, ptr);
+			return;
+		}
+	}
+
+	// Long-Term Credentials (RFC 8489, Section 9.2)
+	usernameLen = ILibTURN_GetAttributeValue(buffer, 0, length, STUN_ATTRIB_USERNAME, 0, &username);
+	nonceLen = ILibTURN_GetAttributeValue(buffer, 0, length, STUN_ATTRIB_NONCE, 0, &nonce);
+	user = usernameLen > 0 ? (struct ILibTURN_ServerUser*)ILibGetEntry(server->users, username, usernameLen) : NULL;
+	if (user == NULL || nonceLen == 0 || ILibTURN_GetAttributeValue(buffer, 0, length, STUN_ATTRIB_MESSAGE_INTEGRITY, 0, &val) != 20)
+	{
+		ptr = ILibTURN_Server_ErrorResponse(server, packet, method, TransactionID, 401, "Unauthorized", NULL);
+	}
+	else if (nonceLen != 16 || memcmp(nonce, server->nonce, 16) != 0)
+	{
+		ptr = ILibTURN_Server_ErrorResponse(server, packet, method, TransactionID, 438, "Stale Nonce", NULL);
+	}
+	else if (ILibTURN_CheckMessageIntegrity(&(user->integrity), buffer, 0, length) == 0)
+	{
+		ptr = ILibTURN_Server_ErrorResponse(server, packet, method, TransactionID, 401, "Unauthorized", NULL);
+	}
+	else if (method == TURN_ALLOCATE)
+	{
+		ptr = ILibTURN_Server_Allocate(server, allocation, user, connection, client, key, keyLength, buffer, length, packet);
+	}
+	else if (allocation == NULL || allocation->user != user)
+	{
+		ptr = ILibTURN_Server_ErrorResponse(server, packet, method, TransactionID, 437, "Allocation Mismatch", &(user->integrity));
+	}
+	else if (method == TURN_REFRESH)
+	{
+		lifetime = ILibTURN_Server_GetLifetime(buffer, length);
+		allocation->expires = ILibGetUptime() + (long long)lifetime * 1000;
+		lifetime = htonl(lifetime);
+
+		ptr = ILibTURN_GenerateStunFormattedPacketHeader(packet, TURN_REFRESH_RESPONSE, TransactionID);
+		ptr += ILibTURN_AddAttributeToStunFormattedPacketHeader(packet, ptr, TURN_LIFETIME, (char*)&lifetime, 4);
+		ptr += ILibStun_AddMessageIntegrityAttrEx(packet, ptr, &(user->integrity));
+		ptr += ILibStun_AddFingerprint(packet, ptr);
+		if (lifetime == 0) { ILibTURN_Server_FreeAllocation(allocation); }
+	}
+	else if (method == TURN_CREATE_PERMISSION)
+	{
+		for (i = 0; (valLen = ILibTURN_GetAttributeValue(buffer, 0, length, STUN_ATTRIB_XOR_PEER_ADDRESS, i, &val)) > 0; ++i)
+		{
+			memset(&peer, 0, sizeof(struct sockaddr_in6));
+			ILibTURN_GetXORMappedAddress(val, valLen, TransactionID, &peer);
+			ILibTURN_Server_InstallPermission(allocation, &peer);
+		}
+		if (i == 0)
+		{
+			ptr = ILibTURN_Server_ErrorResponse(server, packet, method, TransactionID, 400, "Bad Request", &(user->integrity));
+		}
+		else
+		{
+			ptr = ILibTURN_GenerateStunFormattedPacketHeader(packet, TURN_CREATE_PERMISSION_RESPONSE, TransactionID);
+			ptr += ILibStun_AddMessageIntegrityAttrEx(packet, ptr, &(user->integrity));
+			ptr += ILibStun_AddFingerprint(packet, ptr);
+		}
+	}
+	else
+	{
+		ptr = ILibTURN_Server_ChannelBind(allocation, buffer, length, packet);
+	}
+
+	ILibTURN_Server_SendToClient(server, connection, client, packet, ptr);
+}
+
+// Processes one ChannelData or STUN message. Returns the bytes consumed, 0 if the frame is incomplete, or -1 if it isn't TURN at all
+int ILibTURN_Server_ProcessFrame(struct ILibTURN_ServerObject *server, void *connection, struct sockaddr_in6 *client, char *buffer, int length)
+{
+	char key[24];
+	int frameLength;
+	unsigned short dataLength;
+	struct ILibTURN_Allocation *allocation;
+	struct ILibTURN_ServerChannel *channel;
+
+	if (length < 4) { return 0; }
+	dataLength = ntohs(((unsigned short*)buffer)[1]);
+	if ((buffer[0] & 0xC0) == 0x40)
+	{
+		// ChannelData. Only TCP pads it to a four byte boundary
+		frameLength = 4 + (connection != NULL ? FOURBYTEBOUNDARY(dataLength) : dataLength);
+		if (length < frameLength) { return 0; }
+
+		allocation = (struct ILibTURN_Allocation*)ILibGetEntry(server->allocations, key, ILibTURN_Server_AllocationKey(connection, client, key));
+		if (allocation != NULL)
+		{
+			unsigned short channelNumber = ntohs(((unsigned short*)buffer)[0]);
+			channel = (struct ILibTURN_ServerChannel*)ILibGetEntry(allocation->channels, (char*)&channelNumber, sizeof(unsigned short));
+			if (channel != NULL && channel->expires > ILibGetUptime()) { ILibTURN_Server_Relay(allocation, &(channel->peer), buffer + 4, dataLength); }
+		}
+		return(frameLength);
+	}
+
+	if ((buffer[0] & 0xC0) != 0) { return -1; }
+	if (length < 20) { return 0; }
+	if (ntohl(((unsigned int*)buffer)[1]) != 0x2112A442) { return -1; }
+	frameLength = 20 + dataLength;
+	if (length < frameLength) { return 0; }
+
+	ILibTURN_Server_ProcessStun(server, connection, client, buffer, frameLength);
+	return(frameLength);
+}
+
+void ILibTURN_Server_OnUDP(ILibAsyncUDPSocket_SocketModule socketModule, char* buffer, int bufferLength, struct sockaddr_in6 *remoteInterface, void *user, void *user2, int *PAUSE)
+{
+	UNREFERENCED_PARAMETER(socketModule);
+	UNREFERENCED_PARAMETER(user2);
+	UNREFERENCED_PARAMETER(PAUSE);
+
+	// Each datagram carries exactly one message
+	ILibTURN_Server_ProcessFrame((struct ILibTURN_ServerObject*)user, NULL, remoteInterface, buffer, bufferLength);
+}
+
+void ILibTURN_Server_OnTcpConnect(ILibAsyncServerSocket_ServerModule AsyncServerSocketModule, ILibAsyncServerSocket_ConnectionToken ConnectionToken, void **user)
+{
+	UNREFERENCED_PARAMETER(AsyncServerSocketModule);
+	UNREFERENCED_PARAMETER(ConnectionToken);
+	*user = NULL;
+}
+
+void ILibTURN_Server_OnTcpDisconnect(ILibAsyncServerSocket_ServerModule AsyncServerSocketModule, ILibAsyncServerSocket_ConnectionToken ConnectionToken, void *user)
+{
+	struct ILibTURN_ServerObject *server = (struct ILibTURN_ServerObject*)ILibAsyncServerSocket_GetTag(AsyncServerSocketModule);
+	struct ILibTURN_Allocation *allocation;
+	char key[24];
+
+	UNREFERENCED_PARAMETER(user);
+
+	// A TCP allocation lives as long as its connection
+	allocation = (struct ILibTURN_Allocation*)ILibGetEntry(server->allocations, key, ILibTURN_Server_AllocationKey(ConnectionToken, NULL, key));
+	if (allocation != NULL) { ILibTURN_Server_FreeAllocation(allocation); }
+}
+
+void ILibTURN_Server_OnTcpReceive(ILibAsyncServerSocket_ServerModule AsyncServerSocketModule, ILibAsyncServerSocket_ConnectionToken ConnectionToken, char* buffer, int *p_beginPointer, int endPointer, ILibAsyncServerSocket_OnInterrupt *OnInterrupt, void **user, int *PAUSE)
+{
+	struct ILibTURN_ServerObject *server = (struct ILibTURN_ServerObject*)ILibAsyncServerSocket_GetTag(AsyncServerSocketModule);
+	struct sockaddr_in6 client;
+	int consumed;
+
+	UNREFERENCED_PARAMETER(OnInterrupt);
+	UNREFERENCED_PARAMETER(user);
+
+	memset(&client, 0, sizeof(struct sockaddr_in6));
+	ILibAsyncSocket_GetRemoteInterface(ConnectionToken, (struct sockaddr*)&client);
+
+	// Deliver every complete frame in the buffer
+	while (*PAUSE <= 0 && (consumed = ILibTURN_Server_ProcessFrame(server, ConnectionToken, &client, buffer + *p_beginPointer, endPointer - *p_beginPointer)) != 0)
+	{
+		if (consumed < 0) { ILibAsyncSocket_Disconnect(ConnectionToken); return; }
+		*p_beginPointer += consumed;
+	}
+}
+
+void ILibTURN_Server_OnSweep(void *object)
+{
+	struct ILibTURN_ServerObject *server = (struct ILibTURN_ServerObject*)object;
+	struct ILibTURN_Allocation *allocation;
+	long long now = ILibGetUptime();
+	void *en, *expired, *node;
+	char *key;
+	int keyLength;
+
+	expired = ILibLinkedList_Create();
+	en = ILibHashTree_GetEnumerator(server->allocations);
+	while (ILibHashTree_MoveNext(en) == 0)
+	{
+		ILibHashTree_GetValue(en, &key, &keyLength, (void**)&allocation);
+		if (allocation->expires < now) { ILibLinkedList_AddTail(expired, allocation); }
+	}
+	ILibHashTree_DestroyEnumerator(en);
+
+	node = ILibLinkedList_GetNode_Head(expired);
+	while (node != NULL)
+	{
+		ILibTURN_Server_FreeAllocation((struct ILibTURN_Allocation*)ILibLinkedList_GetDataFromNode(node));
+		node = ILibLinkedList_Remove(node);
+	}
+	ILibLinkedList_Destroy(expired);
+
+	ILibLifeTime_AddEx(ILibGetBaseTimer(server->Chain), server, ILibTURN_Server_SweepInterval, &ILibTURN_Server_OnSweep, NULL);
+}
+
+void ILibTURN_Server_OnDestroy(void *object)
+{
+	struct ILibTURN_ServerObject *server = (struct ILibTURN_ServerObject*)object;
+	struct ILibTURN_ServerUser *user;
+	void *en, *allocations, *node;
+	char *key;
+	int keyLength;
+	void *data;
+
+	allocations = ILibLinkedList_Create();
+	en = ILibHashTree_GetEnumerator(server->allocations);
+	while (ILibHashTree_MoveNext(en) == 0) { ILibHashTree_GetValue(en, &key, &keyLength, &data); ILibLinkedList_AddTail(allocations, data); }
+	ILibHashTree_DestroyEnumerator(en);
+	node = ILibLinkedList_GetNode_Head(allocations);
+	while (node != NULL)
+	{
+		ILibTURN_Server_FreeAllocation((struct ILibTURN_Allocation*)ILibLinkedList_GetDataFromNode(node));
+		node = ILibLinkedList_Remove(node);
+	}
+	ILibLinkedList_Destroy(allocations);
+
+	en = ILibHashTree_GetEnumerator(server->users);
+	while (ILibHashTree_MoveNext(en) == 0)
+	{
+		ILibHashTree_GetValue(en, &key, &keyLength, (void**)&user);
+		ILibStun_IntegrityContext_Cleanup(&(user->integrity));
+		free(user);
+	}
+	ILibHashTree_DestroyEnumerator(en);
+
+	ILibDestroyHashTree(server->users);
+	ILibDestroyHashTree(server->allocations);
+	ILibDestroyHashTree(server->relays);	// The relay sockets were closed with their allocations
+	free(server->realm);
+}
+
+ILibTURN_ServerModule ILibTURN_CreateServer(void *chain, unsigned short port, struct sockaddr_in6 *relayInterface, char *realm, int realmLen, int maxAllocations)
+{
+	struct ILibTURN_ServerObject *server;
+	struct sockaddr_in6 localInterface;
+	char nonce[8];
+#if defined(__linux__)
+	int i;
+#endif
+
+	if ((server = (struct ILibTURN_ServerObject*)malloc(sizeof(struct ILibTURN_ServerObject))) == NULL) { ILIBCRITICALEXIT(254); }
+	memset(server, 0, sizeof(struct ILibTURN_ServerObject));
+	server->PreSelect = &ILibTURN_Server_PreSelect;
+	server->PostSelect = &ILibTURN_Server_PostSelect;
+	server->Destroy = &ILibTURN_Server_OnDestroy;
+	server->Chain = chain;
+	server->maxAllocations = maxAllocations;
+	memcpy(&(server->relayInterface), relayInterface, INET_SOCKADDR_LENGTH(relayInterface->sin6_family));
+	if ((server->realm = (char*)malloc(realmLen + 1)) == NULL) { ILIBCRITICALEXIT(254); }
+	memcpy(server->realm, realm, realmLen);
+	server->realm[realmLen] = 0;
+	server->realmLen = realmLen;
+	util_random(8, nonce);
+	util_tohex(nonce, 8, server->nonce);
+
+	server->users = ILibInitHashTree();
+	server->allocations = ILibInitHashTree();
+	server->relays = ILibInitHashTree();
+#if defined(__linux__)
+	for (i = 0; i < ILibTURN_Server_RelayBatchSize; ++i)
+	{
+		server->relayDataVector[i].iov_base = server->relayData[i];
+		server->relayDataVector[i].iov_len = ILibTURN_MaxFrameSize;
+		server->relayDataHeader[i].msg_hdr.msg_iov = &(server->relayDataVector[i]);
+		server->relayDataHeader[i].msg_hdr.msg_iovlen = 1;
+		server->relayDataHeader[i].msg_hdr.msg_name = &(server->relayPeer[i]);
+		server->relayFrameVector[i].iov_base = server->relayFrame[i];
+		server->relayFrameHeader[i].msg_hdr.msg_iov = &(server->relayFrameVector[i]);
+		server->relayFrameHeader[i].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+
+	memset(&localInterface, 0, sizeof(struct sockaddr_in6));
+	localInterface.sin6_family = relayInterface->sin6_family;
+	localInterface.sin6_port = htons(port);	// sin_port and sin6_port are at the same offset
+	server->udpListener = ILibAsyncUDPSocket_CreateEx(chain, ILibTURN_MaxFrameSize, (struct sockaddr*)&localInterface, ILibAsyncUDPSocket_Reuse_EXCLUSIVE, &ILibTURN_Server_OnUDP, NULL, server);
+	server->tcpListener = ILibCreateAsyncServerSocketModule(chain, maxAllocations, port, 2 * ILibTURN_MaxFrameSize, 0, &ILibTURN_Server_OnTcpConnect, &ILibTURN_Server_OnTcpDisconnect, &ILibTURN_Server_OnTcpReceive, NULL, NULL);
+	if (server->tcpListener != NULL) { ILibAsyncServerSocket_SetTag(server->tcpListener, server); }
+
+	ILibAddToChain(chain, server);
+	ILibLifeTime_AddEx(ILibGetBaseTimer(chain), server, ILibTURN_Server_SweepInterval, &ILibTURN_Server_OnSweep, NULL);
+	return(server);
+}
+
+void ILibTURN_Server_AddUser(ILibTURN_ServerModule serverModule, char *username, int usernameLen, char *password, int passwordLen)
+{
+	struct ILibTURN_ServerObject *server = (struct ILibTURN_ServerObject*)serverModule;
+	struct ILibTURN_ServerUser *user = (struct ILibTURN_ServerUser*)ILibGetEntry(server->users, username, usernameLen);
+	char input[256];
+	char integrityKey[16];
+	int inputLen;
+
+	inputLen = snprintf(input, sizeof(input), "%.*s:%s:%.*s", usernameLen, username, server->realm, passwordLen, password);
+	if (inputLen < 0 || inputLen >= (int)sizeof(input)) { return; }
+	util_md5(input, inputLen, integrityKey);
+
+	if (user == NULL)
+	{
+		if ((user = (struct ILibTURN_ServerUser*)malloc(sizeof(struct ILibTURN_ServerUser))) == NULL) { ILIBCRITICALEXIT(254); }
+		memset(user, 0, sizeof(struct ILibTURN_ServerUser));
+		ILibAddEntry(server->users, username, usernameLen, user);
+	}
+	ILibStun_IntegrityContext_Init(&(user->integrity), integrityKey, 16);
+}
+
+void ILibTURN_Server_SetBandwidthQuota(ILibTURN_ServerModule serverModule, unsigned int bytesPerSecond)
+{
+	((struct ILibTURN_ServerObject*)serverModule)->bandwidthQuota = bytesPerSecond;
+}
+
+void ILibTURN_Server_SetLocalEndpoint(ILibTURN_ServerModule serverModule, void *stunModule, struct sockaddr_in6 *endpoint)
+{
+	struct ILibTURN_ServerObject *server = (struct ILibTURN_ServerObject*)serverModule;
+
+	server->localStunModule = stunModule;
+	memset(&(server->localEndpoint), 0, sizeof(struct sockaddr_in6));
+	if (stunModule != NULL && endpoint != NULL) { memcpy(&(server->localEndpoint), endpoint, INET_SOCKADDR_LENGTH(endpoint->sin6_family)); }
+}
+
+//
+// Standalone STUN Binding responder. Stateless, answers every well formed Binding request from a precomputed template
+//
+#define ILibStun_BindingResponder_BatchSize 32
+#define ILibStun_BindingResponder_MaxBatches 16		// Per select, so a flood can't starve the rest of the chain
+#define ILibStun_BindingResponder_MaxRequest 576
+#define ILibStun_BindingResponder_IPv4Length 40		// Header + XOR-MAPPED-ADDRESS(8) + FINGERPRINT
+#define ILibStun_BindingResponder_IPv6Length 52		// Header + XOR-MAPPED-ADDRESS(20) + FINGERPRINT
+
+struct ILibStun_BindingResponderObject
+{
+	ILibChain_PreSelect PreSelect;
+	ILibChain_PostSelect PostSelect;
+	ILibChain_Destroy Destroy;
+	void *Chain;
+	SOCKET socket;
+	unsigned int requests;
+	unsigned int batches;
+
+	char template4[ILibStun_BindingResponder_IPv4Length];
+	char template6[ILibStun_BindingResponder_IPv6Length];
+
+	struct sockaddr_in6 remote[ILibStun_BindingResponder_BatchSize];
+	char request[ILibStun_BindingResponder_BatchSize][ILibStun_BindingResponder_MaxRequest];
+	char response[ILibStun_BindingResponder_BatchSize][ILibStun_BindingResponder_IPv6Length];
+#if defined(__linux__)
+	struct iovec requestVector[ILibStun_BindingResponder_BatchSize];
+	struct iovec responseVector[ILibStun_BindingResponder_BatchSize];
+	struct mmsghdr requestHeader[ILibStun_BindingResponder_BatchSize];
+	struct mmsghdr responseHeader[ILibStun_BindingResponder_BatchSize];
+#endif
+};
+
+void ILibStun_BindingResponder_BuildTemplate(char *packet, int length, int addressLength, char family)
+{
+	memset(packet, 0, length);
+	((unsigned short*)packet)[0] = htons(STUN_BINDING_RESPONSE);
+	((unsigned short*)packet)[1] = htons((unsigned short)(length - 20));
+	((unsigned int*)packet)[1] = htonl(0x2112A442);
+	((unsigned short*)(packet + 20))[0] = htons(STUN_ATTRIB_XOR_MAPPED_ADDRESS);
+	((unsigned short*)(packet + 20))[1] = htons((unsigned short)addressLength);
+	packet[25] = family;
+	((unsigned short*)(packet + 24 + addressLength))[0] = htons((unsigned short)STUN_ATTRIB_FINGERPRINT);
+	((unsigned short*)(packet + 24 + addressLength))[1] = htons(4);
+}
+
+// Fills in 'response' for a Binding request, returns the response length, or 0 if the datagram isn't a Binding request
+int ILibStun_BindingResponder_Respond(struct ILibStun_BindingResponderObject *obj, char *request, int requestLength, struct sockaddr_in6 *remote, char *response)
+{
+	static const char v4mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, (char)0xFF, (char)0xFF };
+	char *addr;
+	int i, length;
+
+	if (requestLength < 20 || ntohs(((unsigned short*)request)[0]) != STUN_BINDING_REQUEST || ntohl(((unsigned int*)request)[1]) != 0x2112A442) { return 0; }
+	if (20 + ntohs(((unsigned short*)request)[1]) != requestLength) { return 0; }
+
+	// Only the transaction ID, the mapped address and the fingerprint differ between responses
+	if (remote->sin6_family == AF_INET6 && memcmp(&(remote->sin6_addr), v4mapped, 12) != 0)
+	{
+		length = ILibStun_BindingResponder_IPv6Length;
+		memcpy(response, obj->template6, length);
+		memcpy(response + 8, request + 8, 12);
+		((unsigned short*)response)[13] = remote->sin6_port ^ htons(0x2112);
+		memcpy(response + 28, &(remote->sin6_addr), 16);
+		for (i = 0; i < 16; ++i) { response[28 + i] ^= response[4 + i]; }	// Magic cookie followed by the transaction ID
+	}
+	else
+	{
+		length = ILibStun_BindingResponder_IPv4Length;
+		memcpy(response, obj->template4, length);
+		memcpy(response + 8, request + 8, 12);
+		((unsigned short*)response)[13] = remote->sin6_port ^ htons(0x2112);	// sin_port and sin6_port are at the same offset
+		addr = remote->sin6_family == AF_INET6 ? ((char*)&(remote->sin6_addr)) + 12 : (char*)&(((struct sockaddr_in*)remote)->sin_addr);
+		((unsigned int*)response)[7] = ((unsigned int*)addr)[0] ^ htonl(0x2112A442);
+	}
+	((unsigned int*)(response + length - 4))[0] = htonl(ILibStun_CRC32(response, length - 8) ^ 0x5354554e);
+	return(length);
+}
+
+void ILibStun_BindingResponder_PreSelect(void* object, fd_set *readset, fd_set *writeset, fd_set *errorset, int* blocktime)
+{
+	struct ILibStun_BindingResponderObject *obj = (struct ILibStun_BindingResponderObject*)object;
+
+	UNREFERENCED_PARAMETER(writeset);
+	UNREFERENCED_PARAMETER(errorset);
+	UNREFERENCED_PARAMETER(blocktime);
+
+#if defined(WIN32)
+	#pragma warning( push, 3 ) // warning C4127: conditional expression is constant
+#endif
+	FD_SET(obj->socket, readset);
+#if defined(WIN32)
+	#pragma warning( pop )
+#endif
+}
+
+void ILibStun_BindingResponder_PostSelect(void* object, int slct, fd_set *readset, fd_set *writeset, fd_set *errorset)
+{
+	struct ILibStun_BindingResponderObject *obj = (struct ILibStun_BindingResponderObject*)object;
+	int batch, received, responses, i, length;
+
+	UNREFERENCED_PARAMETER(slct);
+	UNREFERENCED_PARAMETER(writeset);
+	UNREFERENCED_PARAMETER(errorset);
+
+	if (!FD_ISSET(obj->socket, readset)) { return; }
+
+	for (batch = 0; batch < ILibStun_BindingResponder_MaxBatches; ++batch)
+	{
+		responses = 0;
+#if defined(__linux__)
+		// One system call to read a batch of requests, and one to send all the responses
+		for (i = 0; i < ILibStun_BindingResponder_BatchSize; ++i) { obj->requestHeader[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6); }
+		if ((received = recvmmsg(obj->socket, obj->requestHeader, ILibStun_BindingResponder_BatchSize, MSG_DONTWAIT, NULL)) <= 0) { break; }
+		for (i = 0; i < received; ++i)
+		{
+			if ((length = ILibStun_BindingResponder_Respond(obj, obj->request[i], (int)obj->requestHeader[i].msg_len, &(obj->remote[i]), obj->response[responses])) == 0) { continue; }
+			obj->responseVector[responses].iov_len = length;
+			obj->responseHeader[responses].msg_hdr.msg_name = &(obj->remote[i]);
+			obj->responseHeader[responses].msg_hdr.msg_namelen = obj->requestHeader[i].msg_hdr.msg_namelen;
+			++responses;
+		}
+		if (responses > 0) { sendmmsg(obj->socket, obj->responseHeader, responses, MSG_DONTWAIT); } // Anything the socket can't take is dropped, the client will retransmit
+#else
+		for (received = 0; received < ILibStun_BindingResponder_BatchSize; ++received)
+		{
+#if defined(WINSOCK2)
+			int remoteLength = sizeof(struct sockaddr_in6);
+#else
+			socklen_t remoteLength = sizeof(struct sockaddr_in6);
+#endif
+			if ((length = (int)recvfrom(obj->socket, obj->request[0], ILibStun_BindingResponder_MaxRequest, 0, (struct sockaddr*)&(obj->remote[0]), &remoteLength)) <= 0) { break; }
+			if ((length = ILibStun_BindingResponder_Respond(obj, obj->request[0], length, &(obj->remote[0]), obj->response[0])) == 0) { continue; }
+			sendto(obj->socket, obj->response[0], length, 0, (struct sockaddr*)&(obj->remote[0]), (int)remoteLength);
+			++responses;
+		}
+		if (received == 0) { break; }
+#endif
+		obj->requests += responses;
+		++obj->batches;
+		if (received < ILibStun_BindingResponder_BatchSize) { break; }
+	}
+}
+
+void ILibStun_BindingResponder_OnDestroy(void *object)
+{
+	struct ILibStun_BindingResponderObject *obj = (struct ILibStun_BindingResponderObject*)object;
+#if defined(WIN32)
+	closesocket(obj->socket);
+#else
+	close(obj->socket);
+#endif
+}
+
+ILibStun_BindingResponderModule ILibStun_CreateBindingResponder(void *chain, struct sockaddr_in6 *localInterface)
+{
+	struct ILibStun_BindingResponderObject *obj;
+	SOCKET sock;
+	int flags;
+
+	if ((sock = ILibGetSocket((struct sockaddr*)localInterface, SOCK_DGRAM, IPPROTO_UDP)) == 0) { return NULL; }
+
+	// Non-blocking, so a batch stops as soon as the socket is drained
+#if defined(WIN32)
+	flags = 1;
+	ioctlsocket(sock, FIONBIO, (u_long *)(&flags));
+#else
+	flags = fcntl(sock, F_GETFL, 0);
+	fcntl(sock, F_SETFL, O_NONBLOCK | flags);
+#endif
+
+	if ((obj = (struct ILibStun_BindingResponderObject*)malloc(sizeof(struct ILibStun_BindingResponderObject))) == NULL) { ILIBCRITICALEXIT(254); }
+	memset(obj, 0, sizeof(struct ILibStun_BindingResponderObject));
+	obj->PreSelect = &ILibStun_BindingResponder_PreSelect;
+	obj->PostSelect = &ILibStun_BindingResponder_PostSelect;
+	obj->Destroy = &ILibStun_BindingResponder_OnDestroy;
+	obj->Chain = chain;
+	obj->socket = sock;
+	ILibStun_BindingResponder_BuildTemplate(obj->template4, ILibStun_BindingResponder_IPv4Length, 8, 1);
+	ILibStun_BindingResponder_BuildTemplate(obj->template6, ILibStun_BindingResponder_IPv6Length, 20, 2);
+
+#if defined(__linux__)
+	for (flags = 0; flags < ILibStun_BindingResponder_BatchSize; ++flags)
+	{
+		obj->requestVector[flags].iov_base = obj->request[flags];
+		obj->requestVector[flags].iov_len = ILibStun_BindingResponder_MaxRequest;
+		obj->requestHeader[flags].msg_hdr.msg_iov = &(obj->requestVector[flags]);
+		obj->requestHeader[flags].msg_hdr.msg_iovlen = 1;
+		obj->requestHeader[flags].msg_hdr.msg_name = &(obj->remote[flags]);
+		obj->responseVector[flags].iov_base = obj->response[flags];
+		obj->responseHeader[flags].msg_hdr.msg_iov = &(obj->responseVector[flags]);
+		obj->responseHeader[flags].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+
+	ILibAddToChain(chain, obj);
+	return(obj);
+}
+
+unsigned short ILibStun_BindingResponder_GetLocalPort(ILibStun_BindingResponderModule responder)
+{
+	struct sockaddr_in6 localAddress;
+#if defined(WINSOCK2)
+	int localAddressLength = sizeof(struct sockaddr_in6);
+#else
+	socklen_t localAddressLength = sizeof(struct sockaddr_in6);
+#endif
+
+	if (getsockname(((struct ILibStun_BindingResponderObject*)responder)->socket, (struct sockaddr*)&localAddress, &localAddressLength) != 0) { return 0; }
+	return(ntohs(localAddress.sin6_port));	// sin_port and sin6_port are at the same offset
+}
+
+void ILibStun_BindingResponder_GetStats(ILibStun_BindingResponderModule responder, unsigned int *requests, unsigned int *batches)
+{
+	struct ILibStun_BindingResponderObject *obj = (struct ILibStun_BindingResponderObject*)responder;
+	if (requests != NULL) { *requests = obj->requests; }
+	if (batches != NULL) { *batches = obj->batches; }
 }
 
 #ifdef _WEBRTCDEBUG
@@ -15,12 +15,24 @@ limitations under the License.
 */
 #include "ILibRemoteLogging.h"
 
+#ifdef WIN32
+// Scatter/Gather buffer descriptor, laid out the same as the POSIX definition
+struct iovec
+{
+	void* iov_base;
+	size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
+
 
 #define ILibTransports_Raw_WebRTC 0x50
 
 typedef enum
 {
-	ILibWebRTC_SDP_Flags_DTLS_SERVER = 0x2
+	ILibWebRTC_SDP_Flags_DTLS_SERVER = 0x2,
+	ILibWebRTC_SDP_Flags_ICE_LITE = 0x4
 } ILibWebRTC_SDP_Flags;
 
 typedef enum
@@ -42,6 +54,12 @@ typedef enum
 	ILibWebRTC_TURN_ALWAYS_RELAY = 2	// Always relay all connections
 } ILibWebRTC_TURN_ConnectFlags;
 
+typedef enum
+{
+	ILibTURN_ServerTransport_TCP = 0,	// Control and relayed data share one TCP connection to the server (Default)
+	ILibTURN_ServerTransport_UDP = 1	// RFC 8656 over UDP. Requests are retransmitted, relayed data is not
+} ILibTURN_ServerTransports;
+
 typedef enum
 {
 	ILibWebRTC_DataChannel_ReliabilityMode_RELIABLE = 0x00,
@@ -61,14 +79,25 @@ void ILibStunClient_SetOptions(void* StunModule, SSL_CTX* securityContext, char*
 void* ILibStunClient_Start(void *Chain, unsigned short LocalPort, ILibStunClient_OnResult OnResult);
 void ILibStunClient_PerformNATBehaviorDiscovery(void* StunModule, struct sockaddr_in* StunServer, void *user);
 void ILibStunClient_PerformStun(void* StunModule, struct sockaddr_in* StunServer, void *user);
+// Results are cached per Local Interface and STUN Server for 'seconds' (Default 60), and refreshed in the background while they are being used. 0 = Disabled
+void ILibStunClient_SetResultCacheTTL(void* StunModule, int seconds);
+// Returns non-zero if there is an unexpired result for this STUN Server. 'natBehaviorDiscovery' selects which kind of exchange it came from
+int ILibStunClient_GetCachedResult(void* StunModule, struct sockaddr_in* StunServer, int natBehaviorDiscovery, ILibStun_Results *result, struct sockaddr_in *publicIP);
 void ILibStunClient_SendData(void* StunModule, struct sockaddr* target, char* data, int datalen, enum ILibAsyncSocket_MemoryOwnership UserFree);
 int ILibStun_SetIceOffer(void* StunModule, char* iceOffer, int iceOfferLen, char** answer);
 int ILibStun_SetIceOffer2(void *StunModule, char* iceOffer, int iceOfferLen, char *username, int usernameLength, char* password, int passwordLength, char** answer);
 int ILibStun_GenerateIceOffer(void* StunModule, char** offer, char* userName, char* password);
+// ICE Restart. New credentials and candidates are exchanged, but the existing DTLS session (and SCTP association) moves to the newly selected pair
+int ILibStun_GenerateIceRestartOffer(void *dtlsSession, char** offer, char* userName, char* password);
+int ILibStun_SetIceRestartOffer(void *dtlsSession, char* iceOffer, int iceOfferLen, char** answer);
+// Non-zero if the offer carries a different remote ufrag/pwd than the session is using, which is how the peer signals an ICE Restart
+int ILibStun_IsIceRestartOffer(void *dtlsSession, char* iceOffer, int iceOfferLen);
 unsigned int ILibStun_CRC32(char *buf, int len);
 int ILib_Stun_GetAttributeChangeRequestPacket(int flags, char* TransactionId, char* rbuffer);
 int ILibStun_ProcessStunPacket(void* obj, char* buffer, int bufferLength, struct sockaddr_in6 *remoteInterface);
 void ILibStun_ClearIceState(void* stunModule, int iceSlot);
+// Adds a remote candidate to an offer that was already set (Trickle ICE)
+void ILibORTC_AddCandidate(void *stunModule, char* localUsername, struct sockaddr_in6 *candidate);
 
 
 // WebRTC Related Methods
@@ -82,6 +111,8 @@ typedef enum
 
 int ILibWebRTC_IsDtlsInitiator(void* dtlsSession);
 void ILibWebRTC_OpenDataChannel(void *WebRTCModule, unsigned short streamId, char* channelName, int channelNameLength);
+// Declares an out-of-band negotiated Data Channel (No DCEP exchange). Both peers must declare the same StreamId. Can be called before SCTP is connected. Returns 0 on success
+int ILibWebRTC_OpenNegotiatedDataChannel(void *WebRTCModule, unsigned short streamId, ILibWebRTC_DataChannel_ReliabilityModes reliability, unsigned short reliabilityValue);
 void ILibWebRTC_CloseDataChannel_ALL(void *WebRTCModule);
 ILibWebRTC_DataChannel_CloseStatus ILibWebRTC_CloseDataChannel(void *WebRTCModule, unsigned short streamId);
 ILibWebRTC_DataChannel_CloseStatus ILibWebRTC_CloseDataChannelEx(void *WebRTCModule, unsigned short *streamIds, int streamIdsCount);
@@ -91,9 +122,23 @@ typedef void(*ILibWebRTC_OnDataChannelClosed)(void *StunModule, void* WebRTCModu
 typedef void(*ILibWebRTC_OnDataChannelAck)(void *StunModule, void* WebRTCModule, unsigned short StreamId);
 typedef void(*ILibWebRTC_OnOfferUpdated)(void* stunModule, char* iceOffer, int iceOfferLen);
 void ILibWebRTC_SetCallbacks(void *StunModule, ILibWebRTC_OnDataChannel OnDataChannel, ILibWebRTC_OnDataChannelClosed OnDataChannelClosed, ILibWebRTC_OnDataChannelAck OnDataChannelAck, ILibWebRTC_OnOfferUpdated OnOfferUpdated);
+// Called when the local interface addresses used for host candidates have changed, so the application can restart ICE
+typedef void(*ILibWebRTC_OnInterfacesChanged)(void *stunModule);
+void ILibWebRTC_SetOnInterfacesChanged(void *stunModule, ILibWebRTC_OnInterfacesChanged OnInterfacesChanged);
 void ILibStun_DTLS_GetIceUserName(void* WebRTCModule, char* username);
 void ILibWebRTC_SetTurnServer(void* stunModule, struct sockaddr_in6* turnServer, char* username, int usernameLength, char* password, int passwordLength, ILibWebRTC_TURN_ConnectFlags turnFlags);
 void ILibWebRTC_DisableConsentFreshness(void *stunModule);
+// Enables DTLS Session Resumption, so reconnecting peers skip the certificate exchange. The peer's fingerprint is still verified. 0 = Disabled (Default)
+void ILibWebRTC_SetSessionResumption(void *stunModule, int maxSessions, int timeoutSeconds);
+// Runs DTLS Handshakes on the specified number of worker threads, instead of on the Chain thread. Can only be set once
+void ILibWebRTC_SetHandshakeWorkers(void *stunModule, int workerCount);
+// ICE-Lite, for publicly reachable endpoints. Only answers connectivity checks, and never sends its own. 0 = Full ICE (Default)
+void ILibWebRTC_SetIceLite(void *stunModule, int enabled);
+// Milliseconds between RTT/loss probes of the backup candidate pairs of established sessions. When a backup pair is consistently better,
+// the session is moved to it. Only the CONTROLLING side probes. 0 = Disabled, the selected pair only changes if consent fails (Default 2500)
+void ILibWebRTC_SetPathProbeInterval(void *stunModule, int milliseconds);
+// Selects how the TURN server is reached. Takes effect the next time the TURN server is set
+void ILibWebRTC_SetTurnServerTransport(void *stunModule, ILibTURN_ServerTransports transport);
 
 void ILibWebRTC_SetUserObject(void *stunModule, char* localUsername, void *userObject);
 void* ILibWebRTC_GetUserObject(void *stunModule, char* localUsername);
@@ -114,6 +159,7 @@ int ILibSCTP_Debug_SetDebugCallback(void *dtlsSession, char* debugFieldName, ILi
 typedef void(*ILibSCTP_OnConnect)(void *StunModule, void* module, int connected);
 typedef void(*ILibSCTP_OnData)(void* StunModule, void* module, unsigned short streamId, int pid, char* buffer, int bufferLen, void** user);
 typedef void(*ILibSCTP_OnSendOK)(void* StunModule, void* module, void* user);
+typedef void(*ILibSCTP_OnBufferedAmountLow)(void* StunModule, void* module, unsigned short streamId, void* user);
 
 int ILibSCTP_DoesPeerSupportFeature(void* module, int feature);
 void ILibSCTP_Pause(void* module);
@@ -122,7 +168,28 @@ void ILibSCTP_Resume(void* module);
 void ILibSCTP_SetCallbacks(void* StunModule, ILibSCTP_OnConnect onconnect, ILibSCTP_OnData ondata, ILibSCTP_OnSendOK onsendok);
 ILibTransport_DoneState ILibSCTP_Send(void* module, unsigned short streamId, char* data, int datalen);
 ILibTransport_DoneState ILibSCTP_SendEx(void* module, unsigned short streamId, char* data, int datalen, int dataType);
+// Sends a single message gathered from 'vecCount' buffers, copying each directly into the outbound chunk(s)
+ILibTransport_DoneState ILibSCTP_SendV(void* module, unsigned short streamId, const struct iovec* vec, int vecCount, int dataType);
 int ILibSCTP_GetPendingBytesToSend(void* module);
+
+// Buffered Amount is the number of bytes queued on a stream that have not yet been acknowledged by the peer.
+// OnBufferedAmountLow is triggered when it drops to (or below) the stream's Low Threshold (Default: 0)
+void ILibSCTP_SetBufferedAmountLowCallback(void* StunModule, ILibSCTP_OnBufferedAmountLow onBufferedAmountLow);
+int ILibSCTP_GetBufferedAmount(void* module, unsigned short streamId);
+void ILibSCTP_SetBufferedAmountLowThreshold(void* module, unsigned short streamId, int threshold);
+int ILibSCTP_GetBufferedAmountLowThreshold(void* module, unsigned short streamId);
+
+// Called from within OnData to keep the received data valid after OnData returns. Returns a token for ILibSCTP_ReleaseReceiveBuffer, or NULL if called outside of OnData
+void* ILibSCTP_RetainReceiveBuffer(void* module);
+// Releases a buffer retained with ILibSCTP_RetainReceiveBuffer. May be called from any thread
+void ILibSCTP_ReleaseReceiveBuffer(void* receiveBuffer);
+
+// Caps the bytes queued per association. Sends that would exceed it fail with ILibTransport_DoneState_BUFFER_FULL. 0 = Unlimited
+void ILibSCTP_SetMaxSendBufferSize(void* StunModule, int maxBufferSize);
+// Bounds of the SCTP Retransmission Timeout, in milliseconds (Default: 1000 - 6000). Lower values let LAN deployments recover from loss faster
+void ILibSCTP_SetRTOBounds(void* StunModule, int rtoMin, int rtoMax);
+// Maximum time a SACK is delayed, in milliseconds (Default: 200, Max: 500). 0 = SACK every packet
+void ILibSCTP_SetDelayedAckTime(void* StunModule, int delayedAckTime);
 void ILibSCTP_Close(void* module);
 
 void ILibSCTP_SetUser(void* module, void* user);
@@ -165,4 +232,24 @@ void ILibTURN_CreateChannelBinding(ILibTURN_ClientModule turnModule, unsigned sh
 enum ILibAsyncSocket_SendStatus ILibTURN_SendChannelData(ILibTURN_ClientModule turnModule, unsigned short channelNumber, char* buffer, int offset, int length);
 int ILibTURN_IsConnectedToServer(ILibTURN_ClientModule clientModule);
 unsigned int ILibTURN_GetPendingBytesToSend(ILibTURN_ClientModule turnModule);
+void ILibTURN_SetServerTransport(ILibTURN_ClientModule turnModule, ILibTURN_ServerTransports transport);
+// Number of reads from the TCP connection to the TURN server that delivered frames, and the frames they carried. frames/reads is the average frames per read
+void ILibTURN_GetTcpReadStats(ILibTURN_ClientModule turnModule, unsigned int *reads, unsigned int *frames);
+
+// TURN Server
+typedef void* ILibTURN_ServerModule;
+// Listens for clients on UDP and TCP 'port', and relays to peers over UDP sockets bound to 'relayInterface'
+ILibTURN_ServerModule ILibTURN_CreateServer(void *chain, unsigned short port, struct sockaddr_in6 *relayInterface, char *realm, int realmLen, int maxAllocations);
+void ILibTURN_Server_AddUser(ILibTURN_ServerModule server, char *username, int usernameLen, char *password, int passwordLen);
+// Per allocation, in each direction. 0 = Unlimited
+void ILibTURN_Server_SetBandwidthQuota(ILibTURN_ServerModule server, unsigned int bytesPerSecond);
+// Relayed packets addressed to 'endpoint' are handed directly to 'stunModule', instead of going out a socket. Its replies still reach the client through the relayed address
+void ILibTURN_Server_SetLocalEndpoint(ILibTURN_ServerModule server, void *stunModule, struct sockaddr_in6 *endpoint);
+
+// STUN Binding Responder. Answers Binding requests on its own socket without any ICE state, for running a public STUN service
+typedef void* ILibStun_BindingResponderModule;
+ILibStun_BindingResponderModule ILibStun_CreateBindingResponder(void *chain, struct sockaddr_in6 *localInterface);
+unsigned short ILibStun_BindingResponder_GetLocalPort(ILibStun_BindingResponderModule responder);
+// Requests answered, and the receive batches they came in
+void ILibStun_BindingResponder_GetStats(ILibStun_BindingResponderModule responder, unsigned int *requests, unsigned int *batches);
 
@@ -27,6 +27,13 @@ limitations under the License.
 #include "ILibWrapperWebRTC.h"
 #include "../core/utils.h"
 
+#ifndef WIN32
+#include <pthread.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 
 #if defined(WIN32) && !defined(snprintf) && _MSC_VER < 1900
 #define snprintf(dst, len, frm, ...) _snprintf_s(dst, len, _TRUNCATE, frm, __VA_ARGS__)
@@ -39,6 +46,14 @@ limitations under the License.
 
 #define ILibWrapper_WebRTC_ConnectionFactory_ConnectionBucketSize 16	// *MUST* be a power of 2
 #define ILibWrapper_WebRTC_Connection_DataChannelsBucketSize 16			// *MUST* be a power of 2
+#define ILibWrapper_WebRTC_MaxStreams 1024								// Same as the SCTP stack (ILibSCTP_Stream_MaximumCount)
+
+// AES-GCM is fastest where there is hardware AES support, ChaCha20-Poly1305 everywhere else. CBC suites are only kept for DTLS 1.0 peers.
+#if defined(__arm__) || defined(__aarch64__) || defined(_M_ARM) || defined(_M_ARM64)
+#define ILibWrapper_WebRTC_DefaultCipherSuites "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305:ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:ECDHE-ECDSA-AES128-SHA:ECDHE-RSA-AES128-SHA:AES128-SHA"
+#else
+#define ILibWrapper_WebRTC_DefaultCipherSuites "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305:ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:ECDHE-ECDSA-AES128-SHA:ECDHE-RSA-AES128-SHA:AES128-SHA"
+#endif
 
 #define INET_SOCKADDR_LENGTH(x) ((x==AF_INET6?sizeof(struct sockaddr_in6):sizeof(struct sockaddr_in)))
 #define INET_SOCKADDR_PORT(x) (x->sa_family==AF_INET6?(unsigned short)(((struct sockaddr_in6*)x)->sin6_port):(unsigned short)(((struct sockaddr_in*)x)->sin_port))
@@ -96,6 +111,7 @@ typedef struct
 	int offerBlockLen;
 	int isOfferInitiator;
 	int isDtlsClient;
+	int isRestartingIce;
 
 	ILibSparseArray DataChannels;
 
@@ -201,6 +217,7 @@ int ILibWrapper_SdpToBlock(char* sdp, int sdpLen, int *isActive, char **username
 			*isActive = 1;
 		}
 
+		if(strcmp(f->data, "a=ice-lite")==0) {BlockFlags |= ILibWebRTC_SDP_Flags_ICE_LITE;}
 		if(f->datalength > 12 && strncmp(f->data, "a=ice-ufrag:", 12)==0) {*username = f->data + 12;} 
 		if(f->datalength > 10 && strncmp(f->data, "a=ice-pwd:", 10)==0) {*password = f->data + 10;} 
 
@@ -301,7 +318,7 @@ int ILibWrapper_SdpToBlock(char* sdp, int sdpLen, int *isActive, char **username
 
 int ILibWrapper_BlockToSDPEx(char* block, int blockLen, char** username, char** password, char **sdp, char* serverReflexiveCandidateAddress, unsigned short serverReflexiveCandidatePort)
 {
-	char* sdpTemplate1 = "v=0\r\no=MeshAgent %u 0 IN IP4 0.0.0.0\r\ns=SIP Call\r\nt=0 0\r\na=ice-ufrag:%s\r\na=ice-pwd:%s\r\na=fingerprint:sha-256 %s\r\nm=application 1 DTLS/SCTP 5000\r\nc=IN IP4 0.0.0.0\r\na=sctpmap:5000 webrtc-datachannel 16\r\na=setup:%s\r\n";
+	char* sdpTemplate1 = "v=0\r\no=MeshAgent %u 0 IN IP4 0.0.0.0\r\ns=SIP Call\r\nt=0 0\r\n%sa=ice-ufrag:%s\r\na=ice-pwd:%s\r\na=fingerprint:sha-256 %s\r\nm=application 1 DTLS/SCTP 5000\r\nc=IN IP4 0.0.0.0\r\na=sctpmap:5000 webrtc-datachannel 16\r\na=setup:%s\r\n";
 	char* sdpTemplateRelay = "a=candidate:%d %d UDP %d %s %d typ relay raddr %u.%u.%u.%u %d\r\n";
 	char* sdpTemplateLocalCand = "a=candidate:%d %d UDP %d %u.%u.%u.%u %u typ host\r\n";
 	char* sdpTemplateSrflxCand = "a=candidate:%d %d UDP %d %s %u typ srflx raddr %u.%u.%u.%u rport %u\r\n";
@@ -322,6 +339,7 @@ int ILibWrapper_BlockToSDPEx(char* block, int blockLen, char** username, char**
 
     int blockflags = ILibWrapper_ReadInt(block, 2);	
 	int isActive = (blockflags & ILibWebRTC_SDP_Flags_DTLS_SERVER) == ILibWebRTC_SDP_Flags_DTLS_SERVER ? 0:1;
+	int isLite = (blockflags & ILibWebRTC_SDP_Flags_ICE_LITE) == ILibWebRTC_SDP_Flags_ICE_LITE ? 1:0;
 
 	int usernamelen = (int)block[6];
 	int passwordlen = (int)block[7 + usernamelen];
@@ -353,7 +371,7 @@ int ILibWrapper_BlockToSDPEx(char* block, int blockLen, char** username, char**
 
 
 	// Build the sdp
-	sdpLen = 2 + strlen(sdpTemplate1) + usernamelen + passwordlen + 7 + (dtlshashlen*3) + 7 + (2 *   (candidatecount * (12 + 21 + strlen(sdpTemplateLocalCand)))  );
+	sdpLen = 2 + strlen(sdpTemplate1) + 12 + usernamelen + passwordlen + 7 + (dtlshashlen*3) + 7 + (2 *   (candidatecount * (12 + 21 + strlen(sdpTemplateLocalCand)))  );
 	if(serverReflexiveCandidateAddress!=NULL)
 	{
 		sdpLen += (2* (12 + 21 + strlen(sdpTemplateSrflxCand)));
@@ -367,7 +385,7 @@ int ILibWrapper_BlockToSDPEx(char* block, int blockLen, char** username, char**
 
 	util_random(4, junk);
 
-	x = snprintf(*sdp, sdpLen, sdpTemplate1, ((unsigned int*)junk)[0]%1000000, *username, *password, dtlshash, isActive==0?"passive":"actpass");
+	x = snprintf(*sdp, sdpLen, sdpTemplate1, ((unsigned int*)junk)[0]%1000000, isLite!=0?"a=ice-lite\r\n":"", *username, *password, dtlshash, isActive==0?"passive":"actpass");
 
 	for(c = 1; c <= 2; ++c)
 	{
@@ -401,23 +419,146 @@ int ILibWrapper_BlockToSDP(char* block, int blockLen, int isActive, char** usern
 {
 	return(ILibWrapper_BlockToSDPEx(block, blockLen, username, password, sdp, NULL, 0));
 }
+// Certificates are cached process wide, so that additional factories (and restarts, when a cache file is set) re-use the same keys
+typedef struct ILibWrapper_WebRTC_CertificateCacheEntry
+{
+	int valid;
+	struct util_cert selfcert;
+	struct util_cert selftlscert;
+	struct util_cert selftlsclientcert;
+}ILibWrapper_WebRTC_CertificateCacheEntry;
+
+ILibWrapper_WebRTC_CertificateCacheEntry g_CertificateCache[ILibWrapper_WebRTC_CertificateKey_Count];
+ILibWrapper_WebRTC_CertificateKeyTypes g_CertificateKeyType = ILibWrapper_WebRTC_CertificateKey_ECDSA_P256;
+char* g_CertificateCacheFile = NULL;
+
+#ifdef WIN32
+SRWLOCK g_CertificateCacheLock = SRWLOCK_INIT;
+#define ILibWrapper_WebRTC_CertificateCache_Lock() AcquireSRWLockExclusive(&g_CertificateCacheLock)
+#define ILibWrapper_WebRTC_CertificateCache_UnLock() ReleaseSRWLockExclusive(&g_CertificateCacheLock)
+#else
+pthread_mutex_t g_CertificateCacheLock = PTHREAD_MUTEX_INITIALIZER;
+#define ILibWrapper_WebRTC_CertificateCache_Lock() pthread_mutex_lock(&g_CertificateCacheLock)
+#define ILibWrapper_WebRTC_CertificateCache_UnLock() pthread_mutex_unlock(&g_CertificateCacheLock)
+#endif
+
+// Loads the root, TLS server and TLS client certificates from the cache file. Returns 0 if they were loaded and match the requested key type.
+int ILibWrapper_WebRTC_CertificateCache_Load(ILibWrapper_WebRTC_CertificateCacheEntry *entry, int keyType)
+{
+	struct util_cert* certs[3] = { &(entry->selfcert), &(entry->selftlscert), &(entry->selftlsclientcert) };
+	FILE *pFile = NULL;
+	int i;
+
+	if (g_CertificateCacheFile == NULL) { return 1; }
+#ifdef WIN32
+	fopen_s(&pFile, g_CertificateCacheFile, "rb");
+#else
+	pFile = fopen(g_CertificateCacheFile, "rb");
+#endif
+	if (pFile == NULL) { return 1; }
+
+	for (i = 0; i < 3; ++i)
+	{
+		if ((certs[i]->pkey = PEM_read_PrivateKey(pFile, NULL, 0, NULL)) == NULL) { break; }
+		if ((certs[i]->x509 = PEM_read_X509(pFile, NULL, 0, NULL)) == NULL) { break; }
+	}
+	fclose(pFile);
+
+	if (i == 3)
+	{
+		switch (EVP_PKEY_id(entry->selftlscert.pkey))
+		{
+			case EVP_PKEY_RSA:
+				i = keyType == ILibWrapper_WebRTC_CertificateKey_RSA;
+				break;
+			case EVP_PKEY_EC:
+				i = keyType == ILibWrapper_WebRTC_CertificateKey_ECDSA_P256;
+				break;
+			default:
+				i = keyType == ILibWrapper_WebRTC_CertificateKey_ED25519;
+				break;
+		}
+		if (i != 0) { return 0; }
+	}
+
+	// The file was truncated, or was generated for a different key type
+	util_freecert(&(entry->selftlsclientcert));
+	util_freecert(&(entry->selftlscert));
+	util_freecert(&(entry->selfcert));
+	return 1;
+}
+void ILibWrapper_WebRTC_CertificateCache_Save(ILibWrapper_WebRTC_CertificateCacheEntry *entry)
+{
+	struct util_cert* certs[3] = { &(entry->selfcert), &(entry->selftlscert), &(entry->selftlsclientcert) };
+	FILE *pFile = NULL;
+	int i;
+#ifndef WIN32
+	int fd;
+#endif
+
+	if (g_CertificateCacheFile == NULL) { return; }
+#ifdef WIN32
+	fopen_s(&pFile, g_CertificateCacheFile, "wb");
+#else
+	// The file holds private keys, so it is created owner-only. An existing file keeps its mode on open, so that is fixed before anything is written
+	if ((fd = open(g_CertificateCacheFile, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) < 0) { return; }
+	if (fchmod(fd, S_IRUSR | S_IWUSR) != 0 || (pFile = fdopen(fd, "wb")) == NULL) { close(fd); return; }
+#endif
+	if (pFile == NULL) { return; }
+
+	for (i = 0; i < 3; ++i)
+	{
+		PEM_write_PrivateKey(pFile, certs[i]->pkey, NULL, NULL, 0, NULL, NULL);
+		PEM_write_X509(pFile, certs[i]->x509);
+	}
+	fclose(pFile);
+}
+
 void ILibWrapper_WebRTC_InitializeCrypto(ILibWrapper_WebRTC_ConnectionFactoryStruct *factory)
 {
 	int l = 32;
+	ILibWrapper_WebRTC_CertificateCacheEntry *entry;
 
 	// Init SSL
 	util_openssl_init();
 
 	// Init Certs
-	util_mkCert(NULL, &(factory->selfcert), 2048, 10000, "localhost", CERTIFICATE_ROOT, NULL);
+	ILibWrapper_WebRTC_CertificateCache_Lock();
+	entry = &(g_CertificateCache[g_CertificateKeyType]);
+	if (entry->valid == 0 && ILibWrapper_WebRTC_CertificateCache_Load(entry, g_CertificateKeyType) == 0) { entry->valid = 1; }
+	if (entry->valid == 0)
+	{
+		util_mkCertEx(NULL, &(entry->selfcert), (enum CERTIFICATE_KEY_TYPES)g_CertificateKeyType, 2048, 10000, "localhost", CERTIFICATE_ROOT, NULL);
+		util_mkCertEx(&(entry->selfcert), &(entry->selftlscert), (enum CERTIFICATE_KEY_TYPES)g_CertificateKeyType, 2048, 10000, "localhost", CERTIFICATE_TLS_SERVER, NULL);
+		util_mkCertEx(&(entry->selfcert), &(entry->selftlsclientcert), (enum CERTIFICATE_KEY_TYPES)g_CertificateKeyType, 2048, 10000, "localhost", CERTIFICATE_TLS_CLIENT, NULL);
+		entry->valid = 1;
+		ILibWrapper_WebRTC_CertificateCache_Save(entry);
+	}
+	util_copycert(&(entry->selfcert), &(factory->selfcert));
+	util_copycert(&(entry->selftlscert), &(factory->selftlscert));
+	util_copycert(&(entry->selftlsclientcert), &(factory->selftlsclientcert));
+	ILibWrapper_WebRTC_CertificateCache_UnLock();
 	util_keyhash(factory->selfcert, factory->g_selfid);
-	util_mkCert(&(factory->selfcert), &(factory->selftlscert), 2048, 10000, "localhost", CERTIFICATE_TLS_SERVER, NULL);
-	util_mkCert(&(factory->selfcert), &(factory->selftlsclientcert), 2048, 10000, "localhost", CERTIFICATE_TLS_CLIENT, NULL);
 
-	// Init DTLS
+	// Init DTLS, negotiating DTLS 1.2 (AEAD record protection) when the peer supports it
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+	factory->ctx = SSL_CTX_new(DTLS_method());
+#else
 	factory->ctx = SSL_CTX_new(DTLSv1_method());
-	//factory->ctx = 0;
-	//SSL_CTX_set_ecdh_auto(factory->ctx, 1);
+#endif
+	SSL_CTX_set_options(factory->ctx, SSL_OP_CIPHER_SERVER_PREFERENCE);
+	SSL_CTX_set_cipher_list(factory->ctx, ILibWrapper_WebRTC_DefaultCipherSuites);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	SSL_CTX_set1_curves_list(factory->ctx, "X25519:P-256:P-384");
+#elif OPENSSL_VERSION_NUMBER >= 0x10002000L
+	SSL_CTX_set_ecdh_auto(factory->ctx, 1);
+#else
+	{
+		// ECDSA certificates are only usable with ephemeral ECDH key exchange
+		EC_KEY *ecdh = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+		if (ecdh != NULL) { SSL_CTX_set_tmp_ecdh(factory->ctx, ecdh); EC_KEY_free(ecdh); }
+	}
+#endif
 
 	SSL_CTX_use_certificate(factory->ctx, factory->selftlscert.x509);
 	SSL_CTX_use_PrivateKey(factory->ctx, factory->selftlscert.pkey);		
@@ -607,6 +748,24 @@ void ILibWrapper_WebRTC_OnConnectSink(void *StunModule, void* module, int connec
 
 	obj->isDtlsClient = ILibWebRTC_IsDtlsInitiator(module);
 
+	if(connected!=0)
+	{
+		ILibWrapper_WebRTC_DataChannel *dc;
+		int i;
+
+		// Declare the negotiated channels that were created before we were connected
+		ILibSparseArray_Lock(obj->DataChannels);
+		for(i=0;i<ILibWrapper_WebRTC_MaxStreams;++i)
+		{
+			if((dc = (ILibWrapper_WebRTC_DataChannel*)ILibSparseArray_Get(obj->DataChannels, i)) != NULL && dc->negotiatedPending != 0)
+			{
+				dc->negotiatedPending = 0;
+				ILibWebRTC_OpenNegotiatedDataChannel(module, dc->streamId, dc->reliability, dc->reliabilityValue);
+			}
+		}
+		ILibSparseArray_UnLock(obj->DataChannels);
+	}
+
 	if(obj->OnConnected!=NULL)
 	{
 		obj->OnConnected(obj, connected);
@@ -644,6 +803,19 @@ void ILibWrapper_WebRTC_OnSendOKSink(void* StunModule, void* module, void* user)
 		obj->OnSendOK(obj);
 	}
 }
+void ILibWrapper_WebRTC_OnBufferedAmountLowSink(void* StunModule, void* module, unsigned short streamId, void* user)
+{
+	ILibWrapper_WebRTC_ConnectionStruct *obj = (ILibWrapper_WebRTC_ConnectionStruct*) ILibWebRTC_GetUserObjectFromDtlsSession(module);
+	ILibWrapper_WebRTC_DataChannel *dc;
+
+	if(obj == NULL) {return;}
+
+	ILibSparseArray_Lock(obj->DataChannels);
+	dc = (ILibWrapper_WebRTC_DataChannel*)ILibSparseArray_Get(obj->DataChannels, (int)streamId);
+	ILibSparseArray_UnLock(obj->DataChannels);
+
+	if(dc != NULL && dc->OnBufferedAmountLow != NULL) {dc->OnBufferedAmountLow(dc);}
+}
 void ILibWrapper_WebRTC_OnDataChannelClosed(void *StunModule, void* WebRTCModule, unsigned short StreamId)
 {
 	ILibWrapper_WebRTC_ConnectionStruct *obj = (ILibWrapper_WebRTC_ConnectionStruct*) ILibWebRTC_GetUserObjectFromDtlsSession(WebRTCModule);
@@ -723,6 +895,7 @@ ILibWrapper_WebRTC_ConnectionFactory ILibWrapper_WebRTC_ConnectionFactory_Create
 	ILibStunClient_SetOptions(retVal->mStunModule, retVal->ctx, retVal->tlsServerCertThumbprint);
 	ILibSCTP_SetCallbacks(retVal->mStunModule, &ILibWrapper_WebRTC_OnConnectSink, &ILibWrapper_WebRTC_OnDataSink, &ILibWrapper_WebRTC_OnSendOKSink);
 	ILibWebRTC_SetCallbacks(retVal->mStunModule, &ILibWrapper_WebRTC_OnDataChannel, &ILibWrapper_WebRTC_OnDataChannelClosed, &ILibWrapper_WebRTC_OnDataChannelAck, &ILibWrapper_WebRTC_OnOfferUpdated);
+	ILibSCTP_SetBufferedAmountLowCallback(retVal->mStunModule, &ILibWrapper_WebRTC_OnBufferedAmountLowSink);
 	
 	retVal->Connections = ILibSparseArray_Create(ILibWrapper_WebRTC_ConnectionFactory_ConnectionBucketSize, &ILibWrapper_WebRTC_ConnectionFactory_Bucketizer);
 	retVal->mChain = chain;
@@ -782,6 +955,8 @@ int ILibWrapper_WebRTC_PerformStunEx(ILibWrapper_WebRTC_ConnectionStruct *connec
 {
 	int i,delimiter;
 	struct sockaddr_in6 stunServer;
+	struct sockaddr_in6 publicIP;
+	ILibStun_Results result;
 	unsigned short port;
 	char temp[255];
 	char *host;
@@ -817,7 +992,12 @@ int ILibWrapper_WebRTC_PerformStunEx(ILibWrapper_WebRTC_ConnectionStruct *connec
 						break;
 				}
 				connection->stunIndex = i;
-				if(MappingDetection == 0)
+				if(ILibStunClient_GetCachedResult(connection->mFactory->mStunModule, (struct sockaddr_in*)&stunServer, MappingDetection, &result, (struct sockaddr_in*)&publicIP)!=0)
+				{
+					// We already know what this server will say, so the candidates are ready now
+					ILibWrapper_WebRTC_OnStunResult(connection->mFactory->mStunModule, result, (struct sockaddr_in*)&publicIP, connection);
+				}
+				else if(MappingDetection == 0)
 				{
 					ILibStunClient_PerformStun(connection->mFactory->mStunModule, (struct sockaddr_in*)&stunServer, connection);
 				}
@@ -866,7 +1046,16 @@ char* ILibWrapper_WebRTC_Connection_SetOffer(ILibWrapper_WebRTC_Connection conne
 	offer[offerLen] = 0;
 	ILibRemoteLogging_printf(ILibChainGetLogger(obj->mFactory->mChain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "[ILibWrapperWebRTC] Set ICE/Offer: <br/>%s", offer);
 
-	obj->offerBlockLen = ILibStun_SetIceOffer2(obj->mFactory->mStunModule, obj->remoteOfferBlock, obj->remoteOfferBlockLen, obj->offerBlock != NULL ? obj->localUsername : NULL, obj->offerBlock != NULL ? 8 : 0, obj->offerBlock != NULL ? obj->localPassword : NULL, obj->offerBlock != NULL ? 32 : 0, &obj->offerBlock);
+	if (obj->dtlsSession != NULL && obj->isConnected != 0 && obj->isRestartingIce == 0 && ILibStun_IsIceRestartOffer(obj->dtlsSession, obj->remoteOfferBlock, obj->remoteOfferBlockLen) != 0)
+	{
+		// The peer is restarting ICE on a connection we already have
+		obj->offerBlockLen = ILibStun_SetIceRestartOffer(obj->dtlsSession, obj->remoteOfferBlock, obj->remoteOfferBlockLen, &obj->offerBlock);
+	}
+	else
+	{
+		obj->offerBlockLen = ILibStun_SetIceOffer2(obj->mFactory->mStunModule, obj->remoteOfferBlock, obj->remoteOfferBlockLen, obj->offerBlock != NULL ? obj->localUsername : NULL, obj->offerBlock != NULL ? 8 : 0, obj->offerBlock != NULL ? obj->localPassword : NULL, obj->offerBlock != NULL ? 32 : 0, &obj->offerBlock);
+	}
+	obj->isRestartingIce = 0;
 	ILibWrapper_BlockToSDP(obj->offerBlock, obj->offerBlockLen, obj->isOfferInitiator, &un, &up, &sdp);
 
 	ILibRemoteLogging_printf(ILibChainGetLogger(obj->mFactory->mChain), ILibRemoteLogging_Modules_WebRTC_STUN_ICE, ILibRemoteLogging_Flags_VerbosityLevel_1, "[ILibWrapperWebRTC] Return ICE/Response: <br/>%s", sdp);
@@ -938,6 +1127,41 @@ char* ILibWrapper_WebRTC_Connection_GenerateOffer(ILibWrapper_WebRTC_Connection
 	return(sdp);
 }
 
+char* ILibWrapper_WebRTC_Connection_RestartIce(ILibWrapper_WebRTC_Connection connection, ILibWrapper_WebRTC_OnConnectionCandidate onCandidates)
+{
+	ILibWrapper_WebRTC_ConnectionStruct *obj = (ILibWrapper_WebRTC_ConnectionStruct*) connection;
+
+	char* offer;
+	int offerLen;
+	char *sdp;
+	char* username,*password;
+
+	if(obj->dtlsSession == NULL || obj->isConnected == 0) {return(NULL);}
+	if((offerLen = ILibStun_GenerateIceRestartOffer(obj->dtlsSession, &offer, obj->localUsername, obj->localPassword)) == 0) {return(NULL);}
+
+	ILibWrapper_BlockToSDP(offer, offerLen, obj->isOfferInitiator, &username, &password, &sdp);
+
+	free(username);
+	free(password);
+
+	if(obj->offerBlock!=NULL) {free(obj->offerBlock);}
+	obj->offerBlock = offer;
+	obj->offerBlockLen = offerLen;
+	obj->OnCandidates = onCandidates;
+	obj->isRestartingIce = 1;
+
+	if(onCandidates != NULL)
+	{
+		if(ILibWrapper_WebRTC_PerformStun(obj)!=0)
+		{
+			// No STUN Servers to try
+			onCandidates(connection, NULL);
+		}
+	}
+
+	return(sdp);
+}
+
 char* ILibWrapper_WebRTC_Connection_AddServerReflexiveCandidateToLocalSDP(ILibWrapper_WebRTC_Connection connection, struct sockaddr_in6* candidate)
 {
 	ILibWrapper_WebRTC_ConnectionStruct *obj = (ILibWrapper_WebRTC_ConnectionStruct*) connection;
@@ -963,6 +1187,12 @@ char* ILibWrapper_WebRTC_Connection_AddServerReflexiveCandidateToLocalSDP(ILibWr
 	return(sdp);
 }
 
+void ILibWrapper_WebRTC_Connection_AddRemoteCandidate(ILibWrapper_WebRTC_Connection connection, struct sockaddr_in6* candidate)
+{
+	ILibWrapper_WebRTC_ConnectionStruct *obj = (ILibWrapper_WebRTC_ConnectionStruct*) connection;
+	ILibORTC_AddCandidate(obj->mFactory->mStunModule, obj->localUsername, candidate);
+}
+
 void ILibWrapper_WebRTC_Connection_Pause(ILibWrapper_WebRTC_Connection connection)
 {
 	ILibWrapper_WebRTC_ConnectionStruct *cs = (ILibWrapper_WebRTC_ConnectionStruct*)connection;
@@ -988,6 +1218,37 @@ ILibTransport_DoneState ILibWrapper_WebRTC_DataChannel_SendString(ILibWrapper_We
 {
 	return(ILibWrapper_WebRTC_DataChannel_SendEx(dataChannel, data, dataLen, 51));
 }
+ILibTransport_DoneState ILibWrapper_WebRTC_DataChannel_SendV(ILibWrapper_WebRTC_DataChannel* dataChannel, const struct iovec* vec, int vecCount, int dataType)
+{
+	ILibWrapper_WebRTC_ConnectionStruct *connection = (ILibWrapper_WebRTC_ConnectionStruct*)dataChannel->parent;
+
+	return(ILibSCTP_SendV(connection->dtlsSession, dataChannel->streamId, vec, vecCount, dataType));
+}
+
+int ILibWrapper_WebRTC_DataChannel_GetBufferedAmount(ILibWrapper_WebRTC_DataChannel* dataChannel)
+{
+	ILibWrapper_WebRTC_ConnectionStruct *connection = (ILibWrapper_WebRTC_ConnectionStruct*)dataChannel->parent;
+	return(connection->dtlsSession != NULL ? ILibSCTP_GetBufferedAmount(connection->dtlsSession, dataChannel->streamId) : 0);
+}
+void ILibWrapper_WebRTC_DataChannel_SetBufferedAmountLowThreshold(ILibWrapper_WebRTC_DataChannel* dataChannel, int bufferedAmountLowThreshold)
+{
+	ILibWrapper_WebRTC_ConnectionStruct *connection = (ILibWrapper_WebRTC_ConnectionStruct*)dataChannel->parent;
+	if(connection->dtlsSession != NULL) {ILibSCTP_SetBufferedAmountLowThreshold(connection->dtlsSession, dataChannel->streamId, bufferedAmountLowThreshold);}
+}
+int ILibWrapper_WebRTC_DataChannel_GetBufferedAmountLowThreshold(ILibWrapper_WebRTC_DataChannel* dataChannel)
+{
+	ILibWrapper_WebRTC_ConnectionStruct *connection = (ILibWrapper_WebRTC_ConnectionStruct*)dataChannel->parent;
+	return(connection->dtlsSession != NULL ? ILibSCTP_GetBufferedAmountLowThreshold(connection->dtlsSession, dataChannel->streamId) : 0);
+}
+void* ILibWrapper_WebRTC_DataChannel_RetainBuffer(ILibWrapper_WebRTC_DataChannel* dataChannel)
+{
+	ILibWrapper_WebRTC_ConnectionStruct *connection = (ILibWrapper_WebRTC_ConnectionStruct*)dataChannel->parent;
+	return(connection->dtlsSession != NULL ? ILibSCTP_RetainReceiveBuffer(connection->dtlsSession) : NULL);
+}
+void ILibWrapper_WebRTC_DataChannel_ReleaseBuffer(void* retainedBuffer)
+{
+	ILibSCTP_ReleaseReceiveBuffer(retainedBuffer);
+}
 
 ILibWrapper_WebRTC_DataChannel* ILibWrapper_WebRTC_DataChannel_Create(ILibWrapper_WebRTC_Connection connection, char* channelName, int channelNameLen, ILibWrapper_WebRTC_DataChannel_OnDataChannelAck OnAckHandler)
 {
@@ -998,7 +1259,7 @@ void ILibWrapper_WebRTC_DataChannel_Close(ILibWrapper_WebRTC_DataChannel* dataCh
 	ILibWrapper_WebRTC_ConnectionStruct *connection = (ILibWrapper_WebRTC_ConnectionStruct*)dataChannel->parent;
 	ILibWebRTC_CloseDataChannel(connection->dtlsSession, dataChannel->streamId);
 }
-ILibWrapper_WebRTC_DataChannel* ILibWrapper_WebRTC_DataChannel_CreateEx(ILibWrapper_WebRTC_Connection connection, char* channelName, int channelNameLen, unsigned short streamId, ILibWrapper_WebRTC_DataChannel_OnDataChannelAck OnAckHandler)
+ILibWrapper_WebRTC_DataChannel* ILibWrapper_WebRTC_DataChannel_Allocate(ILibWrapper_WebRTC_Connection connection, char* channelName, int channelNameLen, unsigned short streamId)
 {
 	ILibWrapper_WebRTC_DataChannel *retVal = (ILibWrapper_WebRTC_DataChannel*)malloc(sizeof(ILibWrapper_WebRTC_DataChannel));
 	if(retVal==NULL){ILIBCRITICALEXIT(254);}
@@ -1010,17 +1271,40 @@ ILibWrapper_WebRTC_DataChannel* ILibWrapper_WebRTC_DataChannel_CreateEx(ILibWrap
 	retVal->channelName[channelNameLen] = 0;
 
 	retVal->streamId = streamId;
-	retVal->OnAck = OnAckHandler;
 
 	ILibSparseArray_Lock(((ILibWrapper_WebRTC_ConnectionStruct*)connection)->DataChannels);
 	ILibSparseArray_Add(((ILibWrapper_WebRTC_ConnectionStruct*)connection)->DataChannels, retVal->streamId, retVal);
 	ILibSparseArray_UnLock(((ILibWrapper_WebRTC_ConnectionStruct*)connection)->DataChannels);
 
 	ILibWrapper_InitializeDataChannel_Transport(retVal);
+	return(retVal);
+}
+ILibWrapper_WebRTC_DataChannel* ILibWrapper_WebRTC_DataChannel_CreateEx(ILibWrapper_WebRTC_Connection connection, char* channelName, int channelNameLen, unsigned short streamId, ILibWrapper_WebRTC_DataChannel_OnDataChannelAck OnAckHandler)
+{
+	ILibWrapper_WebRTC_DataChannel *retVal = ILibWrapper_WebRTC_DataChannel_Allocate(connection, channelName, channelNameLen, streamId);
+	retVal->OnAck = OnAckHandler;
 
 	ILibWebRTC_OpenDataChannel(((ILibWrapper_WebRTC_ConnectionStruct*)connection)->dtlsSession, streamId, channelName, channelNameLen);
 	return(retVal);
 }
+ILibWrapper_WebRTC_DataChannel* ILibWrapper_WebRTC_DataChannel_CreateNegotiated(ILibWrapper_WebRTC_Connection connection, char* channelName, int channelNameLen, unsigned short streamId, ILibWebRTC_DataChannel_ReliabilityModes reliability, unsigned short reliabilityValue)
+{
+	ILibWrapper_WebRTC_ConnectionStruct *obj = (ILibWrapper_WebRTC_ConnectionStruct*)connection;
+	ILibWrapper_WebRTC_DataChannel *retVal;
+
+	if(ILibSparseArray_Get(obj->DataChannels, (int)streamId) != NULL) {return(NULL);}
+	if(obj->dtlsSession != NULL && ILibWebRTC_OpenNegotiatedDataChannel(obj->dtlsSession, streamId, reliability, reliabilityValue) != 0) {return(NULL);}
+
+	retVal = ILibWrapper_WebRTC_DataChannel_Allocate(connection, channelName, channelNameLen, streamId);
+	if(obj->dtlsSession == NULL)
+	{
+		// Not connected yet, so it is declared from OnConnectSink, before any data from the peer is processed
+		retVal->negotiatedPending = 1;
+		retVal->reliability = reliability;
+		retVal->reliabilityValue = reliabilityValue;
+	}
+	return(retVal);
+}
 void ILibWrapper_WebRTC_ConnectionFactory_SetTurnServer(ILibWrapper_WebRTC_ConnectionFactory factory, struct sockaddr_in6* turnServer, char* username, int usernameLength, char* password, int passwordLength, ILibWebRTC_TURN_ConnectFlags turnSetting)
 {
 	ILibWrapper_WebRTC_ConnectionFactoryStruct *cf = (ILibWrapper_WebRTC_ConnectionFactoryStruct*)factory;
@@ -1048,6 +1332,77 @@ void ILibWrapper_WebRTC_ConnectionFactory_SetTurnServer(ILibWrapper_WebRTC_Conne
 		ILibWebRTC_SetTurnServer(cf->mStunModule, turnServer, username, usernameLength, password, passwordLength, turnSetting);
 	}
 }
+void ILibWrapper_WebRTC_ConnectionFactory_SetMaxSendBufferSize(ILibWrapper_WebRTC_ConnectionFactory factory, int maxBufferSize)
+{
+	ILibWrapper_WebRTC_ConnectionFactoryStruct *cf = (ILibWrapper_WebRTC_ConnectionFactoryStruct*)factory;
+	ILibSCTP_SetMaxSendBufferSize(cf->mStunModule, maxBufferSize);
+}
+void ILibWrapper_WebRTC_ConnectionFactory_SetRTOBounds(ILibWrapper_WebRTC_ConnectionFactory factory, int rtoMin, int rtoMax)
+{
+	ILibWrapper_WebRTC_ConnectionFactoryStruct *cf = (ILibWrapper_WebRTC_ConnectionFactoryStruct*)factory;
+	ILibSCTP_SetRTOBounds(cf->mStunModule, rtoMin, rtoMax);
+}
+void ILibWrapper_WebRTC_ConnectionFactory_SetSessionResumption(ILibWrapper_WebRTC_ConnectionFactory factory, int maxSessions, int timeoutSeconds)
+{
+	ILibWrapper_WebRTC_ConnectionFactoryStruct *cf = (ILibWrapper_WebRTC_ConnectionFactoryStruct*)factory;
+	ILibWebRTC_SetSessionResumption(cf->mStunModule, maxSessions, timeoutSeconds);
+}
+void ILibWrapper_WebRTC_ConnectionFactory_SetHandshakeWorkers(ILibWrapper_WebRTC_ConnectionFactory factory, int workerCount)
+{
+	ILibWrapper_WebRTC_ConnectionFactoryStruct *cf = (ILibWrapper_WebRTC_ConnectionFactoryStruct*)factory;
+	ILibWebRTC_SetHandshakeWorkers(cf->mStunModule, workerCount);
+}
+void ILibWrapper_WebRTC_ConnectionFactory_SetIceLite(ILibWrapper_WebRTC_ConnectionFactory factory, int enabled)
+{
+	ILibWrapper_WebRTC_ConnectionFactoryStruct *cf = (ILibWrapper_WebRTC_ConnectionFactoryStruct*)factory;
+	ILibWebRTC_SetIceLite(cf->mStunModule, enabled);
+}
+void ILibWrapper_WebRTC_ConnectionFactory_SetTurnServerTransport(ILibWrapper_WebRTC_ConnectionFactory factory, ILibTURN_ServerTransports transport)
+{
+	ILibWrapper_WebRTC_ConnectionFactoryStruct *cf = (ILibWrapper_WebRTC_ConnectionFactoryStruct*)factory;
+	ILibWebRTC_SetTurnServerTransport(cf->mStunModule, transport);
+}
+int ILibWrapper_WebRTC_ConnectionFactory_SetCipherSuites(ILibWrapper_WebRTC_ConnectionFactory factory, char* cipherSuites)
+{
+	ILibWrapper_WebRTC_ConnectionFactoryStruct *cf = (ILibWrapper_WebRTC_ConnectionFactoryStruct*)factory;
+	return(SSL_CTX_set_cipher_list(cf->ctx, cipherSuites != NULL ? cipherSuites : ILibWrapper_WebRTC_DefaultCipherSuites) == 1 ? 0 : 1);
+}
+void ILibWrapper_WebRTC_SetCertificateKeyType(ILibWrapper_WebRTC_CertificateKeyTypes keyType)
+{
+#if OPENSSL_VERSION_NUMBER < 0x10101000L
+	if (keyType == ILibWrapper_WebRTC_CertificateKey_ED25519) { keyType = ILibWrapper_WebRTC_CertificateKey_ECDSA_P256; }
+#endif
+	if (keyType < 0 || keyType >= ILibWrapper_WebRTC_CertificateKey_Count) { return; }
+	ILibWrapper_WebRTC_CertificateCache_Lock();
+	g_CertificateKeyType = keyType;
+	ILibWrapper_WebRTC_CertificateCache_UnLock();
+}
+void ILibWrapper_WebRTC_SetCertificateCacheFile(char* path)
+{
+	ILibWrapper_WebRTC_CertificateCache_Lock();
+	if (g_CertificateCacheFile != NULL) { free(g_CertificateCacheFile); g_CertificateCacheFile = NULL; }
+	if (path != NULL)
+	{
+		int pathLen = (int)strlen(path);
+		if ((g_CertificateCacheFile = (char*)malloc(pathLen + 1)) == NULL) { ILIBCRITICALEXIT(254); }
+		memcpy(g_CertificateCacheFile, path, pathLen + 1);
+	}
+	ILibWrapper_WebRTC_CertificateCache_UnLock();
+}
+void ILibWrapper_WebRTC_ClearCertificateCache()
+{
+	int i;
+	ILibWrapper_WebRTC_CertificateCache_Lock();
+	for (i = 0; i < ILibWrapper_WebRTC_CertificateKey_Count; ++i)
+	{
+		// Factories hold their own references, so this is safe to call while they are still running
+		util_freecert(&(g_CertificateCache[i].selftlsclientcert));
+		util_freecert(&(g_CertificateCache[i].selftlscert));
+		util_freecert(&(g_CertificateCache[i].selfcert));
+		g_CertificateCache[i].valid = 0;
+	}
+	ILibWrapper_WebRTC_CertificateCache_UnLock();
+}
 void ILibWrapper_WebRTC_Connection_SetUserData(ILibWrapper_WebRTC_Connection connection, void *user1, void *user2, void *user3)
 {
 	ILibWrapper_WebRTC_ConnectionStruct *obj = (ILibWrapper_WebRTC_ConnectionStruct*)connection;
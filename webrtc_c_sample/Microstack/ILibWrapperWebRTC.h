@@ -19,9 +19,19 @@ limitations under the License.
 
 #include "ILibAsyncSocket.h"
 
+struct iovec; // Defined in ILibWebRTC.h
+
 #define ILibTransports_WebRTC_DataChannel 0x51
 
 typedef void* ILibWrapper_WebRTC_ConnectionFactory;
+
+typedef enum ILibWrapper_WebRTC_CertificateKeyTypes
+{
+	ILibWrapper_WebRTC_CertificateKey_RSA = 0,			// 2048 bit RSA
+	ILibWrapper_WebRTC_CertificateKey_ECDSA_P256 = 1,	// ECDSA P-256 [DEFAULT]
+	ILibWrapper_WebRTC_CertificateKey_ED25519 = 2,		// Ed25519, requires OpenSSL 1.1.1, and is not yet accepted by browsers
+	ILibWrapper_WebRTC_CertificateKey_Count = 3
+}ILibWrapper_WebRTC_CertificateKeyTypes;
 typedef void* ILibWrapper_WebRTC_Connection;
 
 struct ILibWrapper_WebRTC_DataChannel;
@@ -29,6 +39,7 @@ typedef void(*ILibWrapper_WebRTC_DataChannel_OnDataChannelAck)(struct ILibWrappe
 typedef void(*ILibWrapper_WebRTC_DataChannel_OnData)(struct ILibWrapper_WebRTC_DataChannel* dataChannel, char* data, int dataLen);
 typedef void(*ILibWrapper_WebRTC_DataChannel_OnRawData)(struct ILibWrapper_WebRTC_DataChannel* dataChannel, char* data, int dataLen, int dataType);
 typedef void(*ILibWrapper_WebRTC_DataChannel_OnClosed)(struct ILibWrapper_WebRTC_DataChannel* dataChannel);
+typedef void(*ILibWrapper_WebRTC_DataChannel_OnBufferedAmountLow)(struct ILibWrapper_WebRTC_DataChannel* dataChannel);
 typedef struct ILibWrapper_WebRTC_DataChannel
 {	
 	ILibWrapper_WebRTC_DataChannel_OnData OnBinaryData;
@@ -49,8 +60,13 @@ typedef struct ILibWrapper_WebRTC_DataChannel
 
 	ILibWrapper_WebRTC_DataChannel_OnDataChannelAck OnAck;
 	ILibWrapper_WebRTC_DataChannel_OnClosed OnClosed;
+	ILibWrapper_WebRTC_DataChannel_OnBufferedAmountLow OnBufferedAmountLow;
 	ILibWrapper_WebRTC_Connection parent;
 	void* userData;
+
+	int negotiatedPending;				// Non-zero if this is a negotiated channel that will be declared once the connection is up
+	ILibWebRTC_DataChannel_ReliabilityModes reliability;
+	unsigned short reliabilityValue;
 }ILibWrapper_WebRTC_DataChannel;
 
 typedef void(*ILibWrapper_WebRTC_OnConnectionCandidate)(ILibWrapper_WebRTC_Connection connection, struct sockaddr_in6* candidate);
@@ -70,6 +86,34 @@ ILibWrapper_WebRTC_ConnectionFactory ILibWrapper_WebRTC_ConnectionFactory_Create
 // Sets the TURN server to use for all WebRTC connections
 void ILibWrapper_WebRTC_ConnectionFactory_SetTurnServer(ILibWrapper_WebRTC_ConnectionFactory factory, struct sockaddr_in6* turnServer, char* username, int usernameLength, char* password, int passwordLength, ILibWebRTC_TURN_ConnectFlags turnSetting);
 
+// Caps the number of bytes that can be queued on each WebRTC Connection. (0 = Unlimited)
+void ILibWrapper_WebRTC_ConnectionFactory_SetMaxSendBufferSize(ILibWrapper_WebRTC_ConnectionFactory factory, int maxBufferSize);
+
+// Sets the bounds of the SCTP Retransmission Timeout in milliseconds (Default: 1000 - 6000)
+void ILibWrapper_WebRTC_ConnectionFactory_SetRTOBounds(ILibWrapper_WebRTC_ConnectionFactory factory, int rtoMin, int rtoMax);
+
+// Lets reconnecting peers resume their DTLS session, skipping the certificate exchange. Up to maxSessions are kept for timeoutSeconds. (0 = Disabled [DEFAULT])
+void ILibWrapper_WebRTC_ConnectionFactory_SetSessionResumption(ILibWrapper_WebRTC_ConnectionFactory factory, int maxSessions, int timeoutSeconds);
+
+// Runs DTLS Handshakes on worker threads, so bursts of new peers don't delay established connections. (0 = On the Chain thread [DEFAULT])
+void ILibWrapper_WebRTC_ConnectionFactory_SetHandshakeWorkers(ILibWrapper_WebRTC_ConnectionFactory factory, int workerCount);
+
+// Answers connectivity checks only, and advertises a=ice-lite. For servers with a public address. (0 = Full ICE [DEFAULT])
+void ILibWrapper_WebRTC_ConnectionFactory_SetIceLite(ILibWrapper_WebRTC_ConnectionFactory factory, int enabled);
+
+// Reaches the TURN server over UDP instead of TCP, so relayed connections avoid TCP head-of-line blocking. Call before SetTurnServer (TCP [DEFAULT])
+void ILibWrapper_WebRTC_ConnectionFactory_SetTurnServerTransport(ILibWrapper_WebRTC_ConnectionFactory factory, ILibTURN_ServerTransports transport);
+
+// Sets the DTLS cipher suites in order of preference, as an OpenSSL cipher list. (NULL = Default). Returns 0 on success
+int ILibWrapper_WebRTC_ConnectionFactory_SetCipherSuites(ILibWrapper_WebRTC_ConnectionFactory factory, char* cipherSuites);
+
+// Sets the key type of the DTLS certificates used by Connection Factories created after this call
+void ILibWrapper_WebRTC_SetCertificateKeyType(ILibWrapper_WebRTC_CertificateKeyTypes keyType);
+// Persists the DTLS certificates to the specified PEM file, so they are re-used across restarts. (NULL = In-Memory only)
+void ILibWrapper_WebRTC_SetCertificateCacheFile(char* path);
+// Frees the in-memory certificate cache. Factories that are still running keep their certificates.
+void ILibWrapper_WebRTC_ClearCertificateCache();
+
 // Creates an unconnected WebRTC Connection 
 ILibWrapper_WebRTC_Connection ILibWrapper_WebRTC_ConnectionFactory_CreateConnection(ILibWrapper_WebRTC_ConnectionFactory factory, ILibWrapper_WebRTC_Connection_OnConnect OnConnectHandler, ILibWrapper_WebRTC_Connection_OnDataChannel OnDataChannelHandler, ILibWrapper_WebRTC_Connection_OnSendOK OnConnectionSendOK);
 
@@ -101,6 +145,11 @@ ILibWrapper_WebRTC_DataChannel* ILibWrapper_WebRTC_DataChannel_Create(ILibWrappe
 // Creates a WebRTC Data Channel, using the specified Stream ID
 ILibWrapper_WebRTC_DataChannel* ILibWrapper_WebRTC_DataChannel_CreateEx(ILibWrapper_WebRTC_Connection connection, char* channelName, int channelNameLen, unsigned short streamId, ILibWrapper_WebRTC_DataChannel_OnDataChannelAck OnAckHandler);
 
+// Creates a pre-negotiated WebRTC Data Channel on the specified Stream ID. No DATA_CHANNEL_OPEN is sent, so the channel can be used immediately.
+// Both peers must create it with the same Stream ID and reliability. It can be created before the connection is up (ie: right after SetOffer), so that
+// nothing the peer sends on it is missed. Returns NULL on error.
+ILibWrapper_WebRTC_DataChannel* ILibWrapper_WebRTC_DataChannel_CreateNegotiated(ILibWrapper_WebRTC_Connection connection, char* channelName, int channelNameLen, unsigned short streamId, ILibWebRTC_DataChannel_ReliabilityModes reliability, unsigned short reliabilityValue);
+
 void ILibWrapper_WebRTC_Connection_SetUserData(ILibWrapper_WebRTC_Connection connection, void *user1, void *user2, void *user3);
 void ILibWrapper_WebRTC_Connection_GetUserData(ILibWrapper_WebRTC_Connection connection, void **user1, void **user2, void **user3);
 int ILibWrapper_WebRTC_Connection_DoesPeerSupportUnreliableMode(ILibWrapper_WebRTC_Connection connection);
@@ -114,9 +163,16 @@ char* ILibWrapper_WebRTC_Connection_GenerateOffer(ILibWrapper_WebRTC_Connection
 // Set an SDP Answer/Offer (WebRTC Receiver)
 char* ILibWrapper_WebRTC_Connection_SetOffer(ILibWrapper_WebRTC_Connection connection, char* offer, int offerLen, ILibWrapper_WebRTC_OnConnectionCandidate onCandidates);
 
+// Generate an SDP Offer that restarts ICE on a connected session (ie: after a network change). The peer passes it to SetOffer as usual, and
+// the answer comes back through SetOffer as well. Data Channels stay open while the new candidate pair is selected. Returns NULL on error.
+char* ILibWrapper_WebRTC_Connection_RestartIce(ILibWrapper_WebRTC_Connection connection, ILibWrapper_WebRTC_OnConnectionCandidate onCandidates);
+
 // Generate an udpated SDP offer containing the candidate specified
 char* ILibWrapper_WebRTC_Connection_AddServerReflexiveCandidateToLocalSDP(ILibWrapper_WebRTC_Connection connection, struct sockaddr_in6* candidate);
 
+// Add a remote candidate that was trickled in after the SDP Offer/Answer was set
+void ILibWrapper_WebRTC_Connection_AddRemoteCandidate(ILibWrapper_WebRTC_Connection connection, struct sockaddr_in6* candidate);
+
 // Stop reading inbound data
 void ILibWrapper_WebRTC_Connection_Pause(ILibWrapper_WebRTC_Connection connection); 
 
@@ -137,6 +193,23 @@ ILibTransport_DoneState ILibWrapper_WebRTC_DataChannel_SendEx(ILibWrapper_WebRTC
 // Send String Data over the specified Data Channel
 ILibTransport_DoneState ILibWrapper_WebRTC_DataChannel_SendString(ILibWrapper_WebRTC_DataChannel* dataChannel, char* data, int dataLen);
 
+// Send a single message, gathered from several buffers, over the specified Data Channel. (Must specify the data type)
+ILibTransport_DoneState ILibWrapper_WebRTC_DataChannel_SendV(ILibWrapper_WebRTC_DataChannel* dataChannel, const struct iovec* vec, int vecCount, int dataType);
+
+// Number of bytes queued on the specified Data Channel, that have not yet been acknowledged by the peer
+int ILibWrapper_WebRTC_DataChannel_GetBufferedAmount(ILibWrapper_WebRTC_DataChannel* dataChannel);
+
+// OnBufferedAmountLow will be triggered when the Buffered Amount drops to (or below) this value (Default: 0)
+void ILibWrapper_WebRTC_DataChannel_SetBufferedAmountLowThreshold(ILibWrapper_WebRTC_DataChannel* dataChannel, int bufferedAmountLowThreshold);
+int ILibWrapper_WebRTC_DataChannel_GetBufferedAmountLowThreshold(ILibWrapper_WebRTC_DataChannel* dataChannel);
+
+// Call from within OnData/OnRawData, to keep the received buffer valid after the handler returns (No copy is made)
+// Returns a token that must be passed to ReleaseBuffer when done, or NULL if called outside of a receive handler
+void* ILibWrapper_WebRTC_DataChannel_RetainBuffer(ILibWrapper_WebRTC_DataChannel* dataChannel);
+
+// Releases a buffer retained by RetainBuffer. Can be called from any thread, even after the connection is closed
+void ILibWrapper_WebRTC_DataChannel_ReleaseBuffer(void* retainedBuffer);
+
 #ifdef _WEBRTCDEBUG
 int ILibWrapper_WebRTC_Connection_Debug_Set(ILibWrapper_WebRTC_Connection connection, char* debugFieldName, ILibWrapper_WebRTC_Connection_Debug_OnEvent eventHandler);
 void ILibWrapper_WebRTC_ConnectionFactory_SetSimulatedLossPercentage(ILibWrapper_WebRTC_ConnectionFactory factory, int lossPercentage);
@@ -43,6 +43,7 @@ limitations under the License.
 #include <openssl/ssl.h>
 #include <openssl/rand.h>
 #include <openssl/hmac.h>
+#include <openssl/ec.h>
 
 // Setup OpenSSL
 void __fastcall util_openssl_init()
@@ -94,6 +95,28 @@ void __fastcall util_openssl_init()
 #endif
 }
 
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+sem_t *util_openssl_locks = NULL;
+void util_openssl_lockcallback(int mode, int n, const char *file, int line)
+{
+	UNREFERENCED_PARAMETER(file);
+	UNREFERENCED_PARAMETER(line);
+	if (mode & CRYPTO_LOCK) { sem_wait(&(util_openssl_locks[n])); } else { sem_post(&(util_openssl_locks[n])); }
+}
+#endif
+
+// Installs the locking callbacks OpenSSL needs before it is used from more than one thread. OpenSSL 1.1.0 and later do this themselves.
+void __fastcall util_openssl_threadsafe()
+{
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	int i;
+	if (util_openssl_locks != NULL || CRYPTO_get_locking_callback() != NULL) return;
+	if ((util_openssl_locks = (sem_t*)malloc(CRYPTO_num_locks() * sizeof(sem_t))) == NULL) ILIBCRITICALEXIT(254);
+	for (i = 0; i < CRYPTO_num_locks(); ++i) { sem_init(&(util_openssl_locks[i]), 0, 1); }
+	CRYPTO_set_locking_callback(&util_openssl_lockcallback);
+#endif
+}
+
 // Cleanup OpenSSL
 void __fastcall util_openssl_uninit()
 {
@@ -523,14 +546,54 @@ void __fastcall util_printcert_pk(struct util_cert cert)
 	RSA_print_fp(stdout,cert.pkey->pkey.rsa,0);
 }
 
+// Makes 'dest' share the certificate and key held by 'source', both must later be freed with util_freecert()
+void __fastcall util_copycert(struct util_cert* source, struct util_cert* dest)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	if (source->x509 != NULL) X509_up_ref(source->x509);
+	if (source->pkey != NULL) EVP_PKEY_up_ref(source->pkey);
+#else
+	if (source->x509 != NULL) CRYPTO_add(&(source->x509->references), 1, CRYPTO_LOCK_X509);
+	if (source->pkey != NULL) CRYPTO_add(&(source->pkey->references), 1, CRYPTO_LOCK_EVP_PKEY);
+#endif
+	dest->x509 = source->x509;
+	dest->pkey = source->pkey;
+}
+
+// Generates a new EC key on the NIST P-256 curve
+EVP_PKEY* __fastcall util_mkECKey()
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	// EC_KEY is deprecated in OpenSSL 3. Keys generated this way are always encoded with the named curve, which is all browsers accept
+	return EVP_EC_gen("P-256");
+#else
+	EVP_PKEY *pk = NULL;
+	EC_KEY *ec = NULL;
+
+	if ((ec = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1)) == NULL) return NULL;
+	EC_KEY_set_asn1_flag(ec, OPENSSL_EC_NAMED_CURVE); // Browsers will only accept named curves
+	if (EC_KEY_generate_key(ec) == 0 || (pk = EVP_PKEY_new()) == NULL) { EC_KEY_free(ec); return NULL; }
+	if (!EVP_PKEY_assign_EC_KEY(pk, ec)) { EC_KEY_free(ec); EVP_PKEY_free(pk); return NULL; }
+	return pk;
+#endif
+}
+
+// Creates a X509 certificate with a 2048 bit (or 'bits') RSA key. See util_mkCertEx()
+int __fastcall util_mkCert(struct util_cert *rootcert, struct util_cert* cert, int bits, int days, char* name, enum CERTIFICATE_TYPES certtype, struct util_cert* initialcert)
+{
+	return util_mkCertEx(rootcert, cert, CERTIFICATE_KEY_RSA, bits, days, name, certtype, initialcert);
+}
+
 // Creates a X509 certificate, if rootcert is NULL this creates a root (self-signed) certificate.
 // Is the name parameter is NULL, the hex value of the hash of the public key will be the subject name.
-int __fastcall util_mkCert(struct util_cert *rootcert, struct util_cert* cert, int bits, int days, char* name, enum CERTIFICATE_TYPES certtype, struct util_cert* initialcert)
+// The 'bits' parameter is only used for RSA keys. ECDSA P-256 keys are much faster to generate and sign with.
+int __fastcall util_mkCertEx(struct util_cert *rootcert, struct util_cert* cert, enum CERTIFICATE_KEY_TYPES keytype, int bits, int days, char* name, enum CERTIFICATE_TYPES certtype, struct util_cert* initialcert)
 {
 	X509 *x = NULL;
 	X509_EXTENSION *ex = NULL;
 	EVP_PKEY *pk = NULL;
 	RSA *rsa = NULL;
+	const EVP_MD *md = EVP_sha256();
 	X509_NAME *cname=NULL;
 	X509 **x509p = NULL;
 	EVP_PKEY **pkeyp = NULL;
@@ -541,12 +604,41 @@ int __fastcall util_mkCert(struct util_cert *rootcert, struct util_cert* cert, i
 
 	CRYPTO_mem_ctrl(CRYPTO_MEM_CHECK_ON);
 
-	if (initialcert != NULL)
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	if (keytype == CERTIFICATE_KEY_ED25519) { md = NULL; } // Ed25519 signs the message directly
+#else
+	if (keytype == CERTIFICATE_KEY_ED25519) { return 0; } // Not supported by this version of OpenSSL
+#endif
+
+	if (initialcert != NULL && keytype != CERTIFICATE_KEY_RSA)
+	{
+		// Re-use the existing key, the new certificate holds its own reference
+		struct util_cert tmp;
+		util_copycert(initialcert, &tmp);
+		pk = tmp.pkey;
+		if ((x=X509_new()) == NULL) goto err;
+	}
+	else if (initialcert != NULL)
 	{
 		pk = X509_get_pubkey(initialcert->x509);
 		rsa = EVP_PKEY_get1_RSA(initialcert->pkey);
 		if ((x=X509_new()) == NULL) goto err;
 	}
+	else if (keytype == CERTIFICATE_KEY_ECDSA_P256)
+	{
+		if ((pk = util_mkECKey()) == NULL) return 0;
+		if ((x=X509_new()) == NULL) goto err;
+	}
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	else if (keytype == CERTIFICATE_KEY_ED25519)
+	{
+		EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_ED25519, NULL);
+		if (pctx == NULL) return 0;
+		if (EVP_PKEY_keygen_init(pctx) <= 0 || EVP_PKEY_keygen(pctx, &pk) <= 0) { EVP_PKEY_CTX_free(pctx); return 0; }
+		EVP_PKEY_CTX_free(pctx);
+		if ((x=X509_new()) == NULL) goto err;
+	}
+#endif
 	else
 	{
 		if ((pkeyp == NULL) || (*pkeyp == NULL)) { if ((pk = EVP_PKEY_new()) == NULL) return 0; } else pk = *pkeyp;
@@ -564,13 +656,16 @@ int __fastcall util_mkCert(struct util_cert *rootcert, struct util_cert* cert, i
 		BN_free(oBigNbr);
 	}
 
-	if (!EVP_PKEY_assign_RSA(pk, rsa))
+	if (rsa != NULL)
 	{
-		RSA_free(rsa);
-		abort();
-		goto err;
+		if (!EVP_PKEY_assign_RSA(pk, rsa))
+		{
+			RSA_free(rsa);
+			abort();
+			goto err;
+		}
+		rsa = NULL;
 	}
-	rsa = NULL;
 
 	util_randomtext(8, serial);
 	X509_set_version(x, 2);
@@ -608,7 +703,7 @@ int __fastcall util_mkCert(struct util_cert *rootcert, struct util_cert* cert, i
 		//util_add_ext(x, NID_netscape_cert_type, "sslCA");
 		//util_add_ext(x, NID_netscape_comment, "example comment extension");
 
-		if (!X509_sign(x, pk, EVP_sha256())) goto err;
+		if (!X509_sign(x, pk, md)) goto err;
 	}
 	else
 	{
@@ -638,7 +733,9 @@ int __fastcall util_mkCert(struct util_cert *rootcert, struct util_cert* cert, i
 			X509_EXTENSION_free(ex);
 		}
 
-		if (!X509_sign(x, rootcert->pkey, EVP_sha256())) goto err;
+		// The digest depends on the issuer's key, not the key of this certificate
+		md = (EVP_PKEY_id(rootcert->pkey) == EVP_PKEY_RSA || EVP_PKEY_id(rootcert->pkey) == EVP_PKEY_EC) ? EVP_sha256() : NULL;
+		if (!X509_sign(x, rootcert->pkey, md)) goto err;
 	}
 
 	cert->x509 = x;
@@ -646,6 +743,8 @@ int __fastcall util_mkCert(struct util_cert *rootcert, struct util_cert* cert, i
 
 	return(1);
 err:
+	if (x != NULL) X509_free(x);
+	if (pk != NULL) EVP_PKEY_free(pk);
 	return(0);
 }
 
@@ -70,6 +70,13 @@ enum CERTIFICATE_TYPES
 	CERTIFICATE_TLS_CLIENT = 3
 };
 
+enum CERTIFICATE_KEY_TYPES
+{
+	CERTIFICATE_KEY_RSA = 0,			// RSA, 'bits' sets the modulus size
+	CERTIFICATE_KEY_ECDSA_P256 = 1,		// ECDSA on the NIST P-256 curve
+	CERTIFICATE_KEY_ED25519 = 2			// Ed25519, requires OpenSSL 1.1.1 or later
+};
+
 // Certificate structure
 struct util_cert
 {
@@ -80,6 +87,7 @@ struct util_cert
 // General methods
 void  __fastcall util_openssl_init();
 void  __fastcall util_openssl_uninit();
+void  __fastcall util_openssl_threadsafe();
 void  __fastcall util_free(char* ptr);
 char* __fastcall util_tohex(char* data, int len, char* out);
 char* __fastcall util_tohex2(char* data, int len, char* out);
@@ -110,6 +118,8 @@ int   __fastcall util_to_cer(struct util_cert cert, char** data);
 int   __fastcall util_from_cer(char* data, int datalen, struct util_cert* cert);
 int   __fastcall util_from_pem(char* filename, struct util_cert* cert);
 int   __fastcall util_mkCert(struct util_cert *rootcert, struct util_cert* cert, int bits, int days, char* name, enum CERTIFICATE_TYPES certtype, struct util_cert* initialcert);
+int   __fastcall util_mkCertEx(struct util_cert *rootcert, struct util_cert* cert, enum CERTIFICATE_KEY_TYPES keytype, int bits, int days, char* name, enum CERTIFICATE_TYPES certtype, struct util_cert* initialcert);
+void  __fastcall util_copycert(struct util_cert* source, struct util_cert* dest);
 void  __fastcall util_printcert(struct util_cert cert);
 void  __fastcall util_printcert_pk(struct util_cert cert);
 void  __fastcall util_md5(char* data, int datalen, char* result);
@@ -0,0 +1,104 @@
+/*
+Copyright 2014 - 2015 Intel Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//
+// Cross checks ILibStun_CRC32 (slicing-by-8 / ARMv8 CRC instructions) against the original byte at a time UPDC32 implementation,
+// over random lengths and alignments. The first calls are made from several threads at once, to exercise the table initialization.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <openssl/ssl.h>
+#include "Microstack/ILibParsers.h"
+#include "Microstack/ILibAsyncSocket.h"
+#include "Microstack/ILibWebRTC.h"
+
+#define CRC32TEST_THREADS 8
+#define CRC32TEST_ITERATIONS 200000
+#define CRC32TEST_MAXLENGTH 2048
+
+static unsigned int crc_32_tab[256];
+
+// Same table as ILibStun_CRC32_table (CRC polynomial 0xedb88320)
+static void crc32test_init(void)
+{
+	unsigned int n, k, c;
+	for (n = 0; n < 256; n++)
+	{
+		c = n;
+		for (k = 0; k < 8; k++) { c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1); }
+		crc_32_tab[n] = c;
+	}
+}
+
+// The original implementation
+#define UPDC32(octet, crc) (crc_32_tab[((crc) ^ (octet)) & 0xff] ^ ((crc) >> 8))
+static unsigned int crc32test_reference(char *buf, int len)
+{
+	unsigned int crc = 0xFFFFFFFF;
+	for (; len; --len, ++buf) { crc = UPDC32(*buf, crc); }
+	return ~crc;
+}
+
+static char crc32test_buffer[CRC32TEST_MAXLENGTH + 8];
+static int crc32test_threadFailures = 0;
+
+static void* crc32test_thread(void *arg)
+{
+	UNREFERENCED_PARAMETER(arg);
+	if (ILibStun_CRC32(crc32test_buffer, CRC32TEST_MAXLENGTH) != crc32test_reference(crc32test_buffer, CRC32TEST_MAXLENGTH)) { __sync_fetch_and_add(&crc32test_threadFailures, 1); }
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t threads[CRC32TEST_THREADS];
+	int i, offset, length, failures = 0;
+	unsigned int expected, actual;
+
+	UNREFERENCED_PARAMETER(argc);
+	UNREFERENCED_PARAMETER(argv);
+
+	crc32test_init();
+	srand(0x5354554e);
+	for (i = 0; i < (int)sizeof(crc32test_buffer); ++i) { crc32test_buffer[i] = (char)rand(); }
+
+	// First use, from several threads at once
+	for (i = 0; i < CRC32TEST_THREADS; ++i) { pthread_create(&threads[i], NULL, crc32test_thread, NULL); }
+	for (i = 0; i < CRC32TEST_THREADS; ++i) { pthread_join(threads[i], NULL); }
+	if (crc32test_threadFailures != 0) { printf("ILibStun_CRC32: %d mismatches on first use\r\n", crc32test_threadFailures); ++failures; }
+
+	// Known answer
+	if ((actual = ILibStun_CRC32("123456789", 9)) != 0xCBF43926) { printf("ILibStun_CRC32: Check value %08X, expected CBF43926\r\n", actual); ++failures; }
+
+	for (i = 0; i < CRC32TEST_ITERATIONS && failures < 10; ++i)
+	{
+		offset = rand() % 8;
+		length = rand() % (CRC32TEST_MAXLENGTH + 1);
+		expected = crc32test_reference(crc32test_buffer + offset, length);
+		actual = ILibStun_CRC32(crc32test_buffer + offset, length);
+		if (actual != expected)
+		{
+			printf("ILibStun_CRC32: Offset %d, Length %d: %08X, expected %08X\r\n", offset, length, actual, expected);
+			++failures;
+		}
+	}
+
+	printf("ILibStun_CRC32: %s\r\n", failures == 0 ? "PASSED" : "FAILED");
+	return (failures == 0 ? 0 : 1);
+}
@@ -0,0 +1,150 @@
+/*
+Copyright 2014 - 2015 Intel Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//
+// Pairs a full ICE agent with peers that only listen on a loopback socket, and checks which ICE role the agent's checks claim.
+// Against an ICE-Lite peer the agent must be CONTROLLING, even when the peer wants to be the DTLS client.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+#include "Microstack/ILibParsers.h"
+#include "Microstack/ILibAsyncSocket.h"
+#include "Microstack/ILibWebRTC.h"
+
+#define ICELITETEST_TIMEOUT 5
+#define ICELITETEST_CONTROLLED 0x8029
+#define ICELITETEST_CONTROLLING 0x802A
+
+struct icelitetest_case
+{
+	char *name;
+	int blockflags;			// What the peer puts in its offer
+	int expected;			// The role attribute our checks have to carry
+	int socket;
+};
+
+static struct icelitetest_case icelitetest_cases[] =
+{
+	{ "Full peer, DTLS client", 0, ICELITETEST_CONTROLLED, -1 },
+	{ "Full peer, DTLS server", ILibWebRTC_SDP_Flags_DTLS_SERVER, ICELITETEST_CONTROLLING, -1 },
+	{ "Lite peer, DTLS client", ILibWebRTC_SDP_Flags_ICE_LITE, ICELITETEST_CONTROLLING, -1 },
+	{ "Lite peer, DTLS server", ILibWebRTC_SDP_Flags_ICE_LITE | ILibWebRTC_SDP_Flags_DTLS_SERVER, ICELITETEST_CONTROLLING, -1 },
+};
+#define ICELITETEST_CASES (int)(sizeof(icelitetest_cases) / sizeof(icelitetest_cases[0]))
+
+// Same layout as ILibStun_WebRTC_UpdateOfferResponse, with the peer's socket as the only host candidate. Offers are matched to
+// ICE slots by username, so every peer gets its own
+static int icelitetest_offer(char *offer, int peer, int blockflags, struct sockaddr_in *candidate)
+{
+	memset(offer, 0, 88);
+	((unsigned short*)offer)[0] = 1;
+	((unsigned int*)(offer + 2))[0] = htonl(blockflags);
+	offer[6] = 8;
+	memcpy(offer + 7, "litepeer", 8);
+	offer[14] = (char)('0' + peer);
+	offer[15] = 32;
+	memcpy(offer + 16, "0123456789abcdef0123456789abcdef", 32);
+	offer[48] = 32;
+	offer[81] = 1;
+	memcpy(offer + 82, &(candidate->sin_addr.s_addr), 4);
+	memcpy(offer + 86, &(candidate->sin_port), 2);
+	return 88;
+}
+
+// Returns the ICE role attribute of a Binding request, or 0 if it has none
+static int icelitetest_role(unsigned char *packet, int length)
+{
+	int ptr = 20, type, attrLength;
+
+	if (length < 20 || packet[0] != 0x00 || packet[1] != 0x01) { return 0; }
+	while (ptr + 4 <= length)
+	{
+		type = (packet[ptr] << 8) | packet[ptr + 1];
+		attrLength = (packet[ptr + 2] << 8) | packet[ptr + 3];
+		if (type == ICELITETEST_CONTROLLED || type == ICELITETEST_CONTROLLING) { return type; }
+		ptr += 4 + ((attrLength + 3) & ~3);
+	}
+	return 0;
+}
+
+static void* icelitetest_chain(void *chain)
+{
+	ILibStartChain(chain);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	void *chain, *stun;
+	pthread_t thread;
+	struct sockaddr_in candidate;
+	struct timeval timeout;
+	socklen_t candidateLength;
+	unsigned char packet[1024];
+	char offer[88], *answer;
+	int i, length, role, failures = 0;
+
+	UNREFERENCED_PARAMETER(argc);
+	UNREFERENCED_PARAMETER(argv);
+
+	chain = ILibCreateChain();
+	if ((stun = ILibStunClient_Start(chain, 0, NULL)) == NULL) { printf("ILibStun_IceLite: Could not start the STUN module\r\n"); return 1; }
+
+	for (i = 0; i < ICELITETEST_CASES; ++i)
+	{
+		memset(&candidate, 0, sizeof(struct sockaddr_in));
+		candidate.sin_family = AF_INET;
+		candidate.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		candidateLength = sizeof(struct sockaddr_in);
+		timeout.tv_sec = ICELITETEST_TIMEOUT;
+		timeout.tv_usec = 0;
+		if ((icelitetest_cases[i].socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0 || bind(icelitetest_cases[i].socket, (struct sockaddr*)&candidate, sizeof(struct sockaddr_in)) != 0 ||
+			getsockname(icelitetest_cases[i].socket, (struct sockaddr*)&candidate, &candidateLength) != 0) { printf("ILibStun_IceLite: Could not bind the peer socket\r\n"); return 1; }
+		setsockopt(icelitetest_cases[i].socket, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
+
+		answer = NULL;
+		if (ILibStun_SetIceOffer(stun, offer, icelitetest_offer(offer, i, icelitetest_cases[i].blockflags, &candidate), &answer) <= 0) { printf("ILibStun_IceLite: %s: Offer was rejected\r\n", icelitetest_cases[i].name); ++failures; }
+		if (answer != NULL) { free(answer); }
+	}
+
+	pthread_create(&thread, NULL, icelitetest_chain, chain);
+	for (i = 0; i < ICELITETEST_CASES; ++i)
+	{
+		// Wait for a check that carries a role
+		role = 0;
+		while (role == 0 && (length = (int)recv(icelitetest_cases[i].socket, packet, sizeof(packet), 0)) > 0) { role = icelitetest_role(packet, length); }
+		if (role != icelitetest_cases[i].expected)
+		{
+			printf("ILibStun_IceLite: %s: %s, expected %s\r\n", icelitetest_cases[i].name, role == 0 ? "No checks" : (role == ICELITETEST_CONTROLLING ? "CONTROLLING" : "CONTROLLED"),
+				icelitetest_cases[i].expected == ICELITETEST_CONTROLLING ? "CONTROLLING" : "CONTROLLED");
+			++failures;
+		}
+		close(icelitetest_cases[i].socket);
+	}
+	ILibStopChain(chain);
+	pthread_join(thread, NULL);
+
+	printf("ILibStun_IceLite: %s\r\n", failures == 0 ? "PASSED" : "FAILED");
+	return (failures == 0 ? 0 : 1);
+}